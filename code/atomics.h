@@ -0,0 +1,170 @@
+/*******************************************************************************
+ *
+ * Filename: atomics.h
+ *
+ * Description:
+ *   The atomic operations on data shared between threads, on the __atomic
+ *   builtins of GCC and Clang or the Interlocked functions of Windows.
+ *
+ *   Each helper names the order it gives: loads acquire, stores release,
+ *   and the ...Relaxed ones only keep the access itself whole. The
+ *   Interlocked functions are full barriers, so under Windows every helper
+ *   is at least as strong as its name says.
+ *
+ ******************************************************************************/
+
+#ifndef ATOMICS_H
+#define ATOMICS_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+static inline uint64_t atomicLoad64(const uint64_t * p)
+{
+	return (uint64_t) InterlockedCompareExchange64((volatile LONG64 *) p, 0, 0);
+}
+
+static inline uint64_t atomicLoadRelaxed64(const uint64_t * p)
+{
+	return (uint64_t) InterlockedCompareExchange64((volatile LONG64 *) p, 0, 0);
+}
+
+static inline void atomicStore64(uint64_t * p, uint64_t value)
+{
+	InterlockedExchange64((volatile LONG64 *) p, (LONG64) value);
+}
+
+static inline void atomicStoreRelaxed64(uint64_t * p, uint64_t value)
+{
+	InterlockedExchange64((volatile LONG64 *) p, (LONG64) value);
+}
+
+/* Returns the value before the add */
+static inline uint64_t atomicFetchAdd64(uint64_t * p, uint64_t value)
+{
+	return (uint64_t) InterlockedExchangeAdd64((volatile LONG64 *) p, (LONG64) value);
+}
+
+/* Sets *p to 'desired' if it holds *expected, else reads it into *expected; may fail spuriously */
+static inline int32_t atomicCompareExchange64(uint64_t * p, uint64_t * expected, uint64_t desired)
+{
+	uint64_t seen = (uint64_t) InterlockedCompareExchange64((volatile LONG64 *) p, (LONG64) desired, (LONG64) *expected);
+
+	if (seen == *expected)
+	{
+		return 1;
+	}
+
+	*expected = seen;
+	return 0;
+}
+
+static inline int32_t atomicLoad32(const int32_t * p)
+{
+	return (int32_t) InterlockedCompareExchange((volatile LONG *) p, 0, 0);
+}
+
+static inline void atomicStore32(int32_t * p, int32_t value)
+{
+	InterlockedExchange((volatile LONG *) p, (LONG) value);
+}
+
+/* Returns the value after the add */
+static inline int32_t atomicAdd32(int32_t * p, int32_t value)
+{
+	return (int32_t) InterlockedExchangeAdd((volatile LONG *) p, (LONG) value) + value;
+}
+
+static inline void * atomicLoadPointer(void ** p)
+{
+	return InterlockedCompareExchangePointer((PVOID volatile *) p, NULL, NULL);
+}
+
+static inline int32_t atomicCompareExchangePointer(void ** p, void ** expected, void * desired)
+{
+	void * seen = InterlockedCompareExchangePointer((PVOID volatile *) p, desired, *expected);
+
+	if (seen == *expected)
+	{
+		return 1;
+	}
+
+	*expected = seen;
+	return 0;
+}
+
+static inline void atomicFence(void)
+{
+	MemoryBarrier();
+}
+
+#else
+
+static inline uint64_t atomicLoad64(const uint64_t * p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline uint64_t atomicLoadRelaxed64(const uint64_t * p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void atomicStore64(uint64_t * p, uint64_t value)
+{
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline void atomicStoreRelaxed64(uint64_t * p, uint64_t value)
+{
+	__atomic_store_n(p, value, __ATOMIC_RELAXED);
+}
+
+/* Returns the value before the add */
+static inline uint64_t atomicFetchAdd64(uint64_t * p, uint64_t value)
+{
+	return __atomic_fetch_add(p, value, __ATOMIC_RELAXED);
+}
+
+/* Sets *p to 'desired' if it holds *expected, else reads it into *expected; may fail spuriously */
+static inline int32_t atomicCompareExchange64(uint64_t * p, uint64_t * expected, uint64_t desired)
+{
+	return __atomic_compare_exchange_n(p, expected, desired, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static inline int32_t atomicLoad32(const int32_t * p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomicStore32(int32_t * p, int32_t value)
+{
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+/* Returns the value after the add */
+static inline int32_t atomicAdd32(int32_t * p, int32_t value)
+{
+	return __atomic_add_fetch(p, value, __ATOMIC_ACQ_REL);
+}
+
+static inline void * atomicLoadPointer(void ** p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline int32_t atomicCompareExchangePointer(void ** p, void ** expected, void * desired)
+{
+	return __atomic_compare_exchange_n(p, expected, desired, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomicFence(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#endif
+
+#endif
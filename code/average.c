@@ -0,0 +1,211 @@
+/*******************************************************************************
+ *
+ * Filename: average.c
+ *
+ * Description:
+ *   Capture averaging, see average.h.
+ *
+ *   An int16_t sample is at most 32768 in size, so 65535 of them always fit
+ *   in an int32_t; the 32-bit sums are folded into the 64-bit totals after
+ *   that many captures and when the result is read.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "average.h"
+#include "lanes.h"
+
+#define AVERAGE_FOLD		65535
+
+struct tAverage
+{
+	uint32_t	nSamples;
+	uint32_t	count;				// captures since the reset
+	uint32_t	pending;			// captures in 'sums' not yet folded into 'totals'
+	int32_t *	sums;
+	int64_t *	totals;
+	int64_t *	squares;			// NULL when the deviation is not kept
+};
+
+/****************************************************************************
+* averageCreate
+****************************************************************************/
+AVERAGE * averageCreate(uint32_t nSamples, int16_t deviation)
+{
+	AVERAGE * average = (AVERAGE *) calloc(1, sizeof(AVERAGE));
+
+	if (average == NULL)
+	{
+		return NULL;
+	}
+
+	average->nSamples = nSamples;
+	average->sums = (int32_t *) calloc(nSamples, sizeof(int32_t));
+	average->totals = (int64_t *) calloc(nSamples, sizeof(int64_t));
+	average->squares = deviation ? (int64_t *) calloc(nSamples, sizeof(int64_t)) : NULL;
+
+	if (average->sums == NULL || average->totals == NULL || (deviation && average->squares == NULL))
+	{
+		averageDestroy(average);
+		return NULL;
+	}
+
+	return average;
+}
+
+/****************************************************************************
+* averageDestroy
+****************************************************************************/
+void averageDestroy(AVERAGE * average)
+{
+	if (average == NULL)
+	{
+		return;
+	}
+
+	free(average->sums);
+	free(average->totals);
+	free(average->squares);
+	free(average);
+}
+
+/****************************************************************************
+* averageReset
+****************************************************************************/
+void averageReset(AVERAGE * average)
+{
+	memset(average->sums, 0, average->nSamples * sizeof(int32_t));
+	memset(average->totals, 0, average->nSamples * sizeof(int64_t));
+
+	if (average->squares != NULL)
+	{
+		memset(average->squares, 0, average->nSamples * sizeof(int64_t));
+	}
+
+	average->count = 0;
+	average->pending = 0;
+}
+
+/* Moves the 32-bit sums into the 64-bit totals */
+static void fold(AVERAGE * average)
+{
+	int32_t * sums = average->sums;
+	int64_t * totals = average->totals;
+	uint32_t n;
+
+	for (n = 0; n < average->nSamples; n++)
+	{
+		totals[n] += sums[n];
+		sums[n] = 0;
+	}
+
+	average->pending = 0;
+}
+
+/****************************************************************************
+* averageAdd
+*
+* Adds a capture to the sums, and to the sums of squares if they are kept.
+* The 32-bit sums go into the 64-bit totals first if one more capture could
+* overflow them.
+****************************************************************************/
+void averageAdd(AVERAGE * average, const int16_t * samples)
+{
+	int32_t * sums = average->sums;
+	int64_t * squares = average->squares;
+	uint32_t count = average->nSamples;
+	uint32_t whole = WHOLE_LANES(count, AVERAGE_LANES);
+	uint32_t n, j;
+
+	if (average->pending == AVERAGE_FOLD)
+	{
+		fold(average);
+	}
+
+	for (n = 0; n < whole; n += AVERAGE_LANES)
+	{
+		const int16_t * in = samples + n;
+		int32_t * sum = sums + n;
+
+		for (j = 0; j < AVERAGE_LANES; j++)
+		{
+			sum[j] += in[j];
+		}
+	}
+
+	for (n = whole; n < count; n++)
+	{
+		sums[n] += samples[n];
+	}
+
+	if (squares != NULL)
+	{
+		for (n = 0; n < whole; n += AVERAGE_LANES)
+		{
+			const int16_t * in = samples + n;
+			int64_t * square = squares + n;
+
+			for (j = 0; j < AVERAGE_LANES; j++)
+			{
+				square[j] += (int32_t) in[j] * in[j];
+			}
+		}
+
+		for (n = whole; n < count; n++)
+		{
+			squares[n] += (int32_t) samples[n] * samples[n];
+		}
+	}
+
+	average->count++;
+	average->pending++;
+}
+
+/****************************************************************************
+* averageCount
+****************************************************************************/
+uint32_t averageCount(const AVERAGE * average)
+{
+	return average->count;
+}
+
+/****************************************************************************
+* averageResult
+****************************************************************************/
+void averageResult(AVERAGE * average, float * mean, float * deviation)
+{
+	uint32_t n;
+	double count = (double) average->count;
+	double variance;
+
+	fold(average);
+
+	for (n = 0; n < average->nSamples; n++)
+	{
+		double sum = (double) average->totals[n];
+
+		mean[n] = average->count > 0 ? (float)(sum / count) : 0.0f;
+
+		if (deviation == NULL)
+		{
+			continue;
+		}
+
+		if (average->squares == NULL || average->count < 2)
+		{
+			deviation[n] = 0.0f;
+			continue;
+		}
+
+		// Exact integer sums, so the one-pass formula loses nothing that matters
+		variance = ((double) average->squares[n] - sum * sum / count) / (count - 1.0);
+		deviation[n] = variance > 0.0 ? (float) sqrt(variance) : 0.0f;
+	}
+}
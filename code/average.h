@@ -0,0 +1,45 @@
+/*******************************************************************************
+ *
+ * Filename: average.h
+ *
+ * Description:
+ *   Signal averaging of repeated captures of one channel.
+ *
+ *   Captures of the same length are summed sample by sample in 32-bit
+ *   accumulators, folded into 64-bit totals before they can overflow, and
+ *   optionally their squares in 64-bit accumulators for the standard
+ *   deviation. The sums are exact, so the result does not depend on how many
+ *   captures go in. The adds go through groups of AVERAGE_LANES samples, as
+ *   in lanes.h.
+ *
+ ******************************************************************************/
+
+#ifndef AVERAGE_H
+#define AVERAGE_H
+
+#include <stdint.h>
+
+#define AVERAGE_LANES		16
+
+typedef struct tAverage AVERAGE;
+
+/* 'deviation' also keeps the sums of squares */
+AVERAGE * averageCreate(uint32_t nSamples, int16_t deviation);
+void averageDestroy(AVERAGE * average);
+
+/* Clears the sums for the next group of captures */
+void averageReset(AVERAGE * average);
+
+void averageAdd(AVERAGE * average, const int16_t * samples);
+
+/* Captures summed since the last reset */
+uint32_t averageCount(const AVERAGE * average);
+
+/*
+ * Mean of every sample in ADC counts and, if 'deviation' is not NULL and the
+ * sums of squares are kept, the sample standard deviation (0 for a single
+ * capture).
+ */
+void averageResult(AVERAGE * average, float * mean, float * deviation);
+
+#endif
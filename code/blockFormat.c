@@ -0,0 +1,186 @@
+/*******************************************************************************
+ *
+ * Filename: blockFormat.c
+ *
+ * Description:
+ *   block.txt and block_binary.txt formatting, see blockFormat.h.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "blockFormat.h"
+#include "waveReader.h"
+
+int32_t blockFormatCapture(const BLOCK_CAPTURE * capture, PIPE_BUFFER * text, PIPE_BUFFER * binary)
+{
+	BLOCK_BINARY_RECORD * records = NULL;
+	size_t bytes = capture->nSamples * sizeof(BLOCK_BINARY_RECORD);
+	uint32_t i;
+	int j;
+
+	if (text != NULL)
+	{
+		pipePrintf(text, "Time (ns)\tADC_chA\tmV_chA\tADC_chB\tmV_chB\n");
+	}
+
+	if (binary != NULL)
+	{
+		if ((records = (BLOCK_BINARY_RECORD *) pipeReserve(binary, bytes)) == NULL)
+		{
+			return -1;
+		}
+
+		memset(records, 0, bytes);
+		binary->length += bytes;
+	}
+
+	for (i = 0; i < capture->nSamples; i++)
+	{
+		int32_t time = capture->firstTime + (int32_t) i * capture->intervalNs;
+
+		if (text != NULL)
+		{
+			pipePrintf(text, "%i\t\t", time);
+		}
+
+		if (records != NULL)
+		{
+			records[i].time = time;
+		}
+
+		for (j = 0; j < 2; j++)
+		{
+			if (capture->channel[j] != NULL)
+			{
+				int16_t adc = capture->channel[j][i];
+				int32_t mv = (adc * capture->rangeMv[j]) / capture->maxADCValue;
+
+				if (records != NULL && j == 0)
+				{
+					records[i].adcA = adc;
+					records[i].mvA = mv;
+				}
+				else if (records != NULL)
+				{
+					records[i].adcB = adc;
+					records[i].mvB = mv;
+				}
+
+				if (text != NULL)
+				{
+					pipePrintf(text, "%6d\t%+6d\t", adc, mv);
+				}
+			}
+		}
+
+		if (text != NULL)
+		{
+			pipePrintf(text, "\n");
+		}
+	}
+
+	return 0;
+}
+
+int32_t blockFormatRaw(const BLOCK_CAPTURE * capture, PIPE_BUFFER * text, PIPE_BUFFER * binary)
+{
+	const int16_t * chA = capture->channel[0];
+	const int16_t * chB = capture->channel[1];
+	BLOCK_RAW_RECORD * records = NULL;
+	size_t bytes = capture->nSamples * sizeof(BLOCK_RAW_RECORD);
+	uint32_t i;
+
+	if (text != NULL)
+	{
+		pipePrintf(text, "Time (ns)\tADC_chA\tADC_chB\n");
+	}
+
+	if (binary != NULL)
+	{
+		if ((records = (BLOCK_RAW_RECORD *) pipeReserve(binary, bytes)) == NULL)
+		{
+			return -1;
+		}
+
+		binary->length += bytes;
+	}
+
+	for (i = 0; i < capture->nSamples; i++)
+	{
+		int32_t time = capture->firstTime + (int32_t) i * capture->intervalNs;
+
+		if (records != NULL)
+		{
+			records[i].time = time;
+			records[i].adcA = chA != NULL ? chA[i] : 0;
+			records[i].adcB = chB != NULL ? chB[i] : 0;
+		}
+
+		if (text != NULL)
+		{
+			pipePrintf(text, "%i\t\t", time);
+
+			if (chA != NULL)
+			{
+				pipePrintf(text, "%6d\t", chA[i]);
+			}
+
+			if (chB != NULL)
+			{
+				pipePrintf(text, "%6d\t", chB[i]);
+			}
+
+			pipePrintf(text, "\n");
+		}
+	}
+
+	return 0;
+}
+
+/****************************************************************************
+* blockWriteRawHeaders
+*
+* Heads block.txt and block_binary.txt with what is needed to turn their
+* ADC counts into volts. The device adds the analogue offset before the
+* ADC, so the input is the scaled count less the offset.
+****************************************************************************/
+int32_t blockWriteRawHeaders(OUTPUT_WRITER * text, OUTPUT_WRITER * binary, const WAVE_RUN * run, const uint32_t rangeMv[WAVE_MAX_CHANNELS])
+{
+	uint8_t header[BLOCK_RAW_HEADER_SIZE];
+	int32_t result = 0;
+	int16_t ch;
+
+	if (binary != NULL)
+	{
+		waveEncodeBlockRaw(run, header);
+		result = writerWrite(binary, header, sizeof(header));
+	}
+
+	if (text == NULL)
+	{
+		return result;
+	}
+
+	if (writerPrintf(text, "# ADC counts: mV = count * range_mV / maxADCValue, input V = mV / 1000 - analogueOffset_V\n") < 0 ||
+		writerPrintf(text, "# resolution %u, maxADCValue %d, interval %.3f ns, %u samples per capture, %u pre-trigger\n",
+						run->resolution, run->maxADCValue, run->sampleIntervalNs, run->samplesPerRecord, run->preTrigger) < 0)
+	{
+		return -1;
+	}
+
+	for (ch = 0; ch < WAVE_MAX_CHANNELS; ch++)
+	{
+		if ((run->channelMask & (1 << ch)) &&
+			writerPrintf(text, "# channel %c range_mV %u analogueOffset_V %g\n", 'A' + ch, rangeMv[ch], run->analogueOffset[ch]) < 0)
+		{
+			return -1;
+		}
+	}
+
+	return result;
+}
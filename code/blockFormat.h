@@ -0,0 +1,51 @@
+/*******************************************************************************
+ *
+ * Filename: blockFormat.h
+ *
+ * Description:
+ *   Formatting of the rapid block captures for block.txt and
+ *   block_binary.txt, shared by ps5000aCon and the psbench benchmark.
+ *
+ *   A capture is formatted into pipeline buffers, the text for block.txt and
+ *   the records for block_binary.txt, which the caller then hands to its
+ *   output writers. Like the files, only channels A and B are held.
+ *
+ ******************************************************************************/
+
+#ifndef BLOCK_FORMAT_H
+#define BLOCK_FORMAT_H
+
+#include <stdint.h>
+
+#include "outputWriter.h"
+#include "pipeline.h"
+#include "waveFormat.h"
+
+/* One capture of channels A and B */
+typedef struct
+{
+	const int16_t *	channel[2];			// samples of A and B, NULL when the channel is off
+	int32_t			rangeMv[2];			// input range of A and B
+	int16_t			maxADCValue;
+	uint32_t		nSamples;
+	int32_t			firstTime;			// ns, of the first sample
+	int32_t			intervalNs;
+} BLOCK_CAPTURE;
+
+/*
+ * Appends the capture to 'text' as ADC counts and mV, and to 'binary' as
+ * BLOCK_BINARY_RECORDs; either may be NULL. Returns -1 if there was no
+ * memory for the records.
+ */
+int32_t blockFormatCapture(const BLOCK_CAPTURE * capture, PIPE_BUFFER * text, PIPE_BUFFER * binary);
+
+/* The same as ADC counts only, as BLOCK_RAW_RECORDs in 'binary' */
+int32_t blockFormatRaw(const BLOCK_CAPTURE * capture, PIPE_BUFFER * text, PIPE_BUFFER * binary);
+
+/*
+ * Heads the raw block.txt ('text') and block_binary.txt ('binary') with the
+ * run; either may be NULL. 'rangeMv' is the input range of each channel.
+ */
+int32_t blockWriteRawHeaders(OUTPUT_WRITER * text, OUTPUT_WRITER * binary, const WAVE_RUN * run, const uint32_t rangeMv[WAVE_MAX_CHANNELS]);
+
+#endif
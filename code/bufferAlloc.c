@@ -0,0 +1,216 @@
+/*******************************************************************************
+ *
+ * Filename: bufferAlloc.c
+ *
+ * Description:
+ *   Huge page backed buffers, see bufferAlloc.h.
+ *
+ *   Mapped buffers are rounded up to a whole number of huge pages whatever
+ *   the page kind, so bufferFree() can always unmap the same length, and are
+ *   aligned on BUFFER_HUGE_SIZE so that transparent huge pages can back the
+ *   whole buffer.
+ *
+ ******************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "bufferAlloc.h"
+
+BUFFER_PAGES g_bufferPages = BUFFER_PAGES_TRANSPARENT;
+
+static uint64_t allocated[BUFFER_PAGES_EXPLICIT + 1];
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+
+static size_t roundUp(size_t bytes)
+{
+	return (bytes + BUFFER_HUGE_SIZE - 1) & ~((size_t) BUFFER_HUGE_SIZE - 1);
+}
+
+/* Anonymous mapping of 'length' bytes aligned on BUFFER_HUGE_SIZE */
+static void * mapAligned(size_t length)
+{
+	uint8_t * base = (uint8_t *) mmap(NULL, length + BUFFER_HUGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	uint8_t * aligned;
+	size_t head;
+
+	if (base == (uint8_t *) MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	aligned = (uint8_t *)(((uintptr_t) base + BUFFER_HUGE_SIZE - 1) & ~((uintptr_t) BUFFER_HUGE_SIZE - 1));
+	head = (size_t)(aligned - base);
+
+	if (head > 0)
+	{
+		munmap(base, head);
+	}
+
+	munmap(aligned + length, BUFFER_HUGE_SIZE - head);
+	return aligned;
+}
+
+void * bufferAlloc(size_t bytes)
+{
+	size_t length;
+	void * buffer;
+
+	if (bytes < BUFFER_HUGE_MIN)
+	{
+		allocated[BUFFER_PAGES_NORMAL] += bytes;
+		return calloc(1, bytes);
+	}
+
+	length = roundUp(bytes);
+
+#ifdef MAP_HUGETLB
+	if (g_bufferPages == BUFFER_PAGES_EXPLICIT)
+	{
+		buffer = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+		if (buffer != MAP_FAILED)
+		{
+			allocated[BUFFER_PAGES_EXPLICIT] += length;
+			return buffer;
+		}
+	}
+#endif
+
+	if ((buffer = mapAligned(length)) == NULL)
+	{
+		return NULL;
+	}
+
+#ifdef MADV_HUGEPAGE
+	if (g_bufferPages != BUFFER_PAGES_NORMAL && madvise(buffer, length, MADV_HUGEPAGE) == 0)
+	{
+		allocated[BUFFER_PAGES_TRANSPARENT] += length;
+		return buffer;
+	}
+#endif
+
+#ifdef MADV_NOHUGEPAGE
+	// Normal pages really mean normal pages, even with THP set to 'always'
+	madvise(buffer, length, MADV_NOHUGEPAGE);
+#endif
+
+	allocated[BUFFER_PAGES_NORMAL] += length;
+	return buffer;
+}
+
+void bufferFree(void * buffer, size_t bytes)
+{
+	if (buffer == NULL)
+	{
+		return;
+	}
+
+	if (bytes < BUFFER_HUGE_MIN)
+	{
+		free(buffer);
+	}
+	else
+	{
+		munmap(buffer, roundUp(bytes));
+	}
+}
+
+#else
+
+void * bufferAlloc(size_t bytes)
+{
+	allocated[BUFFER_PAGES_NORMAL] += bytes;
+	return calloc(1, bytes);
+}
+
+void bufferFree(void * buffer, size_t bytes)
+{
+	free(buffer);
+}
+
+#endif
+
+uint64_t bufferAvailable(void)
+{
+#if defined(_WIN32)
+	MEMORYSTATUSEX status;
+
+	status.dwLength = sizeof(status);
+	return GlobalMemoryStatusEx(&status) ? (uint64_t) status.ullAvailPhys : 0;
+#else
+	uint64_t available = 0;
+
+#ifdef __linux__
+	// Free memory plus what the page cache would give back
+	FILE * fp = fopen("/proc/meminfo", "r");
+	char line[128];
+	unsigned long long kb;
+
+	if (fp != NULL)
+	{
+		while (available == 0 && fgets(line, sizeof(line), fp) != NULL)
+		{
+			if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1)
+			{
+				available = (uint64_t) kb * 1024;
+			}
+		}
+
+		fclose(fp);
+	}
+#endif
+
+#ifdef _SC_AVPHYS_PAGES
+	if (available == 0 && sysconf(_SC_AVPHYS_PAGES) > 0 && sysconf(_SC_PAGESIZE) > 0)
+	{
+		available = (uint64_t) sysconf(_SC_AVPHYS_PAGES) * (uint64_t) sysconf(_SC_PAGESIZE);
+	}
+#endif
+
+	return available;
+#endif
+}
+
+void bufferReport(void)
+{
+	if (allocated[BUFFER_PAGES_NORMAL] + allocated[BUFFER_PAGES_TRANSPARENT] + allocated[BUFFER_PAGES_EXPLICIT] > 0)
+	{
+		printf("Sample buffers: %.1f MB on explicit huge pages, %.1f MB on transparent huge pages, %.1f MB on normal pages\n",
+				allocated[BUFFER_PAGES_EXPLICIT] / 1048576.0, allocated[BUFFER_PAGES_TRANSPARENT] / 1048576.0,
+				allocated[BUFFER_PAGES_NORMAL] / 1048576.0);
+	}
+
+	allocated[BUFFER_PAGES_NORMAL] = allocated[BUFFER_PAGES_TRANSPARENT] = allocated[BUFFER_PAGES_EXPLICIT] = 0;
+}
+
+const char * bufferPagesName(BUFFER_PAGES pages)
+{
+	switch (pages)
+	{
+		case BUFFER_PAGES_TRANSPARENT:
+			return "Transparent huge pages";
+		case BUFFER_PAGES_EXPLICIT:
+			return "Explicit huge pages";
+		default:
+			return "Normal pages";
+	}
+}
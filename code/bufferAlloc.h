@@ -0,0 +1,51 @@
+/*******************************************************************************
+ *
+ * Filename: bufferAlloc.h
+ *
+ * Description:
+ *   Allocator for the capture and streaming sample buffers.
+ *
+ *   Buffers of at least BUFFER_HUGE_MIN bytes are mapped directly and, as
+ *   selected by g_bufferPages, backed by 2 MB transparent huge pages
+ *   (madvise), by explicit huge pages from the hugetlbfs pool (MAP_HUGETLB,
+ *   see vm.nr_hugepages), or by normal pages. When explicit huge pages are
+ *   not available the allocation falls back to transparent ones, then to
+ *   normal pages. Smaller buffers always come from calloc.
+ *
+ *   Memory is returned zeroed. bufferFree() needs the size that was asked for.
+ *
+ *   bufferAvailable() is the memory the system can still give without
+ *   swapping (MemAvailable on Linux), for sizing the buffers of a run.
+ *
+ ******************************************************************************/
+
+#ifndef BUFFER_ALLOC_H
+#define BUFFER_ALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BUFFER_HUGE_SIZE	(2u << 20)
+#define BUFFER_HUGE_MIN		BUFFER_HUGE_SIZE
+
+typedef enum
+{
+	BUFFER_PAGES_NORMAL,
+	BUFFER_PAGES_TRANSPARENT,
+	BUFFER_PAGES_EXPLICIT
+} BUFFER_PAGES;
+
+extern BUFFER_PAGES g_bufferPages;
+
+void * bufferAlloc(size_t bytes);
+void bufferFree(void * buffer, size_t bytes);
+
+/* Bytes of memory available without swapping, 0 if unknown */
+uint64_t bufferAvailable(void);
+
+/* Prints and resets the bytes allocated on each kind of page since the last report */
+void bufferReport(void);
+
+const char * bufferPagesName(BUFFER_PAGES pages);
+
+#endif
@@ -0,0 +1,341 @@
+/*******************************************************************************
+ *
+ * Filename: clockSync.c
+ *
+ * Description:
+ *   Sampler thread and fit of the device to host clock correlation, see
+ *   clockSync.h.
+ *
+ *   The fit works on the difference between host and device time, which
+ *   stays small, rather than on the times themselves, so the sums keep their
+ *   precision over any length of run. The slope of each run is only taken
+ *   into the drift through its centred sums, so a new counter origin at each
+ *   run costs one degree of freedom and nothing else.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "perfStats.h"
+#include "clockSync.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/* The drift is used once its standard error is below this */
+#define DRIFT_MAX_ERROR		10e-6
+
+typedef struct
+{
+	uint32_t	from;				// captures complete at the last question before
+	uint32_t	to;					// captures complete at the answer after
+	uint64_t	beforeNs;			// host time the last question with 'from' was asked
+	uint64_t	afterNs;			// host time the answer with 'to' came back
+} BRACKET;
+
+struct tClockSync
+{
+#ifndef _WIN32
+	pthread_t		thread;
+#endif
+	int				running;
+	CLOCK_PROBE		probe;
+	void *			context;
+	uint32_t		periodUs;
+	BRACKET *		brackets;
+	uint32_t		count;
+	uint32_t		capacity;
+	int64_t			unixOffsetNs;		// CLOCK_REALTIME less the monotonic clock at the last answer
+
+	// Pooled over the runs, in device ns against (host - device) ns
+	uint64_t		pairs;
+	uint32_t		runs;
+	double			sxx;
+	double			sxz;
+	double			szz;
+
+	// Last run: host = base + meanY + slope * (device - meanX)
+	uint64_t		baseNs;
+	double			meanX;
+	double			meanY;
+	double			slope;
+	double			slopeError;
+	int16_t			driftKnown;
+	uint32_t		runPairs;
+	double			residualNs;
+	double			windowNs;
+};
+
+CLOCK_SYNC * clockSyncCreate(void)
+{
+	CLOCK_SYNC * sync = (CLOCK_SYNC *) calloc(1, sizeof(CLOCK_SYNC));
+
+	if (sync != NULL)
+	{
+		sync->slope = 1.0;
+	}
+
+	return sync;
+}
+
+void clockSyncDestroy(CLOCK_SYNC * sync)
+{
+	if (sync == NULL)
+	{
+		return;
+	}
+
+	clockSyncStop(sync);
+	free(sync->brackets);
+	free(sync);
+}
+
+static void addBracket(CLOCK_SYNC * sync, uint32_t from, uint32_t to, uint64_t beforeNs, uint64_t afterNs)
+{
+	if (sync->count == sync->capacity)
+	{
+		uint32_t capacity = sync->capacity ? sync->capacity * 2 : 256;
+		BRACKET * larger = (BRACKET *) realloc(sync->brackets, capacity * sizeof(BRACKET));
+
+		if (larger == NULL)
+		{
+			return;
+		}
+
+		sync->brackets = larger;
+		sync->capacity = capacity;
+	}
+
+	sync->brackets[sync->count].from = from;
+	sync->brackets[sync->count].to = to;
+	sync->brackets[sync->count].beforeNs = beforeNs;
+	sync->brackets[sync->count].afterNs = afterNs;
+	sync->count++;
+}
+
+#ifndef _WIN32
+
+static void * samplerThread(void * parameter)
+{
+	CLOCK_SYNC * sync = (CLOCK_SYNC *) parameter;
+	struct timespec pause;
+	struct timespec realtime;
+	uint32_t completed;
+	uint32_t previous = 0;
+	uint64_t previousBefore = 0;
+	int16_t known = 0;
+
+	pause.tv_sec = (time_t)(sync->periodUs / 1000000);
+	pause.tv_nsec = (long)(sync->periodUs % 1000000) * 1000;
+
+	while (__atomic_load_n(&sync->running, __ATOMIC_ACQUIRE))
+	{
+		uint64_t before = perfNow();
+
+		if (sync->probe(sync->context, &completed) == 0)
+		{
+			uint64_t after = perfNow();
+
+			clock_gettime(CLOCK_REALTIME, &realtime);
+			sync->unixOffsetNs = (int64_t)((uint64_t) realtime.tv_sec * 1000000000ULL + (uint64_t) realtime.tv_nsec) - (int64_t) after;
+
+			if (known && completed > previous)
+			{
+				addBracket(sync, previous, completed, previousBefore, after);
+			}
+
+			previous = completed;
+			previousBefore = before;
+			known = 1;
+		}
+
+		nanosleep(&pause, NULL);
+	}
+
+	return NULL;
+}
+
+int32_t clockSyncStart(CLOCK_SYNC * sync, CLOCK_PROBE probe, void * context, uint32_t periodUs)
+{
+	clockSyncStop(sync);
+
+	sync->probe = probe;
+	sync->context = context;
+	sync->periodUs = periodUs ? periodUs : 1;
+	sync->count = 0;
+	sync->running = 1;
+
+	if (pthread_create(&sync->thread, NULL, samplerThread, sync) != 0)
+	{
+		printf("clockSyncStart:pthread_create failed\n");
+		sync->running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void clockSyncStop(CLOCK_SYNC * sync)
+{
+	if (sync->running)
+	{
+		__atomic_store_n(&sync->running, 0, __ATOMIC_RELEASE);
+		pthread_join(sync->thread, NULL);
+	}
+}
+
+#else
+
+int32_t clockSyncStart(CLOCK_SYNC * sync, CLOCK_PROBE probe, void * context, uint32_t periodUs)
+{
+	sync->count = 0;
+	printf("clockSyncStart: capture times are not supported on this platform\n");
+	return -1;
+}
+
+void clockSyncStop(CLOCK_SYNC * sync)
+{
+}
+
+#endif
+
+uint32_t clockSyncFit(CLOCK_SYNC * sync, const double * completeNs, uint32_t nCaptures)
+{
+	double * x;
+	double * y;
+	double sumX = 0.0, sumY = 0.0, sumWindow = 0.0, sumResidual = 0.0;
+	double sxx = 0.0, sxz = 0.0, szz = 0.0;
+	uint32_t n = 0;
+	uint32_t i;
+
+	sync->runPairs = 0;
+	sync->residualNs = 0.0;
+	sync->windowNs = 0.0;
+
+	if (sync->count == 0 || (x = (double *) malloc(2 * sync->count * sizeof(double))) == NULL)
+	{
+		sync->count = 0;
+		return 0;
+	}
+
+	y = x + sync->count;
+	sync->baseNs = sync->brackets[0].beforeNs;
+
+	// Captures from..to-1 were complete within the bracket: the offset lies
+	// between its start less the first and its end less the last
+	for (i = 0; i < sync->count; i++)
+	{
+		const BRACKET * bracket = &sync->brackets[i];
+		double first, last, window;
+
+		if (bracket->to > nCaptures)
+		{
+			break;
+		}
+
+		first = completeNs[bracket->from];
+		last = completeNs[bracket->to - 1];
+		window = ((double)(bracket->afterNs - bracket->beforeNs) - (last - first)) / 2.0;
+
+		x[n] = (first + last) / 2.0;
+		y[n] = ((double)(bracket->beforeNs - sync->baseNs) + (double)(bracket->afterNs - sync->baseNs)) / 2.0;
+		sumX += x[n];
+		sumY += y[n];
+		sumWindow += window > 0.0 ? window : 0.0;
+		n++;
+	}
+
+	sync->count = 0;
+
+	if (n == 0)
+	{
+		free(x);
+		return 0;
+	}
+
+	sync->meanX = sumX / n;
+	sync->meanY = sumY / n;
+
+	for (i = 0; i < n; i++)
+	{
+		double dx = x[i] - sync->meanX;
+		double dz = (y[i] - x[i]) - (sync->meanY - sync->meanX);
+
+		sxx += dx * dx;
+		sxz += dx * dz;
+		szz += dz * dz;
+	}
+
+	sync->pairs += n;
+	sync->runs++;
+	sync->sxx += sxx;
+	sync->sxz += sxz;
+	sync->szz += szz;
+
+	// Pooled slope of (host - device) against device time, one origin per run
+	sync->driftKnown = 0;
+	sync->slope = 1.0;
+
+	if (sync->sxx > 0.0 && sync->pairs > sync->runs + 1)
+	{
+		double slope = sync->sxz / sync->sxx;
+		double variance = (sync->szz - slope * sync->sxz) / (double)(sync->pairs - sync->runs - 1);
+
+		sync->slopeError = sqrt((variance > 0.0 ? variance : 0.0) / sync->sxx);
+
+		if (sync->slopeError < DRIFT_MAX_ERROR)
+		{
+			sync->slope = 1.0 + slope;
+			sync->driftKnown = 1;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		double residual = y[i] - (sync->meanY + sync->slope * (x[i] - sync->meanX));
+
+		sumResidual += residual * residual;
+	}
+
+	sync->runPairs = n;
+	sync->residualNs = sqrt(sumResidual / n);
+	sync->windowNs = sumWindow / n;
+
+	free(x);
+	return n;
+}
+
+int16_t clockSyncHost(const CLOCK_SYNC * sync, double deviceNs, uint64_t * monotonicNs, uint64_t * unixNs)
+{
+	if (sync->runPairs == 0)
+	{
+		return 0;
+	}
+
+	*monotonicNs = sync->baseNs + (uint64_t) llrint(sync->meanY + sync->slope * (deviceNs - sync->meanX));
+	*unixNs = (uint64_t)((int64_t) *monotonicNs + sync->unixOffsetNs);
+	return 1;
+}
+
+void clockSyncStats(const CLOCK_SYNC * sync, CLOCK_SYNC_STATS * stats)
+{
+	memset(stats, 0, sizeof(CLOCK_SYNC_STATS));
+
+	stats->pairs = sync->pairs;
+	stats->runPairs = sync->runPairs;
+	stats->driftKnown = sync->driftKnown;
+	// Device ticks per host ns, less one
+	stats->driftPpm = sync->driftKnown ? (1.0 / sync->slope - 1.0) * 1e6 : 0.0;
+	stats->driftErrorPpm = sync->slopeError * 1e6;
+	stats->residualNs = sync->residualNs;
+	stats->windowNs = sync->windowNs;
+}
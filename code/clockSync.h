@@ -0,0 +1,67 @@
+/*******************************************************************************
+ *
+ * Filename: clockSync.h
+ *
+ * Description:
+ *   Correlation of the device trigger time stamps with the host clocks.
+ *
+ *   The timeStampCounter of a rapid block capture counts samples from an
+ *   arbitrary origin, reset at every run. While a run is acquiring, a sampler
+ *   thread asks the device how many captures are complete, noting the host
+ *   monotonic clock before and after each question. When the count goes up,
+ *   the captures completed in between did so after the last question that
+ *   saw the old count and before the answer with the new one. Once the time
+ *   stamps are read out, each such bracket becomes a pair of device time and
+ *   host time with a known window.
+ *
+ *   The pairs are fitted online: an offset for each run (the origin of its
+ *   counter) and a drift of the device clock shared by all the runs, from
+ *   the pooled slope of the pairs within each run. The residuals of the fit
+ *   give the jitter of the correlation. CLOCK_REALTIME is read next to the
+ *   monotonic clock, so a device time can be given as Unix time as well.
+ *
+ ******************************************************************************/
+
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+
+/* Asks the device for the number of completed captures, returns 0 on success */
+typedef int32_t (* CLOCK_PROBE)(void * context, uint32_t * completed);
+
+typedef struct tClockSync CLOCK_SYNC;
+
+typedef struct
+{
+	uint64_t	pairs;				// pairs fitted, all runs
+	uint32_t	runPairs;			// pairs of the last run
+	int16_t		driftKnown;			// enough spread for the drift to be fitted
+	double		driftPpm;			// device clock against the host monotonic clock
+	double		driftErrorPpm;		// standard error of the drift
+	double		residualNs;			// RMS residual of the last run
+	double		windowNs;			// mean half width of the brackets of the last run
+} CLOCK_SYNC_STATS;
+
+CLOCK_SYNC * clockSyncCreate(void);
+void clockSyncDestroy(CLOCK_SYNC * sync);
+
+/* Starts the sampler thread, asking 'probe' every 'periodUs'. Returns 0 on success. */
+int32_t clockSyncStart(CLOCK_SYNC * sync, CLOCK_PROBE probe, void * context, uint32_t periodUs);
+
+/* Stops the sampler thread; the brackets it found are kept for clockSyncFit() */
+void clockSyncStop(CLOCK_SYNC * sync);
+
+/*
+ * Fits the brackets of the run just stopped. 'completeNs' is the device time
+ * at which each capture was complete, in ns from the origin of the counter.
+ * Returns the number of pairs; with none, the run has no host times.
+ */
+uint32_t clockSyncFit(CLOCK_SYNC * sync, const double * completeNs, uint32_t nCaptures);
+
+/* Host monotonic and Unix times of a device time of the last run fitted, 0 if it had no pairs */
+int16_t clockSyncHost(const CLOCK_SYNC * sync, double deviceNs, uint64_t * monotonicNs, uint64_t * unixNs);
+
+void clockSyncStats(const CLOCK_SYNC * sync, CLOCK_SYNC_STATS * stats);
+
+#endif
@@ -0,0 +1,470 @@
+/*******************************************************************************
+ *
+ * Filename: dsp.c
+ *
+ * Description:
+ *   FIR decimator, biquad cascade and lock-in, see dsp.h.
+ *
+ *   The FIR keeps its last taps - 1 samples in front of the current chunk
+ *   so that every output is one contiguous dot product, and only the outputs
+ *   that are kept are computed, which is the saving of the polyphase form.
+ *   The lock-in reference for a chunk is the chunk's start phasor times a
+ *   table of the per-sample rotation, recomputed from the absolute sample
+ *   index at every chunk so that it does not drift.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "dsp.h"
+#include "lanes.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define DSP_MAX_SECTIONS	8
+
+typedef struct
+{
+	double		b0, b1, b2, a1, a2;
+} BIQUAD;
+
+typedef struct
+{
+	double		z1[DSP_MAX_SECTIONS];
+	double		z2[DSP_MAX_SECTIONS];
+} CASCADE_STATE;
+
+typedef struct
+{
+	float *		history;			// length - 1 older samples, then the current chunk
+	uint32_t	phase;				// samples since the last output
+} FIR_STATE;
+
+struct tDspChannel
+{
+	DSP_OPTIONS		options;
+	double			sampleRate;
+	double			cutoff;
+	// FIR decimator, taps reversed and padded with zeros to a multiple of DSP_LANES
+	float *			taps;
+	uint32_t		length;
+	FIR_STATE		firI;
+	FIR_STATE		firQ;
+	// Biquad cascade
+	BIQUAD			biquads[DSP_MAX_SECTIONS];
+	uint32_t		sections;
+	CASCADE_STATE	iirI;
+	CASCADE_STATE	iirQ;
+	uint32_t		phase;			// IIR decimation
+	// Lock-in reference rotation over one chunk
+	float			rotationCos[DSP_CHUNK];
+	float			rotationSin[DSP_CHUNK];
+	// Working chunks and outputs
+	float			x[DSP_CHUNK];
+	float			i[DSP_CHUNK];
+	float			q[DSP_CHUNK];
+	float *			outI;
+	float *			outQ;
+	uint32_t		outCapacity;
+	uint64_t		next;			// index of the next input sample
+};
+
+/****************************************************************************
+* Design
+****************************************************************************/
+static double blackman(uint32_t n, uint32_t length)
+{
+	double x = length > 1 ? (double) n / (double)(length - 1) : 0.5;
+
+	return 0.42 - 0.5 * cos(2.0 * M_PI * x) + 0.08 * cos(4.0 * M_PI * x);
+}
+
+/* Windowed-sinc low-pass with unity DC gain */
+static int32_t designFir(DSP_CHANNEL * dsp, uint32_t taps, double cutoff)
+{
+	double fc = cutoff / dsp->sampleRate;
+	double centre = (taps - 1) / 2.0;
+	double sum = 0.0;
+	double * h;
+	uint32_t n;
+
+	dsp->length = (taps + DSP_LANES - 1) / DSP_LANES * DSP_LANES;
+	dsp->taps = (float *) calloc(dsp->length, sizeof(float));
+	h = (double *) calloc(taps, sizeof(double));
+
+	if (dsp->taps == NULL || h == NULL)
+	{
+		free(h);
+		return -1;
+	}
+
+	for (n = 0; n < taps; n++)
+	{
+		double t = n - centre;
+
+		h[n] = (t == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * t) / (M_PI * t)) * blackman(n, taps);
+		sum += h[n];
+	}
+
+	// Reversed, so that an output is a forward dot product over the history; the padding goes first (oldest)
+	for (n = 0; n < taps; n++)
+	{
+		dsp->taps[dsp->length - 1 - n] = (float)(h[n] / sum);
+	}
+
+	free(h);
+
+	dsp->firI.history = (float *) calloc(dsp->length - 1 + DSP_CHUNK, sizeof(float));
+	dsp->firQ.history = (float *) calloc(dsp->length - 1 + DSP_CHUNK, sizeof(float));
+
+	return dsp->firI.history != NULL && dsp->firQ.history != NULL ? 0 : -1;
+}
+
+/* Butterworth low-pass of order 2 * sections as a cascade of biquads (bilinear transform) */
+static void designCascade(DSP_CHANNEL * dsp, uint32_t sections, double cutoff)
+{
+	double w0 = 2.0 * M_PI * cutoff / dsp->sampleRate;
+	uint32_t k;
+
+	dsp->sections = sections;
+
+	for (k = 0; k < sections; k++)
+	{
+		double q = 1.0 / (2.0 * cos(M_PI * (2 * k + 1) / (4.0 * sections)));
+		double alpha = sin(w0) / (2.0 * q);
+		double a0 = 1.0 + alpha;
+
+		dsp->biquads[k].b0 = (1.0 - cos(w0)) / 2.0 / a0;
+		dsp->biquads[k].b1 = (1.0 - cos(w0)) / a0;
+		dsp->biquads[k].b2 = (1.0 - cos(w0)) / 2.0 / a0;
+		dsp->biquads[k].a1 = -2.0 * cos(w0) / a0;
+		dsp->biquads[k].a2 = (1.0 - alpha) / a0;
+	}
+}
+
+DSP_CHANNEL * dspCreate(const DSP_OPTIONS * options, double sampleRateHz)
+{
+	DSP_CHANNEL * dsp;
+	double nyquist;
+	uint32_t sections = options->sections < 1 ? 1 : options->sections > DSP_MAX_SECTIONS ? DSP_MAX_SECTIONS : options->sections;
+	int32_t failed = 0;
+	uint32_t k;
+
+	if (options->mode == DSP_OFF || sampleRateHz <= 0.0)
+	{
+		return NULL;
+	}
+
+	if (options->mode == DSP_LOCKIN && (options->referenceHz <= 0.0 || options->referenceHz >= sampleRateHz / 2.0))
+	{
+		printf("dspCreate: the reference must be between 0 and %.0f Hz at %.0f S/s\n", sampleRateHz / 2.0, sampleRateHz);
+		return NULL;
+	}
+
+	if ((dsp = (DSP_CHANNEL *) calloc(1, sizeof(DSP_CHANNEL))) == NULL)
+	{
+		return NULL;
+	}
+
+	dsp->options = *options;
+	dsp->options.decimation = options->decimation < 1 ? 1 : options->decimation;
+	dsp->options.tapsPerPhase = options->tapsPerPhase < 2 ? 2 : options->tapsPerPhase;
+	dsp->sampleRate = sampleRateHz;
+
+	// Keep the corner below the Nyquist frequency of the output, with some room for the transition band
+	nyquist = 0.45 * sampleRateHz / dsp->options.decimation;
+	dsp->cutoff = options->cutoffHz > 0.0 && options->cutoffHz < nyquist ? options->cutoffHz : nyquist;
+
+	switch (options->mode)
+	{
+		case DSP_FIR:
+			failed = designFir(dsp, dsp->options.tapsPerPhase * dsp->options.decimation, dsp->cutoff);
+			break;
+
+		case DSP_IIR:
+			designCascade(dsp, sections, dsp->cutoff);
+			break;
+
+		default:
+			// The cascade sets the lock-in time constant, the FIR only keeps the decimation from aliasing
+			designCascade(dsp, sections, dsp->cutoff);
+			failed = designFir(dsp, dsp->options.tapsPerPhase * dsp->options.decimation, nyquist);
+
+			for (k = 0; k < DSP_CHUNK; k++)
+			{
+				double angle = 2.0 * M_PI * fmod(options->referenceHz / sampleRateHz * k, 1.0);
+
+				dsp->rotationCos[k] = (float) cos(angle);
+				dsp->rotationSin[k] = (float) sin(angle);
+			}
+			break;
+	}
+
+	if (failed)
+	{
+		dspDestroy(dsp);
+		return NULL;
+	}
+
+	return dsp;
+}
+
+void dspDestroy(DSP_CHANNEL * dsp)
+{
+	if (dsp == NULL)
+	{
+		return;
+	}
+
+	free(dsp->taps);
+	free(dsp->firI.history);
+	free(dsp->firQ.history);
+	free(dsp->outI);
+	free(dsp->outQ);
+	free(dsp);
+}
+
+void dspReset(DSP_CHANNEL * dsp, uint64_t firstSample)
+{
+	if (dsp->firI.history != NULL)
+	{
+		memset(dsp->firI.history, 0, (dsp->length - 1 + DSP_CHUNK) * sizeof(float));
+		memset(dsp->firQ.history, 0, (dsp->length - 1 + DSP_CHUNK) * sizeof(float));
+	}
+
+	dsp->firI.phase = 0;
+	dsp->firQ.phase = 0;
+	memset(&dsp->iirI, 0, sizeof(CASCADE_STATE));
+	memset(&dsp->iirQ, 0, sizeof(CASCADE_STATE));
+	dsp->phase = 0;
+	dsp->next = firstSample;
+}
+
+/****************************************************************************
+* Processing
+****************************************************************************/
+static float dot(const float * taps, const float * x, uint32_t length)
+{
+	float lanes[DSP_LANES] = { 0 };
+	float sum = 0.0f;
+	uint32_t k, j;
+
+	for (k = 0; k < length; k += DSP_LANES)
+	{
+		for (j = 0; j < DSP_LANES; j++)
+		{
+			lanes[j] += taps[k + j] * x[k + j];
+		}
+	}
+
+	for (j = 0; j < DSP_LANES; j++)
+	{
+		sum += lanes[j];
+	}
+
+	return sum;
+}
+
+/* Runs one chunk through the decimator, appending the outputs */
+static uint32_t fir(DSP_CHANNEL * dsp, FIR_STATE * state, const float * x, uint32_t n, float * out)
+{
+	float * history = state->history;
+	uint32_t kept = dsp->length - 1;
+	uint32_t outputs = 0;
+	uint32_t p;
+
+	memcpy(history + kept, x, n * sizeof(float));
+
+	for (p = 0; p < n; p++)
+	{
+		if (++state->phase == dsp->options.decimation)
+		{
+			state->phase = 0;
+			// The 'length' samples ending at x[p]
+			out[outputs++] = dot(dsp->taps, history + p, dsp->length);
+		}
+	}
+
+	memmove(history, history + n, kept * sizeof(float));
+	return outputs;
+}
+
+/* Direct form II transposed, in place */
+static void cascade(DSP_CHANNEL * dsp, CASCADE_STATE * state, float * x, uint32_t n)
+{
+	uint32_t p, k;
+
+	for (p = 0; p < n; p++)
+	{
+		double v = x[p];
+
+		for (k = 0; k < dsp->sections; k++)
+		{
+			const BIQUAD * b = &dsp->biquads[k];
+			double y = b->b0 * v + state->z1[k];
+
+			state->z1[k] = b->b1 * v - b->a1 * y + state->z2[k];
+			state->z2[k] = b->b2 * v - b->a2 * y;
+			v = y;
+		}
+
+		x[p] = (float) v;
+	}
+}
+
+/* Converts a chunk of ADC counts to mV in x */
+static void scale(DSP_CHANNEL * dsp, const int16_t * adc, float mvPerCount, uint32_t n)
+{
+	uint32_t whole = WHOLE_LANES(n, DSP_LANES);
+	uint32_t k, j;
+
+	for (k = 0; k < whole; k += DSP_LANES)
+	{
+		for (j = 0; j < DSP_LANES; j++)
+		{
+			dsp->x[k + j] = (float) adc[k + j] * mvPerCount;
+		}
+	}
+
+	for (k = whole; k < n; k++)
+	{
+		dsp->x[k] = (float) adc[k] * mvPerCount;
+	}
+}
+
+/*
+ * I and Q of the chunk in x: x times twice the reference, so that a sine of
+ * amplitude A gives R = A. The chunk arrays have room for a whole last group,
+ * whatever is past n is computed and ignored.
+ */
+static void mix(DSP_CHANNEL * dsp, uint32_t n)
+{
+	double cycles = fmod(dsp->options.referenceHz / dsp->sampleRate * (double) dsp->next, 1.0);
+	double angle = 2.0 * M_PI * cycles + dsp->options.phaseDeg * M_PI / 180.0;
+	float c0 = (float)(2.0 * cos(angle));
+	float s0 = (float)(2.0 * sin(angle));
+	uint32_t k, j;
+
+	for (k = 0; k < n; k += DSP_LANES)
+	{
+		for (j = 0; j < DSP_LANES; j++)
+		{
+			float c = c0 * dsp->rotationCos[k + j] - s0 * dsp->rotationSin[k + j];
+			float s = s0 * dsp->rotationCos[k + j] + c0 * dsp->rotationSin[k + j];
+
+			dsp->i[k + j] = dsp->x[k + j] * c;
+			dsp->q[k + j] = -dsp->x[k + j] * s;
+		}
+	}
+}
+
+uint32_t dspProcess(DSP_CHANNEL * dsp, const int16_t * adc, float mvPerCount, uint32_t count,
+						const float ** i, const float ** q, uint64_t * index)
+{
+	uint32_t needed = count / dsp->options.decimation + 1;
+	uint32_t outputs = 0;
+	uint32_t done, n, k;
+	uint32_t pending = dsp->options.mode == DSP_IIR ? dsp->phase : dsp->firI.phase;
+
+	if (needed > dsp->outCapacity)
+	{
+		float * outI = (float *) realloc(dsp->outI, needed * sizeof(float));
+		float * outQ = (float *) realloc(dsp->outQ, needed * sizeof(float));
+
+		dsp->outI = outI != NULL ? outI : dsp->outI;
+		dsp->outQ = outQ != NULL ? outQ : dsp->outQ;
+
+		if (outI == NULL || outQ == NULL)
+		{
+			return 0;
+		}
+
+		dsp->outCapacity = needed;
+	}
+
+	if (index != NULL)
+	{
+		// The first output completes the current decimation period
+		*index = dsp->next + (dsp->options.decimation - 1 - pending);
+	}
+
+	for (done = 0; done < count; done += n)
+	{
+		n = count - done < DSP_CHUNK ? count - done : DSP_CHUNK;
+
+		scale(dsp, adc + done, mvPerCount, n);
+
+		switch (dsp->options.mode)
+		{
+			case DSP_FIR:
+				outputs += fir(dsp, &dsp->firI, dsp->x, n, dsp->outI + outputs);
+				break;
+
+			case DSP_IIR:
+				cascade(dsp, &dsp->iirI, dsp->x, n);
+
+				for (k = 0; k < n; k++)
+				{
+					if (++dsp->phase == dsp->options.decimation)
+					{
+						dsp->phase = 0;
+						dsp->outI[outputs++] = dsp->x[k];
+					}
+				}
+				break;
+
+			default:
+				mix(dsp, n);
+				cascade(dsp, &dsp->iirI, dsp->i, n);
+				cascade(dsp, &dsp->iirQ, dsp->q, n);
+				fir(dsp, &dsp->firQ, dsp->q, n, dsp->outQ + outputs);
+				outputs += fir(dsp, &dsp->firI, dsp->i, n, dsp->outI + outputs);
+				break;
+		}
+
+		dsp->next += n;
+	}
+
+	*i = dsp->outI;
+
+	if (q != NULL)
+	{
+		*q = dsp->options.mode == DSP_LOCKIN ? dsp->outQ : NULL;
+	}
+
+	return outputs;
+}
+
+double dspOutputRate(const DSP_CHANNEL * dsp)
+{
+	return dsp->sampleRate / dsp->options.decimation;
+}
+
+double dspCutoff(const DSP_CHANNEL * dsp)
+{
+	return dsp->cutoff;
+}
+
+const char * dspModeName(DSP_MODE mode)
+{
+	switch (mode)
+	{
+		case DSP_FIR:
+			return "FIR decimator";
+		case DSP_IIR:
+			return "IIR cascade";
+		case DSP_LOCKIN:
+			return "Lock-in";
+		default:
+			return "Off";
+	}
+}
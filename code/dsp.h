@@ -0,0 +1,78 @@
+/*******************************************************************************
+ *
+ * Filename: dsp.h
+ *
+ * Description:
+ *   Real-time filtering of one channel of samples, block after block:
+ *
+ *	 DSP_FIR		windowed-sinc low-pass, polyphase decimator
+ *	 DSP_IIR		cascade of Butterworth low-pass biquads, then decimation
+ *	 DSP_LOCKIN		digital lock-in: mixing with a reference of the given
+ *					frequency and phase, the biquad cascade on I and Q, then
+ *					the FIR decimator
+ *
+ *   The samples go in as ADC counts and come out in mV, one in 'decimation'.
+ *   Filter state is kept between calls, so a stream can be fed in pieces of
+ *   any length; dspReset() starts again at a given sample index (after a gap,
+ *   or for each rapid block capture), with the lock-in reference phase taken
+ *   from that index so that it stays coherent with the acquisition clock.
+ *
+ *   The sample loops (scaling, mixing, FIR dot products) work on chunks of
+ *   DSP_CHUNK floats in groups of DSP_LANES, laid out as in lanes.h; the
+ *   biquad recursion is inherently serial.
+ *
+ ******************************************************************************/
+
+#ifndef DSP_H
+#define DSP_H
+
+#include <stdint.h>
+
+#define DSP_CHUNK		256
+#define DSP_LANES		8
+
+typedef enum
+{
+	DSP_OFF,
+	DSP_FIR,
+	DSP_IIR,
+	DSP_LOCKIN
+} DSP_MODE;
+
+typedef struct
+{
+	DSP_MODE	mode;
+	uint32_t	decimation;			// one output sample in 'decimation'
+	double		cutoffHz;			// low-pass corner (FIR and IIR, lock-in output filter)
+	uint32_t	tapsPerPhase;		// FIR length is tapsPerPhase * decimation
+	uint32_t	sections;			// biquads in the IIR cascade
+	double		referenceHz;		// lock-in reference frequency
+	double		phaseDeg;			// lock-in reference phase
+} DSP_OPTIONS;
+
+typedef struct tDspChannel DSP_CHANNEL;
+
+/* Designs the filters for a sample rate; NULL if the options do not fit it */
+DSP_CHANNEL * dspCreate(const DSP_OPTIONS * options, double sampleRateHz);
+void dspDestroy(DSP_CHANNEL * dsp);
+
+/* Clears the filter state, the next sample fed in has index 'firstSample' */
+void dspReset(DSP_CHANNEL * dsp, uint64_t firstSample);
+
+/*
+ * Filters 'count' samples of ADC counts, 'mvPerCount' converting them to mV.
+ * Returns the number of output samples and points 'i' (and 'q' for the
+ * lock-in, NULL otherwise) at them, valid until the next call. 'index', if
+ * not NULL, receives the sample index of the first output: the index of the
+ * last input sample that went into it.
+ */
+uint32_t dspProcess(DSP_CHANNEL * dsp, const int16_t * adc, float mvPerCount, uint32_t count,
+						const float ** i, const float ** q, uint64_t * index);
+
+/* Output rate and corner actually used (the corner is kept below the output Nyquist frequency) */
+double dspOutputRate(const DSP_CHANNEL * dsp);
+double dspCutoff(const DSP_CHANNEL * dsp);
+
+const char * dspModeName(DSP_MODE mode);
+
+#endif
@@ -0,0 +1,228 @@
+/*******************************************************************************
+ *
+ * Filename: history.c
+ *
+ * Description:
+ *   Mirrored ring of samples, see history.h.
+ *
+ *   Sample n lives at ring[n % capacity]; with the mirror, ring[capacity + i]
+ *   is the same memory as ring[i], so a run of up to 'capacity' samples can be
+ *   read or written from any position without wrapping.
+ *
+ ******************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+#define HISTORY_PAGE		4096
+
+struct tHistory
+{
+	int16_t *	ring;				// 2 * capacity samples as seen by the reader
+	uint32_t	capacity;
+	int16_t		mirrored;			// the second half is a mapping of the first
+	uint64_t	next;				// index of the next sample appended
+	uint64_t	oldest;				// index of the oldest sample held
+};
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Maps the same 'bytes' of a memfd twice, back to back */
+static int16_t * mapMirror(size_t bytes)
+{
+	uint8_t * base;
+	int fd = memfd_create("ps5000a-history", MFD_CLOEXEC);
+
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	if (ftruncate(fd, (off_t) bytes) != 0 ||
+		(base = (uint8_t *) mmap(NULL, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == (uint8_t *) MAP_FAILED)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	if (mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+		mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(base, 2 * bytes);
+		close(fd);
+		return NULL;
+	}
+
+	// The mappings keep the memory, the descriptor is not needed any more
+	close(fd);
+	return (int16_t *) base;
+}
+
+static void unmapMirror(int16_t * ring, size_t bytes)
+{
+	munmap(ring, 2 * bytes);
+}
+
+static size_t pageSize(void)
+{
+	long size = sysconf(_SC_PAGESIZE);
+
+	return size > 0 ? (size_t) size : HISTORY_PAGE;
+}
+
+#else
+
+static int16_t * mapMirror(size_t bytes)
+{
+	(void) bytes;
+	return NULL;
+}
+
+static void unmapMirror(int16_t * ring, size_t bytes)
+{
+	(void) ring;
+	(void) bytes;
+}
+
+static size_t pageSize(void)
+{
+	return HISTORY_PAGE;
+}
+
+#endif
+
+/****************************************************************************
+* historyCreate
+****************************************************************************/
+HISTORY * historyCreate(uint32_t samples)
+{
+	HISTORY * history = (HISTORY *) calloc(1, sizeof(HISTORY));
+	size_t page = pageSize();
+	size_t bytes;
+
+	if (history == NULL || samples == 0)
+	{
+		free(history);
+		return NULL;
+	}
+
+	bytes = ((size_t) samples * sizeof(int16_t) + page - 1) / page * page;
+	history->capacity = (uint32_t)(bytes / sizeof(int16_t));
+
+	if ((history->ring = mapMirror(bytes)) != NULL)
+	{
+		history->mirrored = 1;
+	}
+	else if ((history->ring = (int16_t *) malloc(2 * bytes)) == NULL)
+	{
+		free(history);
+		return NULL;
+	}
+
+	return history;
+}
+
+/****************************************************************************
+* historyDestroy
+****************************************************************************/
+void historyDestroy(HISTORY * history)
+{
+	if (history == NULL)
+	{
+		return;
+	}
+
+	if (history->mirrored)
+	{
+		unmapMirror(history->ring, (size_t) history->capacity * sizeof(int16_t));
+	}
+	else
+	{
+		free(history->ring);
+	}
+
+	free(history);
+}
+
+/****************************************************************************
+* historyReset
+****************************************************************************/
+void historyReset(HISTORY * history, uint64_t firstSample)
+{
+	history->next = firstSample;
+	history->oldest = firstSample;
+}
+
+/****************************************************************************
+* historyAppend
+****************************************************************************/
+void historyAppend(HISTORY * history, const int16_t * samples, uint32_t count)
+{
+	uint32_t capacity = history->capacity;
+	uint32_t position, first;
+
+	// Only the last 'capacity' samples can be kept
+	if (count > capacity)
+	{
+		history->next += count - capacity;
+		samples += count - capacity;
+		count = capacity;
+	}
+
+	position = (uint32_t)(history->next % capacity);
+
+	if (history->mirrored)
+	{
+		memcpy(&history->ring[position], samples, count * sizeof(int16_t));
+	}
+	else
+	{
+		// Both halves, up to the end of the first and then from its start
+		first = count < capacity - position ? count : capacity - position;
+		memcpy(&history->ring[position], samples, first * sizeof(int16_t));
+		memcpy(&history->ring[capacity + position], samples, first * sizeof(int16_t));
+		memcpy(history->ring, samples + first, (count - first) * sizeof(int16_t));
+		memcpy(&history->ring[capacity], samples + first, (count - first) * sizeof(int16_t));
+	}
+
+	history->next += count;
+
+	if (history->next - history->oldest > capacity)
+	{
+		history->oldest = history->next - capacity;
+	}
+}
+
+/****************************************************************************
+* historyOldest
+****************************************************************************/
+uint64_t historyOldest(const HISTORY * history)
+{
+	return history->oldest;
+}
+
+/****************************************************************************
+* historyWindow
+****************************************************************************/
+const int16_t * historyWindow(const HISTORY * history, uint64_t first, uint32_t count)
+{
+	if (first < history->oldest || first > history->next || count > history->next - first)
+	{
+		return NULL;
+	}
+
+	return &history->ring[first % history->capacity];
+}
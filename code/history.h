@@ -0,0 +1,43 @@
+/*******************************************************************************
+ *
+ * Filename: history.h
+ *
+ * Description:
+ *   Circular history of the last samples of one streamed channel.
+ *
+ *   The ring is mapped twice back to back (a memfd mapped at two adjacent
+ *   addresses), so any run of samples it holds is contiguous in memory even
+ *   when it wraps round the end, and a window can be handed straight to a
+ *   writer without being copied out first. Where the double mapping is not
+ *   available the ring is a plain buffer of twice the size with every sample
+ *   stored in both halves, which gives the same view at the cost of a second
+ *   write.
+ *
+ ******************************************************************************/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+typedef struct tHistory HISTORY;
+
+/* Holds at least the last 'samples' samples (rounded up to whole pages) */
+HISTORY * historyCreate(uint32_t samples);
+void historyDestroy(HISTORY * history);
+
+/* Forgets the samples held, the next sample appended has index 'firstSample' */
+void historyReset(HISTORY * history, uint64_t firstSample);
+
+void historyAppend(HISTORY * history, const int16_t * samples, uint32_t count);
+
+/* Index of the oldest sample held */
+uint64_t historyOldest(const HISTORY * history);
+
+/*
+ * Points at the 'count' samples from index 'first' on, contiguous in memory,
+ * valid until the next append. NULL if any of them is not held.
+ */
+const int16_t * historyWindow(const HISTORY * history, uint64_t first, uint32_t count);
+
+#endif
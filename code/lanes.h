@@ -0,0 +1,24 @@
+/*******************************************************************************
+ *
+ * Filename: lanes.h
+ *
+ * Description:
+ *   Layout of the sample loops left to the compiler to vectorise (filtering,
+ *   capture averaging, the software trigger scan).
+ *
+ *   Such a loop goes through whole groups of a fixed number of lanes, with
+ *   an inner loop of exactly that many steps and no branch or call in it, so
+ *   the compiler can turn each group into vector operations; the samples
+ *   after the last whole group are done one by one. A sum over the samples
+ *   keeps one accumulator per lane, added together at the end, so that no
+ *   lane waits for the one before it.
+ *
+ ******************************************************************************/
+
+#ifndef LANES_H
+#define LANES_H
+
+/* Samples of 'count' that fill whole groups of 'lanes' */
+#define WHOLE_LANES(count, lanes)	((count) / (lanes) * (lanes))
+
+#endif
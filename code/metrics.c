@@ -0,0 +1,344 @@
+/*******************************************************************************
+ *
+ * Filename: metrics.c
+ *
+ * Description:
+ *   Metrics publisher thread, see metrics.h.
+ *
+ *   The thread sleeps in poll() on the listening socket and on a wake-up
+ *   pipe, so between two periods it only runs to answer a client. Each period
+ *   costs a dozen atomic loads, one snprintf and, in file mode, one small
+ *   write and rename.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+
+uint64_t g_metricCounters[METRIC_COUNTERS];
+uint64_t g_metricGauges[METRIC_GAUGES];
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define EXPOSITION_SIZE	4096
+
+typedef struct
+{
+	METRICS_MODE	mode;
+	uint32_t		periodMs;
+	pthread_t		thread;
+	int				running;
+	int				listenFd;
+	int				wakeFds[2];
+	char			text[EXPOSITION_SIZE];
+	size_t			length;
+} PUBLISHER;
+
+static PUBLISHER publisher = { METRICS_OFF, 1000, 0, 0, -1, { -1, -1 }, { 0 }, 0 };
+
+static const char * counterNames[METRIC_COUNTERS][2] =
+{
+	{ "ps5000a_samples_total",			"Samples per channel acquired" },
+	{ "ps5000a_captures_total",			"Rapid block captures read out" },
+	{ "ps5000a_callbacks_total",		"Streaming callbacks with data" },
+	{ "ps5000a_overflows_total",		"Callbacks or captures with a channel over range" },
+	{ "ps5000a_written_bytes_total",	"Bytes handed to the output writers" },
+	{ "ps5000a_soft_triggers_total",	"Events found by the software trigger" },
+	{ "ps5000a_syncs_total",			"Output syncs to disk" },
+	{ "ps5000a_power_changes_total",	"Streaming runs resumed after a power source change" },
+	{ "ps5000a_outage_ms_total",		"Milliseconds without data before streaming resumed" }
+};
+
+static const char * rateNames[METRIC_COUNTERS] =
+{
+	"ps5000a_samples_per_second",
+	"ps5000a_captures_per_second",
+	"ps5000a_callbacks_per_second",
+	"ps5000a_overflows_per_second",
+	"ps5000a_written_bytes_per_second",
+	"ps5000a_soft_triggers_per_second",
+	"ps5000a_syncs_per_second",
+	"ps5000a_power_changes_per_second",
+	"ps5000a_outage_ms_per_second"
+};
+
+static uint64_t monotonicNs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/* Renders the exposition of this period into publisher.text */
+static void render(const uint64_t * counters, const uint64_t * previous, double seconds)
+{
+	char * p = publisher.text;
+	char * end = publisher.text + EXPOSITION_SIZE;
+	int32_t i;
+
+	for (i = 0; i < METRIC_COUNTERS && p < end; i++)
+	{
+		p += snprintf(p, (size_t)(end - p), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+					counterNames[i][0], counterNames[i][1], counterNames[i][0], counterNames[i][0], (unsigned long long) counters[i]);
+	}
+
+	for (i = 0; i < METRIC_COUNTERS && p < end; i++)
+	{
+		p += snprintf(p, (size_t)(end - p), "# TYPE %s gauge\n%s %.1f\n", rateNames[i], rateNames[i],
+					seconds > 0 ? (double)(counters[i] - previous[i]) / seconds : 0.0);
+	}
+
+	if (p < end)
+	{
+		p += snprintf(p, (size_t)(end - p), "# TYPE ps5000a_buffer_fill_ratio gauge\nps5000a_buffer_fill_ratio %.3f\n"
+					"# TYPE ps5000a_acquiring gauge\nps5000a_acquiring %llu\n",
+					(double) __atomic_load_n(&g_metricGauges[METRIC_BUFFER_FILL], __ATOMIC_RELAXED) / 1000.0,
+					(unsigned long long) __atomic_load_n(&g_metricGauges[METRIC_ACQUIRING], __ATOMIC_RELAXED));
+	}
+
+	publisher.length = p < end ? (size_t)(p - publisher.text) : EXPOSITION_SIZE - 1;
+}
+
+static void writeFile(void)
+{
+	FILE * fp = fopen(METRICS_FILE ".tmp", "w");
+
+	if (fp == NULL)
+	{
+		return;
+	}
+
+	fwrite(publisher.text, 1, publisher.length, fp);
+
+	if (fclose(fp) == 0)
+	{
+		rename(METRICS_FILE ".tmp", METRICS_FILE);
+	}
+}
+
+static void serveClient(void)
+{
+	int fd = accept(publisher.listenFd, NULL, NULL);
+	size_t done = 0;
+	ssize_t n;
+
+	if (fd < 0)
+	{
+		return;
+	}
+
+	// The exposition is small, a client that does not read it at once is dropped
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	while (done < publisher.length && (n = send(fd, publisher.text + done, publisher.length - done, MSG_NOSIGNAL)) > 0)
+	{
+		done += (size_t) n;
+	}
+
+	close(fd);
+}
+
+static void * publisherThread(void * arg)
+{
+	uint64_t counters[METRIC_COUNTERS];
+	uint64_t previous[METRIC_COUNTERS];
+	uint64_t last = monotonicNs(), next, now;
+	struct pollfd fds[2];
+	int32_t i;
+
+	(void) arg;
+
+	for (i = 0; i < METRIC_COUNTERS; i++)
+	{
+		previous[i] = __atomic_load_n(&g_metricCounters[i], __ATOMIC_RELAXED);
+	}
+
+	render(previous, previous, 0);
+	next = last + (uint64_t) publisher.periodMs * 1000000ULL;
+
+	fds[0].fd = publisher.wakeFds[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = publisher.listenFd;
+	fds[1].events = POLLIN;
+
+	while (__atomic_load_n(&publisher.running, __ATOMIC_ACQUIRE))
+	{
+		now = monotonicNs();
+
+		if (now >= next)
+		{
+			for (i = 0; i < METRIC_COUNTERS; i++)
+			{
+				counters[i] = __atomic_load_n(&g_metricCounters[i], __ATOMIC_RELAXED);
+			}
+
+			render(counters, previous, (double)(now - last) * 1e-9);
+			memcpy(previous, counters, sizeof(previous));
+			last = now;
+			next += (uint64_t) publisher.periodMs * 1000000ULL;
+			next = next > now ? next : now + (uint64_t) publisher.periodMs * 1000000ULL;
+
+			if (publisher.mode == METRICS_FILE_ONLY || publisher.mode == METRICS_FILE_AND_SOCKET)
+			{
+				writeFile();
+			}
+
+			continue;
+		}
+
+		if (poll(fds, publisher.listenFd >= 0 ? 2 : 1, (int)((next - now + 999999) / 1000000)) > 0 && (fds[1].revents & POLLIN) && publisher.listenFd >= 0)
+		{
+			serveClient();
+		}
+	}
+
+	return NULL;
+}
+
+static int openSocket(void)
+{
+	struct sockaddr_un address;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0)
+	{
+		printf("metricsStart:socket ------ %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", METRICS_SOCKET);
+	unlink(METRICS_SOCKET);
+
+	if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, 4) != 0)
+	{
+		printf("metricsStart:bind %s ------ %s\n", METRICS_SOCKET, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+int32_t metricsStart(METRICS_MODE mode, uint32_t periodMs)
+{
+	metricsStop();
+
+	if (mode == METRICS_OFF)
+	{
+		return 0;
+	}
+
+	publisher.mode = mode;
+	publisher.periodMs = periodMs < 100 ? 100 : periodMs > 60000 ? 60000 : periodMs;
+	publisher.listenFd = -1;
+
+	if (mode == METRICS_SOCKET_ONLY || mode == METRICS_FILE_AND_SOCKET)
+	{
+		if ((publisher.listenFd = openSocket()) < 0)
+		{
+			return -1;
+		}
+	}
+
+	if (pipe(publisher.wakeFds) != 0)
+	{
+		printf("metricsStart:pipe ------ %s\n", strerror(errno));
+		metricsStop();
+		return -1;
+	}
+
+	publisher.running = 1;
+
+	if (pthread_create(&publisher.thread, NULL, publisherThread, NULL) != 0)
+	{
+		printf("metricsStart:pthread_create failed\n");
+		publisher.running = 0;
+		metricsStop();
+		return -1;
+	}
+
+	return 0;
+}
+
+void metricsStop(void)
+{
+	if (publisher.running)
+	{
+		__atomic_store_n(&publisher.running, 0, __ATOMIC_RELEASE);
+
+		if (write(publisher.wakeFds[1], "", 1) < 0)
+		{
+			// The thread still stops at the end of its period
+		}
+
+		pthread_join(publisher.thread, NULL);
+	}
+
+	if (publisher.listenFd >= 0)
+	{
+		close(publisher.listenFd);
+		unlink(METRICS_SOCKET);
+		publisher.listenFd = -1;
+	}
+
+	if (publisher.wakeFds[0] >= 0)
+	{
+		close(publisher.wakeFds[0]);
+		close(publisher.wakeFds[1]);
+		publisher.wakeFds[0] = publisher.wakeFds[1] = -1;
+	}
+}
+
+#else
+
+int32_t metricsStart(METRICS_MODE mode, uint32_t periodMs)
+{
+	if (mode != METRICS_OFF)
+	{
+		printf("metricsStart: live metrics are not supported on this platform\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+void metricsStop(void)
+{
+}
+
+#endif
+
+const char * metricsModeName(METRICS_MODE mode)
+{
+	switch (mode)
+	{
+		case METRICS_FILE_ONLY:
+			return "File " METRICS_FILE;
+		case METRICS_SOCKET_ONLY:
+			return "Socket " METRICS_SOCKET;
+		case METRICS_FILE_AND_SOCKET:
+			return "File " METRICS_FILE " and socket " METRICS_SOCKET;
+		default:
+			return "Off";
+	}
+}
@@ -0,0 +1,80 @@
+/*******************************************************************************
+ *
+ * Filename: metrics.h
+ *
+ * Description:
+ *   Live acquisition metrics.
+ *
+ *   The acquisition code bumps counters and sets gauges with relaxed atomic
+ *   operations and never waits for anything. A publisher thread wakes up once
+ *   per period, derives the rates from the counter deltas and publishes a
+ *   Prometheus text exposition:
+ *
+ *	 - to a file, rewritten atomically (write to a temporary file and rename),
+ *	   for the node_exporter textfile collector or a simple 'watch cat';
+ *	 - on a Unix-domain stream socket, where every client that connects gets
+ *	   the latest exposition and is disconnected ('socat - UNIX:ps5000a.sock').
+ *
+ ******************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#include "atomics.h"
+
+#define METRICS_FILE		"ps5000a.prom"
+#define METRICS_SOCKET		"ps5000a.sock"
+
+typedef enum
+{
+	METRIC_SAMPLES,				// samples per channel acquired
+	METRIC_CAPTURES,			// rapid block captures read out
+	METRIC_CALLBACKS,			// streaming callbacks with data
+	METRIC_OVERFLOWS,			// callbacks or captures with a channel over range
+	METRIC_BYTES_WRITTEN,		// bytes handed to the output writers
+	METRIC_SOFT_TRIGGERS,		// events found by the software trigger
+	METRIC_SYNCS,				// periodic and closing syncs to disk
+	METRIC_POWER_CHANGES,		// streaming resumed after a power source change
+	METRIC_OUTAGE_MS,			// time without data before resuming
+	METRIC_COUNTERS
+} METRIC_COUNTER;
+
+typedef enum
+{
+	METRIC_BUFFER_FILL,			// per mille of the streaming buffer delivered by the last callback
+	METRIC_ACQUIRING,			// 1 while a run is in progress
+	METRIC_GAUGES
+} METRIC_GAUGE;
+
+typedef enum
+{
+	METRICS_OFF,
+	METRICS_FILE_ONLY,
+	METRICS_SOCKET_ONLY,
+	METRICS_FILE_AND_SOCKET
+} METRICS_MODE;
+
+extern uint64_t g_metricCounters[METRIC_COUNTERS];
+extern uint64_t g_metricGauges[METRIC_GAUGES];
+
+static inline void metricsAdd(METRIC_COUNTER counter, uint64_t value)
+{
+	atomicFetchAdd64(&g_metricCounters[counter], value);
+}
+
+static inline void metricsSet(METRIC_GAUGE gauge, uint64_t value)
+{
+	atomicStoreRelaxed64(&g_metricGauges[gauge], value);
+}
+
+/* Starts the publisher thread, returns 0 on success. periodMs is clamped to 100..60000. */
+int32_t metricsStart(METRICS_MODE mode, uint32_t periodMs);
+
+/* Stops the publisher thread and removes the socket */
+void metricsStop(void);
+
+const char * metricsModeName(METRICS_MODE mode);
+
+#endif
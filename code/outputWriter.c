@@ -0,0 +1,1020 @@
+/*******************************************************************************
+ *
+ * Filename: outputWriter.c
+ *
+ * Description:
+ *   stdio and io_uring output backends, see outputWriter.h.
+ *
+ *   The io_uring backend talks to the kernel through the raw system calls
+ *   declared in <linux/io_uring.h>, so no extra library is needed. It is
+ *   compiled when the header is found by configure and falls back to stdio
+ *   if the running kernel refuses to set up a ring.
+ *
+ *   Periodic syncs are an fdatasync from the writing thread with stdio. With
+ *   io_uring they are queued as a draining fsync behind the buffer that
+ *   makes one due, so the writing thread does not wait for them.
+ *
+ *   A journaled file gathers the writes in a buffer of the writer's buffer
+ *   size and frames it as one record when it is full, when a sync is due
+ *   and when the file is closed, so lines of text do not each carry a
+ *   record header.
+ *
+ ******************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include "outputWriter.h"
+#include "metrics.h"
+#include "perfStats.h"
+#include "waveJournal.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(HAVE_LINUX_IO_URING_H)
+#define WRITER_HAVE_URING 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#define WRITER_ALIGNMENT	4096
+#define WRITER_SYNC_TAG		0xFFFFFFFFu
+#define WRITER_RECORD_MIN	65536
+
+typedef enum
+{
+	BUFFER_FREE,
+	BUFFER_FILLING,
+	BUFFER_IN_FLIGHT
+} BUFFER_STATE;
+
+struct tOutputWriter
+{
+	WRITER_BACKEND	backend;
+	FILE *			fp;
+	uint64_t		bytesWritten;
+	int32_t			error;
+	int16_t			journal;
+	uint64_t		sequence;
+	uint8_t *		record;				// data of the next journal record
+	size_t			recordSize;
+	size_t			recordFill;
+	uint64_t		syncNs;				// 0 for no periodic sync
+	uint64_t		lastSyncNs;
+
+#ifdef WRITER_HAVE_URING
+	int				fd;
+	int				ringFd;
+	int16_t			directIo;
+
+	void *			sqRing;
+	size_t			sqRingSize;
+	void *			cqRing;
+	size_t			cqRingSize;
+	struct io_uring_sqe * sqes;
+	size_t			sqesSize;
+	uint32_t *		sqHead;
+	uint32_t *		sqTail;
+	uint32_t *		sqMask;
+	uint32_t *		sqArray;
+	uint32_t *		cqHead;
+	uint32_t *		cqTail;
+	uint32_t *		cqMask;
+	struct io_uring_cqe * cqes;
+
+	uint32_t		nBuffers;
+	uint32_t		bufferSize;
+	uint8_t **		buffers;
+	BUFFER_STATE *	states;
+	uint32_t *		lengths;
+	uint32_t		current;
+	uint32_t		fill;
+	uint32_t		inFlight;
+	uint64_t		offset;
+	int16_t			syncInFlight;
+#endif
+};
+
+static OUTPUT_WRITER * startJournal(OUTPUT_WRITER * writer);
+
+const char * writerBackendName(WRITER_BACKEND backend)
+{
+	return backend == WRITER_URING ? "io_uring" : "stdio";
+}
+
+#ifdef WRITER_HAVE_URING
+/****************************************************************************
+* io_uring backend
+****************************************************************************/
+static int uringSetup(uint32_t entries, struct io_uring_params * params)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int ringFd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags)
+{
+	return (int) syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int uringRegister(int ringFd, uint32_t opcode, const void * arg, uint32_t nArgs)
+{
+	return (int) syscall(__NR_io_uring_register, ringFd, opcode, arg, nArgs);
+}
+
+static int32_t uringMapRings(OUTPUT_WRITER * writer, struct io_uring_params * params)
+{
+	writer->sqRingSize = params->sq_off.array + params->sq_entries * sizeof(uint32_t);
+	writer->cqRingSize = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (params->features & IORING_FEAT_SINGLE_MMAP)
+	{
+		writer->sqRingSize = writer->cqRingSize > writer->sqRingSize ? writer->cqRingSize : writer->sqRingSize;
+		writer->cqRingSize = writer->sqRingSize;
+	}
+#endif
+
+	writer->sqRing = mmap(NULL, writer->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, writer->ringFd, IORING_OFF_SQ_RING);
+
+	if (writer->sqRing == MAP_FAILED)
+	{
+		writer->sqRing = NULL;
+		return -1;
+	}
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (params->features & IORING_FEAT_SINGLE_MMAP)
+	{
+		writer->cqRing = writer->sqRing;
+	}
+	else
+#endif
+	{
+		writer->cqRing = mmap(NULL, writer->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, writer->ringFd, IORING_OFF_CQ_RING);
+
+		if (writer->cqRing == MAP_FAILED)
+		{
+			writer->cqRing = NULL;
+			return -1;
+		}
+	}
+
+	writer->sqesSize = params->sq_entries * sizeof(struct io_uring_sqe);
+	writer->sqes = (struct io_uring_sqe *) mmap(NULL, writer->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, writer->ringFd, IORING_OFF_SQES);
+
+	if (writer->sqes == MAP_FAILED)
+	{
+		writer->sqes = NULL;
+		return -1;
+	}
+
+	writer->sqHead = (uint32_t *)((uint8_t *) writer->sqRing + params->sq_off.head);
+	writer->sqTail = (uint32_t *)((uint8_t *) writer->sqRing + params->sq_off.tail);
+	writer->sqMask = (uint32_t *)((uint8_t *) writer->sqRing + params->sq_off.ring_mask);
+	writer->sqArray = (uint32_t *)((uint8_t *) writer->sqRing + params->sq_off.array);
+	writer->cqHead = (uint32_t *)((uint8_t *) writer->cqRing + params->cq_off.head);
+	writer->cqTail = (uint32_t *)((uint8_t *) writer->cqRing + params->cq_off.tail);
+	writer->cqMask = (uint32_t *)((uint8_t *) writer->cqRing + params->cq_off.ring_mask);
+	writer->cqes = (struct io_uring_cqe *)((uint8_t *) writer->cqRing + params->cq_off.cqes);
+
+	return 0;
+}
+
+static void uringRelease(OUTPUT_WRITER * writer)
+{
+	uint32_t i;
+
+	if (writer->sqes != NULL)
+	{
+		munmap(writer->sqes, writer->sqesSize);
+	}
+
+	if (writer->cqRing != NULL && writer->cqRing != writer->sqRing)
+	{
+		munmap(writer->cqRing, writer->cqRingSize);
+	}
+
+	if (writer->sqRing != NULL)
+	{
+		munmap(writer->sqRing, writer->sqRingSize);
+	}
+
+	if (writer->ringFd >= 0)
+	{
+		close(writer->ringFd);
+	}
+
+	if (writer->buffers != NULL)
+	{
+		for (i = 0; i < writer->nBuffers; i++)
+		{
+			free(writer->buffers[i]);
+		}
+	}
+
+	free(writer->buffers);
+	free(writer->states);
+	free(writer->lengths);
+}
+
+/* Collect finished writes, waiting for at least 'minComplete' of them */
+static void uringReap(OUTPUT_WRITER * writer, uint32_t minComplete)
+{
+	uint32_t head, tail;
+
+	if (minComplete > 0)
+	{
+		while (uringEnter(writer->ringFd, 0, minComplete, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR)
+		{
+		}
+	}
+
+	head = *writer->cqHead;
+	tail = __atomic_load_n(writer->cqTail, __ATOMIC_ACQUIRE);
+
+	while (head != tail)
+	{
+		struct io_uring_cqe * cqe = &writer->cqes[head & *writer->cqMask];
+		uint32_t index = (uint32_t) cqe->user_data;
+
+		if (index == WRITER_SYNC_TAG)
+		{
+			if (cqe->res < 0)
+			{
+				writer->error = -cqe->res;
+			}
+
+			writer->syncInFlight = 0;
+		}
+		else
+		{
+			if (cqe->res < 0 || (uint32_t) cqe->res != writer->lengths[index])
+			{
+				writer->error = cqe->res < 0 ? -cqe->res : EIO;
+			}
+
+			writer->states[index] = BUFFER_FREE;
+		}
+
+		writer->inFlight--;
+		head++;
+	}
+
+	__atomic_store_n(writer->cqHead, head, __ATOMIC_RELEASE);
+}
+
+static int32_t uringSubmit(OUTPUT_WRITER * writer, uint32_t index, uint32_t length)
+{
+	uint32_t tail = *writer->sqTail;
+	uint32_t slot = tail & *writer->sqMask;
+	struct io_uring_sqe * sqe = &writer->sqes[slot];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->fd = writer->fd;
+	sqe->addr = (uint64_t)(uintptr_t) writer->buffers[index];
+	sqe->len = length;
+	sqe->off = writer->offset;
+	sqe->buf_index = (uint16_t) index;
+	sqe->user_data = index;
+
+	writer->sqArray[slot] = slot;
+	__atomic_store_n(writer->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+	writer->lengths[index] = length;
+	writer->states[index] = BUFFER_IN_FLIGHT;
+	writer->inFlight++;
+	writer->offset += length;
+
+	while (uringEnter(writer->ringFd, 1, 0, 0) < 0)
+	{
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			writer->error = errno;
+			return -1;
+		}
+
+		uringReap(writer, writer->inFlight > 1 ? 1 : 0);
+	}
+
+	return 0;
+}
+
+/* Queue an fdatasync that starts once every write before it has finished */
+static int32_t uringSync(OUTPUT_WRITER * writer)
+{
+	uint32_t tail = *writer->sqTail;
+	uint32_t slot = tail & *writer->sqMask;
+	struct io_uring_sqe * sqe = &writer->sqes[slot];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->flags = IOSQE_IO_DRAIN;
+	sqe->fd = writer->fd;
+	sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+	sqe->user_data = WRITER_SYNC_TAG;
+
+	writer->sqArray[slot] = slot;
+	__atomic_store_n(writer->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+	writer->syncInFlight = 1;
+	writer->inFlight++;
+
+	while (uringEnter(writer->ringFd, 1, 0, 0) < 0)
+	{
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			writer->error = errno;
+			return -1;
+		}
+
+		uringReap(writer, writer->inFlight > 1 ? 1 : 0);
+	}
+
+	metricsAdd(METRIC_SYNCS, 1);
+	return 0;
+}
+
+/* Hand the current buffer to the kernel and make the next free one current */
+static int32_t uringFlush(OUTPUT_WRITER * writer)
+{
+	uint32_t i;
+
+	if (writer->fill > 0)
+	{
+		if (uringSubmit(writer, writer->current, writer->fill) != 0)
+		{
+			return -1;
+		}
+
+		writer->fill = 0;
+	}
+
+	uringReap(writer, 0);
+
+	// One sync at a time: a later one covers everything written meanwhile
+	if (writer->syncNs != 0 && !writer->syncInFlight && perfNow() - writer->lastSyncNs >= writer->syncNs)
+	{
+		writer->lastSyncNs = perfNow();
+
+		if (uringSync(writer) != 0)
+		{
+			return -1;
+		}
+	}
+
+	for (;;)
+	{
+		for (i = 0; i < writer->nBuffers; i++)
+		{
+			uint32_t index = (writer->current + 1 + i) % writer->nBuffers;
+
+			if (writer->states[index] == BUFFER_FREE)
+			{
+				writer->current = index;
+				writer->states[index] = BUFFER_FILLING;
+				return 0;
+			}
+		}
+
+		// Every buffer is queued: this is where a slow disk applies back pressure
+		uringReap(writer, 1);
+	}
+}
+
+static int32_t uringOpen(OUTPUT_WRITER * writer, const char * path, const WRITER_OPTIONS * options, uint64_t offset)
+{
+	struct io_uring_params params;
+	struct iovec * iovecs;
+	uint32_t i;
+	int flags = O_WRONLY | O_CREAT;
+
+	writer->ringFd = -1;
+	writer->nBuffers = options->queueDepth < 2 ? 2 : options->queueDepth;
+	writer->bufferSize = (options->bufferSize + WRITER_ALIGNMENT - 1) & ~(uint32_t)(WRITER_ALIGNMENT - 1);
+	writer->bufferSize = writer->bufferSize < 65536 ? 65536 : writer->bufferSize;
+	writer->directIo = options->directIo;
+	writer->offset = offset;
+
+	// Direct writes must start on an aligned offset
+	if (offset % WRITER_ALIGNMENT != 0)
+	{
+		writer->directIo = 0;
+	}
+
+	writer->fd = open(path, flags | (writer->directIo ? O_DIRECT : 0), 0644);
+
+	if (writer->fd < 0 && writer->directIo)
+	{
+		// tmpfs and some network file systems do not support O_DIRECT
+		printf("writerOpen: O_DIRECT not supported for %s, using buffered I/O\n", path);
+		writer->directIo = 0;
+		writer->fd = open(path, flags, 0644);
+	}
+
+	if (writer->fd < 0 || ftruncate(writer->fd, (off_t) offset) != 0)
+	{
+		if (writer->fd >= 0)
+		{
+			close(writer->fd);
+		}
+
+		return -1;
+	}
+
+	memset(&params, 0, sizeof(params));
+	writer->ringFd = uringSetup(writer->nBuffers, &params);
+
+	if (writer->ringFd < 0 || uringMapRings(writer, &params) != 0)
+	{
+		printf("writerOpen: io_uring not available (%s), using stdio\n", strerror(errno));
+		uringRelease(writer);
+		close(writer->fd);
+		return 1;
+	}
+
+	writer->buffers = (uint8_t **) calloc(writer->nBuffers, sizeof(uint8_t *));
+	writer->states = (BUFFER_STATE *) calloc(writer->nBuffers, sizeof(BUFFER_STATE));
+	writer->lengths = (uint32_t *) calloc(writer->nBuffers, sizeof(uint32_t));
+	iovecs = (struct iovec *) calloc(writer->nBuffers, sizeof(struct iovec));
+
+	for (i = 0; writer->buffers != NULL && iovecs != NULL && i < writer->nBuffers; i++)
+	{
+		void * buffer = NULL;
+
+		if (posix_memalign(&buffer, WRITER_ALIGNMENT, writer->bufferSize) != 0)
+		{
+			break;
+		}
+
+		writer->buffers[i] = (uint8_t *) buffer;
+		iovecs[i].iov_base = buffer;
+		iovecs[i].iov_len = writer->bufferSize;
+	}
+
+	// Registered buffers are pinned once, instead of on every write
+	if (i < writer->nBuffers || writer->states == NULL || writer->lengths == NULL ||
+		uringRegister(writer->ringFd, IORING_REGISTER_BUFFERS, iovecs, writer->nBuffers) != 0)
+	{
+		printf("writerOpen: cannot register %u io_uring buffers (%s), using stdio\n", writer->nBuffers, strerror(errno));
+		free(iovecs);
+		uringRelease(writer);
+		close(writer->fd);
+		return 1;
+	}
+
+	free(iovecs);
+
+	writer->current = 0;
+	writer->states[0] = BUFFER_FILLING;
+	return 0;
+}
+
+static int32_t uringClose(OUTPUT_WRITER * writer)
+{
+	uint32_t tail = writer->fill;
+	uint32_t padded = writer->fill;
+	uint64_t size = writer->offset + writer->fill;
+
+	// O_DIRECT needs aligned lengths: pad the tail and cut the file back afterwards
+	if (writer->directIo && writer->fill > 0)
+	{
+		padded = (writer->fill + WRITER_ALIGNMENT - 1) & ~(uint32_t)(WRITER_ALIGNMENT - 1);
+		memset(writer->buffers[writer->current] + writer->fill, 0, padded - writer->fill);
+	}
+
+	if (padded > 0)
+	{
+		uringSubmit(writer, writer->current, padded);
+		writer->fill = 0;
+	}
+
+	while (writer->inFlight > 0)
+	{
+		uringReap(writer, 1);
+	}
+
+	if (padded != tail && ftruncate(writer->fd, (off_t) size) != 0)
+	{
+		writer->error = errno;
+	}
+
+	if ((writer->journal || writer->syncNs != 0) && fdatasync(writer->fd) != 0)
+	{
+		writer->error = errno;
+	}
+
+	uringRegister(writer->ringFd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+	uringRelease(writer);
+
+	if (close(writer->fd) != 0)
+	{
+		writer->error = errno;
+	}
+
+	return writer->error ? -1 : 0;
+}
+#endif
+
+/****************************************************************************
+* stdioSync
+*
+* Flushes the stdio buffer and waits for the data to reach the disk
+****************************************************************************/
+static int32_t stdioSync(OUTPUT_WRITER * writer)
+{
+	if (fflush(writer->fp) != 0)
+	{
+		return -1;
+	}
+
+	metricsAdd(METRIC_SYNCS, 1);
+
+#ifdef _WIN32
+	return _commit(_fileno(writer->fp)) == 0 ? 0 : -1;
+#elif defined(__APPLE__)
+	return fsync(fileno(writer->fp)) == 0 ? 0 : -1;
+#else
+	return fdatasync(fileno(writer->fp)) == 0 ? 0 : -1;
+#endif
+}
+
+/****************************************************************************
+* recoverJournal
+*
+* Before a journaled file is overwritten: if the last run did not close it,
+* cuts it after its last good record and keeps it as PATH.recovered.
+****************************************************************************/
+static void recoverJournal(const char * path)
+{
+	char kept[280];
+	JOURNAL_SCAN scan;
+	FILE * fp = fopen(path, "r+b");
+	int32_t result;
+
+	if (fp == NULL)
+	{
+		return;
+	}
+
+	result = journalScan(fp, &scan, NULL, NULL);
+
+	if (result != 0 || scan.closed)
+	{
+		fclose(fp);
+		return;
+	}
+
+#ifdef _WIN32
+	result = _chsize_s(_fileno(fp), (__int64) scan.goodBytes) == 0 ? 0 : -1;
+#else
+	result = ftruncate(fileno(fp), (off_t) scan.goodBytes);
+#endif
+	fclose(fp);
+
+	snprintf(kept, sizeof(kept), "%s.recovered", path);
+	remove(kept);
+
+	if (result != 0 || rename(path, kept) != 0)
+	{
+		printf("writerOpen: %s was not closed and could not be recovered\n", path);
+		return;
+	}
+
+	printf("%s was not closed: %llu records (%llu bytes) kept in %s, %llu damaged or unsynced bytes dropped\n", path,
+			(unsigned long long) scan.records, (unsigned long long) scan.dataBytes, kept,
+			(unsigned long long)(scan.fileBytes - scan.goodBytes));
+}
+
+/****************************************************************************
+* writerOpen
+*
+* Opens 'path' for writing with the requested backend. Returns NULL if the
+* file cannot be created.
+****************************************************************************/
+OUTPUT_WRITER * writerOpen(const char * path, const WRITER_OPTIONS * options)
+{
+	return writerOpenAt(path, options, 0);
+}
+
+/****************************************************************************
+* writerOpenAt
+*
+* Like writerOpen, but keeps the first 'offset' bytes of an existing file:
+* the file is cut at 'offset' and writing continues from there.
+****************************************************************************/
+OUTPUT_WRITER * writerOpenAt(const char * path, const WRITER_OPTIONS * options, uint64_t offset)
+{
+	OUTPUT_WRITER * writer = (OUTPUT_WRITER *) calloc(1, sizeof(OUTPUT_WRITER));
+
+	if (writer == NULL)
+	{
+		return NULL;
+	}
+
+	writer->backend = WRITER_STDIO;
+
+	if (options != NULL)
+	{
+		// Journals are only ever written from the start
+		writer->journal = options->journal && offset == 0;
+		writer->syncNs = (uint64_t) options->syncMs * 1000000;
+		writer->lastSyncNs = perfNow();
+		writer->recordSize = options->bufferSize < WRITER_RECORD_MIN ? WRITER_RECORD_MIN : options->bufferSize;
+	}
+
+	if (writer->journal)
+	{
+		recoverJournal(path);
+
+		if ((writer->record = (uint8_t *) malloc(writer->recordSize)) == NULL)
+		{
+			free(writer);
+			return NULL;
+		}
+	}
+
+#ifdef WRITER_HAVE_URING
+	if (options != NULL && options->backend == WRITER_URING)
+	{
+		int32_t result = uringOpen(writer, path, options, offset);
+
+		if (result == 0)
+		{
+			writer->backend = WRITER_URING;
+			return startJournal(writer);
+		}
+
+		if (result < 0)
+		{
+			free(writer->record);
+			free(writer);
+			return NULL;
+		}
+	}
+#else
+	if (options != NULL && options->backend == WRITER_URING)
+	{
+		printf("writerOpen: io_uring support not compiled in, using stdio\n");
+	}
+#endif
+
+	writer->fp = fopen(path, offset > 0 ? "r+b" : "w");
+
+	if (writer->fp != NULL && offset > 0)
+	{
+#ifdef _WIN32
+		if (_chsize_s(_fileno(writer->fp), (__int64) offset) != 0 || _fseeki64(writer->fp, (__int64) offset, SEEK_SET) != 0)
+#else
+		if (ftruncate(fileno(writer->fp), (off_t) offset) != 0 || fseeko(writer->fp, (off_t) offset, SEEK_SET) != 0)
+#endif
+		{
+			fclose(writer->fp);
+			writer->fp = NULL;
+		}
+	}
+
+	if (writer->fp == NULL)
+	{
+		free(writer->record);
+		free(writer);
+		return NULL;
+	}
+
+	return startJournal(writer);
+}
+
+/* TRUE once the periodic sync is due */
+static int16_t syncDue(OUTPUT_WRITER * writer)
+{
+	return writer->syncNs != 0 && perfNow() - writer->lastSyncNs >= writer->syncNs;
+}
+
+/****************************************************************************
+* writeRaw
+*
+* Writes bytes as they are, then syncs if one is due (stdio; io_uring syncs
+* when it hands a buffer over)
+****************************************************************************/
+static int32_t writeRaw(OUTPUT_WRITER * writer, const void * data, size_t length)
+{
+	writer->bytesWritten += length;
+	metricsAdd(METRIC_BYTES_WRITTEN, length);
+
+#ifdef WRITER_HAVE_URING
+	if (writer->backend == WRITER_URING)
+	{
+		const uint8_t * source = (const uint8_t *) data;
+
+		while (length > 0)
+		{
+			size_t chunk = writer->bufferSize - writer->fill;
+
+			if (chunk == 0)
+			{
+				if (uringFlush(writer) != 0)
+				{
+					return -1;
+				}
+
+				continue;
+			}
+
+			chunk = chunk < length ? chunk : length;
+			memcpy(writer->buffers[writer->current] + writer->fill, source, chunk);
+			writer->fill += (uint32_t) chunk;
+			source += chunk;
+			length -= chunk;
+		}
+
+		return writer->error ? -1 : 0;
+	}
+#endif
+
+	if (fwrite(data, 1, length, writer->fp) != length)
+	{
+		return -1;
+	}
+
+	if (syncDue(writer))
+	{
+		writer->lastSyncNs = perfNow();
+		return stdioSync(writer);
+	}
+
+	return 0;
+}
+
+/****************************************************************************
+* writeRecord
+*
+* Frames 'length' bytes as one journal record
+****************************************************************************/
+static int32_t writeRecord(OUTPUT_WRITER * writer, uint32_t flags, const void * data, size_t length)
+{
+	static const uint8_t padding[JOURNAL_ALIGN] = { 0 };
+	uint8_t header[JOURNAL_RECORD_SIZE];
+
+	if (length > JOURNAL_MAX_RECORD)
+	{
+		// Split, each part is a record of its own
+		return writeRecord(writer, flags, data, JOURNAL_MAX_RECORD) == 0 &&
+				writeRecord(writer, flags, (const uint8_t *) data + JOURNAL_MAX_RECORD, length - JOURNAL_MAX_RECORD) == 0 ? 0 : -1;
+	}
+
+	journalEncodeRecord(header, flags, writer->sequence++, data, (uint32_t) length);
+
+	if (writeRaw(writer, header, JOURNAL_RECORD_SIZE) != 0 || writeRaw(writer, data, length) != 0)
+	{
+		return -1;
+	}
+
+	return writeRaw(writer, padding, journalPadding((uint32_t) length));
+}
+
+/****************************************************************************
+* startJournal
+*
+* Writes the journal header of a journaled file just opened
+****************************************************************************/
+static OUTPUT_WRITER * startJournal(OUTPUT_WRITER * writer)
+{
+	uint8_t header[JOURNAL_HEADER_SIZE];
+
+	if (writer->journal)
+	{
+		journalEncodeHeader(header);
+		writeRaw(writer, header, JOURNAL_HEADER_SIZE);
+	}
+
+	return writer;
+}
+
+/****************************************************************************
+* flushRecord
+*
+* Writes the data gathered for the next journal record as one record
+****************************************************************************/
+static int32_t flushRecord(OUTPUT_WRITER * writer)
+{
+	int32_t result = 0;
+
+	if (writer->recordFill > 0)
+	{
+		result = writeRecord(writer, 0, writer->record, writer->recordFill);
+		writer->recordFill = 0;
+	}
+
+	return result;
+}
+
+/****************************************************************************
+* gatherRecord
+*
+* Adds 'length' bytes to the next journal record. A write larger than the
+* buffer goes out as a record of its own.
+****************************************************************************/
+static int32_t gatherRecord(OUTPUT_WRITER * writer, const void * data, size_t length)
+{
+	if (writer->recordFill + length > writer->recordSize && flushRecord(writer) != 0)
+	{
+		return -1;
+	}
+
+	if (length > writer->recordSize)
+	{
+		return writeRecord(writer, 0, data, length);
+	}
+
+	memcpy(writer->record + writer->recordFill, data, length);
+	writer->recordFill += length;
+
+	// A due sync should cover what is held here too
+	return syncDue(writer) ? flushRecord(writer) : 0;
+}
+
+int32_t writerWrite(OUTPUT_WRITER * writer, const void * data, size_t length)
+{
+	if (writer == NULL)
+	{
+		return -1;
+	}
+
+	return writer->journal ? gatherRecord(writer, data, length) : writeRaw(writer, data, length);
+}
+
+int32_t writerPrintf(OUTPUT_WRITER * writer, const char * format, ...)
+{
+	va_list args;
+	int32_t result;
+
+	if (writer == NULL)
+	{
+		return -1;
+	}
+
+#ifdef WRITER_HAVE_URING
+	if (writer->backend == WRITER_URING && !writer->journal)
+	{
+		int32_t length;
+		char * line;
+		size_t space = writer->bufferSize - writer->fill;
+
+		// Format straight into the current buffer, move on to the next one if it does not fit
+		va_start(args, format);
+		length = vsnprintf((char *) writer->buffers[writer->current] + writer->fill, space, format, args);
+		va_end(args);
+
+		if (length >= 0 && (size_t) length < space)
+		{
+			writer->fill += (uint32_t) length;
+			writer->bytesWritten += (uint64_t) length;
+			metricsAdd(METRIC_BYTES_WRITTEN, (uint64_t) length);
+			return length;
+		}
+
+		if (length < 0)
+		{
+			return -1;
+		}
+
+		// Format aside and copy, so that every buffer but the last one is submitted full
+		line = (char *) malloc((size_t) length + 1);
+
+		if (line == NULL)
+		{
+			return -1;
+		}
+
+		va_start(args, format);
+		vsnprintf(line, (size_t) length + 1, format, args);
+		va_end(args);
+
+		result = writerWrite(writer, line, (size_t) length);
+		free(line);
+		return result == 0 ? length : -1;
+	}
+#endif
+
+	if (writer->journal)
+	{
+		char line[256];
+		char * text = line;
+		size_t space = writer->recordSize - writer->recordFill;
+
+		// Format straight into the record being gathered when it fits
+		va_start(args, format);
+		result = vsnprintf((char *) writer->record + writer->recordFill, space, format, args);
+		va_end(args);
+
+		if (result >= 0 && (size_t) result < space)
+		{
+			writer->recordFill += (size_t) result;
+
+			return syncDue(writer) && flushRecord(writer) != 0 ? -1 : result;
+		}
+
+		// Else aside, then gathered like a write
+		va_start(args, format);
+		result = vsnprintf(line, sizeof(line), format, args);
+		va_end(args);
+
+		if (result >= (int32_t) sizeof(line) && (text = (char *) malloc((size_t) result + 1)) != NULL)
+		{
+			va_start(args, format);
+			vsnprintf(text, (size_t) result + 1, format, args);
+			va_end(args);
+		}
+
+		if (result < 0 || text == NULL)
+		{
+			return -1;
+		}
+
+		result = gatherRecord(writer, text, (size_t) result) == 0 ? result : -1;
+
+		if (text != line)
+		{
+			free(text);
+		}
+
+		return result;
+	}
+
+	va_start(args, format);
+	result = vfprintf(writer->fp, format, args);
+	va_end(args);
+
+	if (result > 0)
+	{
+		writer->bytesWritten += (uint64_t) result;
+		metricsAdd(METRIC_BYTES_WRITTEN, (uint64_t) result);
+	}
+
+	return result;
+}
+
+uint64_t writerBytesWritten(OUTPUT_WRITER * writer)
+{
+	return writer == NULL ? 0 : writer->bytesWritten;
+}
+
+/****************************************************************************
+* writerClose
+*
+* Waits for every outstanding write, closes the file and releases the
+* writer. Returns -1 if any write failed.
+****************************************************************************/
+int32_t writerClose(OUTPUT_WRITER * writer)
+{
+	int32_t result;
+
+	if (writer == NULL)
+	{
+		return -1;
+	}
+
+	// The end record tells a clean close from a crash
+	if (writer->journal && (flushRecord(writer) != 0 || writeRecord(writer, JOURNAL_RECORD_END, NULL, 0) != 0))
+	{
+		writer->error = EIO;
+	}
+
+	free(writer->record);
+
+#ifdef WRITER_HAVE_URING
+	if (writer->backend == WRITER_URING)
+	{
+		result = uringClose(writer);
+		free(writer);
+		return result;
+	}
+#endif
+
+	if ((writer->journal || writer->syncNs != 0) && stdioSync(writer) != 0)
+	{
+		writer->error = EIO;
+	}
+
+	result = fclose(writer->fp) == 0 && writer->error == 0 ? 0 : -1;
+	free(writer);
+	return result;
+}
@@ -0,0 +1,56 @@
+/*******************************************************************************
+ *
+ * Filename: outputWriter.h
+ *
+ * Description:
+ *   Output writer used for the block, block_binary and stream files.
+ *
+ *   The stdio backend is a thin wrapper around fopen/fprintf/fwrite. The
+ *   io_uring backend (Linux only) copies data into a ring of registered,
+ *   page aligned buffers and submits each full buffer as an asynchronous
+ *   write, so the acquisition thread only waits for the disk when every
+ *   buffer is already in flight.
+ *
+ *   Either backend can sync the file to disk at most every 'syncMs' while
+ *   writing, so that a crash loses at most that much, and can gather the
+ *   writes into checksummed journal records (waveJournal.h). A journaled file
+ *   left unclosed by a crash is cut after its last good record and kept as
+ *   PATH.recovered when the file is next opened for writing.
+ *
+ ******************************************************************************/
+
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum
+{
+	WRITER_STDIO,
+	WRITER_URING
+} WRITER_BACKEND;
+
+typedef struct
+{
+	WRITER_BACKEND	backend;
+	uint32_t		queueDepth;		// writes kept in flight (io_uring only)
+	uint32_t		bufferSize;		// bytes per registered buffer (io_uring only)
+	int16_t			directIo;		// open with O_DIRECT (io_uring only)
+	int16_t			journal;		// writes gathered into checksummed records
+	uint32_t		syncMs;			// fdatasync at most this often, 0 for none until closed
+} WRITER_OPTIONS;
+
+typedef struct tOutputWriter OUTPUT_WRITER;
+
+OUTPUT_WRITER * writerOpen(const char * path, const WRITER_OPTIONS * options);
+OUTPUT_WRITER * writerOpenAt(const char * path, const WRITER_OPTIONS * options, uint64_t offset);
+int32_t writerWrite(OUTPUT_WRITER * writer, const void * data, size_t length);
+int32_t writerPrintf(OUTPUT_WRITER * writer, const char * format, ...);
+int32_t writerClose(OUTPUT_WRITER * writer);
+
+uint64_t writerBytesWritten(OUTPUT_WRITER * writer);
+const char * writerBackendName(WRITER_BACKEND backend);
+
+#endif
@@ -0,0 +1,357 @@
+/*******************************************************************************
+ *
+ * Filename: perfStats.c
+ *
+ * Description:
+ *   Per-thread latency histograms, see perfStats.h.
+ *
+ *   The owning thread is the only writer of its histograms. Counters are
+ *   updated with relaxed atomic stores so that a summary taken while the
+ *   thread is still running reads whole values; summaries are only taken
+ *   between runs in this program.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "perfStats.h"
+#include "atomics.h"
+
+#define SUB_BITS		5
+#define SUB_BUCKETS		(1 << SUB_BITS)
+#define BUCKETS			((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+#if defined(_MSC_VER)
+#define PERF_TLS	__declspec(thread)
+#else
+#define PERF_TLS	__thread
+#endif
+
+typedef struct
+{
+	uint64_t	count;
+	uint64_t	sum;
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	buckets[BUCKETS];
+} HISTOGRAM;
+
+typedef struct tPerfThread
+{
+	HISTOGRAM				stages[PERF_STAGES];
+	struct tPerfThread *	next;
+} PERF_THREAD;
+
+PERF_MODE g_perfMode = PERF_SUMMARY;
+
+static PERF_THREAD * threads = NULL;
+static PERF_TLS PERF_THREAD * self = NULL;
+
+static char runName[64];
+static uint64_t runStart;
+static uint64_t runSamples;
+
+static const char * stageNames[PERF_STAGES] =
+{
+	"stream.poll",
+	"stream.interval",
+	"stream.copy",
+	"stream.convert",
+	"stream.write",
+	"block.arm",
+	"block.ready",
+	"block.readout",
+	"block.convert",
+	"block.write"
+};
+
+uint64_t perfNow(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (uint64_t)((double) counter.QuadPart * 1e9 / (double) frequency.QuadPart);
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+#endif
+}
+
+static inline uint32_t bucketIndex(uint64_t value)
+{
+	uint32_t shift;
+
+	if (value < SUB_BUCKETS)
+	{
+		return (uint32_t) value;
+	}
+
+	shift = (uint32_t)(63 - __builtin_clzll(value)) - SUB_BITS;
+	return ((shift + 1) << SUB_BITS) + (uint32_t)((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+/* Middle of the range of values that fall in a bucket */
+static uint64_t bucketValue(uint32_t index)
+{
+	uint32_t shift;
+
+	if (index < SUB_BUCKETS)
+	{
+		return index;
+	}
+
+	shift = (index >> SUB_BITS) - 1;
+	return ((uint64_t)(SUB_BUCKETS + (index & (SUB_BUCKETS - 1))) << shift) + ((1ULL << shift) >> 1);
+}
+
+/* First record on a thread: give it its own histograms */
+static PERF_THREAD * registerThread(void)
+{
+	PERF_THREAD * thread = (PERF_THREAD *) calloc(1, sizeof(PERF_THREAD));
+	int32_t i;
+
+	if (thread == NULL)
+	{
+		return NULL;
+	}
+
+	for (i = 0; i < PERF_STAGES; i++)
+	{
+		thread->stages[i].min = UINT64_MAX;
+	}
+
+	thread->next = (PERF_THREAD *) atomicLoadPointer((void **) &threads);
+
+	while (!atomicCompareExchangePointer((void **) &threads, (void **) &thread->next, thread))
+	{
+	}
+
+	self = thread;
+	return thread;
+}
+
+void perfRecord(PERF_STAGE stage, uint64_t ns)
+{
+	PERF_THREAD * thread = self;
+	HISTOGRAM * h;
+	uint32_t index;
+
+	if (g_perfMode == PERF_OFF)
+	{
+		return;
+	}
+
+	if (thread == NULL && (thread = registerThread()) == NULL)
+	{
+		return;
+	}
+
+	h = &thread->stages[stage];
+	index = bucketIndex(ns);
+
+	atomicStoreRelaxed64(&h->buckets[index], h->buckets[index] + 1);
+	atomicStoreRelaxed64(&h->count, h->count + 1);
+	atomicStoreRelaxed64(&h->sum, h->sum + ns);
+
+	if (ns < h->min)
+	{
+		atomicStoreRelaxed64(&h->min, ns);
+	}
+
+	if (ns > h->max)
+	{
+		atomicStoreRelaxed64(&h->max, ns);
+	}
+}
+
+void perfAddSamples(uint64_t samples)
+{
+	runSamples += samples;
+}
+
+void perfBegin(const char * run)
+{
+	PERF_THREAD * thread;
+	int32_t i;
+
+	snprintf(runName, sizeof(runName), "%s", run);
+	runSamples = 0;
+
+	for (thread = (PERF_THREAD *) atomicLoadPointer((void **) &threads); thread != NULL; thread = thread->next)
+	{
+		memset(thread->stages, 0, sizeof(thread->stages));
+
+		for (i = 0; i < PERF_STAGES; i++)
+		{
+			thread->stages[i].min = UINT64_MAX;
+		}
+	}
+
+	runStart = perfNow();
+}
+
+/* Merges the histograms of every thread for one stage */
+static void mergeStage(int32_t stage, HISTOGRAM * merged)
+{
+	PERF_THREAD * thread;
+	uint32_t i;
+
+	memset(merged, 0, sizeof(HISTOGRAM));
+	merged->min = UINT64_MAX;
+
+	for (thread = (PERF_THREAD *) atomicLoadPointer((void **) &threads); thread != NULL; thread = thread->next)
+	{
+		const HISTOGRAM * h = &thread->stages[stage];
+
+		merged->count += atomicLoadRelaxed64(&h->count);
+		merged->sum += atomicLoadRelaxed64(&h->sum);
+		merged->min = h->min < merged->min ? h->min : merged->min;
+		merged->max = h->max > merged->max ? h->max : merged->max;
+
+		for (i = 0; i < BUCKETS; i++)
+		{
+			merged->buckets[i] += atomicLoadRelaxed64(&h->buckets[i]);
+		}
+	}
+}
+
+static uint64_t percentile(const HISTOGRAM * h, double fraction)
+{
+	uint64_t target = (uint64_t)(fraction * (double) h->count + 0.5);
+	uint64_t seen = 0;
+	uint32_t i;
+
+	target = target < 1 ? 1 : target;
+
+	for (i = 0; i < BUCKETS; i++)
+	{
+		seen += h->buckets[i];
+
+		if (seen >= target)
+		{
+			uint64_t value = bucketValue(i);
+			return value > h->max ? h->max : value < h->min ? h->min : value;
+		}
+	}
+
+	return h->max;
+}
+
+/****************************************************************************
+* perfEnd
+*
+* Prints the summary of the run and appends it to PERF_JSON_FILE
+****************************************************************************/
+void perfEnd(void)
+{
+	static const double fractions[] = { 0.5, 0.9, 0.99, 0.999 };
+	static const char * labels[] = { "p50", "p90", "p99", "p999" };
+	HISTOGRAM * merged;
+	double elapsed;
+	FILE * json = NULL;
+	int32_t stage, first = 1;
+	uint32_t k;
+
+	if (g_perfMode == PERF_OFF)
+	{
+		return;
+	}
+
+	merged = (HISTOGRAM *) malloc(sizeof(HISTOGRAM));
+
+	if (merged == NULL)
+	{
+		return;
+	}
+
+	elapsed = (double)(perfNow() - runStart) * 1e-9;
+
+	printf("\nLatency of %s (us), %.3f s", runName, elapsed);
+
+	if (runSamples > 0 && elapsed > 0)
+	{
+		printf(", %.0f samples/s per channel", (double) runSamples / elapsed);
+	}
+
+	printf("\n%-18s %10s %10s %10s %10s %10s %10s %10s\n", "stage", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+	if (g_perfMode == PERF_SUMMARY_JSON)
+	{
+		json = fopen(PERF_JSON_FILE, "a");
+
+		if (json != NULL)
+		{
+			fprintf(json, "{\"run\":\"%s\",\"elapsedNs\":%.0f,\"samples\":%llu,\"stages\":{", runName, elapsed * 1e9, (unsigned long long) runSamples);
+		}
+	}
+
+	for (stage = 0; stage < PERF_STAGES; stage++)
+	{
+		mergeStage(stage, merged);
+
+		if (merged->count == 0)
+		{
+			continue;
+		}
+
+		printf("%-18s %10llu %10.1f", stageNames[stage], (unsigned long long) merged->count, (double) merged->sum / (double) merged->count * 1e-3);
+
+		for (k = 0; k < 4; k++)
+		{
+			printf(" %10.1f", (double) percentile(merged, fractions[k]) * 1e-3);
+		}
+
+		printf(" %10.1f\n", (double) merged->max * 1e-3);
+
+		if (json != NULL)
+		{
+			fprintf(json, "%s\"%s\":{\"count\":%llu,\"min\":%llu,\"mean\":%.0f", first ? "" : ",", stageNames[stage],
+					(unsigned long long) merged->count, (unsigned long long) merged->min, (double) merged->sum / (double) merged->count);
+
+			for (k = 0; k < 4; k++)
+			{
+				fprintf(json, ",\"%s\":%llu", labels[k], (unsigned long long) percentile(merged, fractions[k]));
+			}
+
+			fprintf(json, ",\"max\":%llu}", (unsigned long long) merged->max);
+			first = 0;
+		}
+	}
+
+	if (json != NULL)
+	{
+		fprintf(json, "}}\n");
+		fclose(json);
+		printf("Appended to %s\n", PERF_JSON_FILE);
+	}
+
+	free(merged);
+}
+
+const char * perfModeName(PERF_MODE mode)
+{
+	switch (mode)
+	{
+		case PERF_SUMMARY:
+			return "Summary";
+		case PERF_SUMMARY_JSON:
+			return "Summary and JSON";
+		default:
+			return "Off";
+	}
+}
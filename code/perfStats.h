@@ -0,0 +1,79 @@
+/*******************************************************************************
+ *
+ * Filename: perfStats.h
+ *
+ * Description:
+ *   Latency instrumentation of the acquisition hot paths.
+ *
+ *   Each stage has a log-linear histogram (HDR style, 32 sub-buckets per
+ *   power of two, so values are kept within about 3 %) of the time it takes,
+ *   in ns from the monotonic clock. Every thread records into its own set of
+ *   histograms, so recording takes no lock and costs a clock read and a few
+ *   adds; the per-thread sets are merged when a run is summarised.
+ *
+ *   perfBegin() starts a run, perfEnd() prints the percentiles of every stage
+ *   that was hit and, if enabled, appends them as one JSON line to
+ *   PERF_JSON_FILE.
+ *
+ ******************************************************************************/
+
+#ifndef PERF_STATS_H
+#define PERF_STATS_H
+
+#include <stdint.h>
+
+#define PERF_JSON_FILE	"perf.jsonl"
+
+typedef enum
+{
+	PERF_STREAM_POLL,			// ps5000aGetStreamingLatestValues call
+	PERF_STREAM_INTERVAL,		// time between two streaming callbacks
+	PERF_STREAM_COPY,			// copy from driver to application buffers
+	PERF_STREAM_CONVERT,		// conversion and formatting of the text output
+	PERF_STREAM_WRITE,			// encoding and writing of the waveform file
+	PERF_BLOCK_ARM,				// ps5000aRunBlock call
+	PERF_BLOCK_READY,			// ps5000aRunBlock to callBackBlock
+	PERF_BLOCK_READOUT,			// ps5000aGetValuesBulk and trigger time stamps
+	PERF_BLOCK_CONVERT,			// text and binary records of one capture
+	PERF_BLOCK_WRITE,			// writing of one capture
+	PERF_STAGES
+} PERF_STAGE;
+
+typedef enum
+{
+	PERF_OFF,
+	PERF_SUMMARY,
+	PERF_SUMMARY_JSON
+} PERF_MODE;
+
+extern PERF_MODE g_perfMode;
+
+/* Monotonic clock in ns */
+uint64_t perfNow(void);
+
+void perfRecord(PERF_STAGE stage, uint64_t ns);
+
+/* Records the time since 'start' and returns the current time, for chaining */
+static inline uint64_t perfSince(PERF_STAGE stage, uint64_t start)
+{
+	uint64_t now;
+
+	if (g_perfMode == PERF_OFF)
+	{
+		return 0;
+	}
+
+	now = perfNow();
+	perfRecord(stage, now - start);
+	return now;
+}
+
+/* Counts samples per channel acquired in the run, for the throughput */
+void perfAddSamples(uint64_t samples);
+
+void perfBegin(const char * run);
+void perfEnd(void);
+
+const char * perfModeName(PERF_MODE mode);
+
+#endif
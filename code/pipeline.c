@@ -0,0 +1,856 @@
+/*******************************************************************************
+ *
+ * Filename: pipeline.c
+ *
+ * Description:
+ *   Staged pipeline, see pipeline.h.
+ *
+ *   Queues are bounded multi-producer multi-consumer rings in which every
+ *   cell carries a sequence number, so a push or a pop is one compare and
+ *   swap when it does not have to wait. A thread that has to wait (empty or
+ *   full queue, empty pool) sleeps on a condition variable, which the other
+ *   side only signals when it sees a sleeper, so the fast path takes no lock.
+ *
+ *   Without POSIX threads (Windows builds) the stages run one after the
+ *   other inside pipeSubmit().
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "atomics.h"
+
+#ifndef _WIN32
+#define PIPE_THREADS 1
+#include <pthread.h>
+#endif
+
+#define CACHE_LINE		64
+
+typedef struct
+{
+	uint64_t		sequence;
+	PIPE_BLOCK *	block;
+} CELL;
+
+#ifdef PIPE_THREADS
+typedef struct
+{
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	int32_t			sleepers;
+} WAITER;
+#endif
+
+typedef struct
+{
+	CELL *			cells;
+	uint64_t		mask;
+	uint8_t			pad0[CACHE_LINE];
+	uint64_t		head;				// next cell to push
+	uint8_t			pad1[CACHE_LINE];
+	uint64_t		tail;				// next cell to pop
+	uint8_t			pad2[CACHE_LINE];
+	int32_t			closed;
+	uint64_t		highWater;
+#ifdef PIPE_THREADS
+	WAITER			notEmpty;
+	WAITER			notFull;
+#endif
+} QUEUE;
+
+typedef struct
+{
+	PIPELINE *		pipe;
+	int32_t			index;
+	char			name[24];
+	PIPE_PROCESS	process;
+	void *			context;
+	uint32_t		workers;
+	uint32_t		depth;
+	PIPE_POLICY		policy;
+	uint32_t		prescale;
+	uint32_t		flags;
+	QUEUE			input;
+#ifdef PIPE_THREADS
+	pthread_t		threads[PIPE_MAX_WORKERS];
+#endif
+	int32_t			running;
+	uint64_t		blocks;
+	uint64_t		dropped;
+	uint64_t		busyNs;
+	uint64_t		offered;
+	// Reordering, PIPE_ORDERED stages only: blocks held until their turn
+	PIPE_BLOCK **	held;
+	uint32_t		pending;
+	uint64_t		nextSequence;
+} STAGE;
+
+struct tPipeline
+{
+	char			name[24];
+	size_t			userSize;
+	int32_t			stageCount;
+	STAGE			stages[PIPE_MAX_STAGES];
+	QUEUE			pool;
+	PIPE_BLOCK *	blocks;
+	uint8_t *		users;
+	uint32_t		blockCount;
+	uint64_t		nextSequence;
+	uint64_t		startNs;
+	uint64_t		elapsedNs;
+	int32_t			started;
+};
+
+static uint64_t monotonicNs(void)
+{
+#ifdef _WIN32
+	return (uint64_t) clock() * (1000000000ULL / CLOCKS_PER_SEC);
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+#endif
+}
+
+/****************************************************************************
+* Queue
+****************************************************************************/
+static int32_t queueInit(QUEUE * queue, uint32_t depth)
+{
+	uint64_t size = 2, i;
+
+	memset(queue, 0, sizeof(QUEUE));
+
+	while (size < depth)
+	{
+		size <<= 1;
+	}
+
+	queue->cells = (CELL *) calloc((size_t) size, sizeof(CELL));
+
+	if (queue->cells == NULL)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < size; i++)
+	{
+		queue->cells[i].sequence = i;
+	}
+
+	queue->mask = size - 1;
+
+#ifdef PIPE_THREADS
+	pthread_mutex_init(&queue->notEmpty.lock, NULL);
+	pthread_cond_init(&queue->notEmpty.cond, NULL);
+	pthread_mutex_init(&queue->notFull.lock, NULL);
+	pthread_cond_init(&queue->notFull.cond, NULL);
+#endif
+	return 0;
+}
+
+static void queueFree(QUEUE * queue)
+{
+	if (queue->cells == NULL)
+	{
+		return;
+	}
+
+	free(queue->cells);
+	queue->cells = NULL;
+
+#ifdef PIPE_THREADS
+	pthread_mutex_destroy(&queue->notEmpty.lock);
+	pthread_cond_destroy(&queue->notEmpty.cond);
+	pthread_mutex_destroy(&queue->notFull.lock);
+	pthread_cond_destroy(&queue->notFull.cond);
+#endif
+}
+
+static int32_t tryPush(QUEUE * queue, PIPE_BLOCK * block)
+{
+	uint64_t position = atomicLoadRelaxed64(&queue->head);
+	uint64_t fill;
+	CELL * cell;
+
+	for (;;)
+	{
+		int64_t difference;
+
+		cell = &queue->cells[position & queue->mask];
+		difference = (int64_t)(atomicLoad64(&cell->sequence) - position);
+
+		if (difference == 0)
+		{
+			if (atomicCompareExchange64(&queue->head, &position, position + 1))
+			{
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			return 0;
+		}
+		else
+		{
+			position = atomicLoadRelaxed64(&queue->head);
+		}
+	}
+
+	cell->block = block;
+	atomicStore64(&cell->sequence, position + 1);
+
+	fill = position + 1 - atomicLoadRelaxed64(&queue->tail);
+
+	if (fill > atomicLoadRelaxed64(&queue->highWater))
+	{
+		atomicStoreRelaxed64(&queue->highWater, fill);
+	}
+
+	return 1;
+}
+
+static PIPE_BLOCK * tryPop(QUEUE * queue)
+{
+	uint64_t position = atomicLoadRelaxed64(&queue->tail);
+	PIPE_BLOCK * block;
+	CELL * cell;
+
+	for (;;)
+	{
+		int64_t difference;
+
+		cell = &queue->cells[position & queue->mask];
+		difference = (int64_t)(atomicLoad64(&cell->sequence) - (position + 1));
+
+		if (difference == 0)
+		{
+			if (atomicCompareExchange64(&queue->tail, &position, position + 1))
+			{
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			return NULL;
+		}
+		else
+		{
+			position = atomicLoadRelaxed64(&queue->tail);
+		}
+	}
+
+	block = cell->block;
+	atomicStore64(&cell->sequence, position + queue->mask + 1);
+	return block;
+}
+
+static uint64_t queueFill(QUEUE * queue)
+{
+	return atomicLoadRelaxed64(&queue->head) - atomicLoadRelaxed64(&queue->tail);
+}
+
+#ifdef PIPE_THREADS
+static void wake(WAITER * waiter)
+{
+	atomicFence();
+
+	if (atomicLoad32(&waiter->sleepers) > 0)
+	{
+		pthread_mutex_lock(&waiter->lock);
+		pthread_cond_broadcast(&waiter->cond);
+		pthread_mutex_unlock(&waiter->lock);
+	}
+}
+
+/* Sleeps until woken, or 10 ms as a safety net, unless 'ready' says there is no need */
+static void sleepUntil(WAITER * waiter, int32_t (*ready)(QUEUE *), QUEUE * queue)
+{
+	struct timespec until;
+
+	pthread_mutex_lock(&waiter->lock);
+	atomicAdd32(&waiter->sleepers, 1);
+	atomicFence();
+
+	if (!ready(queue))
+	{
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += 10000000;
+
+		if (until.tv_nsec >= 1000000000)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_timedwait(&waiter->cond, &waiter->lock, &until);
+	}
+
+	atomicAdd32(&waiter->sleepers, -1);
+	pthread_mutex_unlock(&waiter->lock);
+}
+
+static int32_t canPop(QUEUE * queue)
+{
+	return queueFill(queue) > 0 || atomicLoad32(&queue->closed);
+}
+
+static int32_t canPush(QUEUE * queue)
+{
+	return queueFill(queue) <= queue->mask;
+}
+#endif
+
+static void push(QUEUE * queue, PIPE_BLOCK * block)
+{
+	while (!tryPush(queue, block))
+	{
+#ifdef PIPE_THREADS
+		sleepUntil(&queue->notFull, canPush, queue);
+#endif
+	}
+
+#ifdef PIPE_THREADS
+	wake(&queue->notEmpty);
+#endif
+}
+
+/* Returns NULL once the queue is closed and empty */
+static PIPE_BLOCK * pop(QUEUE * queue)
+{
+	PIPE_BLOCK * block;
+
+	for (;;)
+	{
+		if ((block = tryPop(queue)) != NULL)
+		{
+#ifdef PIPE_THREADS
+			wake(&queue->notFull);
+#endif
+			return block;
+		}
+
+		if (atomicLoad32(&queue->closed) && queueFill(queue) == 0)
+		{
+			return NULL;
+		}
+
+#ifdef PIPE_THREADS
+		sleepUntil(&queue->notEmpty, canPop, queue);
+#endif
+	}
+}
+
+static void queueClose(QUEUE * queue)
+{
+	atomicStore32(&queue->closed, 1);
+#ifdef PIPE_THREADS
+	wake(&queue->notEmpty);
+#endif
+}
+
+/****************************************************************************
+* Stages
+****************************************************************************/
+void pipeRelease(PIPELINE * pipe, PIPE_BLOCK * block)
+{
+	atomicStore32(&block->stage, -1);
+	push(&pipe->pool, block);
+}
+
+/* Queues a block for a stage according to the stage's policy */
+static void offer(PIPELINE * pipe, STAGE * stage, PIPE_BLOCK * block)
+{
+	PIPE_BLOCK * victim;
+
+	atomicStore32(&block->stage, stage->index);
+
+	switch (stage->policy)
+	{
+		case PIPE_POLICY_DROP_OLDEST:
+			while (!tryPush(&stage->input, block))
+			{
+				if ((victim = tryPop(&stage->input)) != NULL)
+				{
+					pipeRelease(pipe, victim);
+					atomicFetchAdd64(&stage->dropped, 1);
+				}
+			}
+
+#ifdef PIPE_THREADS
+			wake(&stage->input.notEmpty);
+#endif
+			return;
+
+		case PIPE_POLICY_PRESCALE:
+			if (queueFill(&stage->input) * 2 > stage->input.mask &&
+				atomicFetchAdd64(&stage->offered, 1) % stage->prescale != 0)
+			{
+				pipeRelease(pipe, block);
+				atomicFetchAdd64(&stage->dropped, 1);
+				return;
+			}
+
+			push(&stage->input, block);
+			return;
+
+		default:
+			push(&stage->input, block);
+			return;
+	}
+}
+
+static void run(PIPELINE * pipe, STAGE * stage, PIPE_BLOCK * block)
+{
+	uint64_t start = monotonicNs();
+	PIPE_RESULT result = stage->process(block, stage->context);
+
+	atomicFetchAdd64(&stage->busyNs, monotonicNs() - start);
+	atomicFetchAdd64(&stage->blocks, 1);
+
+	if (result == PIPE_FORWARD && stage->index + 1 < pipe->stageCount)
+	{
+		offer(pipe, &pipe->stages[stage->index + 1], block);
+	}
+	else
+	{
+		pipeRelease(pipe, block);
+	}
+}
+
+/* Runs the held blocks that are next in order */
+static void drain(PIPELINE * pipe, STAGE * stage)
+{
+	uint32_t i = 0;
+
+	while (i < stage->pending)
+	{
+		PIPE_BLOCK * block = stage->held[i];
+
+		if (block->sequence != stage->nextSequence)
+		{
+			i++;
+			continue;
+		}
+
+		stage->held[i] = stage->held[--stage->pending];
+		stage->nextSequence++;
+		run(pipe, stage, block);
+		i = 0;
+	}
+}
+
+/*
+ * Moves past the sequence numbers that will never arrive because they were
+ * dropped or discarded upstream: the next one to wait for is the oldest block
+ * still on its way to this stage. Returns 0 when there was nothing to skip.
+ */
+static int32_t skipDropped(PIPELINE * pipe, STAGE * stage)
+{
+	uint64_t oldest = UINT64_MAX;
+	uint32_t i;
+
+	for (i = 0; i < pipe->blockCount; i++)
+	{
+		int32_t where = atomicLoad32(&pipe->blocks[i].stage);
+		uint64_t sequence = atomicLoadRelaxed64(&pipe->blocks[i].sequence);
+
+		if (where >= 0 && where <= stage->index && sequence >= stage->nextSequence && sequence < oldest)
+		{
+			oldest = sequence;
+		}
+	}
+
+	if (oldest == UINT64_MAX || oldest == stage->nextSequence)
+	{
+		return 0;
+	}
+
+	stage->nextSequence = oldest;
+	drain(pipe, stage);
+	return 1;
+}
+
+static void receiveOrdered(PIPELINE * pipe, STAGE * stage, PIPE_BLOCK * block)
+{
+	stage->held[stage->pending++] = block;
+	drain(pipe, stage);
+
+	while (stage->pending > 0 && skipDropped(pipe, stage))
+	{
+	}
+}
+
+#ifdef PIPE_THREADS
+static void * worker(void * arg)
+{
+	STAGE * stage = (STAGE *) arg;
+	PIPELINE * pipe = stage->pipe;
+	PIPE_BLOCK * block;
+
+	while ((block = pop(&stage->input)) != NULL)
+	{
+		if (stage->flags & PIPE_ORDERED)
+		{
+			receiveOrdered(pipe, stage, block);
+		}
+		else
+		{
+			run(pipe, stage, block);
+		}
+	}
+
+	// Everything upstream has finished, only the held blocks are left
+	while (stage->pending > 0 && skipDropped(pipe, stage))
+	{
+	}
+
+	// The last worker out closes the next stage
+	if (atomicAdd32(&stage->running, -1) == 0 && stage->index + 1 < pipe->stageCount)
+	{
+		queueClose(&pipe->stages[stage->index + 1].input);
+	}
+
+	return NULL;
+}
+#endif
+
+/****************************************************************************
+* Pipeline
+****************************************************************************/
+PIPELINE * pipeCreate(const char * name, size_t userSize)
+{
+	PIPELINE * pipe = (PIPELINE *) calloc(1, sizeof(PIPELINE));
+
+	if (pipe != NULL)
+	{
+		snprintf(pipe->name, sizeof(pipe->name), "%s", name);
+		pipe->userSize = userSize;
+	}
+
+	return pipe;
+}
+
+int32_t pipeAddStage(PIPELINE * pipe, const char * name, PIPE_PROCESS process, void * context,
+						uint32_t workers, uint32_t depth, PIPE_POLICY policy, uint32_t prescale, uint32_t flags)
+{
+	STAGE * stage;
+
+	if (pipe == NULL || pipe->started || pipe->stageCount == PIPE_MAX_STAGES)
+	{
+		return -1;
+	}
+
+	stage = &pipe->stages[pipe->stageCount];
+	memset(stage, 0, sizeof(STAGE));
+	stage->pipe = pipe;
+	stage->index = pipe->stageCount;
+	snprintf(stage->name, sizeof(stage->name), "%s", name);
+	stage->process = process;
+	stage->context = context;
+	stage->workers = (flags & PIPE_ORDERED) || workers < 1 ? 1 : workers > PIPE_MAX_WORKERS ? PIPE_MAX_WORKERS : workers;
+	stage->depth = depth < 2 ? 2 : depth;
+	stage->policy = policy;
+	stage->prescale = prescale < 2 ? 2 : prescale;
+	stage->flags = flags;
+
+	if (queueInit(&stage->input, stage->depth) != 0)
+	{
+		return -1;
+	}
+
+	pipe->stageCount++;
+	return 0;
+}
+
+int32_t pipeStart(PIPELINE * pipe)
+{
+	uint32_t i, j;
+	int32_t s;
+
+	if (pipe == NULL || pipe->started || pipe->stageCount == 0)
+	{
+		return -1;
+	}
+
+	// Enough blocks to fill every queue and keep every worker and the source busy
+	pipe->blockCount = 2;
+
+	for (s = 0; s < pipe->stageCount; s++)
+	{
+		pipe->blockCount += (uint32_t)(pipe->stages[s].input.mask + 1) + pipe->stages[s].workers;
+	}
+
+	pipe->blocks = (PIPE_BLOCK *) calloc(pipe->blockCount, sizeof(PIPE_BLOCK));
+	pipe->users = (uint8_t *) calloc(pipe->blockCount, pipe->userSize > 0 ? pipe->userSize : 1);
+
+	if (pipe->blocks == NULL || pipe->users == NULL || queueInit(&pipe->pool, pipe->blockCount) != 0)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < pipe->blockCount; i++)
+	{
+		pipe->blocks[i].user = pipe->users + i * pipe->userSize;
+		pipe->blocks[i].stage = -1;
+		tryPush(&pipe->pool, &pipe->blocks[i]);
+	}
+
+	for (s = 0; s < pipe->stageCount; s++)
+	{
+		STAGE * stage = &pipe->stages[s];
+
+		if (stage->flags & PIPE_ORDERED)
+		{
+			stage->held = (PIPE_BLOCK **) calloc(pipe->blockCount, sizeof(PIPE_BLOCK *));
+
+			if (stage->held == NULL)
+			{
+				return -1;
+			}
+		}
+	}
+
+	pipe->startNs = monotonicNs();
+	pipe->started = 1;
+
+#ifdef PIPE_THREADS
+	for (s = 0; s < pipe->stageCount; s++)
+	{
+		STAGE * stage = &pipe->stages[s];
+
+		stage->running = (int32_t) stage->workers;
+
+		for (j = 0; j < stage->workers; j++)
+		{
+			if (pthread_create(&stage->threads[j], NULL, worker, stage) != 0)
+			{
+				printf("pipeStart:pthread_create failed for stage %s\n", stage->name);
+				stage->running -= (int32_t)(stage->workers - j);
+				stage->workers = j;
+				break;
+			}
+		}
+	}
+#else
+	(void) j;
+#endif
+
+	return 0;
+}
+
+PIPE_BLOCK * pipeAcquire(PIPELINE * pipe)
+{
+	PIPE_BLOCK * block = pop(&pipe->pool);
+	int32_t i;
+
+	if (block != NULL)
+	{
+		memset(block->user, 0, pipe->userSize);
+
+		for (i = 0; i < PIPE_BUFFERS; i++)
+		{
+			block->buffers[i].length = 0;
+		}
+	}
+
+	return block;
+}
+
+void pipeSubmit(PIPELINE * pipe, PIPE_BLOCK * block)
+{
+	atomicStoreRelaxed64(&block->sequence, pipe->nextSequence++);
+
+#ifdef PIPE_THREADS
+	offer(pipe, &pipe->stages[0], block);
+#else
+	{
+		int32_t s;
+
+		for (s = 0; s < pipe->stageCount; s++)
+		{
+			uint64_t start = monotonicNs();
+			PIPE_RESULT result = pipe->stages[s].process(block, pipe->stages[s].context);
+
+			pipe->stages[s].busyNs += monotonicNs() - start;
+			pipe->stages[s].blocks++;
+
+			if (result == PIPE_DISCARD)
+			{
+				break;
+			}
+		}
+
+		pipeRelease(pipe, block);
+	}
+#endif
+}
+
+void pipeFinish(PIPELINE * pipe)
+{
+	int32_t s;
+	uint32_t j;
+
+	if (pipe == NULL || !pipe->started)
+	{
+		return;
+	}
+
+	queueClose(&pipe->stages[0].input);
+
+#ifdef PIPE_THREADS
+	for (s = 0; s < pipe->stageCount; s++)
+	{
+		for (j = 0; j < pipe->stages[s].workers; j++)
+		{
+			pthread_join(pipe->stages[s].threads[j], NULL);
+		}
+	}
+#else
+	(void) s;
+	(void) j;
+#endif
+
+	pipe->elapsedNs = monotonicNs() - pipe->startNs;
+	pipe->started = 0;
+}
+
+void pipeReport(PIPELINE * pipe)
+{
+	double elapsed;
+	int32_t s;
+
+	if (pipe == NULL || pipe->blocks == NULL)
+	{
+		return;
+	}
+
+	elapsed = (double)(pipe->elapsedNs ? pipe->elapsedNs : monotonicNs() - pipe->startNs);
+
+	printf("\nPipeline %s, %u blocks, %.3f s\n", pipe->name, pipe->blockCount, elapsed * 1e-9);
+	printf("%-12s %7s %-11s %10s %10s %9s %7s\n", "stage", "workers", "policy", "blocks", "dropped", "queue max", "busy %");
+
+	for (s = 0; s < pipe->stageCount; s++)
+	{
+		STAGE * stage = &pipe->stages[s];
+
+		printf("%-12s %7u %-11s %10llu %10llu %5llu/%-3llu %7.1f\n", stage->name, stage->workers, pipePolicyName(stage->policy),
+				(unsigned long long) stage->blocks, (unsigned long long) stage->dropped,
+				(unsigned long long) stage->input.highWater, (unsigned long long)(stage->input.mask + 1),
+				elapsed > 0 ? 100.0 * (double) stage->busyNs / (elapsed * stage->workers) : 0.0);
+	}
+}
+
+void pipeDestroy(PIPELINE * pipe)
+{
+	uint32_t i;
+	int32_t s, b;
+
+	if (pipe == NULL)
+	{
+		return;
+	}
+
+	pipeFinish(pipe);
+
+	for (s = 0; s < pipe->stageCount; s++)
+	{
+		queueFree(&pipe->stages[s].input);
+		free(pipe->stages[s].held);
+	}
+
+	for (i = 0; pipe->blocks != NULL && i < pipe->blockCount; i++)
+	{
+		for (b = 0; b < PIPE_BUFFERS; b++)
+		{
+			free(pipe->blocks[i].buffers[b].data);
+		}
+	}
+
+	queueFree(&pipe->pool);
+	free(pipe->blocks);
+	free(pipe->users);
+	free(pipe);
+}
+
+/****************************************************************************
+* Block buffers
+****************************************************************************/
+uint8_t * pipeReserve(PIPE_BUFFER * buffer, size_t bytes)
+{
+	if (buffer->length + bytes > buffer->capacity)
+	{
+		size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+		uint8_t * data;
+
+		while (capacity < buffer->length + bytes)
+		{
+			capacity *= 2;
+		}
+
+		if ((data = (uint8_t *) realloc(buffer->data, capacity)) == NULL)
+		{
+			return NULL;
+		}
+
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+
+	return buffer->data + buffer->length;
+}
+
+int32_t pipePrintf(PIPE_BUFFER * buffer, const char * format, ...)
+{
+	va_list args;
+	int32_t length;
+	size_t space = buffer->capacity - buffer->length;
+
+	va_start(args, format);
+	length = vsnprintf(buffer->data ? (char *)(buffer->data + buffer->length) : NULL, space, format, args);
+	va_end(args);
+
+	if (length < 0)
+	{
+		return -1;
+	}
+
+	if ((size_t) length >= space)
+	{
+		if (pipeReserve(buffer, (size_t) length + 1) == NULL)
+		{
+			return -1;
+		}
+
+		va_start(args, format);
+		vsnprintf((char *)(buffer->data + buffer->length), (size_t) length + 1, format, args);
+		va_end(args);
+	}
+
+	buffer->length += (size_t) length;
+	return length;
+}
+
+const char * pipePolicyName(PIPE_POLICY policy)
+{
+	switch (policy)
+	{
+		case PIPE_POLICY_DROP_OLDEST:
+			return "drop oldest";
+		case PIPE_POLICY_PRESCALE:
+			return "prescale";
+		default:
+			return "block";
+	}
+}
@@ -0,0 +1,103 @@
+/*******************************************************************************
+ *
+ * Filename: pipeline.h
+ *
+ * Description:
+ *   Staged processing pipeline.
+ *
+ *   A pipeline is a chain of stages, each run by one or more worker threads
+ *   and fed by a bounded lock-free queue. Work travels in blocks taken from a
+ *   pool owned by the pipeline: the source (the acquisition thread) takes a
+ *   free block with pipeAcquire(), fills it and hands it over with
+ *   pipeSubmit(); each stage processes it and passes it on; after the last
+ *   stage the block goes back to the pool.
+ *
+ *   Each queue has a policy for when it is full:
+ *
+ *	 PIPE_POLICY_BLOCK			the producer waits (backpressure up to the
+ *								source, which waits in pipeAcquire() once
+ *								every block is used)
+ *	 PIPE_POLICY_DROP_OLDEST	the oldest queued block is dropped to make room
+ *	 PIPE_POLICY_PRESCALE		once the queue is half full only one block in
+ *								'prescale' is queued, the others are dropped
+ *
+ *   A stage with several workers processes blocks out of order; a stage
+ *   created with PIPE_ORDERED (one worker) gets them back in submission
+ *   order, skipping the ones dropped upstream.
+ *
+ *   Every stage counts its blocks, drops, queue high-water mark and the time
+ *   its workers were busy, printed by pipeReport().
+ *
+ ******************************************************************************/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PIPE_MAX_STAGES		8
+#define PIPE_MAX_WORKERS	8
+#define PIPE_BUFFERS		4
+
+typedef enum
+{
+	PIPE_POLICY_BLOCK,
+	PIPE_POLICY_DROP_OLDEST,
+	PIPE_POLICY_PRESCALE
+} PIPE_POLICY;
+
+typedef enum
+{
+	PIPE_FORWARD,			// pass the block to the next stage
+	PIPE_DISCARD			// give the block back to the pool
+} PIPE_RESULT;
+
+#define PIPE_ORDERED		1
+
+/* Growable byte buffer owned by a block, kept across uses */
+typedef struct
+{
+	uint8_t *	data;
+	size_t		length;
+	size_t		capacity;
+} PIPE_BUFFER;
+
+typedef struct
+{
+	uint64_t	sequence;
+	int32_t		stage;						// stage it was last queued for, -1 in the pool
+	void *		user;						// userSize bytes, zeroed by pipeAcquire()
+	PIPE_BUFFER	buffers[PIPE_BUFFERS];		// emptied (not freed) by pipeAcquire()
+} PIPE_BLOCK;
+
+typedef struct tPipeline PIPELINE;
+
+typedef PIPE_RESULT (*PIPE_PROCESS)(PIPE_BLOCK * block, void * context);
+
+PIPELINE * pipeCreate(const char * name, size_t userSize);
+
+/* Appends a stage. depth is the size of its input queue (rounded up to a power of two). */
+int32_t pipeAddStage(PIPELINE * pipe, const char * name, PIPE_PROCESS process, void * context,
+						uint32_t workers, uint32_t depth, PIPE_POLICY policy, uint32_t prescale, uint32_t flags);
+
+/* Allocates the block pool and starts the workers */
+int32_t pipeStart(PIPELINE * pipe);
+
+/* Source side, one thread */
+PIPE_BLOCK * pipeAcquire(PIPELINE * pipe);
+void pipeSubmit(PIPELINE * pipe, PIPE_BLOCK * block);
+void pipeRelease(PIPELINE * pipe, PIPE_BLOCK * block);
+
+/* Lets every submitted block through, stops the workers */
+void pipeFinish(PIPELINE * pipe);
+void pipeReport(PIPELINE * pipe);
+void pipeDestroy(PIPELINE * pipe);
+
+/* Makes room for 'bytes' more bytes, returns the end of the data or NULL */
+uint8_t * pipeReserve(PIPE_BUFFER * buffer, size_t bytes);
+int32_t pipePrintf(PIPE_BUFFER * buffer, const char * format, ...);
+
+const char * pipePolicyName(PIPE_POLICY policy);
+
+#endif
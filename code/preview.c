@@ -0,0 +1,312 @@
+/*******************************************************************************
+ *
+ * Filename: preview.c
+ *
+ * Description:
+ *   Live preview, see preview.h.
+ *
+ *   The producer fills a private frame, then copies it into the back slot of
+ *   the double buffer under that slot's sequence counter (odd while it is
+ *   written) and makes it the front slot. The refresh thread copies the front
+ *   slot and retries if its sequence changed during the copy, so neither side
+ *   ever waits for the other.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "preview.h"
+
+typedef struct
+{
+	uint16_t	channels;
+	int16_t		min[PREVIEW_CHANNELS][PREVIEW_COLUMNS];
+	int16_t		max[PREVIEW_CHANNELS][PREVIEW_COLUMNS];
+	char		status[96];
+} FRAME;
+
+typedef struct
+{
+	uint32_t	sequence;
+	FRAME		frame;
+} SLOT;
+
+#ifndef _WIN32
+
+#include <pthread.h>
+#include <time.h>
+
+typedef struct
+{
+	SLOT		slots[2];
+	uint32_t	front;
+	uint32_t	published;
+	FRAME		staging;
+	int			running;
+	pthread_t	thread;
+	char		title[64];
+	uint16_t	channelMask;
+	int16_t		maxAdc;
+	int32_t		rangeMv[PREVIEW_CHANNELS];
+	int32_t		lines;
+} PREVIEW;
+
+static PREVIEW preview;
+
+/* Copies the front slot, returns 0 if nothing was published yet */
+static int32_t readFrame(FRAME * frame)
+{
+	uint32_t front, before, after;
+
+	do
+	{
+		front = __atomic_load_n(&preview.front, __ATOMIC_ACQUIRE);
+		before = __atomic_load_n(&preview.slots[front].sequence, __ATOMIC_ACQUIRE);
+
+		if (before & 1)
+		{
+			continue;
+		}
+
+		memcpy(frame, &preview.slots[front].frame, sizeof(FRAME));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&preview.slots[front].sequence, __ATOMIC_RELAXED);
+	} while ((before & 1) || before != after);
+
+	return __atomic_load_n(&preview.published, __ATOMIC_RELAXED) != 0;
+}
+
+static void draw(const FRAME * frame)
+{
+	char text[(PREVIEW_COLUMNS + 32) * (PREVIEW_ROWS * PREVIEW_CHANNELS + 4)];
+	char * p = text;
+	int32_t channel, row, column, lines = 0;
+
+	// Back to the top of the previous frame
+	if (preview.lines > 0)
+	{
+		p += sprintf(p, "\033[%dF", preview.lines);
+	}
+
+	p += sprintf(p, "\033[K%s  %s\n", preview.title, frame->status);
+	lines++;
+
+	for (channel = 0; channel < PREVIEW_CHANNELS; channel++)
+	{
+		if (!(preview.channelMask & (1 << channel)))
+		{
+			continue;
+		}
+
+		for (row = 0; row < PREVIEW_ROWS; row++)
+		{
+			// Band of ADC counts covered by this row, top row first
+			int32_t high = preview.maxAdc - (int32_t)(2 * (int64_t) preview.maxAdc * row / PREVIEW_ROWS);
+			int32_t low = preview.maxAdc - (int32_t)(2 * (int64_t) preview.maxAdc * (row + 1) / PREVIEW_ROWS);
+
+			if (row == 0)
+			{
+				p += sprintf(p, "\033[K%c %+6d mV |", 'A' + channel, preview.rangeMv[channel]);
+			}
+			else if (row == PREVIEW_ROWS - 1)
+			{
+				p += sprintf(p, "\033[K  %+6d mV |", -preview.rangeMv[channel]);
+			}
+			else
+			{
+				p += sprintf(p, "\033[K            |");
+			}
+
+			for (column = 0; column < PREVIEW_COLUMNS; column++)
+			{
+				if (!(frame->channels & (1 << channel)))
+				{
+					*p++ = ' ';
+				}
+				else if (frame->max[channel][column] >= low && frame->min[channel][column] <= high)
+				{
+					*p++ = '#';
+				}
+				else
+				{
+					*p++ = (low <= 0 && high > 0) ? '-' : ' ';
+				}
+			}
+
+			*p++ = '|';
+			*p++ = '\n';
+			lines++;
+		}
+	}
+
+	fwrite(text, 1, (size_t)(p - text), stdout);
+	fflush(stdout);
+	preview.lines = lines;
+}
+
+static void * refreshThread(void * arg)
+{
+	struct timespec period = { 0, 1000000000L / PREVIEW_RATE_HZ };
+	uint32_t drawn = 0, published;
+	FRAME frame;
+
+	(void) arg;
+
+	while (__atomic_load_n(&preview.running, __ATOMIC_ACQUIRE))
+	{
+		published = __atomic_load_n(&preview.published, __ATOMIC_RELAXED);
+
+		if (published != drawn && readFrame(&frame))
+		{
+			draw(&frame);
+			drawn = published;
+		}
+
+		nanosleep(&period, NULL);
+	}
+
+	return NULL;
+}
+
+int32_t previewStart(const char * title, uint16_t channelMask, int16_t maxAdc, const int32_t * rangeMv)
+{
+	int32_t i;
+
+	memset(&preview, 0, sizeof(preview));
+	snprintf(preview.title, sizeof(preview.title), "%s", title);
+	preview.channelMask = channelMask;
+	preview.maxAdc = maxAdc > 0 ? maxAdc : 1;
+
+	for (i = 0; i < PREVIEW_CHANNELS; i++)
+	{
+		preview.rangeMv[i] = rangeMv[i];
+	}
+
+	preview.running = 1;
+
+	if (pthread_create(&preview.thread, NULL, refreshThread, NULL) != 0)
+	{
+		preview.running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void previewPush(int32_t channel, const int16_t * max, const int16_t * min, uint32_t n)
+{
+	uint32_t column, i, start, end;
+	int16_t low, high;
+
+	if (!preview.running || channel < 0 || channel >= PREVIEW_CHANNELS || n == 0)
+	{
+		return;
+	}
+
+	min = min != NULL ? min : max;
+
+	for (column = 0; column < PREVIEW_COLUMNS; column++)
+	{
+		start = (uint32_t)((uint64_t) n * column / PREVIEW_COLUMNS);
+		end = (uint32_t)((uint64_t) n * (column + 1) / PREVIEW_COLUMNS);
+		end = end > start ? end : start + 1;
+		low = min[start];
+		high = max[start];
+
+		for (i = start + 1; i < end; i++)
+		{
+			low = min[i] < low ? min[i] : low;
+			high = max[i] > high ? max[i] : high;
+		}
+
+		preview.staging.min[channel][column] = low;
+		preview.staging.max[channel][column] = high;
+	}
+
+	preview.staging.channels |= (uint16_t)(1 << channel);
+}
+
+void previewStatus(const char * format, ...)
+{
+	va_list args;
+
+	if (!preview.running)
+	{
+		return;
+	}
+
+	va_start(args, format);
+	vsnprintf(preview.staging.status, sizeof(preview.staging.status), format, args);
+	va_end(args);
+}
+
+void previewPublish(void)
+{
+	uint32_t back;
+	SLOT * slot;
+
+	if (!preview.running)
+	{
+		return;
+	}
+
+	back = 1 - __atomic_load_n(&preview.front, __ATOMIC_RELAXED);
+	slot = &preview.slots[back];
+
+	__atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&slot->frame, &preview.staging, sizeof(FRAME));
+	__atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&preview.front, back, __ATOMIC_RELEASE);
+	__atomic_store_n(&preview.published, preview.published + 1, __ATOMIC_RELAXED);
+}
+
+void previewStop(void)
+{
+	FRAME frame;
+
+	if (!preview.running)
+	{
+		return;
+	}
+
+	__atomic_store_n(&preview.running, 0, __ATOMIC_RELEASE);
+	pthread_join(preview.thread, NULL);
+
+	if (readFrame(&frame))
+	{
+		draw(&frame);
+	}
+}
+
+#else
+
+int32_t previewStart(const char * title, uint16_t channelMask, int16_t maxAdc, const int32_t * rangeMv)
+{
+	return -1;
+}
+
+void previewPush(int32_t channel, const int16_t * max, const int16_t * min, uint32_t n)
+{
+}
+
+void previewStatus(const char * format, ...)
+{
+}
+
+void previewPublish(void)
+{
+}
+
+void previewStop(void)
+{
+}
+
+#endif
@@ -0,0 +1,40 @@
+/*******************************************************************************
+ *
+ * Filename: preview.h
+ *
+ * Description:
+ *   Decimated live preview of the acquired data.
+ *
+ *   The acquisition code reduces the latest data of each channel to a min/max
+ *   envelope of PREVIEW_COLUMNS columns, adds a status line and publishes the
+ *   frame into a lock-free double buffer. A separate thread redraws the last
+ *   published frame in place on the terminal PREVIEW_RATE_HZ times per second,
+ *   so the console never slows down the acquisition however many callbacks
+ *   or captures arrive. Frames published between two refreshes are skipped.
+ *
+ ******************************************************************************/
+
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stdint.h>
+
+#define PREVIEW_COLUMNS		64
+#define PREVIEW_ROWS		5
+#define PREVIEW_RATE_HZ		10
+#define PREVIEW_CHANNELS	4
+
+/* Starts the refresh thread. channelMask selects the channels drawn, rangeMv[] labels
+ * them and maxAdc is the full scale. Returns -1 if no preview can be shown, in which
+ * case the caller keeps its console output. */
+int32_t previewStart(const char * title, uint16_t channelMask, int16_t maxAdc, const int32_t * rangeMv);
+
+/* Acquisition side, one producer: envelope of n samples (min may be NULL) */
+void previewPush(int32_t channel, const int16_t * max, const int16_t * min, uint32_t n);
+void previewStatus(const char * format, ...);
+void previewPublish(void);
+
+/* Draws the last frame and stops the refresh thread */
+void previewStop(void);
+
+#endif
@@ -58,6 +58,7 @@
  ******************************************************************************/
 
 #include <stdio.h>
+#include <math.h>
 
 /* Headers for Windows */
 #ifdef _WIN32
@@ -137,6 +138,25 @@ return (fp>0)?0:-1;
 #define min(a,b) ((a) < (b) ? a : b)
 #endif
 
+#include "outputWriter.h"
+#include "waveFile.h"
+#include "waveCodec.h"
+#include "perfStats.h"
+#include "metrics.h"
+#include "preview.h"
+#include "realtime.h"
+#include "bufferAlloc.h"
+#include "pipeline.h"
+#include "dsp.h"
+#include "softTrigger.h"
+#include "average.h"
+#include "history.h"
+#include "wavePyramid.h"
+#include "replay.h"
+#include "clockSync.h"
+#include "blockFormat.h"
+#include "atomics.h"
+
 int32_t cycles = 0;
 
 #define BUFFER_SIZE 	2000
@@ -147,6 +167,9 @@ int32_t cycles = 0;
 #define MAX_PICO_DEVICES 64
 #define TIMED_LOOP_STEP 500
 
+// Buffer sets a rapid block run goes through when it does not fit the memory budget
+#define RAPID_BUFFER_SETS	2
+
 typedef struct
 {
 	int16_t DCcoupled;
@@ -190,14 +213,21 @@ typedef struct tPwq
 	PS5000A_PULSE_WIDTH_TYPE type;
 }PWQ;
 
-typedef struct data
+// The trigger last given to setTrigger, kept to set it again after a power source change
+typedef struct
 {
-	int time;
-	int ADC_chA;
-	int mV_chA;
-	int ADC_chB;
-	int mV_chB;
-} data;
+	PS5000A_TRIGGER_CHANNEL_PROPERTIES_V2	properties[PS5000A_MAX_CHANNELS];
+	int16_t									nProperties;
+	PS5000A_CONDITION						conditions[PS5000A_MAX_CHANNELS];
+	int16_t									nConditions;
+	PS5000A_DIRECTION						directions[PS5000A_MAX_CHANNELS];
+	uint16_t								nDirections;
+	PS5000A_CONDITION						pwqConditions[PS5000A_MAX_CHANNELS];
+	PS5000A_DIRECTION						pwqDirections[PS5000A_MAX_CHANNELS];
+	PWQ										pwq;
+	uint32_t								delay;
+	uint64_t								autoTriggerUs;
+} TRIGGER_SETTINGS;
 
 
 typedef struct
@@ -247,6 +277,8 @@ uint32_t		g_startIndex;
 int16_t			g_trig = 0;
 uint32_t		g_trigAt = 0;
 int16_t			g_overflow = 0;
+int16_t			g_copyFailed = FALSE;		// callBackStreaming had no memory for the samples
+TRIGGER_SETTINGS	g_lastTrigger;
 
 int8_t blockFile[20]  = "block.txt";
 
@@ -254,14 +286,161 @@ int8_t binaryFile[20] = "block_binary.txt";
 
 int8_t streamFile[20] = "stream.txt";
 
+WRITER_OPTIONS g_writerOptions = { WRITER_STDIO, 8, 1 << 20, FALSE, FALSE, 0 };
+
+int8_t blockWaveFile[20] = "block_wave.bin";
+
+int8_t streamWaveFile[20] = "stream_wave.bin";
+
+int8_t streamPyramidFile[20] = "stream_wave.pyr";
+
+int8_t blockDspFile[20] = "block_dsp.txt";
+
+int8_t streamDspFile[20] = "stream_dsp.txt";
+
+int8_t streamTriggerFile[20] = "stream_trig.txt";
+
+int8_t streamPreTriggerFile[20] = "stream_pretrig.bin";
+
+int8_t blockTimesFile[20] = "block_times.txt";
+
+WAVE_OUTPUT g_waveOutput = WAVE_OUTPUT_OFF;
+int16_t g_waveAppend = TRUE;
+
+uint64_t g_blockArmNs = 0;
+uint64_t g_lastCallbackNs = 0;
+
+METRICS_MODE g_metricsMode = METRICS_OFF;
+uint32_t g_metricsPeriodMs = 1000;
+
+int16_t g_preview = TRUE;
+
+RT_OPTIONS g_rtOptions = { FALSE, -1, 50, TRUE };
+
+PIPE_POLICY g_pipePolicy = PIPE_POLICY_BLOCK;
+uint32_t g_pipePrescale = 4;
+uint32_t g_pipeDepth = 16;
+uint32_t g_convertWorkers = 1;
+
+// Seconds spent getting streaming going again after a power source change, 0 to stop the run
+uint32_t g_powerRecoverySeconds = 30;
+
+DSP_OPTIONS g_dspOptions = { DSP_OFF, 100, 1000.0, 16, 2, 1000.0, 0.0 };
+
+// Software trigger on the streamed data; thresholds here in mV, rate in mV per span samples
+int16_t g_softTrigger = FALSE;
+TRIG_SETUP g_softTriggerMv = { { { TRIG_ABOVE, 500, -500, 20, 100, 10 } }, TRIG_AND, 0, 0, 0 };
+
+// Min/max/mean pyramid of the streaming waveform file, 'factor' samples per record at each level; 0 for off
+uint32_t g_pyramidFactor = 16;
+
+// Streaming pre-trigger history kept on the host, in samples or in us
+uint32_t g_preTrigger = 0;
+int16_t g_preTriggerTime = FALSE;
+
+// Rapid block averaging: one record per g_averageCaptures captures, 0 for every capture
+uint32_t g_averageCaptures = 0;
+int16_t g_averageDeviation = TRUE;
+
+// block.txt and block_binary.txt hold ADC counts only, with the settings to scale them
+int16_t g_blockRaw = TRUE;
+
+// Completed captures asked for every so many us while a rapid block run acquires, to time the triggers; 0 for off
+uint32_t g_clockSyncUs = 0;
+CLOCK_SYNC * g_clockSync = NULL;
+
+// Host memory for the samples of a rapid block run in MB, 0 for half of what is available; bigger runs are read out in batches
+uint32_t g_rapidBudgetMb = 0;
+
+// Replay of recorded files in place of the device
+int8_t g_replayFile[256] = "stream_wave.bin";
+uint32_t g_replayRun = REPLAY_LAST_RUN;
+uint32_t g_replayCaptureSamples = 2000;
+int16_t g_replayPaced = TRUE;
+REPLAY * g_replay = NULL;
+
 typedef struct tBufferInfo
 {
 	UNIT * unit;
 	int16_t **driverBuffers;
-	int16_t **appBuffers;
+	PIPE_BLOCK * block;
 
 } BUFFER_INFO;
 
+/* Streaming pipeline block: the samples of one callback, max and min of
+ * channel c at buffers[0] + (2 * c) * nSamples and (2 * c + 1) * nSamples */
+typedef struct tStreamBlock
+{
+	int32_t		nSamples;
+	uint32_t	startIndex;
+	int32_t		firstSample;
+	int32_t		poll;
+	int16_t		triggered;
+	uint32_t	triggerAt;
+	int16_t		overflow;
+	int32_t		gap;				// samples lost before this block while streaming was stopped
+	uint64_t	outageNs;			// and how long that took
+} STREAM_BLOCK;
+
+typedef struct tStreamContext
+{
+	UNIT *				unit;
+	OUTPUT_WRITER *		fp;
+	WAVE_FILE *			wave;
+	int16_t				previewing;
+	OUTPUT_WRITER *		dspFile;
+	DSP_CHANNEL *		dsp[PS5000A_MAX_CHANNELS];
+	double				intervalNs;
+	int32_t				nextSample;			// first sample of the next block, a gap resets the filters
+	TRIGGER_ENGINE *	trigger;
+	OUTPUT_WRITER *		triggerFile;
+	int32_t				triggerNext;		// same for the software trigger and history
+	uint64_t			softTriggers;
+	HISTORY *			history[PS5000A_MAX_CHANNELS];
+	WAVE_FILE *			preTriggerWave;
+	uint32_t			preTrigger;			// samples of history written before each trigger
+	uint32_t			preTriggerEvents;
+	WAVE_FILE *			pyramidFile;
+	PYRAMID_BUILDER *	pyramid[PS5000A_MAX_CHANNELS];
+	// Samples of each channel held back for the next chunk of the waveform file
+	int16_t *			pending[PS5000A_MAX_CHANNELS];
+	uint32_t			pendingCapacity;
+	uint32_t			pendingSamples;
+	int16_t				pendingOverflow;
+	WAVE_CHUNK			pendingChunk;
+} STREAM_CONTEXT;
+
+/* Rapid block pipeline block: one capture, read from the capture buffers */
+typedef struct tRapidBlock
+{
+	uint32_t	capture;			// first capture of the record when averaging
+	uint32_t	captures;			// captures averaged into the record, 0 when not averaging
+	int16_t		overflow;			// overflow bits of all of them
+} RAPID_BLOCK;
+
+typedef struct tRapidContext
+{
+	UNIT *					unit;
+	int16_t ***				rapidBuffers;
+	int16_t *				overflow;
+	PS5000A_TRIGGER_INFO *	triggerInfo;
+	uint32_t				nSamples;
+	uint32_t				nCaptures;
+	int32_t					timeIntervalNs;
+	OUTPUT_WRITER *			fp;
+	OUTPUT_WRITER *			fbin;
+	WAVE_FILE *				wave;
+	int16_t					previewing;
+	OUTPUT_WRITER *			dspFile;
+	DSP_CHANNEL *			dsp[PS5000A_MAX_CHANNELS];
+	AVERAGE *				average[PS5000A_MAX_CHANNELS];
+	uint32_t				averageCaptures;
+	int16_t					averageOverflow;
+	uint32_t				records;
+	int16_t					raw;				// counts only, see g_blockRaw
+	int32_t					released;			// captures, in order, whose samples are no longer needed
+} RAPID_CONTEXT;
+
 /****************************************************************************
 * Callback
 * used by ps5000a data block collection calls, on receipt of data.
@@ -271,6 +450,7 @@ void PREF4 callBackBlock( int16_t handle, PICO_STATUS status, void * pParameter)
 {
 	if (status != PICO_CANCELLED)
 	{
+		perfSince(PERF_BLOCK_READY, g_blockArmNs);
 		g_ready = TRUE;
 	}
 }
@@ -291,6 +471,14 @@ void PREF4 callBackStreaming(	int16_t handle,
 {
 	int32_t channel;
 	BUFFER_INFO * bufferInfo = NULL;
+	uint64_t start = perfNow();
+
+	if (g_lastCallbackNs != 0)
+	{
+		perfRecord(PERF_STREAM_INTERVAL, start - g_lastCallbackNs);
+	}
+
+	g_lastCallbackNs = start;
 
 	if (pParameter != NULL)
 	{
@@ -310,31 +498,42 @@ void PREF4 callBackStreaming(	int16_t handle,
 	g_trigAt = triggerAt;
 
 	g_overflow = overflow;
+	g_copyFailed = FALSE;
 
-	if (bufferInfo != NULL && noOfSamples)
+	if (bufferInfo != NULL && noOfSamples && bufferInfo->block != NULL && bufferInfo->driverBuffers)
 	{
+		// Copy out of the driver buffers into the pipeline block before the driver wraps round
+		int16_t * samples = (int16_t *) pipeReserve(&bufferInfo->block->buffers[0],
+								(size_t) bufferInfo->unit->channelCount * 2 * noOfSamples * sizeof(int16_t));
+
+		if (samples == NULL)
+		{
+			g_copyFailed = TRUE;
+			return;
+		}
+
 		for (channel = 0; channel < bufferInfo->unit->channelCount; channel++)
 		{
 			if (bufferInfo->unit->channelSettings[channel].enabled)
 			{
-				if (bufferInfo->appBuffers && bufferInfo->driverBuffers)
+				// Max buffers
+				if (bufferInfo->driverBuffers[channel * 2])
 				{
-					// Max buffers
-					if (bufferInfo->appBuffers[channel * 2]  && bufferInfo->driverBuffers[channel * 2])
-					{
-						memcpy_s (&bufferInfo->appBuffers[channel * 2][startIndex], noOfSamples * sizeof(int16_t),
-							&bufferInfo->driverBuffers[channel * 2][startIndex], noOfSamples * sizeof(int16_t));
-					}
+					memcpy_s (&samples[(size_t)(channel * 2) * noOfSamples], noOfSamples * sizeof(int16_t),
+						&bufferInfo->driverBuffers[channel * 2][startIndex], noOfSamples * sizeof(int16_t));
+				}
 
-					// Min buffers
-					if (bufferInfo->appBuffers[channel * 2 + 1] && bufferInfo->driverBuffers[channel * 2 + 1])
-					{
-						memcpy_s (&bufferInfo->appBuffers[channel * 2 + 1][startIndex], noOfSamples * sizeof(int16_t),
-							&bufferInfo->driverBuffers[channel * 2 + 1][startIndex], noOfSamples * sizeof(int16_t));
-					}
+				// Min buffers
+				if (bufferInfo->driverBuffers[channel * 2 + 1])
+				{
+					memcpy_s (&samples[(size_t)(channel * 2 + 1) * noOfSamples], noOfSamples * sizeof(int16_t),
+						&bufferInfo->driverBuffers[channel * 2 + 1][startIndex], noOfSamples * sizeof(int16_t));
 				}
 			}
 		}
+
+		bufferInfo->block->buffers[0].length = (size_t) bufferInfo->unit->channelCount * 2 * noOfSamples * sizeof(int16_t);
+		perfSince(PERF_STREAM_COPY, start);
 	}
 }
 
@@ -398,1809 +597,4751 @@ int16_t mv_to_adc(int16_t mv, int16_t rangeIndex, UNIT * unit)
 	return (mv * unit->maxADCValue) / inputRanges[rangeIndex];
 }
 
-/****************************************************************************************
-* ChangePowerSource - function to handle switches between +5V supply, and USB only power
-* Only applies to PicoScope 544xA/B units 
-******************************************************************************************/
-PICO_STATUS changePowerSource(int16_t handle, PICO_STATUS status, UNIT * unit)
+/****************************************************************************
+* fillWaveRun
+*
+* Describes the current channel settings in the run chunk of a waveform file
+****************************************************************************/
+void fillWaveRun(UNIT * unit, WAVE_RUN * run, uint32_t samplesPerRecord, uint32_t preTrigger, double sampleIntervalNs)
 {
-	int8_t ch;
+	int16_t ch;
 
-	switch (status)
+	memset(run, 0, sizeof(WAVE_RUN));
+
+	run->resolution = (uint16_t) unit->resolution;
+	run->maxADCValue = unit->maxADCValue;
+	run->samplesPerRecord = samplesPerRecord;
+	run->preTrigger = preTrigger;
+	run->sampleIntervalNs = sampleIntervalNs;
+
+	for (ch = 0; ch < unit->channelCount && ch < WAVE_MAX_CHANNELS; ch++)
 	{
-		case PICO_POWER_SUPPLY_NOT_CONNECTED:		// User must acknowledge they want to power via USB
-			do
-			{
-				printf("\n5 V power supply not connected.");
-				printf("\nDo you want to run using USB only Y/N?\n");
-				ch = toupper(_getch());
-				
-				if(ch == 'Y')
-				{
-					printf("\nPowering the unit via USB\n");
-					status = ps5000aChangePowerSource(handle, PICO_POWER_SUPPLY_NOT_CONNECTED);		// Tell the driver that's ok
-				
-					if(status == PICO_OK && unit->channelCount == QUAD_SCOPE)
-					{
-						unit->channelSettings[PS5000A_CHANNEL_C].enabled = FALSE;
-						unit->channelSettings[PS5000A_CHANNEL_D].enabled = FALSE;
-					}
-					else if (status == PICO_POWER_SUPPLY_UNDERVOLTAGE)
-					{
-						status = changePowerSource(handle, status, unit);
-					}
-					else
-					{
-						// Do nothing
-					}
+		if (unit->channelSettings[ch].enabled)
+		{
+			run->channelMask |= 1 << ch;
+		}
 
-				}
-			}
-			while(ch != 'Y' && ch != 'N');
-			printf(ch == 'N'?"Please use the +5V power supply to power this unit\n":"");
-			break;
+		run->range[ch] = (uint8_t) unit->channelSettings[ch].range;
+		run->analogueOffset[ch] = unit->channelSettings[ch].analogueOffset;
+	}
+}
 
-		case PICO_POWER_SUPPLY_CONNECTED:
-			printf("\nUsing +5 V power supply voltage.\n");
-			status = ps5000aChangePowerSource(handle, PICO_POWER_SUPPLY_CONNECTED);		// Tell the driver we are powered from +5V supply
-			break;
+/****************************************************************************
+* replayClash
+*
+* TRUE if 'path' is the file being replayed, which must not be written while
+* it is read
+****************************************************************************/
+int16_t replayClash(const int8_t * path)
+{
+	if (g_replay != NULL && replaySource(g_replay, (const char *) path))
+	{
+		printf("Not writing %s, it is the file being replayed.\n", path);
+		return TRUE;
+	}
 
-		case PICO_USB3_0_DEVICE_NON_USB3_0_PORT:
-			do
-			{
-				printf("\nUSB 3.0 device on non-USB 3.0 port.");
-				printf("\nDo you wish to continue Y/N?\n");
-				ch = toupper(_getch());
+	return FALSE;
+}
 
-				if (ch == 'Y')
-				{
-					printf("\nSwitching to use USB power from non-USB 3.0 port.\n");
-					status = ps5000aChangePowerSource(handle, PICO_USB3_0_DEVICE_NON_USB3_0_PORT);		// Tell the driver that's ok
+/****************************************************************************
+* closeWaveFile
+*
+* Closes the run of a waveform file and prints what went into it
+****************************************************************************/
+void closeWaveFile(WAVE_FILE * file, const int8_t * path)
+{
+	WAVE_FILE_STATS stats;
 
-					if (status == PICO_POWER_SUPPLY_UNDERVOLTAGE)
-					{
-						status = changePowerSource(handle, status, unit);
-					}
-					else
-					{
-						// Do nothing
-					}
+	if (file == NULL)
+	{
+		return;
+	}
 
-				}
-			} while (ch != 'Y' && ch != 'N');
-			printf(ch == 'N' ? "Please use a USB 3.0 port or press 'Y'.\n" : "");
-			break;
+	waveFileClose(file, &stats);
+	printf("%s: run %u, %llu chunks", path, stats.run, (unsigned long long) stats.chunks);
 
-		case PICO_POWER_SUPPLY_UNDERVOLTAGE:
-			do
-			{
-				printf("\nUSB not supplying required voltage");
-				printf("\nPlease plug in the +5 V power supply\n");
-				printf("\nHit any key to continue, or Esc to exit...\n");
-				ch = _getch();
-				
-				if (ch == 0x1B)	// ESC key
-				{
-					exit(0);
-				}
-				else
-				{
-					status = ps5000aChangePowerSource(handle, PICO_POWER_SUPPLY_CONNECTED);		// Tell the driver that's ok
-				}
-			}
-			while (status == PICO_POWER_SUPPLY_REQUEST_INVALID);
-			break;
+	if (stats.compressed && stats.payloadBytes > 0)
+	{
+		printf(", %llu samples in %llu bytes, compression ratio %.2f", (unsigned long long) stats.samples,
+			(unsigned long long) stats.payloadBytes, (double)(stats.samples * sizeof(int16_t)) / (double) stats.payloadBytes);
 	}
 
 	printf("\n");
-	return status;
 }
 
 /****************************************************************************
-* ClearDataBuffers
+* startPreview
 *
-* stops GetData writing values to memory that has been released
+* Starts the live preview of the enabled channels if it is selected.
+* Returns FALSE if the console dumps should be printed instead.
 ****************************************************************************/
-PICO_STATUS clearDataBuffers(UNIT * unit)
+int16_t startPreview(UNIT * unit, const char * title)
 {
-	int32_t i;
-	PICO_STATUS status;
+	int32_t rangeMv[PREVIEW_CHANNELS] = { 0 };
+	uint16_t channelMask = 0;
+	int16_t ch;
 
-	for (i = 0; i < unit->channelCount; i++) 
+	if (!g_preview)
 	{
-		if(unit->channelSettings[i].enabled)
+		return FALSE;
+	}
+
+	for (ch = 0; ch < unit->channelCount && ch < PREVIEW_CHANNELS; ch++)
+	{
+		if (unit->channelSettings[ch].enabled)
 		{
-			if ((status = ps5000aSetDataBuffers(unit->handle, (PS5000A_CHANNEL) i, NULL, NULL, 0, 0, PS5000A_RATIO_MODE_NONE)) != PICO_OK)
-			{
-				printf("clearDataBuffers:ps5000aSetDataBuffers(channel %d) ------ 0x%08lx \n", i, status);
-			}
+			channelMask |= 1 << ch;
 		}
+
+		rangeMv[ch] = inputRanges[unit->channelSettings[ch].range];
 	}
-	return status;
+
+	return previewStart(title, channelMask, unit->maxADCValue, rangeMv) == 0;
 }
 
 /****************************************************************************
-* streamDataHandler
-* - Used by the two stream data examples - untriggered and triggered
-* Inputs:
-* - unit - the unit to sample on
-* - preTrigger - the number of samples in the pre-trigger phase 
-*					(0 if no trigger has been set)
-***************************************************************************/
-void streamDataHandler(UNIT * unit, uint32_t preTrigger)
+* stopDsp / startDsp
+*
+* startDsp sets up the filter of every enabled channel and opens the file
+* of the filtered or demodulated data. It returns FALSE when filtering is
+* off or cannot run at this sample interval. stopDsp undoes it.
+****************************************************************************/
+void stopDsp(DSP_CHANNEL ** dsp, OUTPUT_WRITER ** file)
 {
-	//Variabili utili
-	int32_t i, j;
-	uint32_t sampleCount = 50000; /* make sure overview buffer is large enough */
-	FILE * fp = NULL;
-	int16_t * buffers[2 * PS5000A_MAX_CHANNELS];
-	int16_t * appBuffers[2 * PS5000A_MAX_CHANNELS];
-	PICO_STATUS status;
-	PICO_STATUS powerStatus;
-	uint32_t sampleInterval;
-	int32_t index = 0;
-	int32_t totalSamples;
-	uint32_t postTrigger;
-	int16_t autostop;
-	uint32_t downsampleRatio;
-	uint32_t triggeredAt = 0;
-	PS5000A_TIME_UNITS timeUnits;
-	PS5000A_RATIO_MODE ratioMode;
-	int16_t retry = 0;
-	int16_t powerChange = 0;
-	uint32_t numStreamingValues = 0;
+	int16_t ch;
 
-	int num_of_samples = 0;
-	BUFFER_INFO bufferInfo;
+	for (ch = 0; ch < PS5000A_MAX_CHANNELS; ch++)
+	{
+		dspDestroy(dsp[ch]);
+		dsp[ch] = NULL;
+	}
 
-	//Non ci interessa
-	powerStatus = ps5000aCurrentPowerSource(unit->handle);
-	
-	for (i = 0; i < unit->channelCount; i++) 
+	if (*file != NULL)
 	{
-		if (i >= DUAL_SCOPE && unit->channelCount == QUAD_SCOPE && powerStatus == PICO_POWER_SUPPLY_NOT_CONNECTED)
-		{
-			// No need to set the channels C and D if Quad channel scope and power supply not connected.
-		}
-		else
-		{
-			if (unit->channelSettings[i].enabled)
-			{
-				buffers[i * 2] = (int16_t*) calloc(sampleCount, sizeof(int16_t));
-				buffers[i * 2 + 1] = (int16_t*) calloc(sampleCount, sizeof(int16_t));
-			
-				status = ps5000aSetDataBuffers(unit->handle, (PS5000A_CHANNEL)i, buffers[i * 2], buffers[i * 2 + 1], sampleCount, 0, PS5000A_RATIO_MODE_NONE);
+		writerClose(*file);
+		*file = NULL;
+	}
+}
 
-				appBuffers[i * 2] = (int16_t*) calloc(sampleCount, sizeof(int16_t));
-				appBuffers[i * 2 + 1] = (int16_t*) calloc(sampleCount, sizeof(int16_t));
+int16_t startDsp(UNIT * unit, DSP_CHANNEL ** dsp, double intervalNs, int8_t * name, OUTPUT_WRITER ** file, int16_t captures)
+{
+	DSP_CHANNEL * first = NULL;
+	int16_t ch;
 
-				printf(status?"StreamDataHandler:ps5000aSetDataBuffers(channel %ld) ------ 0x%08lx \n":"", i, status);
-			}
-		}
+	memset(dsp, 0, PS5000A_MAX_CHANNELS * sizeof(DSP_CHANNEL *));
+	*file = NULL;
+
+	if (g_dspOptions.mode == DSP_OFF)
+	{
+		return FALSE;
 	}
-	
-	downsampleRatio = 1;
-	timeUnits = PS5000A_US;
-	sampleInterval = 1;
-	ratioMode = PS5000A_RATIO_MODE_NONE;
-	preTrigger = 0;
-	postTrigger = 1000000;
-	autostop = TRUE;
-	
-	bufferInfo.unit = unit;	
-	bufferInfo.driverBuffers = buffers;
-	bufferInfo.appBuffers = appBuffers;
 
-	if (autostop)
+	for (ch = 0; ch < unit->channelCount; ch++)
 	{
-		printf("\nStreaming Data for %lu samples", postTrigger / downsampleRatio);
-		
-		if (preTrigger)	// We pass 0 for preTrigger if we're not setting up a trigger
-		{
-			printf(" after the trigger occurs\nNote: %lu Pre Trigger samples before Trigger arms\n\n",preTrigger / downsampleRatio);
-		}
-		else
+		if (unit->channelSettings[ch].enabled)
 		{
-			printf("\n\n");
+			if ((dsp[ch] = dspCreate(&g_dspOptions, 1e9 / intervalNs)) == NULL)
+			{
+				printf("startDsp: cannot set up the %s for channel %c, filtering is off for this run\n", dspModeName(g_dspOptions.mode), 'A' + ch);
+				stopDsp(dsp, file);
+				return FALSE;
+			}
+
+			dspReset(dsp[ch], 0);
+			first = first == NULL ? dsp[ch] : first;
 		}
 	}
-	else
+
+	if (first == NULL)
 	{
-		printf("\nStreaming Data continually.\n\n");
+		return FALSE;
 	}
 
-	g_autoStopped = FALSE;
+	if ((*file = writerOpen((const char *) name, &g_writerOptions)) == NULL)
+	{
+		printf("Cannot open the file %s for writing.\n", name);
+		stopDsp(dsp, file);
+		return FALSE;
+	}
 
+	writerPrintf(*file, "%s, %.0f S/s in, 1 in %u out (%.3f S/s), cutoff %.3f Hz", dspModeName(g_dspOptions.mode),
+					1e9 / intervalNs, g_dspOptions.decimation, dspOutputRate(first), dspCutoff(first));
 
-	do
+	if (g_dspOptions.mode == DSP_LOCKIN)
 	{
-		retry = 0;
+		writerPrintf(*file, ", reference %.3f Hz, phase %.1f deg", g_dspOptions.referenceHz, g_dspOptions.phaseDeg);
+	}
 
-		status = ps5000aRunStreaming(unit->handle, &sampleInterval, timeUnits, preTrigger, postTrigger, autostop, 
-										downsampleRatio, ratioMode, sampleCount);
+	writerPrintf(*file, "\n\n%sTime (ns)", captures ? "Capture\t" : "");
 
-		if (status != PICO_OK)
+	for (ch = 0; ch < unit->channelCount; ch++)
+	{
+		if (dsp[ch] != NULL)
 		{
-			// PicoScope 5X4XA/B/D devices...+5 V PSU connected or removed or
-			// PicoScope 524XD devices on non-USB 3.0 port
-			if (status == PICO_POWER_SUPPLY_CONNECTED || status == PICO_POWER_SUPPLY_NOT_CONNECTED ||
-						status == PICO_USB3_0_DEVICE_NON_USB3_0_PORT || status == PICO_POWER_SUPPLY_UNDERVOLTAGE)		
-			{
-				status = changePowerSource(unit->handle, status, unit);
-				retry = 1;
-			}
-			else
-			{
-				printf("streamDataHandler:ps5000aRunStreaming ------ 0x%08lx \n", status);
-				return;
-			}
+			writerPrintf(*file, g_dspOptions.mode == DSP_LOCKIN ? "\tI_ch%c\tQ_ch%c\tR_ch%c\tDeg_ch%c" : "\tmV_ch%c", 'A' + ch, 'A' + ch, 'A' + ch, 'A' + ch);
 		}
 	}
-	while (retry);
 
-	printf("Streaming data...Press a key to stop\n");
+	writerPrintf(*file, "\n");
+	return TRUE;
+}
 
-	
-	fopen_s(&fp, streamFile, "w");
+/****************************************************************************
+* filterSamples
+*
+* Runs the samples of every channel through its filter and prints the
+* outputs as lines of the filtered data file. samples[ch] holds 'count' ADC
+* counts of channel ch, time of sample n is timeOffsetNs + n * intervalNs.
+****************************************************************************/
+void filterSamples(UNIT * unit, DSP_CHANNEL ** dsp, const int16_t ** samples, uint32_t count,
+					double timeOffsetNs, double intervalNs, int32_t capture, PIPE_BUFFER * text)
+{
+	const float * i[PS5000A_MAX_CHANNELS];
+	const float * q[PS5000A_MAX_CHANNELS];
+	uint64_t index = 0;
+	uint32_t outputs = 0, n, decimation = g_dspOptions.decimation < 1 ? 1 : g_dspOptions.decimation;
+	int16_t ch;
 
-	if (fp != NULL)
+	for (ch = 0; ch < unit->channelCount; ch++)
 	{
-		fprintf(fp,"Streaming Data Log\n\n");
-		fprintf(fp,"For each of the %d Channels, results shown are....\n",unit->channelCount);
-		fprintf(fp,"Maximum Aggregated value ADC Count & mV, Minimum Aggregated value ADC Count & mV\n\n");
-
-		for (i = 0; i < unit->channelCount; i++) 
+		if (dsp[ch] != NULL)
 		{
-			if (unit->channelSettings[i].enabled) 
-			{
-				fprintf(fp,"   Max ADC    Max mV  Min ADC  Min mV   ");
-			}
+			// Every channel gets the same samples, so the outputs line up
+			outputs = dspProcess(dsp[ch], samples[ch], (float) inputRanges[unit->channelSettings[ch].range] / unit->maxADCValue,
+									count, &i[ch], &q[ch], &index);
 		}
-		fprintf(fp, "\n");
 	}
-	
-
-	totalSamples = 0;
 
-	while (!_kbhit() && !g_autoStopped)
+	for (n = 0; n < outputs; n++)
 	{
-		/* Poll until data is received. Until then, GetStreamingLatestValues wont call the callback */
-		g_ready = FALSE;
-
-		status = ps5000aGetStreamingLatestValues(unit->handle, callBackStreaming, &bufferInfo);
-
-		// PicoScope 5X4XA/B/D devices...+5 V PSU connected or removed or
-		// PicoScope 524XD devices on non-USB 3.0 port
-		if (status == PICO_POWER_SUPPLY_CONNECTED || status == PICO_POWER_SUPPLY_NOT_CONNECTED ||
-			status == PICO_USB3_0_DEVICE_NON_USB3_0_PORT || status == PICO_POWER_SUPPLY_UNDERVOLTAGE)
+		if (capture >= 0)
 		{
-			if (status == PICO_POWER_SUPPLY_UNDERVOLTAGE)
-			{
-				changePowerSource(unit->handle, status, unit);
-			}
-
-			printf("\n\nPower Source Change");
-			powerChange = 1;
+			pipePrintf(text, "%d\t", capture);
 		}
 
-		index ++;
+		pipePrintf(text, "%.0f", timeOffsetNs + (double)(index + (uint64_t) n * decimation) * intervalNs);
 
-		if (g_ready && g_sampleCount > 0) /* Can be ready and have no data, if autoStop has fired */
+		for (ch = 0; ch < unit->channelCount; ch++)
 		{
-			if (g_trig)
-			{
-				triggeredAt = totalSamples + g_trigAt;		// Calculate where the trigger occurred in the total samples collected
-			}
-
-			totalSamples += g_sampleCount;
-			printf("\nCollected %3li samples, index = %5lu, Total: %6d samples ", g_sampleCount, g_startIndex, totalSamples);
-			
-			if (g_trig)
+			if (dsp[ch] != NULL && q[ch] != NULL)
 			{
-				printf("Trig. at index %lu total %lu", g_trigAt, triggeredAt + 1);	// show where trigger occurred
-				num_of_samples += 1;
+				pipePrintf(text, "\t%+.4f\t%+.4f\t%.4f\t%+.2f", i[ch][n], q[ch][n],
+							hypot(i[ch][n], q[ch][n]), atan2(q[ch][n], i[ch][n]) * 180.0 / M_PI);
 			}
-			
-			for (i = g_startIndex; i < (int32_t)(g_startIndex + g_sampleCount); i++) 
+			else if (dsp[ch] != NULL)
 			{
-				
-				if (fp != NULL)
-				{
-					for (j = 0; j < unit->channelCount; j++) 
-					{
-						if (unit->channelSettings[j].enabled) 
-						{
-							fprintf(	fp,
-								"Ch%C  %5d = %+5dmV, %5d = %+5dmV   ",
-								(char)('A' + j),
-								appBuffers[j * 2][i],
-								adc_to_mv(appBuffers[j * 2][i], unit->channelSettings[PS5000A_CHANNEL_A + j].range, unit),
-								appBuffers[j * 2 + 1][i],
-								adc_to_mv(appBuffers[j * 2 + 1][i], unit->channelSettings[PS5000A_CHANNEL_A + j].range, unit));
-						}
-					}
-
-					fprintf(fp, "\n");
-				}
-				else
-				{
-					printf("Cannot open the file %s for writing.\n", streamFile);
-				}
-				
+				pipePrintf(text, "\t%+.4f", i[ch][n]);
 			}
 		}
-	}
 
-	printf("\n\n");
+		pipePrintf(text, "\n");
+	}
+}
 
-	ps5000aStop(unit->handle);
+/****************************************************************************
+* stopAverage / startAverage
+*
+* startAverage sets up the sums of every enabled channel for rapid block
+* averaging. It returns FALSE when averaging is off or there is not enough
+* memory, the captures are then written one by one.
+****************************************************************************/
+void stopAverage(AVERAGE ** average)
+{
+	int16_t ch;
 
-	if (fp != NULL)
+	for (ch = 0; ch < PS5000A_MAX_CHANNELS; ch++)
 	{
-
-		fclose (fp);
+		averageDestroy(average[ch]);
+		average[ch] = NULL;
 	}
+}
 
-	if (!g_autoStopped && !powerChange)  
-	{
-		printf("\nData collection aborted\n");
-		_getch();
-	}
-	else
+int16_t startAverage(UNIT * unit, AVERAGE ** average, uint32_t nSamples)
+{
+	int16_t ch;
+
+	memset(average, 0, PS5000A_MAX_CHANNELS * sizeof(AVERAGE *));
+
+	if (g_averageCaptures == 0)
 	{
-		printf("\nData collection complete.\n\n");
+		return FALSE;
 	}
-	
-	for (i = 0; i < unit->channelCount; i++) 
+
+	for (ch = 0; ch < unit->channelCount; ch++)
 	{
-		if(unit->channelSettings[i].enabled)
+		if (unit->channelSettings[ch].enabled && (average[ch] = averageCreate(nSamples, g_averageDeviation)) == NULL)
 		{
-			free(buffers[i * 2]);
-			free(appBuffers[i * 2]);
-
-			free(buffers[i * 2 + 1]);
-			free(appBuffers[i * 2 + 1]);
+			printf("startAverage: no memory for the sums of channel %c, averaging is off for this run\n", 'A' + ch);
+			stopAverage(average);
+			return FALSE;
 		}
 	}
 
-	clearDataBuffers(unit);
+	return TRUE;
 }
 
 /****************************************************************************
-* setTrigger
-*
-* - Used to call all the functions required to set up triggering.
+* stopPyramid / startPyramid
 *
-***************************************************************************/
-PICO_STATUS setTrigger(UNIT * unit,
-	PS5000A_TRIGGER_CHANNEL_PROPERTIES_V2 * channelProperties,
-	int16_t nChannelProperties,
-	PS5000A_CONDITION * triggerConditions,
-	int16_t nTriggerConditions,
-	PS5000A_DIRECTION * directions,
-	uint16_t nDirections,
-	struct tPwq * pwq,
-	uint32_t delay,
-	uint64_t autoTriggerUs)
+* startPyramid sets up a min/max/mean pyramid of every enabled channel next
+* to the streaming waveform file, in stream_wave.pyr. It returns FALSE when
+* the pyramid is off or there is no waveform file.
+****************************************************************************/
+void writePyramid(void * context, uint16_t channel, uint32_t level, uint64_t firstRecord, uint32_t records, const int16_t * planes)
 {
-	PICO_STATUS status;
-	PS5000A_CONDITIONS_INFO info = PS5000A_CLEAR;
-	PS5000A_CONDITIONS_INFO pwqInfo = PS5000A_CLEAR;
-
-	int16_t auxOutputEnabled = 0; // Not used by function call
+	WAVE_CHUNK chunk;
+
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.type = WAVE_CHUNK_PYRAMID;
+	chunk.channel = channel;
+	chunk.segment = level;
+	chunk.nSamples = 3 * records;
+	chunk.firstSample = firstRecord;
+	chunk.triggerIndex = WAVE_NO_TRIGGER;
+	waveFileWrite((WAVE_FILE *) context, &chunk, planes);
+}
 
-	status = ps5000aSetTriggerChannelPropertiesV2(unit->handle, channelProperties, nChannelProperties, auxOutputEnabled);
+void stopPyramid(STREAM_CONTEXT * stream)
+{
+	int16_t ch;
 
-	if (status != PICO_OK) 
+	for (ch = 0; ch < PS5000A_MAX_CHANNELS; ch++)
 	{
-		printf("setTrigger:ps5000aSetTriggerChannelPropertiesV2 ------ Ox%08lx \n", status);
-		return status;
+		if (stream->pyramid[ch] != NULL)
+		{
+			pyramidFinish(stream->pyramid[ch]);
+			pyramidDestroy(stream->pyramid[ch]);
+			stream->pyramid[ch] = NULL;
+		}
 	}
 
-	if (nTriggerConditions != 0)
+	closeWaveFile(stream->pyramidFile, streamPyramidFile);
+	stream->pyramidFile = NULL;
+}
+
+int16_t startPyramid(UNIT * unit, STREAM_CONTEXT * stream, WAVE_RUN * run)
+{
+	WAVE_RUN settings = *run;
+	int16_t ch;
+
+	memset(stream->pyramid, 0, sizeof(stream->pyramid));
+	stream->pyramidFile = NULL;
+
+	if (g_pyramidFactor == 0 || stream->wave == NULL)
 	{
-		info = (PS5000A_CONDITIONS_INFO)(PS5000A_CLEAR | PS5000A_ADD); // Clear and add trigger condition specified unless no trigger conditions have been specified
+		return FALSE;
 	}
 
-	status = ps5000aSetTriggerChannelConditionsV2(unit->handle, triggerConditions, nTriggerConditions, info);
+	// Same run settings as the waveform file, with the factor in place of the record length
+	settings.samplesPerRecord = g_pyramidFactor;
 
-	if (status != PICO_OK)
+	if (replayClash(streamPyramidFile))
 	{
-		printf("setTrigger:ps5000aSetTriggerChannelConditionsV2 ------ 0x%08lx \n", status);
-		return status;
+		return FALSE;
 	}
 
-	status = ps5000aSetTriggerChannelDirectionsV2(unit->handle, directions, nDirections);
+	if ((stream->pyramidFile = waveFileOpen((const char *) streamPyramidFile, &g_writerOptions, &settings, g_waveOutput, g_waveAppend)) == NULL)
+	{
+		printf("Cannot open the file %s for writing.\n", streamPyramidFile);
+		return FALSE;
+	}
 
-	if (status != PICO_OK) 
+	for (ch = 0; ch < unit->channelCount; ch++)
 	{
-		printf("setTrigger:ps5000aSetTriggerChannelDirectionsV2 ------ 0x%08lx \n", status);
-		return status;
+		if (unit->channelSettings[ch].enabled &&
+			(stream->pyramid[ch] = pyramidCreate(g_pyramidFactor, (uint16_t) ch, writePyramid, stream->pyramidFile)) == NULL)
+		{
+			printf("startPyramid: no memory for the pyramid of channel %c\n", 'A' + ch);
+			stopPyramid(stream);
+			return FALSE;
+		}
 	}
 
-	status = ps5000aSetAutoTriggerMicroSeconds(unit->handle, autoTriggerUs);
+	return TRUE;
+}
 
-	if (status != PICO_OK)
+/****************************************************************************
+* stopHistory / startHistory
+*
+* startHistory sets up the pre-trigger history rings of the enabled
+* channels, big enough for the history plus one callback of 'blockSamples',
+* and opens stream_pretrig.bin. It returns FALSE when there is no history.
+****************************************************************************/
+void stopHistory(STREAM_CONTEXT * stream)
+{
+	int16_t ch;
+
+	for (ch = 0; ch < PS5000A_MAX_CHANNELS; ch++)
 	{
-		printf("setTrigger:ps5000aSetAutoTriggerMicroSeconds ------ 0x%08lx \n", status);
-		return status;
+		historyDestroy(stream->history[ch]);
+		stream->history[ch] = NULL;
 	}
 
-	status = ps5000aSetTriggerDelay(unit->handle, delay);
-	
-	if (status != PICO_OK)
+	closeWaveFile(stream->preTriggerWave, streamPreTriggerFile);
+	stream->preTriggerWave = NULL;
+}
+
+int16_t startHistory(UNIT * unit, STREAM_CONTEXT * stream, uint32_t blockSamples)
+{
+	WAVE_RUN run;
+	int16_t ch;
+
+	memset(stream->history, 0, sizeof(stream->history));
+	stream->preTriggerWave = NULL;
+	stream->preTriggerEvents = 0;
+	stream->preTrigger = g_preTriggerTime ? (uint32_t)(g_preTrigger * 1000.0 / stream->intervalNs) : g_preTrigger;
+
+	if (stream->preTrigger == 0)
 	{
-		printf("setTrigger:ps5000aSetTriggerDelay ------ 0x%08lx \n", status);
-		return status;
+		return FALSE;
 	}
 
-	// Clear and add pulse width qualifier condition, clear if no pulse width qualifier has been specified
-	if (pwq->nPwqConditions != 0)
+	for (ch = 0; ch < unit->channelCount; ch++)
 	{
-		pwqInfo = (PS5000A_CONDITIONS_INFO)(PS5000A_CLEAR | PS5000A_ADD);
+		if (unit->channelSettings[ch].enabled && (stream->history[ch] = historyCreate(stream->preTrigger + 1 + blockSamples)) == NULL)
+		{
+			printf("startHistory: no memory for %u samples of history, pre-trigger is off for this run\n", stream->preTrigger);
+			stopHistory(stream);
+			return FALSE;
+		}
 	}
 
-	status = ps5000aSetPulseWidthQualifierConditions(unit->handle, pwq->pwqConditions, pwq->nPwqConditions, pwqInfo);
+	// The history has nowhere else to go, so this file is written even with the waveform output off
+	fillWaveRun(unit, &run, stream->preTrigger + 1, stream->preTrigger, stream->intervalNs);
 
-	if (status != PICO_OK)
+	if (replayClash(streamPreTriggerFile))
 	{
-		printf("setTrigger:ps5000aSetPulseWidthQualifierConditions ------ 0x%08lx \n", status);
-		return status;
+		stopHistory(stream);
+		return FALSE;
 	}
 
-	status = ps5000aSetPulseWidthQualifierDirections(unit->handle, pwq->pwqDirections, pwq->nPwqDirections);
-
-	if (status != PICO_OK)
+	if ((stream->preTriggerWave = waveFileOpen((const char *) streamPreTriggerFile, &g_writerOptions, &run,
+								g_waveOutput == WAVE_OUTPUT_OFF ? WAVE_OUTPUT_RAW : g_waveOutput, FALSE)) == NULL)
 	{
-		printf("setTrigger:ps5000aSetPulseWidthQualifierDirections ------ 0x%08lx \n", status);
-		return status;
+		printf("Cannot open the file %s for writing.\n", streamPreTriggerFile);
+		stopHistory(stream);
+		return FALSE;
 	}
 
-	status = ps5000aSetPulseWidthQualifierProperties(unit->handle, pwq->lower, pwq->upper, pwq->type);
+	return TRUE;
+}
 
-	if (status != PICO_OK)
-	{
-		printf("setTrigger:ps5000aSetPulseWidthQualifierProperties ------ Ox%08lx \n", status);
-		return status;
-	}
+/****************************************************************************
+* triggerCounts
+*
+* mV to ADC counts on a channel range, in 32 bits and clamped to 'limit'
+* counts either way: a level past the range is one the samples cannot pass,
+* not one that wraps round to the other side.
+****************************************************************************/
+int32_t triggerCounts(int32_t mv, int16_t rangeIndex, UNIT * unit, int32_t limit)
+{
+	int64_t counts = (int64_t) mv * unit->maxADCValue / inputRanges[rangeIndex];
 
-	return status;
+	return (int32_t)(counts > limit ? limit : counts < -limit ? -limit : counts);
 }
 
 /****************************************************************************
-* collectRapidBlock
-*  this function demonstrates how to collect a set of captures using
-*  rapid block mode.
+* stopSoftTrigger / startSoftTrigger
+*
+* startSoftTrigger converts the software trigger thresholds to ADC counts
+* for the ranges of the run, sets up the engine and opens stream_trig.txt.
+* It returns FALSE when the software trigger is off or has no condition on
+* an enabled channel.
 ****************************************************************************/
-void collectRapidBlock(UNIT * unit)
+void stopSoftTrigger(TRIGGER_ENGINE ** engine, OUTPUT_WRITER ** file)
 {
-	int num_of_waveforms = 1000;
-	int num_of_points = 2000;
-	int num_of_points_pre_trigger = 500;
-	int num_of_points_post_trigger = 1500;
+	triggerDestroy(*engine);
+	*engine = NULL;
 
-	int16_t init_trigger_voltage = 500;
-	PS5000A_CHANNEL init_trigger_channel = PS5000A_EXTERNAL;
+	if (*file != NULL)
+	{
+		writerClose(*file);
+		*file = NULL;
+	}
+}
 
-	int8_t ch = '.';
-	
-	while(ch != 'S')
+int16_t startSoftTrigger(UNIT * unit, TRIGGER_ENGINE ** engine, OUTPUT_WRITER ** file)
+{
+	TRIG_SETUP setup = g_softTriggerMv;
+	int16_t ch;
+
+	*engine = NULL;
+	*file = NULL;
+
+	if (!g_softTrigger)
 	{
-		printf("\n\n");
-		printf("ACTUAL OPTIONS FOR BLOCK DATA CAPTURE (DATA STRUCTURE)\n\n");
-		printf("Number of waveforms = %i\n", num_of_waveforms);
-		printf("Number of Points per waveform = %i\n", num_of_points);
-		printf("Number of Points pre-trigger = %i\n", num_of_points_pre_trigger);
-		printf("Number of Points post-trigger = %i\n", num_of_points_post_trigger);
-		printf("\n");
+		return FALSE;
+	}
 
-		printf("ACTUAL OPTIONS FOR BLOCK DATA CAPTURE (TRIGGER OPTIONS)\n\n");
-		switch (init_trigger_channel)
+	for (ch = 0; ch < TRIG_CHANNELS; ch++)
+	{
+		TRIG_CONDITION * condition = &setup.channels[ch];
+		int16_t range = unit->channelSettings[ch].range;
+
+		if (ch >= unit->channelCount || !unit->channelSettings[ch].enabled)
 		{
-			case PS5000A_CHANNEL_A:
-				printf("Trigger Channel = A\n");
-				break;
-			case PS5000A_CHANNEL_B:
-				printf("Trigger Channel = B\n");
-				break;
-			case PS5000A_CHANNEL_C:
-				printf("Trigger Channel = C\n");
-				break;
-			case PS5000A_CHANNEL_D:
-				printf("Trigger Channel = D\n");
-				break;
-			case PS5000A_EXTERNAL:
-				printf("Trigger Channel = EXT\n");
-				break;
-			default:
-				printf("Trigger Channel not found\n");
-				break;
+			condition->type = TRIG_NONE;
+			continue;
 		}
-		printf("Trigger Voltage = %i\n mV", init_trigger_voltage);
 
-		printf("\n");
-		printf("Please select operation:\n\n");
+		if (condition->type != TRIG_NONE &&
+			(abs(condition->upper) > inputRanges[range] || abs(condition->lower) > inputRanges[range]))
+		{
+			printf("startSoftTrigger: channel %c levels beyond the %d mV range are taken as the range\n", 'A' + ch, inputRanges[range]);
+		}
 
-		printf("W - Set Number of Waveforms		P - Set Number of Points per waveform\n");
-		printf("F - Set Number of Points pre-trigger	L - Set Number of points post-trigger\n");
-		printf("\n");
-		printf("C - Set Trigger channel 		V - Set Trigger Voltage\n");
-		printf("\n");
-		printf("S - Continue\n");
-		printf("Operation:");
+		// Levels within the range, hysteresis and rate within its full span
+		condition->upper = triggerCounts(condition->upper, range, unit, unit->maxADCValue);
+		condition->lower = triggerCounts(condition->lower, range, unit, unit->maxADCValue);
+		condition->hysteresis = triggerCounts(condition->hysteresis, range, unit, 2 * unit->maxADCValue);
+		condition->rate = triggerCounts(condition->rate, range, unit, 2 * unit->maxADCValue);
+	}
 
-		ch = toupper(_getch());
+	if ((*engine = triggerCreate(&setup)) == NULL)
+	{
+		printf("startSoftTrigger: no condition on an enabled channel, the software trigger is off for this run\n");
+		return FALSE;
+	}
 
-		printf("\n\n");
+	if ((*file = writerOpen((const char *) streamTriggerFile, &g_writerOptions)) == NULL)
+	{
+		printf("Cannot open the file %s for writing.\n", streamTriggerFile);
+		stopSoftTrigger(engine, file);
+		return FALSE;
+	}
 
-		switch (ch)
+	writerPrintf(*file, "Software trigger, %s of", setup.logic == TRIG_AND ? "AND" : "OR");
+
+	for (ch = 0; ch < TRIG_CHANNELS; ch++)
+	{
+		if (setup.channels[ch].type != TRIG_NONE)
 		{
-			case 'W':
-				printf("Number of waveforms to collect:");
-				scanf_s("%i", &num_of_waveforms);
-				break;
-			case 'P':
-				printf("Number of points per waveform to collect:");
-				scanf_s("%i", &num_of_points);
-				do
+			writerPrintf(*file, " %c %s", 'A' + ch, triggerTypeName(setup.channels[ch].type));
+		}
+	}
+
+	writerPrintf(*file, ", pulse width %u..%u, holdoff %u samples\n\nSample\tTime (ns)\n", setup.minWidth, setup.maxWidth, setup.holdoff);
+	return TRUE;
+}
+
+/****************************************************************************************
+* ChangePowerSource - function to handle switches between +5V supply, and USB only power
+* Only applies to PicoScope 544xA/B units 
+******************************************************************************************/
+PICO_STATUS changePowerSource(int16_t handle, PICO_STATUS status, UNIT * unit)
+{
+	int8_t ch;
+
+	switch (status)
+	{
+		case PICO_POWER_SUPPLY_NOT_CONNECTED:		// User must acknowledge they want to power via USB
+			do
+			{
+				printf("\n5 V power supply not connected.");
+				printf("\nDo you want to run using USB only Y/N?\n");
+				ch = toupper(_getch());
+				
+				if(ch == 'Y')
 				{
-					printf("Number of points pre-trigger to collect:");
-					scanf_s("%i", &num_of_points_pre_trigger);
-					num_of_points_post_trigger = num_of_points - num_of_points_pre_trigger;
-					if(num_of_points_pre_trigger > num_of_points || num_of_points_pre_trigger < 0)
+					printf("\nPowering the unit via USB\n");
+					status = ps5000aChangePowerSource(handle, PICO_POWER_SUPPLY_NOT_CONNECTED);		// Tell the driver that's ok
+				
+					if(status == PICO_OK && unit->channelCount == QUAD_SCOPE)
 					{
-						printf("Invalid value: Number of points pre-trigger is greater than Number of points. Please set a valid value\n");
-					}				
-				} while(num_of_points_pre_trigger > num_of_points || num_of_points_pre_trigger < 0);
-				break;
-			case 'F':
-				do
-				{
-					printf("Number of points pre-trigger to collect:");
-					scanf_s("%i", &num_of_points_pre_trigger);
-					num_of_points_post_trigger = num_of_points - num_of_points_pre_trigger;
-					if(num_of_points_pre_trigger > num_of_points || num_of_points_pre_trigger < 0)
+						unit->channelSettings[PS5000A_CHANNEL_C].enabled = FALSE;
+						unit->channelSettings[PS5000A_CHANNEL_D].enabled = FALSE;
+					}
+					else if (status == PICO_POWER_SUPPLY_UNDERVOLTAGE)
 					{
-						printf("Invalid value: Number of points pre-trigger is greater than Number of points. Please set a valid value\n");
+						status = changePowerSource(handle, status, unit);
 					}
-				}while (num_of_points_pre_trigger > num_of_points || num_of_points_pre_trigger < 0);
-				break;
-			case 'L': 
-				do
-				{
-					printf("Number of points post-trigger to collect:");
-					scanf_s("%i", &num_of_points_post_trigger);
-					num_of_points_pre_trigger = num_of_points - num_of_points_post_trigger;
-					if(num_of_points_post_trigger > num_of_points || num_of_points_post_trigger < 0)
+					else
 					{
-						printf("Invalid value: Number of points post-trigger is greater than Number of points. Please set a valid value\n");
+						// Do nothing
 					}
-				}while (num_of_points_post_trigger > num_of_points || num_of_points_post_trigger < 0);
-				break;
-			case 'S':
-				break;
-			case 'C':
-				do
+
+				}
+			}
+			while(ch != 'Y' && ch != 'N');
+			printf(ch == 'N'?"Please use the +5V power supply to power this unit\n":"");
+			break;
+
+		case PICO_POWER_SUPPLY_CONNECTED:
+			printf("\nUsing +5 V power supply voltage.\n");
+			status = ps5000aChangePowerSource(handle, PICO_POWER_SUPPLY_CONNECTED);		// Tell the driver we are powered from +5V supply
+			break;
+
+		case PICO_USB3_0_DEVICE_NON_USB3_0_PORT:
+			do
+			{
+				printf("\nUSB 3.0 device on non-USB 3.0 port.");
+				printf("\nDo you wish to continue Y/N?\n");
+				ch = toupper(_getch());
+
+				if (ch == 'Y')
 				{
-					printf("0 -> A\n");
-					printf("1 -> B\n");
-					printf("2 -> C\n");
-					printf("3 -> D\n");
-					printf("4 -> EXT\n");
-					printf("\n");
-					printf("Trigger Channel:");
-					scanf_s("%i", &init_trigger_channel);	
-					if(init_trigger_channel > 4 || init_trigger_channel < 0)
+					printf("\nSwitching to use USB power from non-USB 3.0 port.\n");
+					status = ps5000aChangePowerSource(handle, PICO_USB3_0_DEVICE_NON_USB3_0_PORT);		// Tell the driver that's ok
+
+					if (status == PICO_POWER_SUPPLY_UNDERVOLTAGE)
 					{
-						printf("Invalid value: Channel value out of range. Please set a valid value\n");
+						status = changePowerSource(handle, status, unit);
 					}
-				}while(init_trigger_channel > 4 || init_trigger_channel < 0);
-				break;
-			case 'V':
-				do
-				{
-					printf("Trigger Voltage:");
-					scanf_s("%hi", &init_trigger_voltage);
-					if(init_trigger_voltage < -5000 || init_trigger_voltage > 5000) 
+					else
 					{
-						printf("Trigger Voltage out of range (over 5V). Please set a valid value\n");
+						// Do nothing
 					}
-				}while(init_trigger_voltage < -5000 || init_trigger_voltage > 5000);
-				break;
-			default:
-				printf("Invalid Operation\n");
-				break;
+
+				}
+			} while (ch != 'Y' && ch != 'N');
+			printf(ch == 'N' ? "Please use a USB 3.0 port or press 'Y'.\n" : "");
+			break;
+
+		case PICO_POWER_SUPPLY_UNDERVOLTAGE:
+			do
+			{
+				printf("\nUSB not supplying required voltage");
+				printf("\nPlease plug in the +5 V power supply\n");
+				printf("\nHit any key to continue, or Esc to exit...\n");
+				ch = _getch();
+				
+				if (ch == 0x1B)	// ESC key
+				{
+					exit(0);
+				}
+				else
+				{
+					status = ps5000aChangePowerSource(handle, PICO_POWER_SUPPLY_CONNECTED);		// Tell the driver that's ok
+				}
+			}
+			while (status == PICO_POWER_SUPPLY_REQUEST_INVALID);
+			break;
+	}
+
+	printf("\n");
+	return status;
+}
+
+/****************************************************************************
+* ClearDataBuffers
+*
+* stops GetData writing values to memory that has been released
+****************************************************************************/
+PICO_STATUS clearDataBuffers(UNIT * unit)
+{
+	int32_t i;
+	PICO_STATUS status;
+
+	for (i = 0; i < unit->channelCount; i++) 
+	{
+		if(unit->channelSettings[i].enabled)
+		{
+			if ((status = ps5000aSetDataBuffers(unit->handle, (PS5000A_CHANNEL) i, NULL, NULL, 0, 0, PS5000A_RATIO_MODE_NONE)) != PICO_OK)
+			{
+				printf("clearDataBuffers:ps5000aSetDataBuffers(channel %d) ------ 0x%08lx \n", i, status);
+			}
+		}
+	}
+	return status;
+}
+
+/****************************************************************************
+* Streaming pipeline stages
+*
+* analyze - live preview or console status line (one worker, it owns the preview)
+* trigger - software trigger and pre-trigger history, in callback order
+*           (only when enabled)
+* filter  - filtered or demodulated data, in callback order (only when enabled)
+* convert - text lines of stream.txt
+* write   - stream.txt, stream_trig.txt, stream_dsp.txt, the waveform file and
+*           its pyramid, in callback order (stream_pretrig.bin is written by the trigger
+*           stage, from the history rings)
+****************************************************************************/
+PIPE_RESULT streamAnalyze(PIPE_BLOCK * block, void * context)
+{
+	STREAM_CONTEXT * stream = (STREAM_CONTEXT *) context;
+	STREAM_BLOCK * header = (STREAM_BLOCK *) block->user;
+	const int16_t * samples = (const int16_t *) block->buffers[0].data;
+	int32_t total = header->firstSample + header->nSamples;
+	int32_t j;
+
+	if (stream->previewing)
+	{
+		for (j = 0; j < stream->unit->channelCount; j++)
+		{
+			if (stream->unit->channelSettings[j].enabled)
+			{
+				previewPush(j, &samples[(size_t)(j * 2) * header->nSamples], &samples[(size_t)(j * 2 + 1) * header->nSamples], (uint32_t) header->nSamples);
+			}
+		}
+
+		previewStatus("%d samples, last %d at index %u%s", total, header->nSamples, header->startIndex, header->triggered ? ", triggered" : "");
+		previewPublish();
+	}
+	else
+	{
+		printf("\nCollected %3d samples, index = %5u, Total: %6d samples ", header->nSamples, header->startIndex, total);
+
+		if (header->triggered)
+		{
+			printf("Trig. at index %u total %u", header->triggerAt, header->firstSample + header->triggerAt + 1);	// show where trigger occurred
+		}
+	}
+
+	return PIPE_FORWARD;
+}
+
+/* Writes the history up to and including sample 'at' to the pre-trigger file, straight from the rings */
+void writePreTrigger(STREAM_CONTEXT * stream, uint64_t at)
+{
+	uint64_t first = at > stream->preTrigger ? at - stream->preTrigger : 0;
+	const int16_t * window;
+	WAVE_CHUNK chunk;
+	int16_t j;
+
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.type = WAVE_CHUNK_CAPTURE;
+	chunk.segment = stream->preTriggerEvents++;
+	chunk.flags = WAVE_CHUNK_TRIGGERED;
+
+	for (j = 0; j < stream->unit->channelCount; j++)
+	{
+		if (stream->history[j] == NULL)
+		{
+			continue;
+		}
+
+		// Shorter after the start or a gap
+		if (first < historyOldest(stream->history[j]))
+		{
+			first = historyOldest(stream->history[j]);
+		}
+
+		if ((window = historyWindow(stream->history[j], first, (uint32_t)(at + 1 - first))) != NULL)
+		{
+			chunk.channel = (uint16_t) j;
+			chunk.nSamples = (uint32_t)(at + 1 - first);
+			chunk.firstSample = first;
+			chunk.triggerIndex = (uint32_t)(at - first);
+			waveFileWrite(stream->preTriggerWave, &chunk, window);
+		}
+	}
+}
+
+PIPE_RESULT streamTrigger(PIPE_BLOCK * block, void * context)
+{
+	STREAM_CONTEXT * stream = (STREAM_CONTEXT *) context;
+	STREAM_BLOCK * header = (STREAM_BLOCK *) block->user;
+	const int16_t * samples = (const int16_t *) block->buffers[0].data;
+	const int16_t * max[PS5000A_MAX_CHANNELS] = { NULL };
+	const uint64_t * triggers = NULL;
+	uint32_t count = 0, i;
+	int16_t gap = header->firstSample != stream->triggerNext;
+	int16_t j;
+
+	for (j = 0; j < stream->unit->channelCount; j++)
+	{
+		max[j] = stream->unit->channelSettings[j].enabled ? &samples[(size_t)(j * 2) * header->nSamples] : NULL;
+
+		// No edge or history can be followed across blocks dropped upstream
+		if (stream->history[j] != NULL)
+		{
+			if (gap)
+			{
+				historyReset(stream->history[j], (uint64_t) header->firstSample);
+			}
+
+			historyAppend(stream->history[j], max[j], (uint32_t) header->nSamples);
+		}
+	}
+
+	stream->triggerNext = header->firstSample + header->nSamples;
+
+	if (stream->trigger != NULL)
+	{
+		if (gap)
+		{
+			triggerReset(stream->trigger, (uint64_t) header->firstSample);
+		}
+
+		count = triggerScan(stream->trigger, max, (uint32_t) header->nSamples, &triggers);
+
+		for (i = 0; i < count; i++)
+		{
+			pipePrintf(&block->buffers[3], "%llu\t%.0f\n", (unsigned long long) triggers[i], (double) triggers[i] * stream->intervalNs);
+		}
+
+		stream->softTriggers += count;
+		metricsAdd(METRIC_SOFT_TRIGGERS, count);
+	}
+
+	if (stream->preTriggerWave != NULL)
+	{
+		if (header->triggered)
+		{
+			writePreTrigger(stream, (uint64_t) header->firstSample + header->triggerAt);
+		}
+
+		for (i = 0; i < count; i++)
+		{
+			writePreTrigger(stream, triggers[i]);
+		}
+	}
+
+	return PIPE_FORWARD;
+}
+
+PIPE_RESULT streamFilter(PIPE_BLOCK * block, void * context)
+{
+	STREAM_CONTEXT * stream = (STREAM_CONTEXT *) context;
+	STREAM_BLOCK * header = (STREAM_BLOCK *) block->user;
+	const int16_t * samples = (const int16_t *) block->buffers[0].data;
+	const int16_t * max[PS5000A_MAX_CHANNELS];
+	int16_t j;
+
+	for (j = 0; j < stream->unit->channelCount; j++)
+	{
+		max[j] = &samples[(size_t)(j * 2) * header->nSamples];
+
+		// Blocks dropped upstream leave a gap, start the filters again after it
+		if (stream->dsp[j] != NULL && header->firstSample != stream->nextSample)
+		{
+			dspReset(stream->dsp[j], (uint64_t) header->firstSample);
+		}
+	}
+
+	stream->nextSample = header->firstSample + header->nSamples;
+	filterSamples(stream->unit, stream->dsp, max, (uint32_t) header->nSamples, 0.0, stream->intervalNs, -1, &block->buffers[2]);
+	return PIPE_FORWARD;
+}
+
+PIPE_RESULT streamConvert(PIPE_BLOCK * block, void * context)
+{
+	STREAM_CONTEXT * stream = (STREAM_CONTEXT *) context;
+	STREAM_BLOCK * header = (STREAM_BLOCK *) block->user;
+	const int16_t * samples = (const int16_t *) block->buffers[0].data;
+	UNIT * unit = stream->unit;
+	uint64_t start = perfNow();
+	int32_t i, j;
+
+	if (stream->fp == NULL)
+	{
+		return PIPE_FORWARD;
+	}
+
+	if (header->gap > 0)
+	{
+		pipePrintf(&block->buffers[1], "Power source change: no data for %.1f ms, %d samples lost\n",
+					(double) header->outageNs / 1e6, header->gap);
+	}
+
+	for (i = 0; i < header->nSamples; i++)
+	{
+		for (j = 0; j < unit->channelCount; j++)
+		{
+			if (unit->channelSettings[j].enabled)
+			{
+				const int16_t * max = &samples[(size_t)(j * 2) * header->nSamples];
+				const int16_t * min = &samples[(size_t)(j * 2 + 1) * header->nSamples];
+
+				pipePrintf(&block->buffers[1],
+					"Ch%C  %5d = %+5dmV, %5d = %+5dmV   ",
+					(char)('A' + j),
+					max[i],
+					adc_to_mv(max[i], unit->channelSettings[PS5000A_CHANNEL_A + j].range, unit),
+					min[i],
+					adc_to_mv(min[i], unit->channelSettings[PS5000A_CHANNEL_A + j].range, unit));
+			}
+		}
+
+		pipePrintf(&block->buffers[1], "\n");
+	}
+
+	perfSince(PERF_STREAM_CONVERT, start);
+	return PIPE_FORWARD;
+}
+
+/****************************************************************************
+* flushStreamWave / holdStreamWave
+*
+* The streaming blocks go into the waveform file in chunks of at least a
+* codec block (WAVE_CODEC_BLOCK samples) rather than one per callback, which
+* would make the chunk headers and index entries outweigh the samples.
+* holdStreamWave appends a block to the held samples; a gap, a trigger or a
+* jump in the sample index starts a new chunk. flushStreamWave writes the
+* held samples, one chunk per channel. Without the memory to hold a block
+* it goes in as a chunk of its own.
+****************************************************************************/
+void flushStreamWave(STREAM_CONTEXT * stream)
+{
+	int16_t j;
+
+	for (j = 0; j < stream->unit->channelCount && stream->pendingSamples > 0; j++)
+	{
+		if (stream->pending[j] != NULL)
+		{
+			stream->pendingChunk.channel = (uint16_t) j;
+			stream->pendingChunk.nSamples = stream->pendingSamples;
+			stream->pendingChunk.flags = (stream->pendingChunk.flags & ~WAVE_CHUNK_OVERFLOW) |
+											((stream->pendingOverflow >> j) & 1 ? WAVE_CHUNK_OVERFLOW : 0);
+			waveFileWrite(stream->wave, &stream->pendingChunk, stream->pending[j]);
+		}
+	}
+
+	stream->pendingSamples = 0;
+	stream->pendingOverflow = 0;
+}
+
+void writeStreamWave(STREAM_CONTEXT * stream, const STREAM_BLOCK * header, const int16_t * samples)
+{
+	WAVE_CHUNK chunk;
+	int16_t j;
+
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.type = WAVE_CHUNK_STREAM;
+	chunk.segment = (uint32_t) header->poll;
+	chunk.nSamples = (uint32_t) header->nSamples;
+	chunk.firstSample = (uint64_t) header->firstSample;
+	chunk.triggerIndex = header->triggered ? header->triggerAt : WAVE_NO_TRIGGER;
+
+	for (j = 0; j < stream->unit->channelCount; j++)
+	{
+		if (stream->unit->channelSettings[j].enabled)
+		{
+			chunk.channel = (uint16_t) j;
+			chunk.flags = (header->triggered ? WAVE_CHUNK_TRIGGERED : 0) | ((header->overflow >> j) & 1 ? WAVE_CHUNK_OVERFLOW : 0) |
+							(header->gap > 0 ? WAVE_CHUNK_GAP : 0);
+			waveFileWrite(stream->wave, &chunk, &samples[(size_t)(j * 2) * header->nSamples]);
+		}
+	}
+}
+
+void holdStreamWave(STREAM_CONTEXT * stream, const STREAM_BLOCK * header, const int16_t * samples)
+{
+	uint32_t n = (uint32_t) header->nSamples;
+	int64_t pendingEnd = (int64_t) stream->pendingChunk.firstSample + stream->pendingSamples;
+	int16_t * larger[PS5000A_MAX_CHANNELS];
+	int16_t failed = FALSE;
+	int16_t j;
+
+	if (stream->pendingSamples > 0 && (header->gap > 0 || header->triggered || (int64_t) header->firstSample != pendingEnd))
+	{
+		flushStreamWave(stream);
+	}
+
+	if (stream->pendingSamples + n > stream->pendingCapacity)
+	{
+		uint32_t capacity = stream->pendingSamples + n > WAVE_CODEC_BLOCK ? stream->pendingSamples + n : WAVE_CODEC_BLOCK;
+
+		// All the channels grow or none does, so they keep the same capacity
+		memset(larger, 0, sizeof(larger));
+
+		for (j = 0; j < stream->unit->channelCount && !failed; j++)
+		{
+			if (stream->unit->channelSettings[j].enabled)
+			{
+				failed = (larger[j] = (int16_t *) malloc(capacity * sizeof(int16_t))) == NULL;
+			}
+		}
+
+		for (j = 0; j < stream->unit->channelCount; j++)
+		{
+			if (failed)
+			{
+				free(larger[j]);
+			}
+			else if (larger[j] != NULL)
+			{
+				if (stream->pending[j] != NULL)
+				{
+					memcpy(larger[j], stream->pending[j], stream->pendingSamples * sizeof(int16_t));
+				}
+
+				free(stream->pending[j]);
+				stream->pending[j] = larger[j];
+			}
+		}
+
+		if (failed)
+		{
+			printf("holdStreamWave: no memory, the samples go in as they come\n");
+			flushStreamWave(stream);
+			writeStreamWave(stream, header, samples);
+			return;
+		}
+
+		stream->pendingCapacity = capacity;
+	}
+
+	if (stream->pendingSamples == 0)
+	{
+		memset(&stream->pendingChunk, 0, sizeof(stream->pendingChunk));
+		stream->pendingChunk.type = WAVE_CHUNK_STREAM;
+		stream->pendingChunk.segment = (uint32_t) header->poll;
+		stream->pendingChunk.firstSample = (uint64_t) header->firstSample;
+		stream->pendingChunk.triggerIndex = header->triggered ? header->triggerAt : WAVE_NO_TRIGGER;
+		stream->pendingChunk.flags = (header->triggered ? WAVE_CHUNK_TRIGGERED : 0) | (header->gap > 0 ? WAVE_CHUNK_GAP : 0);
+	}
+
+	for (j = 0; j < stream->unit->channelCount; j++)
+	{
+		if (stream->pending[j] != NULL)
+		{
+			memcpy(stream->pending[j] + stream->pendingSamples, &samples[(size_t)(j * 2) * n], n * sizeof(int16_t));
+		}
+	}
+
+	stream->pendingSamples += n;
+	stream->pendingOverflow |= header->overflow;
+
+	if (stream->pendingSamples >= WAVE_CODEC_BLOCK)
+	{
+		flushStreamWave(stream);
+	}
+}
+
+PIPE_RESULT streamWrite(PIPE_BLOCK * block, void * context)
+{
+	STREAM_CONTEXT * stream = (STREAM_CONTEXT *) context;
+	STREAM_BLOCK * header = (STREAM_BLOCK *) block->user;
+	const int16_t * samples = (const int16_t *) block->buffers[0].data;
+	uint64_t start = perfNow();
+	int32_t j;
+
+	if (stream->fp != NULL)
+	{
+		writerWrite(stream->fp, block->buffers[1].data, block->buffers[1].length);
+	}
+
+	if (stream->dspFile != NULL)
+	{
+		writerWrite(stream->dspFile, block->buffers[2].data, block->buffers[2].length);
+	}
+
+	if (stream->triggerFile != NULL)
+	{
+		writerWrite(stream->triggerFile, block->buffers[3].data, block->buffers[3].length);
+	}
+
+	if (stream->wave != NULL)
+	{
+		holdStreamWave(stream, header, samples);
+
+		for (j = 0; j < stream->unit->channelCount; j++)
+		{
+			if (stream->pyramid[j] != NULL)
+			{
+				pyramidAdd(stream->pyramid[j], (uint64_t) header->firstSample, &samples[(size_t)(j * 2) * header->nSamples], (uint32_t) header->nSamples);
+			}
+		}
+	}
+
+	perfSince(PERF_STREAM_WRITE, start);
+	return PIPE_FORWARD;
+}
+
+/****************************************************************************
+* createPipeline
+*
+* analyze, (step, filter,) convert and write stages shared by both
+* acquisition modes. The overload policy applies where blocks enter the
+* pipeline, the later queues pass the backpressure on to it. The step
+* (software trigger or averaging, named 'stepName') and filter stages keep
+* state from block to block so they take them in order; they are left out
+* when NULL.
+****************************************************************************/
+PIPELINE * createPipeline(const char * name, size_t userSize, PIPE_POLICY policy, PIPE_PROCESS analyze, const char * stepName,
+							PIPE_PROCESS step, PIPE_PROCESS filter, PIPE_PROCESS convert, PIPE_PROCESS write, void * context)
+{
+	PIPELINE * pipe = pipeCreate(name, userSize);
+
+	if (pipe == NULL ||
+		pipeAddStage(pipe, "analyze", analyze, context, 1, g_pipeDepth, policy, g_pipePrescale, 0) != 0 ||
+		(step != NULL && pipeAddStage(pipe, stepName, step, context, 1, g_pipeDepth, PIPE_POLICY_BLOCK, 0, PIPE_ORDERED) != 0) ||
+		(filter != NULL && pipeAddStage(pipe, "filter", filter, context, 1, g_pipeDepth, PIPE_POLICY_BLOCK, 0, PIPE_ORDERED) != 0) ||
+		pipeAddStage(pipe, "convert", convert, context, g_convertWorkers, g_pipeDepth, PIPE_POLICY_BLOCK, 0, 0) != 0 ||
+		pipeAddStage(pipe, "write", write, context, 1, g_pipeDepth, PIPE_POLICY_BLOCK, 0, PIPE_ORDERED) != 0 ||
+		pipeStart(pipe) != 0)
+	{
+		printf("createPipeline: cannot set up the %s pipeline\n", name);
+		pipeDestroy(pipe);
+		return NULL;
+	}
+
+	return pipe;
+}
+
+/****************************************************************************
+* finishPipeline
+*
+* Lets the queued blocks through, stops the preview and prints the stage
+* counters with the latency summary
+****************************************************************************/
+void finishPipeline(PIPELINE * pipe)
+{
+	pipeFinish(pipe);
+	previewStop();
+
+	if (g_perfMode != PERF_OFF)
+	{
+		pipeReport(pipe);
+	}
+
+	pipeDestroy(pipe);
+}
+
+/****************************************************************************
+* openStreamPipeline / closeStreamPipeline
+*
+* openStreamPipeline opens the streaming files, sets up the optional stages
+* for blocks of up to 'blockSamples' per channel and starts the pipeline.
+* closeStreamPipeline lets the queued blocks through, reports what the
+* optional stages found and closes the files. The device and the replay of a
+* recording both go through them.
+****************************************************************************/
+PIPELINE * openStreamPipeline(UNIT * unit, STREAM_CONTEXT * context, double intervalNs, uint32_t preTrigger,
+								uint32_t blockSamples, PIPE_POLICY policy)
+{
+	WAVE_RUN waveRun;
+	int32_t i;
+
+	context->fp = replayClash(streamFile) ? NULL : writerOpen((const char *) streamFile, &g_writerOptions);
+
+	if (context->fp == NULL)
+	{
+		printf("Cannot open the file %s for writing.\n", streamFile);
+	}
+	else
+	{
+		writerPrintf(context->fp,"Streaming Data Log\n\n");
+		writerPrintf(context->fp,"For each of the %d Channels, results shown are....\n",unit->channelCount);
+		writerPrintf(context->fp,"Maximum Aggregated value ADC Count & mV, Minimum Aggregated value ADC Count & mV\n\n");
+
+		for (i = 0; i < unit->channelCount; i++) 
+		{
+			if (unit->channelSettings[i].enabled) 
+			{
+				writerPrintf(context->fp,"   Max ADC    Max mV  Min ADC  Min mV   ");
+			}
+		}
+		writerPrintf(context->fp, "\n");
+	}
+
+	fillWaveRun(unit, &waveRun, 0, preTrigger, intervalNs);
+	context->wave = replayClash(streamWaveFile) ? NULL : waveFileOpen((const char *) streamWaveFile, &g_writerOptions, &waveRun, g_waveOutput, g_waveAppend);
+
+	g_lastCallbackNs = 0;
+	perfBegin(g_replay != NULL ? "stream replay" : "streaming");
+	metricsSet(METRIC_ACQUIRING, 1);
+
+	context->unit = unit;
+	context->previewing = startPreview(unit, g_replay != NULL ? "Stream replay" : "Streaming");
+	context->intervalNs = intervalNs;
+	context->nextSample = 0;
+	context->triggerNext = 0;
+	context->softTriggers = 0;
+	memset(context->pending, 0, sizeof(context->pending));
+	context->pendingCapacity = 0;
+	context->pendingSamples = 0;
+	context->pendingOverflow = 0;
+	startPyramid(unit, context, &waveRun);
+	// Not ||, both have to run to set up or clear their part of the context
+	return createPipeline("streaming", sizeof(STREAM_BLOCK), policy, streamAnalyze, "trigger",
+							(startSoftTrigger(unit, &context->trigger, &context->triggerFile) |
+								startHistory(unit, context, blockSamples)) ? streamTrigger : NULL,
+							startDsp(unit, context->dsp, context->intervalNs, streamDspFile, &context->dspFile, FALSE) ? streamFilter : NULL,
+							streamConvert, streamWrite, context);
+}
+
+void closeStreamPipeline(STREAM_CONTEXT * context, PIPELINE * pipe)
+{
+	int16_t j;
+
+	finishPipeline(pipe);
+	stopDsp(context->dsp, &context->dspFile);
+
+	if (context->wave != NULL)
+	{
+		flushStreamWave(context);
+	}
+
+	for (j = 0; j < PS5000A_MAX_CHANNELS; j++)
+	{
+		free(context->pending[j]);
+		context->pending[j] = NULL;
+	}
+
+	if (context->trigger != NULL)
+	{
+		printf("\nSoftware trigger: %llu events (%s)", (unsigned long long) context->softTriggers, streamTriggerFile);
+		stopSoftTrigger(&context->trigger, &context->triggerFile);
+	}
+
+	if (context->pyramidFile != NULL)
+	{
+		printf("\nPyramid: 1 in %u per level (%s)\n", g_pyramidFactor, streamPyramidFile);
+		stopPyramid(context);
+	}
+
+	if (context->preTriggerWave != NULL)
+	{
+		printf("\nPre-trigger history: %u events of up to %u samples (%s)\n", context->preTriggerEvents, context->preTrigger, streamPreTriggerFile);
+		stopHistory(context);
+	}
+
+	printf("\n\n");
+
+	if (context->fp != NULL)
+	{
+		writerClose(context->fp);
+	}
+
+	closeWaveFile(context->wave, streamWaveFile);
+	perfEnd();
+	metricsSet(METRIC_ACQUIRING, 0);
+	metricsSet(METRIC_BUFFER_FILL, 0);
+}
+
+/****************************************************************************
+* queueStreamBlock
+*
+* Hands the samples copied by callBackStreaming to the pipeline, with the
+* block header filled in from what the callback was told. If the callback
+* could not copy them the block goes back unused and its samples are a gap
+* in the output; returns how many samples were lost that way.
+****************************************************************************/
+int32_t queueStreamBlock(PIPELINE * pipe, PIPE_BLOCK * block, int32_t poll, int32_t * totalSamples, uint32_t bufferSamples)
+{
+	STREAM_BLOCK * header = (STREAM_BLOCK *) block->user;
+
+	header->nSamples = g_sampleCount;
+	header->startIndex = g_startIndex;
+	header->firstSample = *totalSamples;
+	header->poll = poll;
+	header->triggered = g_trig;
+	header->triggerAt = g_trigAt;
+	header->overflow = g_overflow;
+
+	*totalSamples += g_sampleCount;
+	perfAddSamples(g_sampleCount);
+	metricsAdd(METRIC_SAMPLES, (uint64_t) g_sampleCount);
+	metricsAdd(METRIC_CALLBACKS, 1);
+	metricsAdd(METRIC_OVERFLOWS, g_overflow ? 1 : 0);
+	metricsSet(METRIC_BUFFER_FILL, (uint64_t) g_sampleCount * 1000 / bufferSamples);
+
+	if (g_copyFailed)
+	{
+		pipeRelease(pipe, block);
+		return g_sampleCount;
+	}
+
+	pipeSubmit(pipe, block);
+	return 0;
+}
+
+/****************************************************************************
+* recordTrigger
+*
+* Keeps a copy of a trigger setup in g_lastTrigger. The arrays may be the
+* ones of g_lastTrigger itself.
+****************************************************************************/
+void recordTrigger(PS5000A_TRIGGER_CHANNEL_PROPERTIES_V2 * channelProperties, int16_t nChannelProperties, PS5000A_CONDITION * triggerConditions,
+	int16_t nTriggerConditions, PS5000A_DIRECTION * directions, uint16_t nDirections, struct tPwq * pwq, uint32_t delay, uint64_t autoTriggerUs)
+{
+	TRIGGER_SETTINGS * t = &g_lastTrigger;
+	PWQ copy = *pwq;
+
+	t->nProperties = nChannelProperties < PS5000A_MAX_CHANNELS ? nChannelProperties : PS5000A_MAX_CHANNELS;
+	t->nConditions = nTriggerConditions < PS5000A_MAX_CHANNELS ? nTriggerConditions : PS5000A_MAX_CHANNELS;
+	t->nDirections = nDirections < PS5000A_MAX_CHANNELS ? nDirections : PS5000A_MAX_CHANNELS;
+	copy.nPwqConditions = copy.nPwqConditions < PS5000A_MAX_CHANNELS ? copy.nPwqConditions : PS5000A_MAX_CHANNELS;
+	copy.nPwqDirections = copy.nPwqDirections < PS5000A_MAX_CHANNELS ? copy.nPwqDirections : PS5000A_MAX_CHANNELS;
+
+	memmove(t->properties, channelProperties, t->nProperties * sizeof(t->properties[0]));
+	memmove(t->conditions, triggerConditions, t->nConditions * sizeof(t->conditions[0]));
+	memmove(t->directions, directions, t->nDirections * sizeof(t->directions[0]));
+
+	if (copy.nPwqConditions > 0)
+	{
+		memmove(t->pwqConditions, pwq->pwqConditions, copy.nPwqConditions * sizeof(t->pwqConditions[0]));
+	}
+
+	if (copy.nPwqDirections > 0)
+	{
+		memmove(t->pwqDirections, pwq->pwqDirections, copy.nPwqDirections * sizeof(t->pwqDirections[0]));
+	}
+
+	copy.pwqConditions = t->pwqConditions;
+	copy.pwqDirections = t->pwqDirections;
+	t->pwq = copy;
+	t->delay = delay;
+	t->autoTriggerUs = autoTriggerUs;
+}
+
+/****************************************************************************
+* setTrigger
+*
+* - Used to call all the functions required to set up triggering.
+*
+***************************************************************************/
+PICO_STATUS setTrigger(UNIT * unit,
+	PS5000A_TRIGGER_CHANNEL_PROPERTIES_V2 * channelProperties,
+	int16_t nChannelProperties,
+	PS5000A_CONDITION * triggerConditions,
+	int16_t nTriggerConditions,
+	PS5000A_DIRECTION * directions,
+	uint16_t nDirections,
+	struct tPwq * pwq,
+	uint32_t delay,
+	uint64_t autoTriggerUs)
+{
+	PICO_STATUS status;
+	PS5000A_CONDITIONS_INFO info = PS5000A_CLEAR;
+	PS5000A_CONDITIONS_INFO pwqInfo = PS5000A_CLEAR;
+
+	int16_t auxOutputEnabled = 0; // Not used by function call
+
+	recordTrigger(channelProperties, nChannelProperties, triggerConditions, nTriggerConditions, directions, nDirections, pwq, delay, autoTriggerUs);
+
+	status = ps5000aSetTriggerChannelPropertiesV2(unit->handle, channelProperties, nChannelProperties, auxOutputEnabled);
+
+	if (status != PICO_OK) 
+	{
+		printf("setTrigger:ps5000aSetTriggerChannelPropertiesV2 ------ Ox%08lx \n", status);
+		return status;
+	}
+
+	if (nTriggerConditions != 0)
+	{
+		info = (PS5000A_CONDITIONS_INFO)(PS5000A_CLEAR | PS5000A_ADD); // Clear and add trigger condition specified unless no trigger conditions have been specified
+	}
+
+	status = ps5000aSetTriggerChannelConditionsV2(unit->handle, triggerConditions, nTriggerConditions, info);
+
+	if (status != PICO_OK)
+	{
+		printf("setTrigger:ps5000aSetTriggerChannelConditionsV2 ------ 0x%08lx \n", status);
+		return status;
+	}
+
+	status = ps5000aSetTriggerChannelDirectionsV2(unit->handle, directions, nDirections);
+
+	if (status != PICO_OK) 
+	{
+		printf("setTrigger:ps5000aSetTriggerChannelDirectionsV2 ------ 0x%08lx \n", status);
+		return status;
+	}
+
+	status = ps5000aSetAutoTriggerMicroSeconds(unit->handle, autoTriggerUs);
+
+	if (status != PICO_OK)
+	{
+		printf("setTrigger:ps5000aSetAutoTriggerMicroSeconds ------ 0x%08lx \n", status);
+		return status;
+	}
+
+	status = ps5000aSetTriggerDelay(unit->handle, delay);
+	
+	if (status != PICO_OK)
+	{
+		printf("setTrigger:ps5000aSetTriggerDelay ------ 0x%08lx \n", status);
+		return status;
+	}
+
+	// Clear and add pulse width qualifier condition, clear if no pulse width qualifier has been specified
+	if (pwq->nPwqConditions != 0)
+	{
+		pwqInfo = (PS5000A_CONDITIONS_INFO)(PS5000A_CLEAR | PS5000A_ADD);
+	}
+
+	status = ps5000aSetPulseWidthQualifierConditions(unit->handle, pwq->pwqConditions, pwq->nPwqConditions, pwqInfo);
+
+	if (status != PICO_OK)
+	{
+		printf("setTrigger:ps5000aSetPulseWidthQualifierConditions ------ 0x%08lx \n", status);
+		return status;
+	}
+
+	status = ps5000aSetPulseWidthQualifierDirections(unit->handle, pwq->pwqDirections, pwq->nPwqDirections);
+
+	if (status != PICO_OK)
+	{
+		printf("setTrigger:ps5000aSetPulseWidthQualifierDirections ------ 0x%08lx \n", status);
+		return status;
+	}
+
+	status = ps5000aSetPulseWidthQualifierProperties(unit->handle, pwq->lower, pwq->upper, pwq->type);
+
+	if (status != PICO_OK)
+	{
+		printf("setTrigger:ps5000aSetPulseWidthQualifierProperties ------ Ox%08lx \n", status);
+		return status;
+	}
+
+	return status;
+}
+
+/****************************************************************************
+* powerChanged
+*
+* Statuses by which the driver reports a change of the power source
+* (PicoScope 5X4XA/B/D +5 V supply, 524XD on a non-USB 3.0 port)
+****************************************************************************/
+int16_t powerChanged(PICO_STATUS status)
+{
+	return status == PICO_POWER_SUPPLY_CONNECTED || status == PICO_POWER_SUPPLY_NOT_CONNECTED ||
+			status == PICO_USB3_0_DEVICE_NON_USB3_0_PORT || status == PICO_POWER_SUPPLY_UNDERVOLTAGE;
+}
+
+/****************************************************************************
+* resumeStreaming
+*
+* Gets streaming going again after the power source change reported by
+* 'status', without asking: acknowledges the change, waits for the +5 V
+* supply if channel C or D is enabled on a 4 channel unit, sets the
+* channels, the trigger and the driver buffers again and restarts
+* streaming with the same settings. 'trigger' is the trigger to arm again,
+* with 'preTrigger' samples before it, or NULL once the trigger has been
+* seen, when streaming goes on untriggered for the 'samples' still to come.
+* Gives up after g_powerRecoverySeconds or on a key press.
+****************************************************************************/
+PICO_STATUS resumeStreaming(UNIT * unit, PICO_STATUS status, int16_t ** buffers, uint32_t bufferSamples, uint32_t * sampleInterval,
+							PS5000A_TIME_UNITS timeUnits, TRIGGER_SETTINGS * trigger, uint32_t preTrigger, uint32_t samples, int16_t autostop,
+							uint32_t downsampleRatio, PS5000A_RATIO_MODE ratioMode)
+{
+	uint64_t deadline = perfNow() + (uint64_t) g_powerRecoverySeconds * 1000000000ULL;
+	int16_t needSupply = unit->channelCount == QUAD_SCOPE &&
+							(unit->channelSettings[PS5000A_CHANNEL_C].enabled || unit->channelSettings[PS5000A_CHANNEL_D].enabled);
+	int32_t i;
+
+	ps5000aStop(unit->handle);
+
+	while (perfNow() < deadline && !_kbhit())
+	{
+		if (powerChanged(status))
+		{
+			// Undervoltage can only be cleared by the +5 V supply
+			if (ps5000aChangePowerSource(unit->handle, status == PICO_POWER_SUPPLY_UNDERVOLTAGE ? PICO_POWER_SUPPLY_CONNECTED : status) != PICO_OK)
+			{
+				Sleep(50);
+				continue;
+			}
+		}
+
+		if (needSupply && ps5000aCurrentPowerSource(unit->handle) == PICO_POWER_SUPPLY_NOT_CONNECTED)
+		{
+			status = PICO_OK;
+			Sleep(50);
+			continue;
+		}
+
+		setDefaults(unit);
+
+		if (trigger != NULL)
+		{
+			setTrigger(unit, trigger->properties, trigger->nProperties, trigger->conditions, trigger->nConditions,
+						trigger->directions, trigger->nDirections, &trigger->pwq, trigger->delay, trigger->autoTriggerUs);
+		}
+		else
+		{
+			ps5000aSetSimpleTrigger(unit->handle, 0, PS5000A_EXTERNAL, 0, PS5000A_RISING, 0, 0);
+		}
+
+		for (i = 0; i < unit->channelCount; i++)
+		{
+			if (unit->channelSettings[i].enabled)
+			{
+				ps5000aSetDataBuffers(unit->handle, (PS5000A_CHANNEL) i, buffers[i * 2], buffers[i * 2 + 1], bufferSamples, 0, PS5000A_RATIO_MODE_NONE);
+			}
+		}
+
+		status = ps5000aRunStreaming(unit->handle, sampleInterval, timeUnits, trigger != NULL ? preTrigger : 0, samples, autostop,
+										downsampleRatio, ratioMode, bufferSamples);
+
+		if (status == PICO_OK)
+		{
+			return PICO_OK;
+		}
+
+		if (!powerChanged(status))
+		{
+			printf("resumeStreaming:ps5000aRunStreaming ------ 0x%08x \n", status);
+			return status;
+		}
+	}
+
+	printf("\nStreaming could not be resumed\n");
+	return status != PICO_OK ? status : PICO_POWER_SUPPLY_NOT_CONNECTED;
+}
+
+/****************************************************************************
+* streamDataHandler
+* - Used by the two stream data examples - untriggered and triggered
+* Inputs:
+* - unit - the unit to sample on
+* - preTrigger - the number of samples in the pre-trigger phase 
+*					(0 if no trigger has been set)
+***************************************************************************/
+void streamDataHandler(UNIT * unit, uint32_t preTrigger)
+{
+	//Variabili utili
+	int32_t i;
+	uint32_t sampleCount = 50000; /* make sure overview buffer is large enough */
+	double intervalNs;
+	int16_t * buffers[2 * PS5000A_MAX_CHANNELS];
+	PIPELINE * pipe;
+	PIPE_BLOCK * block = NULL;
+	STREAM_CONTEXT context;
+	PICO_STATUS status;
+	PICO_STATUS powerStatus;
+	uint32_t sampleInterval;
+	int32_t index = 0;
+	int32_t totalSamples;
+	uint32_t postTrigger;
+	int16_t autostop;
+	uint32_t downsampleRatio;
+	uint32_t triggeredAt = 0;
+	PS5000A_TIME_UNITS timeUnits;
+	PS5000A_RATIO_MODE ratioMode;
+	int16_t retry = 0;
+	int16_t powerChange = 0;
+	uint32_t numStreamingValues = 0;
+	uint64_t start;
+	uint64_t lostAt;
+	uint64_t outageNs = 0;
+	uint64_t totalOutageNs = 0;
+	int32_t gap = 0;
+	int32_t lostSamples = 0;
+	int32_t droppedSamples = 0;
+	uint32_t outages = 0;
+
+	int num_of_samples = 0;
+	BUFFER_INFO bufferInfo;
+
+	//Non ci interessa
+	powerStatus = ps5000aCurrentPowerSource(unit->handle);
+	
+	for (i = 0; i < unit->channelCount; i++) 
+	{
+		if (i >= DUAL_SCOPE && unit->channelCount == QUAD_SCOPE && powerStatus == PICO_POWER_SUPPLY_NOT_CONNECTED)
+		{
+			// No need to set the channels C and D if Quad channel scope and power supply not connected.
+		}
+		else
+		{
+			if (unit->channelSettings[i].enabled)
+			{
+				buffers[i * 2] = (int16_t*) bufferAlloc(sampleCount * sizeof(int16_t));
+				buffers[i * 2 + 1] = (int16_t*) bufferAlloc(sampleCount * sizeof(int16_t));
+			
+				status = ps5000aSetDataBuffers(unit->handle, (PS5000A_CHANNEL)i, buffers[i * 2], buffers[i * 2 + 1], sampleCount, 0, PS5000A_RATIO_MODE_NONE);
+
+				printf(status?"StreamDataHandler:ps5000aSetDataBuffers(channel %ld) ------ 0x%08lx \n":"", i, status);
+			}
+		}
+	}
+	
+	downsampleRatio = 1;
+	timeUnits = PS5000A_US;
+	sampleInterval = 1;
+	ratioMode = PS5000A_RATIO_MODE_NONE;
+	preTrigger = 0;
+	postTrigger = 1000000;
+	autostop = TRUE;
+	
+	bufferInfo.unit = unit;	
+	bufferInfo.driverBuffers = buffers;
+	bufferInfo.block = NULL;
+
+	if (autostop)
+	{
+		printf("\nStreaming Data for %lu samples", postTrigger / downsampleRatio);
+		
+		if (preTrigger)	// We pass 0 for preTrigger if we're not setting up a trigger
+		{
+			printf(" after the trigger occurs\nNote: %lu Pre Trigger samples before Trigger arms\n\n",preTrigger / downsampleRatio);
+		}
+		else
+		{
+			printf("\n\n");
+		}
+	}
+	else
+	{
+		printf("\nStreaming Data continually.\n\n");
+	}
+
+	g_autoStopped = FALSE;
+
+	bufferReport();
+	rtEnter(&g_rtOptions);
+
+	for (i = 0; i < unit->channelCount; i++)
+	{
+		if (unit->channelSettings[i].enabled)
+		{
+			rtPrefault(buffers[i * 2], sampleCount * sizeof(int16_t));
+			rtPrefault(buffers[i * 2 + 1], sampleCount * sizeof(int16_t));
+		}
+	}
+
+	do
+	{
+		retry = 0;
+
+		status = ps5000aRunStreaming(unit->handle, &sampleInterval, timeUnits, preTrigger, postTrigger, autostop, 
+										downsampleRatio, ratioMode, sampleCount);
+
+		if (status != PICO_OK)
+		{
+			// PicoScope 5X4XA/B/D devices...+5 V PSU connected or removed or
+			// PicoScope 524XD devices on non-USB 3.0 port
+			if (status == PICO_POWER_SUPPLY_CONNECTED || status == PICO_POWER_SUPPLY_NOT_CONNECTED ||
+						status == PICO_USB3_0_DEVICE_NON_USB3_0_PORT || status == PICO_POWER_SUPPLY_UNDERVOLTAGE)		
+			{
+				status = changePowerSource(unit->handle, status, unit);
+				retry = 1;
+			}
+			else
+			{
+				printf("streamDataHandler:ps5000aRunStreaming ------ 0x%08lx \n", status);
+				rtLeave();
+				return;
+			}
+		}
+	}
+	while (retry);
+
+	printf("Streaming data...Press a key to stop\n");
+
+	
+	// sampleInterval has been updated by ps5000aRunStreaming to the interval actually used
+	intervalNs = sampleInterval;
+
+	for (i = timeUnits; i < PS5000A_NS; i++)
+	{
+		intervalNs /= 1000.0;
+	}
+
+	for (i = PS5000A_NS; i < (int32_t) timeUnits; i++)
+	{
+		intervalNs *= 1000.0;
+	}
+
+	totalSamples = 0;
+	pipe = openStreamPipeline(unit, &context, intervalNs * downsampleRatio, preTrigger, sampleCount, g_pipePolicy);
+
+	while (pipe != NULL && !_kbhit() && !g_autoStopped)
+	{
+		// Waits here only when every block is in use and the policy is to block
+		if (block == NULL)
+		{
+			block = pipeAcquire(pipe);
+			bufferInfo.block = block;
+		}
+
+		/* Poll until data is received. Until then, GetStreamingLatestValues wont call the callback */
+		g_ready = FALSE;
+
+		start = perfNow();
+		status = ps5000aGetStreamingLatestValues(unit->handle, callBackStreaming, &bufferInfo);
+		perfSince(PERF_STREAM_POLL, start);
+
+		if (!g_ready)
+		{
+			rtRelax();
+		}
+
+		// PicoScope 5X4XA/B/D devices...+5 V PSU connected or removed or
+		// PicoScope 524XD devices on non-USB 3.0 port
+		if (powerChanged(status))
+		{
+			printf("\n\nPower Source Change");
+			lostAt = perfNow();
+
+			// Streaming goes on for the samples still to come, the time without data is a gap in the output.
+			// Until the trigger is seen it is armed again as it was; after it, autostop counts from the trigger
+			if (g_powerRecoverySeconds == 0 ||
+				resumeStreaming(unit, status, buffers, sampleCount, &sampleInterval, timeUnits,
+								num_of_samples ? NULL : &g_lastTrigger, preTrigger,
+								!num_of_samples ? postTrigger : postTrigger > (uint32_t) totalSamples - triggeredAt ? postTrigger - ((uint32_t) totalSamples - triggeredAt) : 1,
+								autostop, downsampleRatio, ratioMode) != PICO_OK)
+			{
+				if (status == PICO_POWER_SUPPLY_UNDERVOLTAGE && g_powerRecoverySeconds == 0)
+				{
+					changePowerSource(unit->handle, status, unit);
+				}
+
+				powerChange = 1;
+				break;
+			}
+
+			outageNs += perfNow() - lostAt;
+			gap = (int32_t)((double) outageNs / (intervalNs * downsampleRatio));
+			outages++;
+			metricsAdd(METRIC_POWER_CHANGES, 1);
+			metricsAdd(METRIC_OUTAGE_MS, (perfNow() - lostAt) / 1000000);
+			printf(", streaming resumed after %.1f ms\n", (double)(perfNow() - lostAt) / 1e6);
+			continue;
+		}
+
+		index ++;
+
+		if (g_ready && g_sampleCount > 0) /* Can be ready and have no data, if autoStop has fired */
+		{
+			if (outageNs != 0)
+			{
+				STREAM_BLOCK * header = (STREAM_BLOCK *) block->user;
+
+				header->gap = gap;
+				header->outageNs = outageNs;
+				totalSamples += gap;
+				lostSamples += gap;
+				totalOutageNs += outageNs;
+				outageNs = 0;
+			}
+
+			if (g_trig)
+			{
+				triggeredAt = totalSamples + g_trigAt;		// Calculate where the trigger occurred in the total samples collected
+				num_of_samples += 1;
+			}
+
+			droppedSamples += queueStreamBlock(pipe, block, index, &totalSamples, sampleCount);
+			block = NULL;
+		}
+	}
+
+	if (block != NULL)
+	{
+		pipeRelease(pipe, block);
+	}
+
+	closeStreamPipeline(&context, pipe);
+
+	if (context.previewing && num_of_samples)
+	{
+		printf("Triggered at sample %u\n", triggeredAt + 1);
+	}
+
+	if (outages > 0)
+	{
+		printf("Power source changes: %u, no data for %.1f ms (%d samples)\n", outages, (double) totalOutageNs / 1e6, lostSamples);
+	}
+
+	if (droppedSamples > 0)
+	{
+		printf("No memory to copy %d samples out of the driver buffers, they are missing from the output\n", droppedSamples);
+	}
+
+	ps5000aStop(unit->handle);
+	rtLeave();
+
+	if (!g_autoStopped && !powerChange)  
+	{
+		printf("\nData collection aborted\n");
+		_getch();
+	}
+	else
+	{
+		printf("\nData collection complete.\n\n");
+	}
+	
+	for (i = 0; i < unit->channelCount; i++) 
+	{
+		if(unit->channelSettings[i].enabled)
+		{
+			bufferFree(buffers[i * 2], sampleCount * sizeof(int16_t));
+			bufferFree(buffers[i * 2 + 1], sampleCount * sizeof(int16_t));
+		}
+	}
+
+	clearDataBuffers(unit);
+}
+
+/****************************************************************************
+* Rapid block pipeline stages
+*
+* analyze - live preview or console dump of the capture
+* average - adds the capture to the sums, only the last capture of each
+*           group goes on, with the averaged record (only when averaging)
+* filter  - filtered or demodulated data of the capture (only when enabled)
+* convert - text lines of block.txt and records of block_binary.txt, or the
+*           averaged record
+* write   - block.txt, block_binary.txt, block_dsp.txt and the waveform file,
+*           in capture order
+****************************************************************************/
+PIPE_RESULT rapidAnalyze(PIPE_BLOCK * block, void * context)
+{
+	RAPID_CONTEXT * rapid = (RAPID_CONTEXT *) context;
+	UNIT * unit = rapid->unit;
+	uint32_t capture = ((RAPID_BLOCK *) block->user)->capture;
+	PS5000A_TRIGGER_INFO * triggerInfo = rapid->triggerInfo;
+	uint64_t timeStampCounterDiff;
+	int16_t channel;
+	int32_t i;
+
+	if (rapid->previewing)
+	{
+		for (channel = 0; channel < unit->channelCount; channel++)
+		{
+			if (unit->channelSettings[channel].enabled)
+			{
+				previewPush(channel, rapid->rapidBuffers[channel][capture], NULL, rapid->nSamples);
+			}
+		}
+
+		previewStatus("capture %d of %d, trigger index %u, timestamp %llu", capture + 1, rapid->nCaptures,
+						triggerInfo[capture].triggerIndex, (unsigned long long) triggerInfo[capture].timeStampCounter);
+		previewPublish();
+		return PIPE_FORWARD;
+	}
+
+	printf("\n");
+	printf("Capture index %d:-\n\n", capture);
+
+	// Trigger Info status & Timestamp 
+	printf("Trigger Info:- Status: %u  Trigger index: %u  Timestamp Counter: %I64u\n", triggerInfo[capture].status, triggerInfo[capture].triggerIndex, triggerInfo[capture].timeStampCounter);
+
+	// Calculate time between trigger events - the first timestamp is arbitrary so is only used to calculate offsets
+
+	// The structure containing the status code with bit flag PICO_DEVICE_TIME_STAMP_RESET will have an arbitrary timeStampCounter value. 
+	// This should be the first segment in each run, so in this case segment 0 will be ignored.
+
+	if (capture == 0)
+	{
+		// Nothing to display
+		printf("\n");
+	}
+	else if (capture > 0 && triggerInfo[capture].status == PICO_OK)
+	{
+		timeStampCounterDiff = triggerInfo[capture].timeStampCounter - triggerInfo[capture - 1].timeStampCounter;
+		printf("Time since trigger for last segment: %I64u ns\n\n", (timeStampCounterDiff * (uint64_t)rapid->timeIntervalNs));
+	}
+	else
+	{
+		// Do nothing
+	}
+
+	for (channel = 0; channel < unit->channelCount; channel++)
+	{
+		if (unit->channelSettings[channel].enabled)
+		{
+			printf("Channel %c:\t", 'A' + channel);
+		}
+	}
+
+	printf("\n\n");
+
+	for (i = 0; i < 10; i++)
+	{
+		for (channel = 0; channel < unit->channelCount; channel++)
+		{
+			if (unit->channelSettings[channel].enabled)
+			{
+				printf("   %6d       ", scaleVoltages ?
+					adc_to_mv(rapid->rapidBuffers[channel][capture][i], unit->channelSettings[PS5000A_CHANNEL_A + channel].range, unit)	// If scaleVoltages, print mV value
+					: rapid->rapidBuffers[channel][capture][i]);																	// else print ADC Count
+			}
+		}
+
+		printf("\n");
+	}
+
+	return PIPE_FORWARD;
+}
+
+PIPE_RESULT rapidAverage(PIPE_BLOCK * block, void * context)
+{
+	RAPID_CONTEXT * rapid = (RAPID_CONTEXT *) context;
+	RAPID_BLOCK * header = (RAPID_BLOCK *) block->user;
+	uint32_t capture = header->capture;
+	uint32_t captures = 0;
+	size_t bytes = (size_t) rapid->unit->channelCount * 2 * rapid->nSamples * sizeof(float);
+	float * results;
+	int16_t channel;
+
+	for (channel = 0; channel < rapid->unit->channelCount; channel++)
+	{
+		if (rapid->average[channel] != NULL)
+		{
+			averageAdd(rapid->average[channel], rapid->rapidBuffers[channel][capture]);
+			captures = averageCount(rapid->average[channel]);
+		}
+	}
+
+	rapid->averageOverflow |= rapid->overflow[capture];
+	// The samples are in the sums, their buffer can take another capture
+	atomicAdd32(&rapid->released, 1);
+
+	if (captures < rapid->averageCaptures && capture + 1 < rapid->nCaptures)
+	{
+		return PIPE_DISCARD;
+	}
+
+	// Mean and deviation of each channel, nSamples floats each
+	if ((results = (float *) pipeReserve(&block->buffers[3], bytes)) == NULL)
+	{
+		printf("rapidAverage: no memory for the record of captures %u to %u\n", capture + 1 - captures, capture);
+		return PIPE_DISCARD;
+	}
+
+	for (channel = 0; channel < rapid->unit->channelCount; channel++)
+	{
+		if (rapid->average[channel] != NULL)
+		{
+			averageResult(rapid->average[channel], &results[(size_t)(channel * 2) * rapid->nSamples],
+							&results[(size_t)(channel * 2 + 1) * rapid->nSamples]);
+			averageReset(rapid->average[channel]);
+		}
+	}
+
+	block->buffers[3].length = bytes;
+	header->capture = capture + 1 - captures;
+	header->captures = captures;
+	header->overflow = rapid->averageOverflow;
+	rapid->averageOverflow = 0;
+	rapid->records++;
+	return PIPE_FORWARD;
+}
+
+PIPE_RESULT rapidFilter(PIPE_BLOCK * block, void * context)
+{
+	RAPID_CONTEXT * rapid = (RAPID_CONTEXT *) context;
+	uint32_t capture = ((RAPID_BLOCK *) block->user)->capture;
+	const int16_t * samples[PS5000A_MAX_CHANNELS];
+	int16_t channel;
+
+	// Captures are not contiguous, each one starts from clear filters
+	for (channel = 0; channel < rapid->unit->channelCount; channel++)
+	{
+		samples[channel] = rapid->dsp[channel] != NULL ? rapid->rapidBuffers[channel][capture] : NULL;
+
+		if (rapid->dsp[channel] != NULL)
+		{
+			dspReset(rapid->dsp[channel], 0);
+		}
+	}
+
+	filterSamples(rapid->unit, rapid->dsp, samples, rapid->nSamples, (double) g_times[0], (double) rapid->timeIntervalNs, (int32_t) capture, &block->buffers[2]);
+	return PIPE_FORWARD;
+}
+
+/* Averaged record: text lines in mV (or counts) and rounded ADC counts for the waveform file */
+void convertAverage(RAPID_CONTEXT * rapid, PIPE_BLOCK * block)
+{
+	UNIT * unit = rapid->unit;
+	RAPID_BLOCK * header = (RAPID_BLOCK *) block->user;
+	const float * results = (const float *) block->buffers[3].data;
+	size_t n = rapid->nSamples;
+	PIPE_BUFFER * text = &block->buffers[0];
+	int16_t * counts = (int16_t *) pipeReserve(&block->buffers[1], (size_t) unit->channelCount * n * sizeof(int16_t));
+	double mvPerCount[PS5000A_MAX_CHANNELS];
+	uint32_t i;
+	int16_t j;
+
+	if (rapid->fp != NULL)
+	{
+		pipePrintf(text, "Captures %u to %u (%u averaged)\n", header->capture, header->capture + header->captures - 1, header->captures);
+		pipePrintf(text, "Time (ns)");
+	}
+
+	for (j = 0; j < unit->channelCount; j++)
+	{
+		mvPerCount[j] = (double) inputRanges[unit->channelSettings[j].range] / unit->maxADCValue;
+
+		if (rapid->fp != NULL && rapid->average[j] != NULL && rapid->raw)
+		{
+			pipePrintf(text, g_averageDeviation ? "\tADC_ch%c\tSD_ADC_ch%c" : "\tADC_ch%c", 'A' + j, 'A' + j);
+		}
+		else if (rapid->fp != NULL && rapid->average[j] != NULL)
+		{
+			pipePrintf(text, g_averageDeviation ? "\tADC_ch%c\tmV_ch%c\tSD_mV_ch%c" : "\tADC_ch%c\tmV_ch%c", 'A' + j, 'A' + j, 'A' + j);
+		}
+	}
+
+	if (rapid->fp != NULL)
+	{
+		pipePrintf(text, "\n");
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		if (rapid->fp != NULL)
+		{
+			pipePrintf(text, "%i", g_times[0] + (int32_t) i * rapid->timeIntervalNs);
+		}
+
+		for (j = 0; j < unit->channelCount; j++)
+		{
+			if (rapid->average[j] != NULL)
+			{
+				float mean = results[(size_t)(j * 2) * n + i];
+				float deviation = results[(size_t)(j * 2 + 1) * n + i];
+
+				if (counts != NULL)
+				{
+					counts[(size_t) j * n + i] = (int16_t) lrintf(mean);
+				}
+
+				if (rapid->fp != NULL && rapid->raw)
+				{
+					pipePrintf(text, g_averageDeviation ? "\t%.2f\t%.2f" : "\t%.2f", mean, deviation);
+				}
+				else if (rapid->fp != NULL)
+				{
+					pipePrintf(text, g_averageDeviation ? "\t%.2f\t%+.3f\t%.3f" : "\t%.2f\t%+.3f", mean, mean * mvPerCount[j], deviation * mvPerCount[j]);
+				}
+			}
+		}
+
+		if (rapid->fp != NULL)
+		{
+			pipePrintf(text, "\n");
+		}
+	}
+
+	if (counts != NULL)
+	{
+		block->buffers[1].length = (size_t) unit->channelCount * n * sizeof(int16_t);
+	}
+}
+
+PIPE_RESULT rapidConvert(PIPE_BLOCK * block, void * context)
+{
+	RAPID_CONTEXT * rapid = (RAPID_CONTEXT *) context;
+	UNIT * unit = rapid->unit;
+	uint32_t capture = ((RAPID_BLOCK *) block->user)->capture;
+	PIPE_BUFFER * text = rapid->fp != NULL ? &block->buffers[0] : NULL;
+	PIPE_BUFFER * binary = rapid->fbin != NULL ? &block->buffers[1] : NULL;
+	uint64_t start = perfNow();
+	BLOCK_CAPTURE samples;
+	int j;
+
+	if (((RAPID_BLOCK *) block->user)->captures != 0)
+	{
+		convertAverage(rapid, block);
+		perfSince(PERF_BLOCK_CONVERT, start);
+		return PIPE_FORWARD;
+	}
+
+	for (j = 0; j < 2; j++)
+	{
+		samples.channel[j] = unit->channelSettings[j].enabled ? rapid->rapidBuffers[j][capture] : NULL;
+		samples.rangeMv[j] = inputRanges[unit->channelSettings[j].range];
+	}
+
+	samples.maxADCValue = unit->maxADCValue;
+	samples.nSamples = rapid->nSamples;
+	samples.firstTime = (int32_t) g_times[0];
+	samples.intervalNs = rapid->timeIntervalNs;
+
+	// Raw captures are ADC counts only, scaled by the run at the head of the files
+	if (rapid->raw)
+	{
+		blockFormatRaw(&samples, text, binary);
+	}
+	else
+	{
+		blockFormatCapture(&samples, text, binary);
+	}
+
+	perfSince(PERF_BLOCK_CONVERT, start);
+	return PIPE_FORWARD;
+}
+
+PIPE_RESULT rapidWrite(PIPE_BLOCK * block, void * context)
+{
+	RAPID_CONTEXT * rapid = (RAPID_CONTEXT *) context;
+	UNIT * unit = rapid->unit;
+	RAPID_BLOCK * header = (RAPID_BLOCK *) block->user;
+	uint32_t capture = header->capture;
+	int16_t overflow = header->captures != 0 ? header->overflow : rapid->overflow[capture];
+	uint64_t start = perfNow();
+	WAVE_CHUNK chunk;
+	int16_t channel;
+
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.type = WAVE_CHUNK_CAPTURE;
+	// An averaged record is one segment of the file, timed by its first capture
+	chunk.segment = header->captures != 0 ? capture / rapid->averageCaptures : capture;
+	chunk.nSamples = rapid->nSamples;
+	chunk.firstSample = rapid->triggerInfo[capture].timeStampCounter;
+	chunk.triggerIndex = rapid->triggerInfo[capture].triggerIndex;
+
+	for (channel = 0; channel < unit->channelCount && rapid->wave != NULL; channel++)
+	{
+		if (unit->channelSettings[channel].enabled)
+		{
+			chunk.channel = (uint16_t) channel;
+			chunk.flags = WAVE_CHUNK_TRIGGERED | ((overflow >> channel) & 1 ? WAVE_CHUNK_OVERFLOW : 0) |
+							(rapid->triggerInfo[capture].status & PICO_DEVICE_TIME_STAMP_RESET ? WAVE_CHUNK_TIME_RESET : 0);
+			waveFileWrite(rapid->wave, &chunk, header->captures != 0 ? (int16_t *) block->buffers[1].data + (size_t) channel * rapid->nSamples
+										: rapid->rapidBuffers[channel][capture]);
+		}
+	}
+
+	if (rapid->fp != NULL)
+	{
+		writerWrite(rapid->fp, block->buffers[0].data, block->buffers[0].length);
+	}
+
+	if (rapid->fbin != NULL && header->captures == 0)
+	{
+		writerWrite(rapid->fbin, block->buffers[1].data, block->buffers[1].length);
+	}
+
+	if (rapid->dspFile != NULL)
+	{
+		writerWrite(rapid->dspFile, block->buffers[2].data, block->buffers[2].length);
+	}
+
+	if (header->captures == 0)
+	{
+		atomicAdd32(&rapid->released, 1);
+	}
+
+	perfSince(PERF_BLOCK_WRITE, start);
+	return PIPE_FORWARD;
+}
+
+/****************************************************************************
+* openCaptures / submitCaptures / closeCaptures
+*
+* openCaptures opens the block files and starts the rapid block pipeline
+* over the captures that 'rapidBuffers' will point to. submitCaptures runs
+* captures from..to-1 through it once their samples are in; the stages
+* count off in context->released the captures they are done with, so their
+* buffers can be read into again. closeCaptures lets the rest through and
+* closes the files.
+****************************************************************************/
+PIPELINE * openCaptures(RAPID_CONTEXT * context, UNIT * unit, int16_t *** rapidBuffers, int16_t * overflow, PS5000A_TRIGGER_INFO * triggerInfo,
+						uint32_t nSamples, uint32_t nCaptures, int32_t timeIntervalNs, uint32_t preTrigger)
+{
+	WAVE_RUN waveRun;
+
+	context->fp = replayClash(blockFile) ? NULL : writerOpen((const char *) blockFile, &g_writerOptions);
+	// Averaged records are not ADC samples, they only go to the text and waveform files
+	context->fbin = g_averageCaptures > 0 || replayClash(binaryFile) ? NULL : writerOpen((const char *) binaryFile, &g_writerOptions);
+
+	fillWaveRun(unit, &waveRun, nSamples, preTrigger, timeIntervalNs);
+	context->raw = g_blockRaw;
+
+	if (context->raw)
+	{
+		uint32_t rangeMv[WAVE_MAX_CHANNELS];
+		int16_t ch;
+
+		for (ch = 0; ch < WAVE_MAX_CHANNELS; ch++)
+		{
+			rangeMv[ch] = inputRanges[waveRun.range[ch]];
+		}
+
+		blockWriteRawHeaders(context->fp, context->fbin, &waveRun, rangeMv);
+	}
+
+	context->wave = replayClash(blockWaveFile) ? NULL : waveFileOpen((const char *) blockWaveFile, &g_writerOptions, &waveRun, g_waveOutput, g_waveAppend);
+
+	context->unit = unit;
+	context->rapidBuffers = rapidBuffers;
+	context->overflow = overflow;
+	context->triggerInfo = triggerInfo;
+	context->nSamples = nSamples;
+	context->nCaptures = nCaptures;
+	context->timeIntervalNs = timeIntervalNs;
+	context->previewing = startPreview(unit, g_replay != NULL ? "Rapid block replay" : "Rapid block");
+	context->averageCaptures = startAverage(unit, context->average, nSamples) ? g_averageCaptures : 0;
+	context->averageOverflow = 0;
+	context->records = 0;
+	context->released = 0;
+
+	if (context->averageCaptures > 0)
+	{
+		memset(context->dsp, 0, sizeof(context->dsp));
+		context->dspFile = NULL;
+	}
+
+	// Nothing is lost by waiting here, the captures stay in memory until written
+	return createPipeline("rapid block", sizeof(RAPID_BLOCK), PIPE_POLICY_BLOCK, rapidAnalyze, "average",
+							context->averageCaptures > 0 ? rapidAverage : NULL,
+							context->averageCaptures == 0 && startDsp(unit, context->dsp, timeIntervalNs, blockDspFile, &context->dspFile, TRUE) ? rapidFilter : NULL,
+							rapidConvert, rapidWrite, context);
+}
+
+void submitCaptures(PIPELINE * pipe, uint32_t from, uint32_t to)
+{
+	PIPE_BLOCK * block;
+	uint32_t capture;
+
+	// The captures are already in memory, the stages read them in place
+	for (capture = from; capture < to && pipe != NULL; capture++)
+	{
+		block = pipeAcquire(pipe);
+		((RAPID_BLOCK *) block->user)->capture = capture;
+		pipeSubmit(pipe, block);
+	}
+}
+
+void closeCaptures(RAPID_CONTEXT * context, PIPELINE * pipe)
+{
+	finishPipeline(pipe);
+	stopDsp(context->dsp, &context->dspFile);
+
+	if (context->averageCaptures > 0)
+	{
+		printf("\nAveraged %u captures into %u records (%s)", context->nCaptures, context->records, blockFile);
+		stopAverage(context->average);
+	}
+
+	printf("\n");
+
+	if (context->fp != NULL)
+	{
+		writerClose(context->fp);
+	}
+
+	if (context->fbin != NULL)
+	{
+		writerClose(context->fbin);
+	}
+
+	closeWaveFile(context->wave, blockWaveFile);
+}
+
+/****************************************************************************
+* processCaptures
+*
+* Runs the captures held in 'rapidBuffers' through the rapid block pipeline
+* and writes the block files. The replay of a recording goes through it.
+****************************************************************************/
+void processCaptures(UNIT * unit, int16_t *** rapidBuffers, int16_t * overflow, PS5000A_TRIGGER_INFO * triggerInfo,
+						uint32_t nSamples, uint32_t nCaptures, int32_t timeIntervalNs, uint32_t preTrigger)
+{
+	RAPID_CONTEXT context;
+	PIPELINE * pipe = openCaptures(&context, unit, rapidBuffers, overflow, triggerInfo, nSamples, nCaptures, timeIntervalNs, preTrigger);
+
+	submitCaptures(pipe, 0, nCaptures);
+	closeCaptures(&context, pipe);
+}
+
+/****************************************************************************
+* probeCaptures
+*
+* Completed captures of the run in progress, for the clock correlation
+****************************************************************************/
+int32_t probeCaptures(void * context, uint32_t * completed)
+{
+	return ps5000aGetNoOfCaptures(((UNIT *) context)->handle, completed) == PICO_OK ? 0 : -1;
+}
+
+/****************************************************************************
+* startClockSync
+*
+* Starts asking for the completed captures of the run just armed. Returns
+* TRUE if the sampler is running.
+****************************************************************************/
+int16_t startClockSync(UNIT * unit)
+{
+	if (g_clockSyncUs == 0)
+	{
+		return FALSE;
+	}
+
+	if (g_clockSync == NULL && (g_clockSync = clockSyncCreate()) == NULL)
+	{
+		printf("startClockSync: no memory for the clock correlation\n");
+		return FALSE;
+	}
+
+	return clockSyncStart(g_clockSync, probeCaptures, unit, g_clockSyncUs) == 0;
+}
+
+/****************************************************************************
+* writeCaptureTimes
+*
+* Fits the device time stamps of the captures to the host clocks and writes
+* the host time of every trigger to block_times.txt. Only the captures up
+* to the next reset of the time stamp counter share its origin.
+****************************************************************************/
+void writeCaptureTimes(PS5000A_TRIGGER_INFO * triggerInfo, uint32_t nCaptures, int32_t timeIntervalNs, uint32_t postTrigger)
+{
+	double * completeNs = (double *) malloc(nCaptures * sizeof(double));
+	OUTPUT_WRITER * fp;
+	CLOCK_SYNC_STATS stats;
+	uint64_t monotonicNs;
+	uint64_t unixNs;
+	uint32_t counted;
+	uint32_t capture;
+
+	if (completeNs == NULL)
+	{
+		printf("writeCaptureTimes: no memory for %u captures\n", nCaptures);
+		return;
+	}
+
+	for (counted = 0; counted < nCaptures; counted++)
+	{
+		if (counted > 0 && (triggerInfo[counted].status & PICO_DEVICE_TIME_STAMP_RESET))
+		{
+			break;
+		}
+
+		completeNs[counted] = (double)(triggerInfo[counted].timeStampCounter + postTrigger) * timeIntervalNs;
+	}
+
+	if (clockSyncFit(g_clockSync, completeNs, counted) == 0)
+	{
+		printf("No capture was seen completing, %s not written\n", blockTimesFile);
+		free(completeNs);
+		return;
+	}
+
+	free(completeNs);
+	clockSyncStats(g_clockSync, &stats);
+
+	printf("Capture times (%s): %u pairs, residual %.1f us RMS, window +/-%.1f us", blockTimesFile, stats.runPairs,
+				stats.residualNs / 1000.0, stats.windowNs / 1000.0);
+	printf(stats.driftKnown ? ", device clock %+.2f +/- %.2f ppm\n" : ", drift not known yet\n", stats.driftPpm, stats.driftErrorPpm);
+
+	if ((fp = writerOpen((const char *) blockTimesFile, &g_writerOptions)) == NULL)
+	{
+		return;
+	}
+
+	writerPrintf(fp, "# Trigger times from %u correlation pairs: residual %.0f ns RMS, window +/-%.0f ns", stats.runPairs,
+					stats.residualNs, stats.windowNs);
+	writerPrintf(fp, stats.driftKnown ? ", device clock %+.3f ppm\n" : ", device clock drift not known yet\n", stats.driftPpm);
+	writerPrintf(fp, "Capture\tTimeStampCounter\tUnix (ns)\tMonotonic (ns)\n");
+
+	for (capture = 0; capture < counted; capture++)
+	{
+		clockSyncHost(g_clockSync, (double) triggerInfo[capture].timeStampCounter * timeIntervalNs, &monotonicNs, &unixNs);
+		writerPrintf(fp, "%u\t%llu\t%llu\t%llu\n", capture, (unsigned long long) triggerInfo[capture].timeStampCounter,
+						(unsigned long long) unixNs, (unsigned long long) monotonicNs);
+	}
+
+	writerClose(fp);
+}
+
+/****************************************************************************
+* planRapidMemory
+*
+* Captures read out at a time so that the samples of a run stay within the
+* host memory budget (g_rapidBudgetMb), and the sets of buffers they are
+* read into. A run that fits is read out at once into one set. One that
+* does not is read out in batches into RAPID_BUFFER_SETS sets in turn, each
+* batch written out by the pipeline while the next one is read out, so the
+* captures of a run are only limited by the device memory.
+****************************************************************************/
+uint32_t planRapidMemory(UNIT * unit, uint32_t nCaptures, uint32_t nSamples, uint32_t * sets)
+{
+	uint64_t budget = g_rapidBudgetMb ? (uint64_t) g_rapidBudgetMb << 20 : bufferAvailable() / 2;
+	uint64_t perCapture = 0;
+	uint64_t fixed = 0;
+	uint64_t batch;
+	int16_t channel;
+
+	for (channel = 0; channel < unit->channelCount; channel++)
+	{
+		perCapture += unit->channelSettings[channel].enabled ? (uint64_t) nSamples * sizeof(int16_t) : 0;
+		fixed += unit->channelSettings[channel].enabled ? sizeof(int16_t *) : 0;
+	}
+
+	// Trigger information, overflow flags and buffer pointers are kept for every capture
+	fixed = (uint64_t) nCaptures * (fixed + sizeof(PS5000A_TRIGGER_INFO) + unit->channelCount * sizeof(int16_t));
+	*sets = 1;
+
+	if (budget == 0 || perCapture == 0 || fixed + nCaptures * perCapture <= budget)
+	{
+		return nCaptures;
+	}
+
+	*sets = RAPID_BUFFER_SETS;
+	batch = budget > fixed ? (budget - fixed) / (RAPID_BUFFER_SETS * perCapture) : 0;
+
+	if (batch == 0)
+	{
+		printf("planRapidMemory: the budget of %.1f MB is too small for this run, reading out 1 capture at a time\n", budget / 1048576.0);
+		batch = 1;
+	}
+
+	printf("Memory plan: %u captures need %.1f MB, over the budget of %.1f MB. Reading out %u captures at a time into %u sets of %.1f MB.\n",
+			nCaptures, (fixed + nCaptures * perCapture) / 1048576.0, budget / 1048576.0, (uint32_t) batch, RAPID_BUFFER_SETS,
+			batch * perCapture / 1048576.0);
+	return (uint32_t) batch;
+}
+
+/****************************************************************************
+* freeRapidBuffers
+*
+* Frees the sample buffers of a rapid block run, also when only some of them
+* could be allocated
+****************************************************************************/
+void freeRapidBuffers(UNIT * unit, int16_t *** rapidBuffers, int16_t * rapidData[RAPID_BUFFER_SETS][PS5000A_MAX_CHANNELS], uint32_t sets, size_t rapidBytes)
+{
+	int16_t channel;
+	uint32_t set;
+
+	for (channel = 0; channel < unit->channelCount; channel++)
+	{
+		for (set = 0; set < sets; set++)
+		{
+			bufferFree(rapidData[set][channel], rapidBytes);
+		}
+
+		if (rapidBuffers != NULL)
+		{
+			free(rapidBuffers[channel]);
+		}
+	}
+
+	free(rapidBuffers);
+}
+
+/****************************************************************************
+* collectRapidBlock
+*  this function demonstrates how to collect a set of captures using
+*  rapid block mode.
+****************************************************************************/
+void collectRapidBlock(UNIT * unit)
+{
+	int num_of_waveforms = 1000;
+	int num_of_points = 2000;
+	int num_of_points_pre_trigger = 500;
+	int num_of_points_post_trigger = 1500;
+
+	int16_t init_trigger_voltage = 500;
+	PS5000A_CHANNEL init_trigger_channel = PS5000A_EXTERNAL;
+
+	int8_t ch = '.';
+	
+	while(ch != 'S')
+	{
+		printf("\n\n");
+		printf("ACTUAL OPTIONS FOR BLOCK DATA CAPTURE (DATA STRUCTURE)\n\n");
+		printf("Number of waveforms = %i\n", num_of_waveforms);
+		printf("Number of Points per waveform = %i\n", num_of_points);
+		printf("Number of Points pre-trigger = %i\n", num_of_points_pre_trigger);
+		printf("Number of Points post-trigger = %i\n", num_of_points_post_trigger);
+
+		if (g_averageCaptures > 0)
+		{
+			printf("Averaging = 1 record per %u waveforms, standard deviation %s\n", g_averageCaptures, g_averageDeviation ? "On" : "Off");
+		}
+		else
+		{
+			printf("Averaging = Off\n");
+		}
+
+		printf("\n");
+
+		printf("ACTUAL OPTIONS FOR BLOCK DATA CAPTURE (TRIGGER OPTIONS)\n\n");
+		switch (init_trigger_channel)
+		{
+			case PS5000A_CHANNEL_A:
+				printf("Trigger Channel = A\n");
+				break;
+			case PS5000A_CHANNEL_B:
+				printf("Trigger Channel = B\n");
+				break;
+			case PS5000A_CHANNEL_C:
+				printf("Trigger Channel = C\n");
+				break;
+			case PS5000A_CHANNEL_D:
+				printf("Trigger Channel = D\n");
+				break;
+			case PS5000A_EXTERNAL:
+				printf("Trigger Channel = EXT\n");
+				break;
+			default:
+				printf("Trigger Channel not found\n");
+				break;
+		}
+		printf("Trigger Voltage = %i\n mV", init_trigger_voltage);
+
+		printf("\n");
+		printf("Please select operation:\n\n");
+
+		printf("W - Set Number of Waveforms		P - Set Number of Points per waveform\n");
+		printf("F - Set Number of Points pre-trigger	L - Set Number of points post-trigger\n");
+		printf("\n");
+		printf("C - Set Trigger channel 		V - Set Trigger Voltage\n");
+		printf("\n");
+		printf("A - Set averaging			D - Standard deviation On/Off\n");
+		printf("\n");
+		printf("S - Continue\n");
+		printf("Operation:");
+
+		ch = toupper(_getch());
+
+		printf("\n\n");
+
+		switch (ch)
+		{
+			case 'W':
+				printf("Number of waveforms to collect:");
+				scanf_s("%i", &num_of_waveforms);
+				break;
+			case 'P':
+				printf("Number of points per waveform to collect:");
+				scanf_s("%i", &num_of_points);
+				do
+				{
+					printf("Number of points pre-trigger to collect:");
+					scanf_s("%i", &num_of_points_pre_trigger);
+					num_of_points_post_trigger = num_of_points - num_of_points_pre_trigger;
+					if(num_of_points_pre_trigger > num_of_points || num_of_points_pre_trigger < 0)
+					{
+						printf("Invalid value: Number of points pre-trigger is greater than Number of points. Please set a valid value\n");
+					}				
+				} while(num_of_points_pre_trigger > num_of_points || num_of_points_pre_trigger < 0);
+				break;
+			case 'F':
+				do
+				{
+					printf("Number of points pre-trigger to collect:");
+					scanf_s("%i", &num_of_points_pre_trigger);
+					num_of_points_post_trigger = num_of_points - num_of_points_pre_trigger;
+					if(num_of_points_pre_trigger > num_of_points || num_of_points_pre_trigger < 0)
+					{
+						printf("Invalid value: Number of points pre-trigger is greater than Number of points. Please set a valid value\n");
+					}
+				}while (num_of_points_pre_trigger > num_of_points || num_of_points_pre_trigger < 0);
+				break;
+			case 'L': 
+				do
+				{
+					printf("Number of points post-trigger to collect:");
+					scanf_s("%i", &num_of_points_post_trigger);
+					num_of_points_pre_trigger = num_of_points - num_of_points_post_trigger;
+					if(num_of_points_post_trigger > num_of_points || num_of_points_post_trigger < 0)
+					{
+						printf("Invalid value: Number of points post-trigger is greater than Number of points. Please set a valid value\n");
+					}
+				}while (num_of_points_post_trigger > num_of_points || num_of_points_post_trigger < 0);
+				break;
+			case 'S':
+				break;
+			case 'C':
+				do
+				{
+					printf("0 -> A\n");
+					printf("1 -> B\n");
+					printf("2 -> C\n");
+					printf("3 -> D\n");
+					printf("4 -> EXT\n");
+					printf("\n");
+					printf("Trigger Channel:");
+					scanf_s("%i", &init_trigger_channel);	
+					if(init_trigger_channel > 4 || init_trigger_channel < 0)
+					{
+						printf("Invalid value: Channel value out of range. Please set a valid value\n");
+					}
+				}while(init_trigger_channel > 4 || init_trigger_channel < 0);
+				break;
+			case 'V':
+				do
+				{
+					printf("Trigger Voltage:");
+					scanf_s("%hi", &init_trigger_voltage);
+					if(init_trigger_voltage < -5000 || init_trigger_voltage > 5000) 
+					{
+						printf("Trigger Voltage out of range (over 5V). Please set a valid value\n");
+					}
+				}while(init_trigger_voltage < -5000 || init_trigger_voltage > 5000);
+				break;
+			case 'A':
+				printf("Waveforms averaged into each record (0 for off):");
+				scanf_s("%u", &g_averageCaptures);
+				break;
+			case 'D':
+				g_averageDeviation = !g_averageDeviation;
+				break;
+			default:
+				printf("Invalid Operation\n");
+				break;
+		}
+
+	}
+
+	printf("\n\n");
+
+	uint32_t	nCaptures;
+	uint32_t	nSegments;
+	int32_t		nMaxSamples;
+	uint32_t	nSamples = num_of_points;
+	int32_t		timeIndisposed;
+	uint32_t	capture;
+	int16_t		channel;
+	int16_t***	rapidBuffers;
+	int16_t*	rapidData[RAPID_BUFFER_SETS][PS5000A_MAX_CHANNELS];
+	size_t		rapidBytes;
+	uint32_t	batch;
+	uint32_t	sets;
+	uint32_t	set;
+	uint32_t	from;
+	uint32_t	to;
+	uint32_t	readSamples;
+	uint64_t	readoutNs;
+	RAPID_CONTEXT context;
+	PIPELINE *	pipe;
+	int16_t		processing;
+	int16_t		allocated;
+	int16_t*	overflow;
+	PICO_STATUS status;
+	uint32_t	nCompletedCaptures;
+	int16_t		retry;
+	int16_t		sampling;
+	int32_t timeInterval;
+
+	int16_t		triggerVoltage = init_trigger_voltage; // mV
+	//PS5000A_CHANNEL triggerChannel = PS5000A_CHANNEL_A;
+	PS5000A_CHANNEL triggerChannel = (PS5000A_CHANNEL) init_trigger_channel;
+	int16_t		voltageRange = inputRanges[unit->channelSettings[triggerChannel].range];
+	int16_t		triggerThreshold = 0;
+
+	int32_t		timeIntervalNs = 0;
+	int32_t		maxSamples = 0;
+	uint32_t	maxSegments = 0;
+
+	uint64_t start;
+
+	PS5000A_TRIGGER_INFO * triggerInfo; // Struct to store trigger timestamping information
+
+	// Structures for setting up trigger - declare each as an array of multiple structures if using multiple channels
+	struct tPS5000ATriggerChannelPropertiesV2 triggerProperties;
+	struct tPS5000ACondition conditions;
+	struct tPS5000ADirection directions;
+
+	// Struct to hold Pulse Width Qualifier information
+	struct tPwq pulseWidth;
+
+	memset(&triggerProperties, 0, sizeof(struct tPS5000ATriggerChannelPropertiesV2));
+	memset(&conditions, 0, sizeof(struct tPS5000ACondition));
+	memset(&directions, 0, sizeof(struct tPS5000ADirection));
+	memset(&pulseWidth, 0, sizeof(struct tPwq));
+
+	// If the channel is not enabled, warn the User and return
+	if (unit->channelSettings[triggerChannel].enabled == 0)
+	{
+		printf("collectBlockTriggered: Channel not enabled.");
+	}
+
+	// If the trigger voltage level is greater than the range selected, set the threshold to half
+	// of the range selected e.g. for 200 mV, set the threshold to 10 0mV
+	
+	if (triggerVoltage > voltageRange)
+	{
+		printf("Changing trigger voltage to half of the channel voltage range!\n");
+		triggerVoltage = (voltageRange / 2);
+	}
+	
+
+	triggerThreshold = mv_to_adc(triggerVoltage, unit->channelSettings[triggerChannel].range, unit);
+
+	// Set trigger channel properties
+	triggerProperties.thresholdUpper = triggerThreshold;
+	triggerProperties.thresholdUpperHysteresis = 256 * 10;
+	triggerProperties.thresholdLower = triggerThreshold;
+	triggerProperties.thresholdLowerHysteresis = 256 * 10;
+	triggerProperties.channel = triggerChannel;
+
+	// Set trigger conditions
+	conditions.source = triggerChannel;
+	conditions.condition = PS5000A_CONDITION_TRUE;
+
+	// Set trigger directions
+	directions.source = triggerChannel;
+	directions.direction = PS5000A_RISING;
+	directions.mode = PS5000A_LEVEL;
+
+	printf("Collect rapid block triggered...\n");
+	printf("Collects when value rises past %d ", scaleVoltages ?
+		adc_to_mv(triggerProperties.thresholdUpper, unit->channelSettings[PS5000A_EXTERNAL].range, unit)	// If scaleVoltages, print mV value
+		: triggerProperties.thresholdUpper);																// else print ADC Count
+
+	printf(scaleVoltages ? "mV\n" : "ADC Counts\n");
+	printf("Press any key to abort\n");
+
+	setDefaults(unit);
+
+	// Trigger enabled
+	status = setTrigger(unit, &triggerProperties, 1, &conditions, 1, &directions, 1, &pulseWidth, 0, 0);
+
+	// Find the maximum number of segments
+	status = ps5000aGetMaxSegments(unit->handle, &maxSegments);
+
+	// Set the number of segments - this can be more than the number of waveforms to collect
+	nSegments = num_of_waveforms;
+
+	if (nSegments > maxSegments)
+	{
+		nSegments = maxSegments;
+	}
+
+	// Set the number of captures
+	nCaptures = num_of_waveforms;
+
+	// Segment the memory
+	status = ps5000aMemorySegments(unit->handle, nSegments, &nMaxSamples);
+
+	// Set the number of captures
+	status = ps5000aSetNoOfCaptures(unit->handle, nCaptures);
+
+	// Run
+	//timebase = 127;		// 1 MS/s at 8-bit resolution, ~504 kS/s at 12 & 16-bit resolution
+
+	// Verify timebase and number of samples per channel for segment 0
+	do
+	{
+		status = ps5000aGetTimebase(unit->handle, timebase, nSamples, &timeIntervalNs, &maxSamples, 0);
+
+		if (status == PICO_INVALID_TIMEBASE)
+		{
+			timebase++;
+		}
+	} while (status != PICO_OK);
+
+	perfBegin("rapid block");
+	metricsSet(METRIC_ACQUIRING, 1);
+	rtEnter(&g_rtOptions);
+
+	do
+	{
+		retry = 0;
+		g_blockArmNs = perfNow();
+		status = ps5000aRunBlock(unit->handle, num_of_points_pre_trigger, num_of_points_post_trigger, timebase, &timeIndisposed, 0, callBackBlock, NULL);
+		perfSince(PERF_BLOCK_ARM, g_blockArmNs);
+
+		if (status != PICO_OK)
+		{
+			// PicoScope 5X4XA/B/D devices...+5 V PSU connected or removed or
+			// PicoScope 524XD devices on non-USB 3.0 port
+			if (status == PICO_POWER_SUPPLY_CONNECTED || status == PICO_POWER_SUPPLY_NOT_CONNECTED || status == PICO_USB3_0_DEVICE_NON_USB3_0_PORT)
+			{
+				status = changePowerSource(unit->handle, status, unit);
+				retry = 1;
+			}
+			else
+			{
+				printf("collectRapidBlock:ps5000aRunBlock ------ 0x%08lx \n", status);
+			}
+		}
+	} while (retry);
+
+	sampling = status == PICO_OK && startClockSync(unit);
+
+	// Wait until data ready
+	g_ready = 0;
+
+	while (!g_ready && !_kbhit())
+	{
+		Sleep(0);
+		rtRelax();
+	}
+
+	if (sampling)
+	{
+		clockSyncStop(g_clockSync);
+	}
+
+	if (!g_ready)
+	{
+		_getch();
+		status = ps5000aStop(unit->handle);
+		status = ps5000aGetNoOfCaptures(unit->handle, &nCompletedCaptures);
+
+		printf("Rapid capture aborted. %lu complete blocks were captured\n", nCompletedCaptures);
+		printf("\nPress any key...\n\n");
+		_getch();
+
+		if (nCompletedCaptures == 0)
+		{
+			perfEnd();
+			metricsSet(METRIC_ACQUIRING, 0);
+			rtLeave();
+			return;
+		}
+
+		// Only display the blocks that were captured
+		nCaptures = (uint16_t)nCompletedCaptures;
+	}
+
+	// Allocate memory: for all the captures if they fit the budget, else for a few batches used in turn
+	batch = planRapidMemory(unit, nCaptures, nSamples, &sets);
+	rapidBytes = (size_t) batch * nSamples * sizeof(int16_t);
+	rapidBuffers = (int16_t ***)calloc(unit->channelCount, sizeof(int16_t*));
+	overflow = (int16_t *)calloc(unit->channelCount * nCaptures, sizeof(int16_t));
+	memset(rapidData, 0, sizeof(rapidData));
+	allocated = rapidBuffers != NULL && overflow != NULL;
+
+	for (channel = 0; channel < unit->channelCount && allocated; channel++)
+	{
+		if (unit->channelSettings[channel].enabled)
+		{
+			rapidBuffers[channel] = (int16_t **)calloc(nCaptures, sizeof(int16_t*));
+			allocated = rapidBuffers[channel] != NULL;
+
+			// One block per channel and set for all its captures, so that it can sit on huge pages
+			for (set = 0; set < sets && allocated; set++)
+			{
+				if ((rapidData[set][channel] = (int16_t *)bufferAlloc(rapidBytes)) == NULL)
+				{
+					allocated = FALSE;
+				}
+				else
+				{
+					rtPrefault(rapidData[set][channel], rapidBytes);
+				}
+			}
+		}
+	}
+
+	bufferReport();
+
+	// Allocate memory for the trigger timestamping
+	triggerInfo = (PS5000A_TRIGGER_INFO *)calloc(nCaptures, sizeof(PS5000A_TRIGGER_INFO));
+
+	if (!allocated || triggerInfo == NULL)
+	{
+		printf("collectRapidBlock: no memory for the samples of %u captures, try a smaller rapid block sample memory\n", nCaptures);
+		status = ps5000aStop(unit->handle);
+		rtLeave();
+		freeRapidBuffers(unit, rapidBuffers, rapidData, sets, rapidBytes);
+		free(overflow);
+		free(triggerInfo);
+		perfEnd();
+		metricsSet(METRIC_ACQUIRING, 0);
+		return;
+	}
+
+	// Retrieve trigger timestamping information first, the captures are written with it as they are read out
+	start = perfNow();
+	status = ps5000aGetTriggerInfoBulk(unit->handle, triggerInfo, 0, nCaptures - 1);
+	readoutNs = perfNow() - start;
+
+	if (status == PICO_OK && sampling)
+	{
+		writeCaptureTimes(triggerInfo, nCaptures, timeIntervalNs, num_of_points_post_trigger);
+	}
+
+	processing = status == PICO_OK;
+	pipe = processing ? openCaptures(&context, unit, rapidBuffers, overflow, triggerInfo, nSamples, nCaptures, timeIntervalNs, num_of_points_pre_trigger) : NULL;
+
+	// Get data, a batch at a time
+	for (from = 0; from < nCaptures && pipe != NULL && status == PICO_OK; from += batch)
+	{
+		to = min(from + batch, nCaptures);
+		set = (from / batch) % sets;
+
+		// The set last held the batch one round before, wait until it is written
+		while (from >= batch * sets && (uint32_t) atomicLoad32(&context.released) < from - batch * (sets - 1))
+		{
+			Sleep(1);
+		}
+
+		for (channel = 0; channel < unit->channelCount; channel++)
+		{
+			if (unit->channelSettings[channel].enabled)
+			{
+				for (capture = from; capture < to; capture++)
+				{
+					rapidBuffers[channel][capture] = rapidData[set][channel] + (size_t)(capture - from) * nSamples;
+					status = ps5000aSetDataBuffer(unit->handle, (PS5000A_CHANNEL)channel, rapidBuffers[channel][capture], nSamples, capture, PS5000A_RATIO_MODE_NONE);
+				}
+			}
+		}
+
+		start = perfNow();
+		readSamples = nSamples;
+		status = ps5000aGetValuesBulk(unit->handle, &readSamples, from, to - 1, 1, PS5000A_RATIO_MODE_NONE, overflow + from);
+		readoutNs += perfNow() - start;
+
+		if (status == PICO_POWER_SUPPLY_CONNECTED || status == PICO_POWER_SUPPLY_NOT_CONNECTED ||
+					status == PICO_USB3_0_DEVICE_NON_USB3_0_PORT || status == PICO_POWER_SUPPLY_UNDERVOLTAGE)
+		{
+			printf("\nPower Source Changed. Data collection aborted.\n");
+			break;
+		}
+		else if (status != PICO_OK)
+		{
+			printf("collectRapidBlock:ps5000aGetValuesBulk ------ 0x%08x \n", status);
+			break;
+		}
+
+		perfAddSamples((uint64_t) readSamples * (to - from));
+		metricsAdd(METRIC_SAMPLES, (uint64_t) readSamples * (to - from));
+		metricsAdd(METRIC_CAPTURES, to - from);
+
+		for (capture = from; capture < to; capture++)
+		{
+			metricsAdd(METRIC_OVERFLOWS, overflow[capture] ? 1 : 0);
+		}
+
+		submitCaptures(pipe, from, to);
+	}
+
+	perfRecord(PERF_BLOCK_READOUT, readoutNs);
+
+	if (processing)
+	{
+		closeCaptures(&context, pipe);
+	}
+
+	// Stop
+	status = ps5000aStop(unit->handle);
+	rtLeave();
+
+	// Free memory
+	free(overflow);
+	freeRapidBuffers(unit, rapidBuffers, rapidData, sets, rapidBytes);
+	free(triggerInfo);
+	perfEnd();
+	metricsSet(METRIC_ACQUIRING, 0);
+}
+
+/****************************************************************************
+* Initialise unit' structure with Variant specific defaults
+****************************************************************************/
+void set_info(UNIT * unit)
+{
+	int8_t description [11][25]= { "Driver Version",
+		"USB Version",
+		"Hardware Version",
+		"Variant Info",
+		"Serial",
+		"Cal Date",
+		"Kernel Version",
+		"Digital HW Version",
+		"Analogue HW Version",
+		"Firmware 1",
+		"Firmware 2"};
+
+	int16_t i = 0;
+	int16_t requiredSize = 0;
+	int8_t line [80];
+	int32_t variant;
+	PICO_STATUS status = PICO_OK;
+
+	// Variables used for arbitrary waveform parameters
+	int16_t			minArbitraryWaveformValue = 0;
+	int16_t			maxArbitraryWaveformValue = 0;
+	uint32_t		minArbitraryWaveformSize = 0;
+	uint32_t		maxArbitraryWaveformSize = 0;
+
+	//Initialise default unit properties and change when required
+	unit->sigGen = SIGGEN_FUNCTGEN;
+	unit->firstRange = PS5000A_10MV;
+	unit->lastRange = PS5000A_20V;
+	unit->channelCount = DUAL_SCOPE;
+	unit->awgBufferSize = MIN_SIG_GEN_BUFFER_SIZE;
+	unit->digitalPortCount = 0;
+
+	if (unit->handle) 
+	{
+		printf("Device information:-\n\n");
+
+		for (i = 0; i < 11; i++) 
+		{
+			status = ps5000aGetUnitInfo(unit->handle, line, sizeof (line), &requiredSize, i);
+
+			// info = 3 - PICO_VARIANT_INFO
+			if (i == PICO_VARIANT_INFO) 
+			{
+				variant = atoi(line);
+				memcpy(&(unit->modelString), line, sizeof(unit->modelString)==5?5:sizeof(unit->modelString));
+
+				unit->channelCount = (int16_t)line[1];
+				unit->channelCount = unit->channelCount - 48; // Subtract ASCII 0 (48)
+
+				// Determine if the device is an MSO
+				if (strstr(line, "MSO") != NULL)
+				{
+					unit->digitalPortCount = 2;
+				}
+				else
+				{
+					unit->digitalPortCount = 0;
+				}
+				
+			}
+			else if (i == PICO_BATCH_AND_SERIAL)	// info = 4 - PICO_BATCH_AND_SERIAL
+			{
+				memcpy(&(unit->serial), line, requiredSize);
+			}
+
+			printf("%s: %s\n", description[i], line);
+		}
+
+		printf("\n");
+
+		// Set sig gen parameters
+		// If device has Arbitrary Waveform Generator, find the maximum AWG buffer size
+		status = ps5000aSigGenArbitraryMinMaxValues(unit->handle, &minArbitraryWaveformValue, &maxArbitraryWaveformValue, &minArbitraryWaveformSize, &maxArbitraryWaveformSize);
+		unit->awgBufferSize = maxArbitraryWaveformSize;
+
+		if (unit->awgBufferSize > 0)
+		{
+			unit->sigGen = SIGGEN_AWG;
+		}
+		else
+		{
+			unit->sigGen = SIGGEN_FUNCTGEN;
+		}
+	}
+}
+
+void setCoupling(UNIT * unit)
+{
+	PICO_STATUS powerStatus = PICO_OK;
+	PICO_STATUS status = PICO_OK;
+	PS5000A_DEVICE_RESOLUTION resolution = PS5000A_DR_8BIT;
+
+	int32_t i, ch;
+	int32_t count = 0;
+	int16_t numValidChannels = unit->channelCount; // Dependent on power setting - i.e. channel A & B if USB powered on 4-channel device
+	int16_t numEnabledChannels = 0;
+	int16_t retry = FALSE;
+
+	if (unit->channelCount == QUAD_SCOPE)
+	{
+		powerStatus = ps5000aCurrentPowerSource(unit->handle); 
+
+		if (powerStatus == PICO_POWER_SUPPLY_NOT_CONNECTED)
+		{
+			numValidChannels = DUAL_SCOPE;
+		}
+	}
+
+	// See what ranges are available... 
+	printf("0 -> AC COUPLING\n");
+	printf("1 -> DC COUPLING\n");
+
+
+	do
+	{
+		count = 0;
+
+		do
+		{
+			// Ask the user to select a range
+			printf("Specify coupling (0 or 1)\n");
+			printf("99 - switches channel off\n");
+		
+			for (ch = 0; ch < numValidChannels; ch++) 
+			{
+				printf("\n");
+
+				do 
+				{
+					printf("Channel %c: ", 'A' + ch);
+					fflush(stdin);
+					scanf_s("%hd", &(unit->channelSettings[ch].DCcoupled));
+			
+				} while (unit->channelSettings[ch].DCcoupled != 0 && unit->channelSettings[ch].DCcoupled != 1 && unit->channelSettings[ch].DCcoupled != 99);
+
+				if (unit->channelSettings[ch].DCcoupled != 99) 
+				{
+					if(unit->channelSettings[ch].DCcoupled == 0) printf(" - AC COUPLED\n");
+					if(unit->channelSettings[ch].DCcoupled == 1) printf(" - DC COUPLED\n");
+					unit->channelSettings[ch].enabled = TRUE;
+					count++;
+				} 
+				else 
+				{
+					printf("Channel Switched off\n");
+					unit->channelSettings[ch].enabled = FALSE;
+					unit->channelSettings[ch].DCcoupled = 0;
+				}
+			}
+			printf(count == 0? "\n** At least 1 channel must be enabled **\n\n":"");
+		}
+		while (count == 0);	// must have at least one channel enabled
+
+		status = ps5000aGetDeviceResolution(unit->handle, &resolution);
+
+		// Verify that the number of enabled channels is valid for the resolution set.
+
+		switch (resolution)
+		{
+			case PS5000A_DR_15BIT:
+
+				if (count > 2)
+				{
+					printf("\nError: Only 2 channels may be enabled with 15-bit resolution set.\n");
+					printf("Please switch off %d channel(s).\n", numValidChannels - 2);
+					retry = TRUE;
+				}
+				else
+				{
+					retry = FALSE;
+				}
+				break;
+
+			case PS5000A_DR_16BIT:
+
+				if (count > 1)
+				{
+					printf("\nError: Only one channes may be enabled with 16-bit resolution set.\n");
+					printf("Please switch off %d channel(s).\n", numValidChannels - 1);
+					retry = TRUE;
+				}
+				else
+				{
+					retry = FALSE;
+				}
+				
+				break;
+
+			default:
+
+				retry = FALSE;
+				break;
+		}
+
+		printf("\n");
+	}
+	while (retry == TRUE);
+
+	setDefaults(unit);	// Put these changes into effect
+}
+
+/****************************************************************************
+* Select input voltage ranges for channels
+****************************************************************************/
+void setVoltages(UNIT * unit)
+{
+	PICO_STATUS powerStatus = PICO_OK;
+	PICO_STATUS status = PICO_OK;
+	PS5000A_DEVICE_RESOLUTION resolution = PS5000A_DR_8BIT;
+
+	int32_t i, ch;
+	int32_t count = 0;
+	int16_t numValidChannels = unit->channelCount; // Dependent on power setting - i.e. channel A & B if USB powered on 4-channel device
+	int16_t numEnabledChannels = 0;
+	int16_t retry = FALSE;
+
+	if (unit->channelCount == QUAD_SCOPE)
+	{
+		powerStatus = ps5000aCurrentPowerSource(unit->handle); 
+
+		if (powerStatus == PICO_POWER_SUPPLY_NOT_CONNECTED)
+		{
+			numValidChannels = DUAL_SCOPE;
+		}
+	}
+
+	// See what ranges are available... 
+	for (i = unit->firstRange; i <= unit->lastRange; i++) 
+	{
+		printf("%d -> %d mV\n", i, inputRanges[i]);
+	}
+
+	do
+	{
+		count = 0;
+
+		do
+		{
+			// Ask the user to select a range
+			printf("Specify voltage range (%d..%d)\n", unit->firstRange, unit->lastRange);
+			printf("99 - switches channel off\n");
+		
+			for (ch = 0; ch < numValidChannels; ch++) 
+			{
+				printf("\n");
+
+				do 
+				{
+					printf("Channel %c: ", 'A' + ch);
+					fflush(stdin);
+					scanf_s("%hd", &(unit->channelSettings[ch].range));
+			
+				} while (unit->channelSettings[ch].range != 99 && (unit->channelSettings[ch].range < unit->firstRange || unit->channelSettings[ch].range > unit->lastRange));
+
+				if (unit->channelSettings[ch].range != 99) 
+				{
+					printf(" - %d mV\n", inputRanges[unit->channelSettings[ch].range]);
+					unit->channelSettings[ch].enabled = TRUE;
+					count++;
+				} 
+				else 
+				{
+					printf("Channel Switched off\n");
+					unit->channelSettings[ch].enabled = FALSE;
+					unit->channelSettings[ch].range = PS5000A_MAX_RANGES-1;
+				}
+			}
+			printf(count == 0? "\n** At least 1 channel must be enabled **\n\n":"");
+		}
+		while (count == 0);	// must have at least one channel enabled
+
+		status = ps5000aGetDeviceResolution(unit->handle, &resolution);
+
+		// Verify that the number of enabled channels is valid for the resolution set.
+
+		switch (resolution)
+		{
+			case PS5000A_DR_15BIT:
+
+				if (count > 2)
+				{
+					printf("\nError: Only 2 channels may be enabled with 15-bit resolution set.\n");
+					printf("Please switch off %d channel(s).\n", numValidChannels - 2);
+					retry = TRUE;
+				}
+				else
+				{
+					retry = FALSE;
+				}
+				break;
+
+			case PS5000A_DR_16BIT:
+
+				if (count > 1)
+				{
+					printf("\nError: Only one channes may be enabled with 16-bit resolution set.\n");
+					printf("Please switch off %d channel(s).\n", numValidChannels - 1);
+					retry = TRUE;
+				}
+				else
+				{
+					retry = FALSE;
+				}
+				
+				break;
+
+			default:
+
+				retry = FALSE;
+				break;
+		}
+
+		printf("\n");
+	}
+	while (retry == TRUE);
+
+	setDefaults(unit);	// Put these changes into effect
+}
+
+/****************************************************************************
+* setTimebase
+* Select timebase, set time units as nano seconds
+*
+****************************************************************************/
+void setTimebase(UNIT * unit)
+{
+	PICO_STATUS status = PICO_OK;
+	PICO_STATUS powerStatus = PICO_OK;
+	int32_t timeInterval;
+	int32_t maxSamples;
+	int32_t ch;
+
+	uint32_t shortestTimebase;
+	double timeIntervalSeconds;
+	
+	PS5000A_CHANNEL_FLAGS enabledChannelOrPortFlags = (PS5000A_CHANNEL_FLAGS)0;
+	
+	int16_t numValidChannels = unit->channelCount; // Dependent on power setting - i.e. channel A & B if USB powered on 4-channel device
+	
+	if (unit->channelCount == QUAD_SCOPE)
+	{
+		powerStatus = ps5000aCurrentPowerSource(unit->handle);
+		
+		if (powerStatus == PICO_POWER_SUPPLY_NOT_CONNECTED)
+		{
+			numValidChannels = DUAL_SCOPE;
+		}
+	}
+	
+	// Find the analogue channels that are enabled - if an MSO model is being used, this will need to be
+	// modified to add channel flags for enabled digital ports
+	for (ch = 0; ch < numValidChannels; ch++)
+	{
+		if (unit->channelSettings[ch].enabled)
+		{
+			enabledChannelOrPortFlags = enabledChannelOrPortFlags | (PS5000A_CHANNEL_FLAGS)(1 << ch);
+		}
+	}
+	
+	// Find the shortest possible timebase and inform the user.
+	status = ps5000aGetMinimumTimebaseStateless(unit->handle, enabledChannelOrPortFlags, &shortestTimebase, &timeIntervalSeconds, unit->resolution);
+
+	if (status != PICO_OK)
+	{
+		printf("setTimebase:ps5000aGetMinimumTimebaseStateless ------ 0x%08lx \n", status);
+		return;
+	}
+
+	printf("Shortest timebase index available %d (%.9f seconds).\n", shortestTimebase, timeIntervalSeconds);
+	
+	printf("Specify desired timebase: ");
+	fflush(stdin);
+	scanf_s("%lud", &timebase);
+
+	do 
+	{
+		status = ps5000aGetTimebase(unit->handle, timebase, BUFFER_SIZE, &timeInterval, &maxSamples, 0);
+
+		if (status == PICO_INVALID_NUMBER_CHANNELS_FOR_RESOLUTION)
+		{
+			printf("SetTimebase: Error - Invalid number of channels for resolution.\n");
+			return;
+		}
+		else if (status == PICO_OK)
+		{
+			// Do nothing
+		}
+		else
+		{
+			timebase++; // Increase timebase if the one specified can't be used. 
 		}
 
 	}
+	while (status != PICO_OK);
 
-	printf("\n\n");
+	float timeInterval_float = (float) timeInterval;
 
-	uint32_t	nCaptures;
-	uint32_t	nSegments;
-	int32_t		nMaxSamples;
-	uint32_t	nSamples = num_of_points;
-	int32_t		timeIndisposed;
-	uint32_t	capture;
-	int16_t		channel;
-	int16_t***	rapidBuffers;
-	int16_t*	overflow;
-	PICO_STATUS status;
-	int16_t		i;
-	uint32_t	nCompletedCaptures;
-	int16_t		retry;
-	int32_t timeInterval;
+	if (timeInterval < 1000)
+	{
+		printf("Timebase used %lu = %.2f ns sample interval\n", timebase, timeInterval_float);
+	}
+	else if (timeInterval >= 1000 && timeInterval < 1000000)
+	{
+		printf("Timebase used %lu = %.2f us sample interval\n", timebase, timeInterval_float/1000);
+	}
+	else if (timeInterval >=1000000 && timeInterval < 1000000000)
+	{
+		printf("Timebase used %lu = %.2f ms sampleInterval\n", timebase, timeInterval_float/1000000);
+	}
+	else
+	{
+		printf("Timebase used too much high for sampling rate\n");
+	}
 
-	int16_t		triggerVoltage = init_trigger_voltage; // mV
-	//PS5000A_CHANNEL triggerChannel = PS5000A_CHANNEL_A;
-	PS5000A_CHANNEL triggerChannel = (PS5000A_CHANNEL) init_trigger_channel;
-	int16_t		voltageRange = inputRanges[unit->channelSettings[triggerChannel].range];
-	int16_t		triggerThreshold = 0;
+}
 
-	int32_t		timeIntervalNs = 0;
-	int32_t		maxSamples = 0;
-	uint32_t	maxSegments = 0;
+/****************************************************************************
+* printResolution
+*
+* Outputs the resolution in text format to the console window
+****************************************************************************/
+void printResolution(PS5000A_DEVICE_RESOLUTION * resolution)
+{
+	switch(*resolution)
+	{
+		case PS5000A_DR_8BIT:
 
-	uint64_t timeStampCounterDiff = 0;
-	
-	FILE * fp = NULL;
-	
-	FILE * fbin = NULL;
+			printf("8 bits");
+			break;
 
-	PS5000A_TRIGGER_INFO * triggerInfo; // Struct to store trigger timestamping information
+		case PS5000A_DR_12BIT:
 
-	// Structures for setting up trigger - declare each as an array of multiple structures if using multiple channels
-	struct tPS5000ATriggerChannelPropertiesV2 triggerProperties;
-	struct tPS5000ACondition conditions;
-	struct tPS5000ADirection directions;
+			printf("12 bits");
+			break;
 
-	// Struct to hold Pulse Width Qualifier information
-	struct tPwq pulseWidth;
+		case PS5000A_DR_14BIT:
 
-	memset(&triggerProperties, 0, sizeof(struct tPS5000ATriggerChannelPropertiesV2));
-	memset(&conditions, 0, sizeof(struct tPS5000ACondition));
-	memset(&directions, 0, sizeof(struct tPS5000ADirection));
-	memset(&pulseWidth, 0, sizeof(struct tPwq));
+			printf("14 bits");
+			break;
 
-	// If the channel is not enabled, warn the User and return
-	if (unit->channelSettings[triggerChannel].enabled == 0)
-	{
-		printf("collectBlockTriggered: Channel not enabled.");
-	}
+		case PS5000A_DR_15BIT:
 
-	// If the trigger voltage level is greater than the range selected, set the threshold to half
-	// of the range selected e.g. for 200 mV, set the threshold to 10 0mV
-	
-	if (triggerVoltage > voltageRange)
-	{
-		printf("Changing trigger voltage to half of the channel voltage range!\n");
-		triggerVoltage = (voltageRange / 2);
-	}
-	
+			printf("15 bits");
+			break;
 
-	triggerThreshold = mv_to_adc(triggerVoltage, unit->channelSettings[triggerChannel].range, unit);
+		case PS5000A_DR_16BIT:
 
-	// Set trigger channel properties
-	triggerProperties.thresholdUpper = triggerThreshold;
-	triggerProperties.thresholdUpperHysteresis = 256 * 10;
-	triggerProperties.thresholdLower = triggerThreshold;
-	triggerProperties.thresholdLowerHysteresis = 256 * 10;
-	triggerProperties.channel = triggerChannel;
+			printf("16 bits");
+			break;
 
-	// Set trigger conditions
-	conditions.source = triggerChannel;
-	conditions.condition = PS5000A_CONDITION_TRUE;
+		default:
 
-	// Set trigger directions
-	directions.source = triggerChannel;
-	directions.direction = PS5000A_RISING;
-	directions.mode = PS5000A_LEVEL;
+			break;
+	}
 
-	printf("Collect rapid block triggered...\n");
-	printf("Collects when value rises past %d ", scaleVoltages ?
-		adc_to_mv(triggerProperties.thresholdUpper, unit->channelSettings[PS5000A_EXTERNAL].range, unit)	// If scaleVoltages, print mV value
-		: triggerProperties.thresholdUpper);																// else print ADC Count
+	printf("\n");
+}
 
-	printf(scaleVoltages ? "mV\n" : "ADC Counts\n");
-	printf("Press any key to abort\n");
+/****************************************************************************
+* setResolution
+* Set resolution for the device
+*
+****************************************************************************/
+void setResolution(UNIT * unit)
+{
+	int16_t value;
+	int16_t i;
+	int16_t numEnabledChannels = 0;
+	int16_t retry;
+	int32_t resolutionInput;
 
-	setDefaults(unit);
+	PICO_STATUS status;
+	PS5000A_DEVICE_RESOLUTION resolution;
+	PS5000A_DEVICE_RESOLUTION newResolution = PS5000A_DR_8BIT;
 
-	// Trigger enabled
-	status = setTrigger(unit, &triggerProperties, 1, &conditions, 1, &directions, 1, &pulseWidth, 0, 0);
+	// Determine number of channels enabled
+	for(i = 0; i < unit->channelCount; i++)
+	{
+		if(unit->channelSettings[i].enabled == TRUE)
+		{
+			numEnabledChannels++;
+		}
+	}
 
-	// Find the maximum number of segments
-	status = ps5000aGetMaxSegments(unit->handle, &maxSegments);
+	if(numEnabledChannels == 0)
+	{
+		printf("setResolution: Please enable channels.\n");
+		return;
+	}
 
-	// Set the number of segments - this can be more than the number of waveforms to collect
-	nSegments = num_of_waveforms;
+	status = ps5000aGetDeviceResolution(unit->handle, &resolution);
 
-	if (nSegments > maxSegments)
+	if(status == PICO_OK)
 	{
-		nSegments = maxSegments;
+		printf("Current resolution: ");
+		printResolution(&resolution);
+	}
+	else
+	{
+		printf("setResolution:ps5000aGetDeviceResolution ------ 0x%08lx \n", status);
+		return;
 	}
 
-	// Set the number of captures
-	nCaptures = num_of_waveforms;
+	printf("\n");
 
-	// Segment the memory
-	status = ps5000aMemorySegments(unit->handle, nSegments, &nMaxSamples);
+	printf("Select device resolution:\n");
+	printf("0: 8 bits\n");
+	printf("1: 12 bits\n");
+	printf("2: 14 bits\n");
 
-	// Set the number of captures
-	status = ps5000aSetNoOfCaptures(unit->handle, nCaptures);
+	if(numEnabledChannels <= 2)
+	{
+		printf("3: 15 bits\n");
+	}
 
-	// Run
-	//timebase = 127;		// 1 MS/s at 8-bit resolution, ~504 kS/s at 12 & 16-bit resolution
+	if(numEnabledChannels == 1)
+	{
+		printf("4: 16 bits\n\n");
+	}
+
+	retry = TRUE;
 
-	// Verify timebase and number of samples per channel for segment 0
 	do
 	{
-		status = ps5000aGetTimebase(unit->handle, timebase, nSamples, &timeIntervalNs, &maxSamples, 0);
-
-		if (status == PICO_INVALID_TIMEBASE)
+		if(numEnabledChannels == 1)
 		{
-			timebase++;
+			printf("Resolution [0...4]: ");
 		}
-	} while (status != PICO_OK);
+		else if(numEnabledChannels == 2)
+		{
+			printf("Resolution [0...3]: ");
+		}
+		else
+		{
+			printf("Resolution [0...2]: ");
+		}
+	
+		fflush(stdin);
+		scanf_s("%lud", &resolutionInput);
 
-	do
-	{
-		retry = 0;
-		status = ps5000aRunBlock(unit->handle, num_of_points_pre_trigger, num_of_points_post_trigger, timebase, &timeIndisposed, 0, callBackBlock, NULL);
+		newResolution = (PS5000A_DEVICE_RESOLUTION)resolutionInput;
 
-		if (status != PICO_OK)
+		// Verify if resolution can be selected for number of channels enabled
+
+		if (newResolution == PS5000A_DR_16BIT && numEnabledChannels > 1)
 		{
-			// PicoScope 5X4XA/B/D devices...+5 V PSU connected or removed or
-			// PicoScope 524XD devices on non-USB 3.0 port
-			if (status == PICO_POWER_SUPPLY_CONNECTED || status == PICO_POWER_SUPPLY_NOT_CONNECTED || status == PICO_USB3_0_DEVICE_NON_USB3_0_PORT)
-			{
-				status = changePowerSource(unit->handle, status, unit);
-				retry = 1;
-			}
-			else
-			{
-				printf("collectRapidBlock:ps5000aRunBlock ------ 0x%08lx \n", status);
-			}
+			printf("setResolution: 16 bit resolution can only be selected with 1 channel enabled.\n");
+		}
+		else if (newResolution == PS5000A_DR_15BIT && numEnabledChannels > 2)
+		{
+			printf("setResolution: 15 bit resolution can only be selected with a maximum of 2 channels enabled.\n");
 		}
-	} while (retry);
+		else if(newResolution < PS5000A_DR_8BIT && newResolution > PS5000A_DR_16BIT)
+		{
+			printf("setResolution: Resolution index selected out of bounds.\n");
+		}
+		else
+		{
+			retry = FALSE;
+		}
+	}
+	while(retry);
+	
+	printf("\n");
 
-	// Wait until data ready
-	g_ready = 0;
+	status = ps5000aSetDeviceResolution(unit->handle, (PS5000A_DEVICE_RESOLUTION) newResolution);
 
-	while (!g_ready && !_kbhit())
+	if (status == PICO_OK)
 	{
-		Sleep(0);
-	}
+		unit->resolution = newResolution;
 
-	if (!g_ready)
+		printf("Resolution selected: ");
+		printResolution(&newResolution);
+		
+		// The maximum ADC value will change if transitioning from 8 bit to >= 12 bit or vice-versa
+		ps5000aMaximumValue(unit->handle, &value);
+		unit->maxADCValue = value;
+	}
+	else
 	{
-		_getch();
-		status = ps5000aStop(unit->handle);
-		status = ps5000aGetNoOfCaptures(unit->handle, &nCompletedCaptures);
+		printf("setResolution:ps5000aSetDeviceResolution ------ 0x%08lx \n", status);
+	}
 
-		printf("Rapid capture aborted. %lu complete blocks were captured\n", nCompletedCaptures);
-		printf("\nPress any key...\n\n");
-		_getch();
+}
 
-		if (nCompletedCaptures == 0)
-		{
-			return;
-		}
+/****************************************************************************
+* setFastestResolution
+*
+* Picks the resolution and timebase for a wanted sample interval, the
+* enabled channels and a rapid block geometry, and sets both. The
+* resolutions are tried from the highest down: the first whose shortest
+* timebase (ps5000aGetMinimumTimebaseStateless) reaches the interval and
+* whose segments hold the record length wins. Its timebase is then the
+* slowest one that is still no longer than the interval, found by
+* bisection, so it runs no faster than asked.
+****************************************************************************/
+void setFastestResolution(UNIT * unit)
+{
+	static const PS5000A_DEVICE_RESOLUTION resolutions[] = { PS5000A_DR_16BIT, PS5000A_DR_15BIT, PS5000A_DR_14BIT, PS5000A_DR_12BIT, PS5000A_DR_8BIT };
+	static const int16_t bits[] = { 16, 15, 14, 12, 8 };
+	PS5000A_CHANNEL_FLAGS flags = (PS5000A_CHANNEL_FLAGS) 0;
+	PS5000A_DEVICE_RESOLUTION resolution = unit->resolution;
+	PICO_STATUS status;
+	double wantedNs = 0.0;
+	double shortestNs = 0.0;
+	double intervalSeconds;
+	uint32_t nSamples = 0;
+	uint32_t nSegments = 0;
+	uint32_t maxSegments = 0;
+	uint32_t shortest;
+	uint32_t low, high, middle;
+	int32_t intervalNs;
+	int32_t maxSamples;
+	int32_t nMaxSamples;
+	int16_t numValidChannels = unit->channelCount;
+	int16_t value;
+	int16_t ch;
+	size_t i;
 
-		// Only display the blocks that were captured
-		nCaptures = (uint16_t)nCompletedCaptures;
+	// Channels C and D are off without the power supply, as in setTimebase
+	if (unit->channelCount == QUAD_SCOPE && ps5000aCurrentPowerSource(unit->handle) == PICO_POWER_SUPPLY_NOT_CONNECTED)
+	{
+		numValidChannels = DUAL_SCOPE;
 	}
 
-	// Allocate memory
-	rapidBuffers = (int16_t ***)calloc(unit->channelCount, sizeof(int16_t*));
-	overflow = (int16_t *)calloc(unit->channelCount * nCaptures, sizeof(int16_t));
-
-	for (channel = 0; channel < unit->channelCount; channel++)
+	for (ch = 0; ch < numValidChannels; ch++)
 	{
-		if (unit->channelSettings[channel].enabled)
+		if (unit->channelSettings[ch].enabled)
 		{
-			rapidBuffers[channel] = (int16_t **)calloc(nCaptures, sizeof(int16_t*));
+			flags = flags | (PS5000A_CHANNEL_FLAGS)(1 << ch);
 		}
 	}
 
-	for (channel = 0; channel < unit->channelCount; channel++)
+	if (flags == 0)
 	{
-		if (unit->channelSettings[channel].enabled)
-		{
-			for (capture = 0; capture < nCaptures; capture++)
-			{
-				rapidBuffers[channel][capture] = (int16_t *)calloc(nSamples, sizeof(int16_t));
-			}
-		}
+		printf("setFastestResolution: Please enable channels.\n");
+		return;
 	}
 
-	for (channel = 0; channel < unit->channelCount; channel++)
+	do
 	{
-		if (unit->channelSettings[channel].enabled)
-		{
-			for (capture = 0; capture < nCaptures; capture++)
-			{
-				status = ps5000aSetDataBuffer(unit->handle, (PS5000A_CHANNEL)channel, rapidBuffers[channel][capture], nSamples, capture, PS5000A_RATIO_MODE_NONE);
-			}
-		}
-	}
+		printf("Sample interval wanted (ns):");
+		scanf_s("%lf", &wantedNs);
+	} while (wantedNs <= 0.0);
 
-	// Allocate memory for the trigger timestamping
-	triggerInfo = (PS5000A_TRIGGER_INFO *)malloc(nCaptures * sizeof(PS5000A_TRIGGER_INFO));
-	memset(triggerInfo, 0, nCaptures * sizeof(PS5000A_TRIGGER_INFO));
+	do
+	{
+		printf("Samples per capture:");
+		scanf_s("%u", &nSamples);
+	} while (nSamples == 0);
 
-	// Get data
-	status = ps5000aGetValuesBulk(unit->handle, &nSamples, 0, nCaptures - 1, 1, PS5000A_RATIO_MODE_NONE, overflow);
+	do
+	{
+		printf("Captures (segments):");
+		scanf_s("%u", &nSegments);
+	} while (nSegments == 0);
 
-	if (status == PICO_POWER_SUPPLY_CONNECTED || status == PICO_POWER_SUPPLY_NOT_CONNECTED ||
-				status == PICO_USB3_0_DEVICE_NON_USB3_0_PORT || status == PICO_POWER_SUPPLY_UNDERVOLTAGE)
+	ps5000aGetMaxSegments(unit->handle, &maxSegments);
+
+	if (maxSegments > 0 && nSegments > maxSegments)
 	{
-		printf("\nPower Source Changed. Data collection aborted.\n");
+		printf("The device holds at most %u segments, planning for that many.\n", maxSegments);
+		nSegments = maxSegments;
 	}
 
-	// Retrieve trigger timestamping information
-	status = ps5000aGetTriggerInfoBulk(unit->handle, triggerInfo, 0, nCaptures - 1);
+	printf("\n");
 
-	fopen_s(&fp, blockFile, "w");
-	fopen_s(&fbin, binaryFile, "w");
-		
-	if (status == PICO_OK)
+	for (i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); i++)
 	{
-		//print first 10 samples from each capture
-		for (capture = 0; capture < nCaptures; capture++)
-		{
-			fprintf(fp, "Time (ns)\t");
-			printf("\n");
-			
-			fprintf(fp,"ADC_chA\tmV_chA\tADC_chB\tmV_chB");
-			
-			fprintf(fp, "\n");
+		status = ps5000aGetMinimumTimebaseStateless(unit->handle, flags, &shortest, &intervalSeconds, resolutions[i]);
 
-			printf("Capture index %d:-\n\n", capture);
-
-			// Trigger Info status & Timestamp 
-			printf("Trigger Info:- Status: %u  Trigger index: %u  Timestamp Counter: %I64u\n", triggerInfo[capture].status, triggerInfo[capture].triggerIndex, triggerInfo[capture].timeStampCounter);
+		if (status == PICO_INVALID_NUMBER_CHANNELS_FOR_RESOLUTION)
+		{
+			continue;
+		}
+		else if (status != PICO_OK)
+		{
+			printf("setFastestResolution:ps5000aGetMinimumTimebaseStateless ------ 0x%08x \n", status);
+			continue;
+		}
 
-			// Calculate time between trigger events - the first timestamp is arbitrary so is only used to calculate offsets
+		shortestNs = intervalSeconds * 1e9;
 
-			// The structure containing the status code with bit flag PICO_DEVICE_TIME_STAMP_RESET will have an arbitrary timeStampCounter value. 
-			// This should be the first segment in each run, so in this case segment 0 will be ignored.
+		if (shortestNs > wantedNs * (1.0 + 1e-9))
+		{
+			continue;
+		}
 
-			if (capture == 0)
-			{
-				// Nothing to display
-				printf("\n");
-			}
-			else if (capture > 0 && triggerInfo[capture].status == PICO_OK)
-			{
-				timeStampCounterDiff = triggerInfo[capture].timeStampCounter - triggerInfo[capture - 1].timeStampCounter;
-				printf("Time since trigger for last segment: %I64u ns\n\n", (timeStampCounterDiff * (uint64_t)timeIntervalNs));
-			}
-			else
+		// Segments shrink at the higher resolutions: the record length has to fit at this one
+		if ((status = ps5000aSetDeviceResolution(unit->handle, resolutions[i])) != PICO_OK ||
+			(status = ps5000aMemorySegments(unit->handle, nSegments, &nMaxSamples)) != PICO_OK ||
+			(status = ps5000aGetTimebase(unit->handle, shortest, (int32_t) nSamples, &intervalNs, &maxSamples, 0)) != PICO_OK)
+		{
+			if (status == PICO_TOO_MANY_SAMPLES)
 			{
-				// Do nothing
+				printf("At %d bits, %u segments do not hold %u samples per capture.\n", bits[i], nSegments, nSamples);
 			}
 
-			for (channel = 0; channel < unit->channelCount; channel++)
-			{
-				if (unit->channelSettings[channel].enabled)
-				{
-					printf("Channel %c:\t", 'A' + channel);
-				}
-			}
+			continue;
+		}
 
-			printf("\n\n");
+		// Slowest timebase no longer than the interval; past the first few, timebases are at least 8 ns apart
+		low = shortest;
+		high = (uint32_t) min((double) shortest + wantedNs / 8.0 + 4.0, (double) UINT32_MAX);
 
-			for (i = 0; i < 10; i++)
-			{
-				for (channel = 0; channel < unit->channelCount; channel++)
-				{
-					if (unit->channelSettings[channel].enabled)
-					{
-						printf("   %6d       ", scaleVoltages ?
-							adc_to_mv(rapidBuffers[channel][capture][i], unit->channelSettings[PS5000A_CHANNEL_A + channel].range, unit)	// If scaleVoltages, print mV value
-							: rapidBuffers[channel][capture][i]);																	// else print ADC Count
-					}
-				}
+		while (low < high)
+		{
+			middle = low + (high - low + 1) / 2;
 
-				printf("\n");
+			if (ps5000aGetTimebase(unit->handle, middle, (int32_t) nSamples, &intervalNs, &maxSamples, 0) == PICO_OK && intervalNs <= wantedNs)
+			{
+				low = middle;
 			}
-			for (i = 0; i < nSamples; i++)
+			else
 			{
-				struct data values;
-				//fprintf(fp, "%I64u ", g_times[0] + (uint64_t)(i * timeInterval));
-				fprintf(fp, "%i\t\t", g_times[0] + i*timeIntervalNs );
-				
-				values.time = g_times[0] + i*timeIntervalNs;
-				
-				for (int j = 0; j < 2; j++) 
-				{
-					if (unit->channelSettings[j].enabled) 
-					{
-						if(j==0) {
-							values.ADC_chA = rapidBuffers[j][capture][i];
-							values.mV_chA = adc_to_mv(rapidBuffers[j][capture][i], unit->channelSettings[PS5000A_CHANNEL_A + j].range, unit);
-						}
-						else if(j==1) {
-							values.ADC_chB = rapidBuffers[j][capture][i];
-							values.mV_chB = adc_to_mv(rapidBuffers[j][capture][i], unit->channelSettings[PS5000A_CHANNEL_A + j].range, unit);
-						}
-						fprintf(fp, "%6d\t%+6d\t", rapidBuffers[j][capture][i], adc_to_mv(rapidBuffers[j][capture][i], unit->channelSettings[PS5000A_CHANNEL_A + j].range, unit));
-					}
-				}
-				fwrite(&values, sizeof(struct data), 1, fbin);
-
-				fprintf(fp, "\n");
+				high = middle - 1;
 			}
 		}
-	}
-
-	// Stop
-	status = ps5000aStop(unit->handle);
 
-	// Free memory
-	free(overflow);
+		ps5000aGetTimebase(unit->handle, low, (int32_t) nSamples, &intervalNs, &maxSamples, 0);
+		ps5000aMemorySegments(unit->handle, 1, &nMaxSamples);
 
-	for (channel = 0; channel < unit->channelCount; channel++)
-	{
-		if (unit->channelSettings[channel].enabled)
-		{
-			for (capture = 0; capture < nCaptures; capture++)
-			{
-				free(rapidBuffers[channel][capture]);
-			}
-		}
-	}
+		timebase = low;
+		unit->resolution = resolutions[i];
+		ps5000aMaximumValue(unit->handle, &value);
+		unit->maxADCValue = value;
 
-	for (channel = 0; channel < unit->channelCount; channel++)
-	{
-		if (unit->channelSettings[channel].enabled)
-		{
-			free(rapidBuffers[channel]);
-		}
+		printf("Resolution selected: ");
+		printResolution(&unit->resolution);
+		printf("Timebase used %lu = %d ns sample interval (%.9g ns wanted, shortest %.9g ns), up to %d samples per capture in %u segments\n",
+				(unsigned long) timebase, intervalNs, wantedNs, shortestNs, maxSamples, nSegments);
+		return;
 	}
 
-	free(rapidBuffers);
-	free(triggerInfo);
-	
-	if (fp != NULL)
-	{
-		fclose(fp);
-	}
-	
-	if (fbin != NULL)
-	{
-		fclose(fbin);
-	}
+	// Nothing fits: leave the device as it was
+	ps5000aSetDeviceResolution(unit->handle, resolution);
+	ps5000aMemorySegments(unit->handle, 1, &nMaxSamples);
+	printf("setFastestResolution: no resolution reaches a %.9g ns interval with %u samples in each of %u segments.\n", wantedNs, nSamples, nSegments);
 }
 
 /****************************************************************************
-* Initialise unit' structure with Variant specific defaults
-****************************************************************************/
-void set_info(UNIT * unit)
+* collectStreamingTriggered
+*  This function demonstrates how to collect a stream of data
+*  from the unit (start collecting on trigger)
+***************************************************************************/
+void collectStreamingTriggered(UNIT * unit)
 {
-	int8_t description [11][25]= { "Driver Version",
-		"USB Version",
-		"Hardware Version",
-		"Variant Info",
-		"Serial",
-		"Cal Date",
-		"Kernel Version",
-		"Digital HW Version",
-		"Analogue HW Version",
-		"Firmware 1",
-		"Firmware 2"};
+	int16_t triggerVoltage = 500; // mV
+	PS5000A_CHANNEL triggerChannel = PS5000A_CHANNEL_A;
+	int16_t voltageRange = inputRanges[unit->channelSettings[triggerChannel].range];
+	int16_t triggerThreshold = 0;
 
-	int16_t i = 0;
-	int16_t requiredSize = 0;
-	int8_t line [80];
-	int32_t variant;
-	PICO_STATUS status = PICO_OK;
+	// Structures for setting up trigger - declare each as an array of multiple structures if using multiple channels
+	struct tPS5000ATriggerChannelPropertiesV2 triggerProperties;
+	struct tPS5000ACondition conditions;
+	struct tPS5000ADirection directions;
 
-	// Variables used for arbitrary waveform parameters
-	int16_t			minArbitraryWaveformValue = 0;
-	int16_t			maxArbitraryWaveformValue = 0;
-	uint32_t		minArbitraryWaveformSize = 0;
-	uint32_t		maxArbitraryWaveformSize = 0;
+	// Struct to hold Pulse Width Qualifier information
+	struct tPwq pulseWidth;
 
-	//Initialise default unit properties and change when required
-	unit->sigGen = SIGGEN_FUNCTGEN;
-	unit->firstRange = PS5000A_10MV;
-	unit->lastRange = PS5000A_20V;
-	unit->channelCount = DUAL_SCOPE;
-	unit->awgBufferSize = MIN_SIG_GEN_BUFFER_SIZE;
-	unit->digitalPortCount = 0;
+	memset(&triggerProperties, 0, sizeof(struct tPS5000ATriggerChannelPropertiesV2));
+	memset(&conditions, 0, sizeof(struct tPS5000ACondition));
+	memset(&directions, 0, sizeof(struct tPS5000ADirection));
+	memset(&pulseWidth, 0, sizeof(struct tPwq));
 
-	if (unit->handle) 
+	// If the channel is not enabled, warn the User and return
+	if (unit->channelSettings[triggerChannel].enabled == 0)
 	{
-		printf("Device information:-\n\n");
-
-		for (i = 0; i < 11; i++) 
-		{
-			status = ps5000aGetUnitInfo(unit->handle, line, sizeof (line), &requiredSize, i);
+		printf("collectStreamingTriggered: Channel not enabled.");
+		return;
+	}
 
-			// info = 3 - PICO_VARIANT_INFO
-			if (i == PICO_VARIANT_INFO) 
-			{
-				variant = atoi(line);
-				memcpy(&(unit->modelString), line, sizeof(unit->modelString)==5?5:sizeof(unit->modelString));
+	// If the trigger voltage level is greater than the range selected, set the threshold to half
+	// of the range selected e.g. for 200 mV, set the threshold to 100 mV
+	if (triggerVoltage > voltageRange)
+	{
+		triggerVoltage = (voltageRange / 2);
+	}
 
-				unit->channelCount = (int16_t)line[1];
-				unit->channelCount = unit->channelCount - 48; // Subtract ASCII 0 (48)
+	triggerThreshold = mv_to_adc(triggerVoltage, unit->channelSettings[triggerChannel].range, unit);
 
-				// Determine if the device is an MSO
-				if (strstr(line, "MSO") != NULL)
-				{
-					unit->digitalPortCount = 2;
-				}
-				else
-				{
-					unit->digitalPortCount = 0;
-				}
-				
-			}
-			else if (i == PICO_BATCH_AND_SERIAL)	// info = 4 - PICO_BATCH_AND_SERIAL
-			{
-				memcpy(&(unit->serial), line, requiredSize);
-			}
+	// Set trigger channel properties
+	triggerProperties.thresholdUpper = triggerThreshold;
+	triggerProperties.thresholdUpperHysteresis = 256 * 10;
+	triggerProperties.thresholdLower = triggerThreshold;
+	triggerProperties.thresholdLowerHysteresis = 256 * 10;
+	triggerProperties.channel = triggerChannel;
 
-			printf("%s: %s\n", description[i], line);
-		}
+	// Set trigger conditions
+	conditions.source = triggerChannel;
+	conditions.condition = PS5000A_CONDITION_TRUE;
 
-		printf("\n");
+	// Set trigger directions
+	directions.source = triggerChannel;
+	directions.direction = PS5000A_RISING;
+	directions.mode = PS5000A_LEVEL;
+		
+	printf("Collect streaming triggered...\n");
+	printf("Data is written to disk file (stream.txt)\n");
+	printf("Press a key to start\n");
+	_getch();
+	
+	setDefaults(unit);
 
-		// Set sig gen parameters
-		// If device has Arbitrary Waveform Generator, find the maximum AWG buffer size
-		status = ps5000aSigGenArbitraryMinMaxValues(unit->handle, &minArbitraryWaveformValue, &maxArbitraryWaveformValue, &minArbitraryWaveformSize, &maxArbitraryWaveformSize);
-		unit->awgBufferSize = maxArbitraryWaveformSize;
+	/* Trigger enabled
+	* Rising edge
+	* Threshold = 1000 mV */
+	setTrigger(unit, &triggerProperties, 1, &conditions, 1, &directions, 1, &pulseWidth, 0, 0);
 
-		if (unit->awgBufferSize > 0)
-		{
-			unit->sigGen = SIGGEN_AWG;
-		}
-		else
-		{
-			unit->sigGen = SIGGEN_FUNCTGEN;
-		}
-	}
+	streamDataHandler(unit, 0);
 }
 
-void setCoupling(UNIT * unit)
+
+/****************************************************************************
+* displaySettings 
+* Displays information about the user configurable settings in this example
+* Parameters 
+* - unit        pointer to the UNIT structure
+*
+* Returns       none
+***************************************************************************/
+void displaySettings(UNIT *unit)
 {
-	PICO_STATUS powerStatus = PICO_OK;
+	int32_t ch;
+	int32_t voltage;
 	PICO_STATUS status = PICO_OK;
 	PS5000A_DEVICE_RESOLUTION resolution = PS5000A_DR_8BIT;
 
-	int32_t i, ch;
-	int32_t count = 0;
-	int16_t numValidChannels = unit->channelCount; // Dependent on power setting - i.e. channel A & B if USB powered on 4-channel device
-	int16_t numEnabledChannels = 0;
-	int16_t retry = FALSE;
+	printf("\nReadings will be scaled in %s\n", (scaleVoltages)? ("millivolts") : ("ADC counts"));
+	printf("\n");
 
-	if (unit->channelCount == QUAD_SCOPE)
+	for (ch = 0; ch < unit->channelCount; ch++)
 	{
-		powerStatus = ps5000aCurrentPowerSource(unit->handle); 
-
-		if (powerStatus == PICO_POWER_SUPPLY_NOT_CONNECTED)
+		if (!(unit->channelSettings[ch].enabled))
 		{
-			numValidChannels = DUAL_SCOPE;
+			printf("Channel %c Voltage Range = Off\n", 'A' + ch);
 		}
-	}
-
-	// See what ranges are available... 
-	printf("0 -> AC COUPLING\n");
-	printf("1 -> DC COUPLING\n");
-
-
-	do
-	{
-		count = 0;
-
-		do
+		else
 		{
-			// Ask the user to select a range
-			printf("Specify coupling (0 or 1)\n");
-			printf("99 - switches channel off\n");
-		
-			for (ch = 0; ch < numValidChannels; ch++) 
-			{
-				printf("\n");
-
-				do 
-				{
-					printf("Channel %c: ", 'A' + ch);
-					fflush(stdin);
-					scanf_s("%hd", &(unit->channelSettings[ch].DCcoupled));
+			voltage = inputRanges[unit->channelSettings[ch].range];
+			printf("Channel %c Voltage Range = ", 'A' + ch);
 			
-				} while (unit->channelSettings[ch].DCcoupled != 0 && unit->channelSettings[ch].DCcoupled != 1 && unit->channelSettings[ch].DCcoupled != 99);
-
-				if (unit->channelSettings[ch].DCcoupled != 99) 
-				{
-					if(unit->channelSettings[ch].DCcoupled == 0) printf(" - AC COUPLED\n");
-					if(unit->channelSettings[ch].DCcoupled == 1) printf(" - DC COUPLED\n");
-					unit->channelSettings[ch].enabled = TRUE;
-					count++;
-				} 
-				else 
-				{
-					printf("Channel Switched off\n");
-					unit->channelSettings[ch].enabled = FALSE;
-					unit->channelSettings[ch].DCcoupled = 0;
-				}
+			if (voltage < 1000)
+			{
+				printf("%dmV\n", voltage);
+			}
+			else
+			{
+				printf("%dV\n", voltage / 1000);
 			}
-			printf(count == 0? "\n** At least 1 channel must be enabled **\n\n":"");
 		}
-		while (count == 0);	// must have at least one channel enabled
-
-		status = ps5000aGetDeviceResolution(unit->handle, &resolution);
-
-		// Verify that the number of enabled channels is valid for the resolution set.
-
-		switch (resolution)
-		{
-			case PS5000A_DR_15BIT:
-
-				if (count > 2)
-				{
-					printf("\nError: Only 2 channels may be enabled with 15-bit resolution set.\n");
-					printf("Please switch off %d channel(s).\n", numValidChannels - 2);
-					retry = TRUE;
-				}
-				else
-				{
-					retry = FALSE;
-				}
-				break;
-
-			case PS5000A_DR_16BIT:
-
-				if (count > 1)
-				{
-					printf("\nError: Only one channes may be enabled with 16-bit resolution set.\n");
-					printf("Please switch off %d channel(s).\n", numValidChannels - 1);
-					retry = TRUE;
-				}
-				else
-				{
-					retry = FALSE;
-				}
-				
-				break;
+	}
 
-			default:
+	printf("\n");
 
-				retry = FALSE;
-				break;
-		}
+	status = ps5000aGetDeviceResolution(unit->handle, &resolution);
 
-		printf("\n");
-	}
-	while (retry == TRUE);
+	printf("Device Resolution: ");
+	printResolution(&resolution);
 
-	setDefaults(unit);	// Put these changes into effect
 }
 
 /****************************************************************************
-* Select input voltage ranges for channels
-****************************************************************************/
-void setVoltages(UNIT * unit)
+* setOutputOptions
+* Select how the block, block_binary and stream files are written and
+* whether the binary waveform files are produced
+*
+***************************************************************************/
+void setOutputOptions(void)
 {
-	PICO_STATUS powerStatus = PICO_OK;
-	PICO_STATUS status = PICO_OK;
-	PS5000A_DEVICE_RESOLUTION resolution = PS5000A_DR_8BIT;
-
-	int32_t i, ch;
-	int32_t count = 0;
-	int16_t numValidChannels = unit->channelCount; // Dependent on power setting - i.e. channel A & B if USB powered on 4-channel device
-	int16_t numEnabledChannels = 0;
-	int16_t retry = FALSE;
+	int8_t ch = '.';
 
-	if (unit->channelCount == QUAD_SCOPE)
+	while (ch != 'S')
 	{
-		powerStatus = ps5000aCurrentPowerSource(unit->handle); 
+		printf("\n\n");
+		printf("ACTUAL OUTPUT OPTIONS\n\n");
+		printf("Output backend = %s\n", writerBackendName(g_writerOptions.backend));
+		printf("Writes in flight = %u\n", g_writerOptions.queueDepth);
+		printf("Buffer size = %u kB\n", g_writerOptions.bufferSize / 1024);
+		printf("O_DIRECT = %s\n", g_writerOptions.directIo ? "On" : "Off");
+		printf("Journaled text files = %s\n", g_writerOptions.journal ? "On" : "Off");
+		printf("Block files (%s, %s) = %s\n", blockFile, binaryFile, g_blockRaw ? "ADC counts and run settings" : "ADC counts and mV");
+		printf(g_clockSyncUs ? "Capture times (%s) = captures asked for every %u us\n" : "Capture times (%s) = Off\n", blockTimesFile, g_clockSyncUs);
+		printf(g_writerOptions.syncMs ? "Sync to disk = every %u ms\n" : "Sync to disk = Off\n", g_writerOptions.syncMs);
+		printf("Waveform files (%s, %s) = %s\n", blockWaveFile, streamWaveFile, waveOutputName(g_waveOutput));
+		printf("Waveform file runs = %s\n", g_waveAppend ? "Appended" : "Overwritten");
+		printf(g_pyramidFactor ? "Streaming pyramid (%s) = 1 in %u per level\n" : "Streaming pyramid (%s) = Off\n", streamPyramidFile, g_pyramidFactor);
+		printf("Latency statistics = %s\n", perfModeName(g_perfMode));
+		printf("Live metrics = %s, every %u ms\n", metricsModeName(g_metricsMode), g_metricsPeriodMs);
+		printf("Live preview = %s\n", g_preview ? "On" : "Off (print samples)");
+		printf("Sample buffers = %s\n", bufferPagesName(g_bufferPages));
+		printf("Rapid block sample memory = %.0f MB%s\n", g_rapidBudgetMb ? (double) g_rapidBudgetMb : bufferAvailable() / 2 / 1048576.0,
+				g_rapidBudgetMb ? "" : " (half of the available)");
+		printf("Streaming pipeline overload policy = %s", pipePolicyName(g_pipePolicy));
+		printf(g_pipePolicy == PIPE_POLICY_PRESCALE ? ", 1 in %u\n" : "\n", g_pipePrescale);
+		printf("Convert workers = %u\n", g_convertWorkers);
+		printf(g_powerRecoverySeconds ? "Power source change while streaming = Resume within %u s\n" :
+				"Power source change while streaming = Stop\n", g_powerRecoverySeconds);
+		printf("\n");
 
-		if (powerStatus == PICO_POWER_SUPPLY_NOT_CONNECTED)
-		{
-			numValidChannels = DUAL_SCOPE;
-		}
-	}
+		printf("Please select operation:\n\n");
+		printf("B - Toggle backend stdio/io_uring	Q - Set writes in flight\n");
+		printf("K - Set buffer size (kB)		D - Toggle O_DIRECT\n");
+		printf("W - Waveform files Off/raw/compressed	A - Toggle append/overwrite waveform files\n");
+		printf("P - Latency statistics Off/summary/JSON (%s)\n", PERF_JSON_FILE);
+		printf("M - Live metrics Off/file/socket/both	N - Set live metrics period (ms)\n");
+		printf("L - Toggle live preview			H - Sample buffers normal/transparent/explicit huge pages\n");
+		printf("G - Pipeline block/drop oldest/prescale	E - Set prescale ratio\n");
+		printf("J - Set convert workers			Y - Set streaming pyramid factor\n");
+		printf("R - Toggle journaled text files		U - Set sync interval (ms)\n");
+		printf("T - Set power change recovery (s)	V - Toggle block files counts/counts and mV\n");
+		printf("C - Set capture time sampling (us)	I - Set rapid block sample memory (MB)\n");
+		printf("\n");
+		printf("S - Continue\n");
+		printf("Operation:");
 
-	// See what ranges are available... 
-	for (i = unit->firstRange; i <= unit->lastRange; i++) 
-	{
-		printf("%d -> %d mV\n", i, inputRanges[i]);
-	}
+		ch = toupper(_getch());
 
-	do
-	{
-		count = 0;
+		printf("\n\n");
 
-		do
+		switch (ch)
 		{
-			// Ask the user to select a range
-			printf("Specify voltage range (%d..%d)\n", unit->firstRange, unit->lastRange);
-			printf("99 - switches channel off\n");
-		
-			for (ch = 0; ch < numValidChannels; ch++) 
-			{
-				printf("\n");
-
-				do 
+			case 'B':
+				g_writerOptions.backend = g_writerOptions.backend == WRITER_STDIO ? WRITER_URING : WRITER_STDIO;
+				break;
+			case 'Q':
+				do
 				{
-					printf("Channel %c: ", 'A' + ch);
-					fflush(stdin);
-					scanf_s("%hd", &(unit->channelSettings[ch].range));
-			
-				} while (unit->channelSettings[ch].range != 99 && (unit->channelSettings[ch].range < unit->firstRange || unit->channelSettings[ch].range > unit->lastRange));
-
-				if (unit->channelSettings[ch].range != 99) 
+					printf("Number of writes in flight (2..256):");
+					scanf_s("%u", &g_writerOptions.queueDepth);
+				} while (g_writerOptions.queueDepth < 2 || g_writerOptions.queueDepth > 256);
+				break;
+			case 'K':
+				do
 				{
-					printf(" - %d mV\n", inputRanges[unit->channelSettings[ch].range]);
-					unit->channelSettings[ch].enabled = TRUE;
-					count++;
-				} 
-				else 
+					printf("Buffer size in kB (64..65536):");
+					scanf_s("%u", &g_writerOptions.bufferSize);
+				} while (g_writerOptions.bufferSize < 64 || g_writerOptions.bufferSize > 65536);
+				g_writerOptions.bufferSize *= 1024;
+				break;
+			case 'D':
+				g_writerOptions.directIo = !g_writerOptions.directIo;
+				break;
+			case 'R':
+				g_writerOptions.journal = !g_writerOptions.journal;
+				break;
+			case 'V':
+				g_blockRaw = !g_blockRaw;
+				break;
+			case 'C':
+				do
+				{
+					printf("Ask for the completed captures every us (0 for off, up to 1000000):");
+					scanf_s("%u", &g_clockSyncUs);
+				} while (g_clockSyncUs > 1000000);
+				break;
+			case 'I':
+				printf("Host memory for the samples of a rapid block run in MB (0 for half of the available):");
+				scanf_s("%u", &g_rapidBudgetMb);
+				break;
+			case 'T':
+				do
+				{
+					printf("Time to resume streaming after a power source change in s (0 to stop, up to 3600):");
+					scanf_s("%u", &g_powerRecoverySeconds);
+				} while (g_powerRecoverySeconds > 3600);
+				break;
+			case 'U':
+				do
+				{
+					printf("Sync to disk at most every ms (0 for off, up to 600000):");
+					scanf_s("%u", &g_writerOptions.syncMs);
+				} while (g_writerOptions.syncMs > 600000);
+				break;
+			case 'W':
+				g_waveOutput = (WAVE_OUTPUT)((g_waveOutput + 1) % (WAVE_OUTPUT_COMPRESSED + 1));
+				break;
+			case 'A':
+				g_waveAppend = !g_waveAppend;
+				break;
+			case 'Y':
+				do
 				{
-					printf("Channel Switched off\n");
-					unit->channelSettings[ch].enabled = FALSE;
-					unit->channelSettings[ch].range = PS5000A_MAX_RANGES-1;
-				}
-			}
-			printf(count == 0? "\n** At least 1 channel must be enabled **\n\n":"");
-		}
-		while (count == 0);	// must have at least one channel enabled
-
-		status = ps5000aGetDeviceResolution(unit->handle, &resolution);
-
-		// Verify that the number of enabled channels is valid for the resolution set.
-
-		switch (resolution)
-		{
-			case PS5000A_DR_15BIT:
+					printf("Samples per record at each pyramid level (2..1024, 0 for off):");
+					scanf_s("%u", &g_pyramidFactor);
+				} while (g_pyramidFactor == 1 || g_pyramidFactor > 1024);
+				break;
+			case 'P':
+				g_perfMode = (PERF_MODE)((g_perfMode + 1) % (PERF_SUMMARY_JSON + 1));
+				break;
+			case 'M':
+				g_metricsMode = (METRICS_MODE)((g_metricsMode + 1) % (METRICS_FILE_AND_SOCKET + 1));
 
-				if (count > 2)
+				if (metricsStart(g_metricsMode, g_metricsPeriodMs) != 0)
 				{
-					printf("\nError: Only 2 channels may be enabled with 15-bit resolution set.\n");
-					printf("Please switch off %d channel(s).\n", numValidChannels - 2);
-					retry = TRUE;
+					g_metricsMode = METRICS_OFF;
 				}
-				else
+				break;
+			case 'L':
+				g_preview = !g_preview;
+				break;
+			case 'H':
+				g_bufferPages = (BUFFER_PAGES)((g_bufferPages + 1) % (BUFFER_PAGES_EXPLICIT + 1));
+				break;
+			case 'G':
+				g_pipePolicy = (PIPE_POLICY)((g_pipePolicy + 1) % (PIPE_POLICY_PRESCALE + 1));
+				break;
+			case 'E':
+				do
 				{
-					retry = FALSE;
-				}
+					printf("Keep 1 block in (2..1000) when the pipeline falls behind:");
+					scanf_s("%u", &g_pipePrescale);
+				} while (g_pipePrescale < 2 || g_pipePrescale > 1000);
 				break;
-
-			case PS5000A_DR_16BIT:
-
-				if (count > 1)
+			case 'J':
+				do
 				{
-					printf("\nError: Only one channes may be enabled with 16-bit resolution set.\n");
-					printf("Please switch off %d channel(s).\n", numValidChannels - 1);
-					retry = TRUE;
-				}
-				else
+					printf("Number of convert workers (1..%d):", PIPE_MAX_WORKERS);
+					scanf_s("%u", &g_convertWorkers);
+				} while (g_convertWorkers < 1 || g_convertWorkers > PIPE_MAX_WORKERS);
+				break;
+			case 'N':
+				do
 				{
-					retry = FALSE;
+					printf("Live metrics period in ms (100..60000):");
+					scanf_s("%u", &g_metricsPeriodMs);
+				} while (g_metricsPeriodMs < 100 || g_metricsPeriodMs > 60000);
+
+				if (metricsStart(g_metricsMode, g_metricsPeriodMs) != 0)
+				{
+					g_metricsMode = METRICS_OFF;
 				}
-				
 				break;
-
+			case 'S':
+				break;
 			default:
-
-				retry = FALSE;
+				printf("Invalid Operation\n");
 				break;
 		}
-
-		printf("\n");
 	}
-	while (retry == TRUE);
-
-	setDefaults(unit);	// Put these changes into effect
 }
 
 /****************************************************************************
-* setTimebase
-* Select timebase, set time units as nano seconds
+* setRealtimeOptions
 *
+* Real-time profile applied while streaming or collecting rapid blocks
 ****************************************************************************/
-void setTimebase(UNIT * unit)
+void setRealtimeOptions(void)
 {
-	PICO_STATUS status = PICO_OK;
-	PICO_STATUS powerStatus = PICO_OK;
-	int32_t timeInterval;
-	int32_t maxSamples;
-	int32_t ch;
+	int8_t ch = '.';
 
-	uint32_t shortestTimebase;
-	double timeIntervalSeconds;
-	
-	PS5000A_CHANNEL_FLAGS enabledChannelOrPortFlags = (PS5000A_CHANNEL_FLAGS)0;
-	
-	int16_t numValidChannels = unit->channelCount; // Dependent on power setting - i.e. channel A & B if USB powered on 4-channel device
-	
-	if (unit->channelCount == QUAD_SCOPE)
-	{
-		powerStatus = ps5000aCurrentPowerSource(unit->handle);
-		
-		if (powerStatus == PICO_POWER_SUPPLY_NOT_CONNECTED)
-		{
-			numValidChannels = DUAL_SCOPE;
-		}
-	}
-	
-	// Find the analogue channels that are enabled - if an MSO model is being used, this will need to be
-	// modified to add channel flags for enabled digital ports
-	for (ch = 0; ch < numValidChannels; ch++)
+	while (ch != 'S')
 	{
-		if (unit->channelSettings[ch].enabled)
-		{
-			enabledChannelOrPortFlags = enabledChannelOrPortFlags | (PS5000A_CHANNEL_FLAGS)(1 << ch);
-		}
-	}
-	
-	// Find the shortest possible timebase and inform the user.
-	status = ps5000aGetMinimumTimebaseStateless(unit->handle, enabledChannelOrPortFlags, &shortestTimebase, &timeIntervalSeconds, unit->resolution);
+		printf("\n\n");
+		printf("ACTUAL REAL-TIME OPTIONS\n\n");
+		printf("Real-time profile = %s\n", g_rtOptions.enabled ? "On" : "Off");
+		printf("CPU affinity = ");
+		printf(g_rtOptions.cpu >= 0 ? "CPU %d\n" : "Unchanged\n", g_rtOptions.cpu);
+		printf("SCHED_FIFO priority = ");
+		printf(g_rtOptions.priority > 0 ? "%d\n" : "Unchanged\n", g_rtOptions.priority);
+		printf("Lock memory = %s\n", g_rtOptions.lockMemory ? "On" : "Off");
+		printf("\n");
 
-	if (status != PICO_OK)
-	{
-		printf("setTimebase:ps5000aGetMinimumTimebaseStateless ------ 0x%08lx \n", status);
-		return;
-	}
+		printf("Please select operation:\n\n");
+		printf("E - Toggle real-time profile		U - Set CPU (-1 unchanged)\n");
+		printf("P - Set priority (0 unchanged)		M - Toggle lock memory\n");
+		printf("\n");
+		printf("S - Continue\n");
+		printf("Operation:");
 
-	printf("Shortest timebase index available %d (%.9f seconds).\n", shortestTimebase, timeIntervalSeconds);
-	
-	printf("Specify desired timebase: ");
-	fflush(stdin);
-	scanf_s("%lud", &timebase);
+		ch = toupper(_getch());
 
-	do 
-	{
-		status = ps5000aGetTimebase(unit->handle, timebase, BUFFER_SIZE, &timeInterval, &maxSamples, 0);
+		printf("\n\n");
 
-		if (status == PICO_INVALID_NUMBER_CHANNELS_FOR_RESOLUTION)
-		{
-			printf("SetTimebase: Error - Invalid number of channels for resolution.\n");
-			return;
-		}
-		else if (status == PICO_OK)
-		{
-			// Do nothing
-		}
-		else
+		switch (ch)
 		{
-			timebase++; // Increase timebase if the one specified can't be used. 
+			case 'E':
+				g_rtOptions.enabled = !g_rtOptions.enabled;
+				break;
+			case 'U':
+				printf("CPU (-1 to leave the affinity unchanged):");
+				scanf_s("%d", &g_rtOptions.cpu);
+				g_rtOptions.cpu = g_rtOptions.cpu < -1 ? -1 : g_rtOptions.cpu;
+				break;
+			case 'P':
+				do
+				{
+					printf("SCHED_FIFO priority (1..99, 0 to leave the policy unchanged):");
+					scanf_s("%d", &g_rtOptions.priority);
+				} while (g_rtOptions.priority < 0 || g_rtOptions.priority > 99);
+				break;
+			case 'M':
+				g_rtOptions.lockMemory = !g_rtOptions.lockMemory;
+				break;
+			case 'S':
+				break;
+			default:
+				printf("Invalid Operation\n");
+				break;
 		}
-
 	}
-	while (status != PICO_OK);
+}
 
-	float timeInterval_float = (float) timeInterval;
+/****************************************************************************
+* openDevice 
+* Parameters 
+* - unit        pointer to the UNIT structure, where the handle will be stored
+* - serial		pointer to the int8_t array containing serial number
+*
+* Returns
+* - PICO_STATUS to indicate success, or if an error occurred
+***************************************************************************/
+PICO_STATUS openDevice(UNIT *unit, int8_t *serial)
+{
+	PICO_STATUS status;
+	unit->resolution = PS5000A_DR_8BIT;
 
-	if (timeInterval < 1000)
-	{
-		printf("Timebase used %lu = %.2f ns sample interval\n", timebase, timeInterval_float);
-	}
-	else if (timeInterval >= 1000 && timeInterval < 1000000)
-	{
-		printf("Timebase used %lu = %.2f us sample interval\n", timebase, timeInterval_float/1000);
-	}
-	else if (timeInterval >=1000000 && timeInterval < 1000000000)
+	if (serial == NULL)
 	{
-		printf("Timebase used %lu = %.2f ms sampleInterval\n", timebase, timeInterval_float/1000000);
+		status = ps5000aOpenUnit(&unit->handle, NULL, unit->resolution);
 	}
 	else
 	{
-		printf("Timebase used too much high for sampling rate\n");
+		status = ps5000aOpenUnit(&unit->handle, serial, unit->resolution);
 	}
 
+	unit->openStatus = (int16_t) status;
+	unit->complete = 1;
+
+	return status;
 }
 
 /****************************************************************************
-* printResolution
+* handleDevice
+* Parameters
+* - unit        pointer to the UNIT structure, where the handle will be stored
 *
-* Outputs the resolution in text format to the console window
-****************************************************************************/
-void printResolution(PS5000A_DEVICE_RESOLUTION * resolution)
+* Returns
+* - PICO_STATUS to indicate success, or if an error occurred
+***************************************************************************/
+PICO_STATUS handleDevice(UNIT * unit)
 {
-	switch(*resolution)
+	int16_t value = 0;
+	int32_t i;
+	struct tPwq pulseWidth;
+	PICO_STATUS status;
+
+	printf("Handle: %d\n", unit->handle);
+	
+	if (unit->openStatus != PICO_OK)
 	{
-		case PS5000A_DR_8BIT:
+		printf("Unable to open device\n");
+		printf("Error code : 0x%08x\n", (uint32_t) unit->openStatus);
+		while(!_kbhit());
+		exit(99); // exit program
+	}
 
-			printf("8 bits");
-			break;
+	printf("Device opened successfully, cycle %d\n\n", ++cycles);
+	
+	// Setup device info - unless it's set already
+	if (unit->model == MODEL_NONE)
+	{
+		set_info(unit);
+	}
 
-		case PS5000A_DR_12BIT:
+	// Turn off any digital ports (MSO models only)
+	if (unit->digitalPortCount > 0)
+	{
+		printf("Turning off digital ports.");
 
-			printf("12 bits");
-			break;
+		for (i = 0; i < unit->digitalPortCount; i++)
+		{
+			status = ps5000aSetDigitalPort(unit->handle, (PS5000A_CHANNEL)(i + PS5000A_DIGITAL_PORT0), 0, 0);
+		}
+	}
+	
+	timebase = 1;
 
-		case PS5000A_DR_14BIT:
+	ps5000aMaximumValue(unit->handle, &value);
+	unit->maxADCValue = value;
 
-			printf("14 bits");
-			break;
+	status = ps5000aCurrentPowerSource(unit->handle);
 
-		case PS5000A_DR_15BIT:
+	for (i = 0; i < unit->channelCount; i++)
+	{
+		// Do not enable channels C and D if power supply not connected for PicoScope 544XA/B devices
+		if(unit->channelCount == QUAD_SCOPE && status == PICO_POWER_SUPPLY_NOT_CONNECTED && i >= DUAL_SCOPE)
+		{
+			unit->channelSettings[i].enabled = FALSE;
+			unit->channelSettings[4].enabled = TRUE;
+		}
+		else
+		{
+			unit->channelSettings[i].enabled = TRUE;
+			unit->channelSettings[4].enabled = TRUE;
+		}
 
-			printf("15 bits");
-			break;
+		unit->channelSettings[i].DCcoupled = FALSE;
+		unit->channelSettings[i].range = PS5000A_5V;
+		unit->channelSettings[i].analogueOffset = 0.0f;
+	}
 
-		case PS5000A_DR_16BIT:
+	memset(&pulseWidth, 0, sizeof(struct tPwq));
 
-			printf("16 bits");
-			break;
+	setDefaults(unit);
 
-		default:
+	/* Trigger disabled	*/
+	status = ps5000aSetSimpleTrigger(unit->handle, 0, PS5000A_EXTERNAL, 0, PS5000A_RISING, 0, 0);
 
-			break;
-	}
+	return unit->openStatus;
+}
 
-	printf("\n");
+/****************************************************************************
+* closeDevice 
+****************************************************************************/
+void closeDevice(UNIT *unit)
+{
+	ps5000aCloseUnit(unit->handle);
 }
 
 /****************************************************************************
-* setResolution
-* Set resolution for the device
+* setDspOptions
 *
+* Filtering or lock-in demodulation of the streaming and rapid block data,
+* written to stream_dsp.txt and block_dsp.txt
 ****************************************************************************/
-void setResolution(UNIT * unit)
+void setDspOptions(void)
 {
-	int16_t value;
-	int16_t i;
-	int16_t numEnabledChannels = 0;
-	int16_t retry;
-	int32_t resolutionInput;
-
-	PICO_STATUS status;
-	PS5000A_DEVICE_RESOLUTION resolution;
-	PS5000A_DEVICE_RESOLUTION newResolution = PS5000A_DR_8BIT;
+	int8_t ch = '.';
 
-	// Determine number of channels enabled
-	for(i = 0; i < unit->channelCount; i++)
+	while (ch != 'S')
 	{
-		if(unit->channelSettings[i].enabled == TRUE)
-		{
-			numEnabledChannels++;
-		}
-	}
+		printf("\n\n");
+		printf("ACTUAL FILTERING OPTIONS\n\n");
+		printf("Filtering = %s (%s, %s)\n", dspModeName(g_dspOptions.mode), streamDspFile, blockDspFile);
+		printf("Decimation = 1 in %u\n", g_dspOptions.decimation);
+		printf("Cutoff frequency = %.3f Hz\n", g_dspOptions.cutoffHz);
+		printf("FIR taps per phase = %u\n", g_dspOptions.tapsPerPhase);
+		printf("IIR biquad sections = %u\n", g_dspOptions.sections);
+		printf("Lock-in reference = %.3f Hz, phase %.1f deg\n", g_dspOptions.referenceHz, g_dspOptions.phaseDeg);
+		printf("\n");
 
-	if(numEnabledChannels == 0)
-	{
-		printf("setResolution: Please enable channels.\n");
-		return;
-	}
+		printf("Please select operation:\n\n");
+		printf("F - Filtering Off/FIR/IIR/lock-in		D - Set decimation\n");
+		printf("C - Set cutoff frequency (Hz)		T - Set FIR taps per phase\n");
+		printf("B - Set IIR biquad sections		R - Set lock-in reference (Hz)\n");
+		printf("P - Set lock-in reference phase (deg)\n");
+		printf("\n");
+		printf("S - Continue\n");
+		printf("Operation:");
 
-	status = ps5000aGetDeviceResolution(unit->handle, &resolution);
+		ch = toupper(_getch());
 
-	if(status == PICO_OK)
-	{
-		printf("Current resolution: ");
-		printResolution(&resolution);
-	}
-	else
-	{
-		printf("setResolution:ps5000aGetDeviceResolution ------ 0x%08lx \n", status);
-		return;
-	}
+		printf("\n\n");
 
-	printf("\n");
+		switch (ch)
+		{
+			case 'F':
+				g_dspOptions.mode = (DSP_MODE)((g_dspOptions.mode + 1) % (DSP_LOCKIN + 1));
+				break;
+			case 'D':
+				do
+				{
+					printf("Keep 1 sample in (1..100000):");
+					scanf_s("%u", &g_dspOptions.decimation);
+				} while (g_dspOptions.decimation < 1 || g_dspOptions.decimation > 100000);
+				break;
+			case 'C':
+				do
+				{
+					printf("Cutoff frequency in Hz (it is kept below the output Nyquist frequency):");
+					scanf_s("%lf", &g_dspOptions.cutoffHz);
+				} while (g_dspOptions.cutoffHz <= 0.0);
+				break;
+			case 'T':
+				do
+				{
+					printf("FIR taps per phase (2..64):");
+					scanf_s("%u", &g_dspOptions.tapsPerPhase);
+				} while (g_dspOptions.tapsPerPhase < 2 || g_dspOptions.tapsPerPhase > 64);
+				break;
+			case 'B':
+				do
+				{
+					printf("IIR biquad sections (1..8), each adds 12 dB/octave:");
+					scanf_s("%u", &g_dspOptions.sections);
+				} while (g_dspOptions.sections < 1 || g_dspOptions.sections > 8);
+				break;
+			case 'R':
+				do
+				{
+					printf("Lock-in reference frequency in Hz:");
+					scanf_s("%lf", &g_dspOptions.referenceHz);
+				} while (g_dspOptions.referenceHz <= 0.0);
+				break;
+			case 'P':
+				printf("Lock-in reference phase in degrees:");
+				scanf_s("%lf", &g_dspOptions.phaseDeg);
+				break;
+			case 'S':
+				break;
+			default:
+				printf("Invalid Operation\n");
+				break;
+		}
+	}
+}
 
-	printf("Select device resolution:\n");
-	printf("0: 8 bits\n");
-	printf("1: 12 bits\n");
-	printf("2: 14 bits\n");
+/****************************************************************************
+* setSoftTriggerOptions
+*
+* Software trigger run on the streamed data, its events written to
+* stream_trig.txt. Thresholds are entered in mV and converted to ADC counts
+* for the ranges of each run. The pre-trigger history kept on the host is
+* written to stream_pretrig.bin for the device and software triggers.
+****************************************************************************/
+void setSoftTriggerOptions(void)
+{
+	int8_t ch = '.';
+	int16_t channel;
+	int32_t type;
+	TRIG_CONDITION * condition;
 
-	if(numEnabledChannels <= 2)
+	while (ch != 'S')
 	{
-		printf("3: 15 bits\n");
-	}
+		printf("\n\n");
+		printf("ACTUAL SOFTWARE TRIGGER OPTIONS\n\n");
+		printf("Software trigger = %s (%s), channels combined with %s\n", g_softTrigger ? "On" : "Off", streamTriggerFile,
+				g_softTriggerMv.logic == TRIG_AND ? "AND" : "OR");
 
-	if(numEnabledChannels == 1)
-	{
-		printf("4: 16 bits\n\n");
-	}
+		for (channel = 0; channel < TRIG_CHANNELS; channel++)
+		{
+			condition = &g_softTriggerMv.channels[channel];
+			printf("Channel %c: %s", 'A' + channel, triggerTypeName(condition->type));
 
-	retry = TRUE;
+			switch (condition->type)
+			{
+				case TRIG_ABOVE:
+				case TRIG_BELOW:
+					printf(" %i mV, hysteresis %i mV", condition->upper, condition->hysteresis);
+					break;
+				case TRIG_INSIDE:
+				case TRIG_OUTSIDE:
+					printf(" %i..%i mV, hysteresis %i mV", condition->lower, condition->upper, condition->hysteresis);
+					break;
+				case TRIG_SLOPE_RISING:
+				case TRIG_SLOPE_FALLING:
+					printf(" %i mV in %u samples", condition->rate, condition->span);
+					break;
+				default:
+					break;
+			}
 
-	do
-	{
-		if(numEnabledChannels == 1)
-		{
-			printf("Resolution [0...4]: ");
+			printf("\n");
 		}
-		else if(numEnabledChannels == 2)
+
+		printf("Pulse width = %u..%u samples (0 for no limit)\n", g_softTriggerMv.minWidth, g_softTriggerMv.maxWidth);
+		printf("Holdoff = %u samples\n", g_softTriggerMv.holdoff);
+
+		if (g_preTrigger > 0)
 		{
-			printf("Resolution [0...3]: ");
+			printf("Pre-trigger history = %u %s (%s)\n", g_preTrigger, g_preTriggerTime ? "us" : "samples", streamPreTriggerFile);
 		}
 		else
 		{
-			printf("Resolution [0...2]: ");
+			printf("Pre-trigger history = Off\n");
 		}
-	
-		fflush(stdin);
-		scanf_s("%lud", &resolutionInput);
 
-		newResolution = (PS5000A_DEVICE_RESOLUTION)resolutionInput;
+		printf("\n");
 
-		// Verify if resolution can be selected for number of channels enabled
+		printf("Please select operation:\n\n");
+		printf("E - Software trigger On/Off			L - Logic AND/OR\n");
+		printf("A..D - Set channel condition			W - Set pulse width\n");
+		printf("H - Set holdoff					P - Set pre-trigger history\n");
+		printf("\n");
+		printf("S - Continue\n");
+		printf("Operation:");
 
-		if (newResolution == PS5000A_DR_16BIT && numEnabledChannels > 1)
-		{
-			printf("setResolution: 16 bit resolution can only be selected with 1 channel enabled.\n");
-		}
-		else if (newResolution == PS5000A_DR_15BIT && numEnabledChannels > 2)
-		{
-			printf("setResolution: 15 bit resolution can only be selected with a maximum of 2 channels enabled.\n");
-		}
-		else if(newResolution < PS5000A_DR_8BIT && newResolution > PS5000A_DR_16BIT)
-		{
-			printf("setResolution: Resolution index selected out of bounds.\n");
-		}
-		else
+		ch = toupper(_getch());
+
+		printf("\n\n");
+
+		switch (ch)
 		{
-			retry = FALSE;
-		}
-	}
-	while(retry);
-	
-	printf("\n");
+			case 'E':
+				g_softTrigger = !g_softTrigger;
+				break;
+			case 'L':
+				g_softTriggerMv.logic = g_softTriggerMv.logic == TRIG_AND ? TRIG_OR : TRIG_AND;
+				break;
+			case 'A':
+			case 'B':
+			case 'C':
+			case 'D':
+				condition = &g_softTriggerMv.channels[ch - 'A'];
 
-	status = ps5000aSetDeviceResolution(unit->handle, (PS5000A_DEVICE_RESOLUTION) newResolution);
+				for (type = TRIG_NONE; type <= TRIG_SLOPE_FALLING; type++)
+				{
+					printf("%i - %s\n", type, triggerTypeName((TRIG_TYPE) type));
+				}
 
-	if (status == PICO_OK)
-	{
-		unit->resolution = newResolution;
+				do
+				{
+					printf("Condition:");
+					scanf_s("%i", &type);
+				} while (type < TRIG_NONE || type > TRIG_SLOPE_FALLING);
 
-		printf("Resolution selected: ");
-		printResolution(&newResolution);
-		
-		// The maximum ADC value will change if transitioning from 8 bit to >= 12 bit or vice-versa
-		ps5000aMaximumValue(unit->handle, &value);
-		unit->maxADCValue = value;
-	}
-	else
-	{
-		printf("setResolution:ps5000aSetDeviceResolution ------ 0x%08lx \n", status);
-	}
+				condition->type = (TRIG_TYPE) type;
+
+				if (type == TRIG_SLOPE_RISING || type == TRIG_SLOPE_FALLING)
+				{
+					do
+					{
+						printf("Change in mV:");
+						scanf_s("%i", &condition->rate);
+					} while (condition->rate <= 0);
+
+					do
+					{
+						printf("Over how many samples (1..%i):", TRIG_MAX_SPAN);
+						scanf_s("%u", &condition->span);
+					} while (condition->span < 1 || condition->span > TRIG_MAX_SPAN);
+				}
+				else if (type != TRIG_NONE)
+				{
+					printf(type == TRIG_ABOVE || type == TRIG_BELOW ? "Level in mV:" : "Upper limit in mV:");
+					scanf_s("%i", &condition->upper);
+
+					if (type == TRIG_INSIDE || type == TRIG_OUTSIDE)
+					{
+						do
+						{
+							printf("Lower limit in mV (below %i):", condition->upper);
+							scanf_s("%i", &condition->lower);
+						} while (condition->lower >= condition->upper);
+					}
+
+					do
+					{
+						printf("Hysteresis in mV:");
+						scanf_s("%i", &condition->hysteresis);
+					} while (condition->hysteresis < 0);
+				}
+				break;
+			case 'W':
+				printf("Minimum pulse width in samples (0 for none):");
+				scanf_s("%u", &g_softTriggerMv.minWidth);
+
+				do
+				{
+					printf("Maximum pulse width in samples (0 for none, else at least %u):", g_softTriggerMv.minWidth);
+					scanf_s("%u", &g_softTriggerMv.maxWidth);
+				} while (g_softTriggerMv.maxWidth != 0 && g_softTriggerMv.maxWidth < g_softTriggerMv.minWidth);
+				break;
+			case 'H':
+				printf("Holdoff in samples:");
+				scanf_s("%u", &g_softTriggerMv.holdoff);
+				break;
+			case 'P':
+				do
+				{
+					printf("0 - in samples\n");
+					printf("1 - in us\n");
+					printf("Pre-trigger history:");
+					scanf_s("%hi", &g_preTriggerTime);
+				} while (g_preTriggerTime < 0 || g_preTriggerTime > 1);
 
+				do
+				{
+					printf("History before each trigger (0 for off, up to 100000000):");
+					scanf_s("%u", &g_preTrigger);
+				} while (g_preTrigger > 100000000);
+				break;
+			case 'S':
+				break;
+			default:
+				printf("Invalid Operation\n");
+				break;
+		}
+	}
 }
 
 /****************************************************************************
-* collectStreamingTriggered
-*  This function demonstrates how to collect a stream of data
-*  from the unit (start collecting on trigger)
-***************************************************************************/
-void collectStreamingTriggered(UNIT * unit)
+* replayStreaming
+*
+* Feeds the callbacks of a recorded streaming run to callBackStreaming, as
+* if the driver had made them, and on through the streaming pipeline
+****************************************************************************/
+void replayStreaming(UNIT * unit)
 {
-	int16_t triggerVoltage = 500; // mV
-	PS5000A_CHANNEL triggerChannel = PS5000A_CHANNEL_A;
-	int16_t voltageRange = inputRanges[unit->channelSettings[triggerChannel].range];
-	int16_t triggerThreshold = 0;
-
-	// Structures for setting up trigger - declare each as an array of multiple structures if using multiple channels
-	struct tPS5000ATriggerChannelPropertiesV2 triggerProperties;
-	struct tPS5000ACondition conditions;
-	struct tPS5000ADirection directions;
+	const REPLAY_RECORD * record;
+	int16_t * buffers[2 * PS5000A_MAX_CHANNELS];
+	uint32_t blockSamples = replayMaxSamples(g_replay);
+	// Without aggregation the driver leaves the min buffers as they were set up, zeroed
+	int16_t * unused = (int16_t *) calloc(blockSamples, sizeof(int16_t));
+	BUFFER_INFO bufferInfo;
+	STREAM_CONTEXT context;
+	PIPELINE * pipe;
+	PIPE_BLOCK * block;
+	int32_t index = 0;
+	int32_t totalSamples = 0;
+	int32_t droppedSamples = 0;
+	int16_t ch;
 
-	// Struct to hold Pulse Width Qualifier information
-	struct tPwq pulseWidth;
+	memset(buffers, 0, sizeof(buffers));
+	bufferInfo.unit = unit;
+	bufferInfo.driverBuffers = buffers;
+	bufferInfo.block = NULL;
+	g_autoStopped = FALSE;
 
-	memset(&triggerProperties, 0, sizeof(struct tPS5000ATriggerChannelPropertiesV2));
-	memset(&conditions, 0, sizeof(struct tPS5000ACondition));
-	memset(&directions, 0, sizeof(struct tPS5000ADirection));
-	memset(&pulseWidth, 0, sizeof(struct tPwq));
+	printf("Replaying...Press a key to stop\n");
 
-	// If the channel is not enabled, warn the User and return
-	if (unit->channelSettings[triggerChannel].enabled == 0)
-	{
-		printf("collectStreamingTriggered: Channel not enabled.");
-		return;
-	}
+	// Unthrottled, nothing is dropped: the point is to see how fast the stages go
+	pipe = openStreamPipeline(unit, &context, replayRun(g_replay)->sampleIntervalNs, 0, blockSamples,
+								g_replayPaced ? g_pipePolicy : PIPE_POLICY_BLOCK);
 
-	// If the trigger voltage level is greater than the range selected, set the threshold to half
-	// of the range selected e.g. for 200 mV, set the threshold to 100 mV
-	if (triggerVoltage > voltageRange)
+	while (pipe != NULL && !_kbhit() && (record = replayNext(g_replay, g_replayPaced)) != NULL)
 	{
-		triggerVoltage = (voltageRange / 2);
-	}
-
-	triggerThreshold = mv_to_adc(triggerVoltage, unit->channelSettings[triggerChannel].range, unit);
+		block = pipeAcquire(pipe);
+		bufferInfo.block = block;
 
-	// Set trigger channel properties
-	triggerProperties.thresholdUpper = triggerThreshold;
-	triggerProperties.thresholdUpperHysteresis = 256 * 10;
-	triggerProperties.thresholdLower = triggerThreshold;
-	triggerProperties.thresholdLowerHysteresis = 256 * 10;
-	triggerProperties.channel = triggerChannel;
+		// The recording holds the max buffers
+		for (ch = 0; ch < unit->channelCount; ch++)
+		{
+			buffers[ch * 2] = (int16_t *) record->samples[ch];
+			buffers[ch * 2 + 1] = record->samples[ch] != NULL ? unused : NULL;
+		}
 
-	// Set trigger conditions
-	conditions.source = triggerChannel;
-	conditions.condition = PS5000A_CONDITION_TRUE;
+		index++;
+		callBackStreaming(unit->handle, (int32_t) record->nSamples, 0, (int16_t) record->overflow,
+							record->flags & WAVE_CHUNK_TRIGGERED ? record->triggerIndex : 0,
+							(record->flags & WAVE_CHUNK_TRIGGERED) != 0, FALSE, &bufferInfo);
+		droppedSamples += queueStreamBlock(pipe, block, index, &totalSamples, blockSamples);
+	}
 
-	// Set trigger directions
-	directions.source = triggerChannel;
-	directions.direction = PS5000A_RISING;
-	directions.mode = PS5000A_LEVEL;
-		
-	printf("Collect streaming triggered...\n");
-	printf("Data is written to disk file (stream.txt)\n");
-	printf("Press a key to start\n");
-	_getch();
-	
-	setDefaults(unit);
+	closeStreamPipeline(&context, pipe);
+	free(unused);
 
-	/* Trigger enabled
-	* Rising edge
-	* Threshold = 1000 mV */
-	setTrigger(unit, &triggerProperties, 1, &conditions, 1, &directions, 1, &pulseWidth, 0, 0);
+	if (droppedSamples > 0)
+	{
+		printf("No memory to copy %d samples of the recording, they are missing from the output\n", droppedSamples);
+	}
 
-	streamDataHandler(unit, 0);
+	if (_kbhit())
+	{
+		_getch();
+		printf("Replay aborted after %d callbacks\n", index);
+	}
+	else
+	{
+		printf("Replayed %d samples in %d callbacks.\n", totalSamples, index);
+	}
 }
 
-
 /****************************************************************************
-* displaySettings 
-* Displays information about the user configurable settings in this example
-* Parameters 
-* - unit        pointer to the UNIT structure
+* replayCaptures
 *
-* Returns       none
-***************************************************************************/
-void displaySettings(UNIT *unit)
+* Reads the captures of a recorded rapid block run in place of
+* ps5000aGetValuesBulk and ps5000aGetTriggerInfoBulk, then runs them through
+* the rapid block pipeline. Uncompressed captures are read straight from the
+* mapping of the file.
+****************************************************************************/
+void replayCaptures(UNIT * unit)
 {
-	int32_t ch;
-	int32_t voltage;
-	PICO_STATUS status = PICO_OK;
-	PS5000A_DEVICE_RESOLUTION resolution = PS5000A_DR_8BIT;
+	const WAVE_RUN * run = replayRun(g_replay);
+	const REPLAY_RECORD * record = NULL;
+	uint32_t nCaptures = replayRecords(g_replay);
+	uint32_t nSamples = run->samplesPerRecord;
+	uint32_t capture = 0;
+	size_t rapidBytes = (size_t) nCaptures * nSamples * sizeof(int16_t);
+	int16_t inPlace = replayInPlace(g_replay);
+	int16_t *** rapidBuffers;
+	int16_t * rapidData[PS5000A_MAX_CHANNELS];
+	int16_t * overflow;
+	PS5000A_TRIGGER_INFO * triggerInfo;
+	int16_t channel;
+	uint64_t start;
+
+	rapidBuffers = (int16_t ***) calloc(unit->channelCount, sizeof(int16_t **));
+	overflow = (int16_t *) calloc(nCaptures, sizeof(int16_t));
+	triggerInfo = (PS5000A_TRIGGER_INFO *) calloc(nCaptures, sizeof(PS5000A_TRIGGER_INFO));
+	memset(rapidData, 0, sizeof(rapidData));
 
-	printf("\nReadings will be scaled in %s\n", (scaleVoltages)? ("millivolts") : ("ADC counts"));
-	printf("\n");
+	for (channel = 0; channel < unit->channelCount; channel++)
+	{
+		if (unit->channelSettings[channel].enabled)
+		{
+			rapidBuffers[channel] = (int16_t **) calloc(nCaptures, sizeof(int16_t *));
+			rapidData[channel] = inPlace ? NULL : (int16_t *) bufferAlloc(rapidBytes);
+		}
+	}
 
-	for (ch = 0; ch < unit->channelCount; ch++)
+	printf("Replaying %u captures...Press a key to stop\n", nCaptures);
+	perfBegin("rapid block replay");
+	metricsSet(METRIC_ACQUIRING, 1);
+
+	// The readout: paced, the captures come in at the rate they were taken
+	start = perfNow();
+
+	while (capture < nCaptures && !_kbhit() && (record = replayNext(g_replay, g_replayPaced)) != NULL)
 	{
-		if (!(unit->channelSettings[ch].enabled))
+		if (record->nSamples != nSamples)
 		{
-			printf("Channel %c Voltage Range = Off\n", 'A' + ch);
+			printf("Capture %u holds %u samples, not %u. The replay stops there.\n", record->segment, record->nSamples, nSamples);
+			break;
 		}
-		else
+
+		for (channel = 0; channel < unit->channelCount && record != NULL; channel++)
 		{
-			voltage = inputRanges[unit->channelSettings[ch].range];
-			printf("Channel %c Voltage Range = ", 'A' + ch);
-			
-			if (voltage < 1000)
+			if (!unit->channelSettings[channel].enabled)
 			{
-				printf("%dmV\n", voltage);
+				continue;
+			}
+
+			if (record->samples[channel] == NULL)
+			{
+				printf("Capture %u has no channel %c. The replay stops there.\n", record->segment, 'A' + channel);
+				record = NULL;
+			}
+			else if (inPlace)
+			{
+				rapidBuffers[channel][capture] = (int16_t *) record->samples[channel];
 			}
 			else
 			{
-				printf("%dV\n", voltage / 1000);
+				rapidBuffers[channel][capture] = rapidData[channel] + (size_t) capture * nSamples;
+				memcpy(rapidBuffers[channel][capture], record->samples[channel], nSamples * sizeof(int16_t));
 			}
 		}
-	}
-
-	printf("\n");
-
-	status = ps5000aGetDeviceResolution(unit->handle, &resolution);
 
-	printf("Device Resolution: ");
-	printResolution(&resolution);
+		if (record == NULL)
+		{
+			break;
+		}
 
-}
+		overflow[capture] = (int16_t) record->overflow;
+		triggerInfo[capture].status = record->flags & WAVE_CHUNK_TIME_RESET ? PICO_DEVICE_TIME_STAMP_RESET : PICO_OK;
+		triggerInfo[capture].segmentIndex = capture;
+		triggerInfo[capture].triggerIndex = record->flags & WAVE_CHUNK_TRIGGERED ? record->triggerIndex : run->preTrigger;
+		triggerInfo[capture].timeStampCounter = record->firstSample;
+		capture++;
+	}
 
-/****************************************************************************
-* openDevice 
-* Parameters 
-* - unit        pointer to the UNIT structure, where the handle will be stored
-* - serial		pointer to the int8_t array containing serial number
-*
-* Returns
-* - PICO_STATUS to indicate success, or if an error occurred
-***************************************************************************/
-PICO_STATUS openDevice(UNIT *unit, int8_t *serial)
-{
-	PICO_STATUS status;
-	unit->resolution = PS5000A_DR_8BIT;
+	perfSince(PERF_BLOCK_READOUT, start);
+	perfAddSamples((uint64_t) nSamples * capture);
+	metricsAdd(METRIC_SAMPLES, (uint64_t) nSamples * capture);
+	metricsAdd(METRIC_CAPTURES, capture);
 
-	if (serial == NULL)
+	if (_kbhit())
 	{
-		status = ps5000aOpenUnit(&unit->handle, NULL, unit->resolution);
+		_getch();
+		printf("Replay aborted. %u captures were read\n", capture);
 	}
-	else
+
+	if (capture > 0)
 	{
-		status = ps5000aOpenUnit(&unit->handle, serial, unit->resolution);
+		processCaptures(unit, rapidBuffers, overflow, triggerInfo, nSamples, capture, (int32_t)(run->sampleIntervalNs + 0.5), run->preTrigger);
 	}
 
-	unit->openStatus = (int16_t) status;
-	unit->complete = 1;
+	for (channel = 0; channel < unit->channelCount; channel++)
+	{
+		if (unit->channelSettings[channel].enabled)
+		{
+			bufferFree(rapidData[channel], rapidBytes);
+			free(rapidBuffers[channel]);
+		}
+	}
 
-	return status;
+	free(rapidBuffers);
+	free(overflow);
+	free(triggerInfo);
+	perfEnd();
+	metricsSet(METRIC_ACQUIRING, 0);
 }
 
 /****************************************************************************
-* handleDevice
-* Parameters
-* - unit        pointer to the UNIT structure, where the handle will be stored
+* replayRecording
 *
-* Returns
-* - PICO_STATUS to indicate success, or if an error occurred
-***************************************************************************/
-PICO_STATUS handleDevice(UNIT * unit)
+* Opens the file to replay and sets up a unit with the settings it was
+* recorded with, in place of the device
+****************************************************************************/
+void replayRecording(void)
 {
-	int16_t value = 0;
-	int32_t i;
-	struct tPwq pulseWidth;
-	PICO_STATUS status;
+	const WAVE_RUN * run;
+	UNIT unit;
+	int16_t ch;
 
-	printf("Handle: %d\n", unit->handle);
-	
-	if (unit->openStatus != PICO_OK)
+	if ((g_replay = replayOpen((const char *) g_replayFile, g_replayRun, g_replayCaptureSamples)) == NULL)
 	{
-		printf("Unable to open device\n");
-		printf("Error code : 0x%08x\n", (uint32_t) unit->openStatus);
-		while(!_kbhit());
-		exit(99); // exit program
+		return;
 	}
 
-	printf("Device opened successfully, cycle %d\n\n", ++cycles);
-	
-	// Setup device info - unless it's set already
-	if (unit->model == MODEL_NONE)
+	// Text files the stages write as they go
+	if (replaySource(g_replay, (const char *) streamFile) || replaySource(g_replay, (const char *) blockFile) || replaySource(g_replay, (const char *) streamDspFile) ||
+		replaySource(g_replay, (const char *) blockDspFile) || replaySource(g_replay, (const char *) streamTriggerFile))
 	{
-		set_info(unit);
+		printf("%s is written by the replay itself.\n", g_replayFile);
+		replayClose(g_replay);
+		g_replay = NULL;
+		return;
 	}
 
-	// Turn off any digital ports (MSO models only)
-	if (unit->digitalPortCount > 0)
+	run = replayRun(g_replay);
+
+	memset(&unit, 0, sizeof(UNIT));
+	memcpy(unit.modelString, "Replay", 7);
+	unit.firstRange = PS5000A_10MV;
+	unit.lastRange = PS5000A_20V;
+	unit.resolution = (PS5000A_DEVICE_RESOLUTION) run->resolution;
+	unit.maxADCValue = run->maxADCValue;
+	unit.channelCount = run->channelMask >> DUAL_SCOPE ? QUAD_SCOPE : DUAL_SCOPE;
+
+	for (ch = 0; ch < unit.channelCount; ch++)
 	{
-		printf("Turning off digital ports.");
+		unit.channelSettings[ch].enabled = (run->channelMask >> ch) & 1;
+		unit.channelSettings[ch].range = run->range[ch];
+		unit.channelSettings[ch].analogueOffset = run->analogueOffset[ch];
+		unit.channelSettings[ch].DCcoupled = TRUE;
+	}
 
-		for (i = 0; i < unit->digitalPortCount; i++)
-		{
-			status = ps5000aSetDigitalPort(unit->handle, (PS5000A_CHANNEL)(i + PS5000A_DIGITAL_PORT0), 0, 0);
-		}
+	printf("Replaying run %u of %s: %u %s, %.1f ns per sample, %s\n", replayRunNumber(g_replay), g_replayFile,
+				replayRecords(g_replay), replayKind(g_replay) == REPLAY_STREAM ? "callbacks" : "captures",
+				run->sampleIntervalNs, g_replayPaced ? "at the original rate" : "unthrottled");
+
+	if (replayKind(g_replay) == REPLAY_STREAM)
+	{
+		replayStreaming(&unit);
+	}
+	else
+	{
+		replayCaptures(&unit);
 	}
-	
-	timebase = 1;
 
-	ps5000aMaximumValue(unit->handle, &value);
-	unit->maxADCValue = value;
+	replayClose(g_replay);
+	g_replay = NULL;
+}
 
-	status = ps5000aCurrentPowerSource(unit->handle);
+/****************************************************************************
+* replayMenu
+*
+* Replay of a recording through the processing stages, with or without a
+* device
+****************************************************************************/
+void replayMenu(void)
+{
+	int8_t ch = '.';
 
-	for (i = 0; i < unit->channelCount; i++)
+	while (ch != 'X')
 	{
-		// Do not enable channels C and D if power supply not connected for PicoScope 544XA/B devices
-		if(unit->channelCount == QUAD_SCOPE && status == PICO_POWER_SUPPLY_NOT_CONNECTED && i >= DUAL_SCOPE)
+		printf("\n\n");
+		printf("ACTUAL OPTIONS FOR REPLAY\n\n");
+		printf("File = %s\n", g_replayFile);
+
+		if (g_replayRun == REPLAY_LAST_RUN)
 		{
-			unit->channelSettings[i].enabled = FALSE;
-			unit->channelSettings[4].enabled = TRUE;
+			printf("Run = last\n");
 		}
 		else
 		{
-			unit->channelSettings[i].enabled = TRUE;
-			unit->channelSettings[4].enabled = TRUE;
+			printf("Run = %u\n", g_replayRun);
 		}
 
-		unit->channelSettings[i].DCcoupled = FALSE;
-		unit->channelSettings[i].range = PS5000A_5V;
-		unit->channelSettings[i].analogueOffset = 0.0f;
-	}
+		printf("Samples per capture (block_binary.txt with mV) = %u\n", g_replayCaptureSamples);
+		printf("Pace = %s\n", g_replayPaced ? "Original rate" : "Unthrottled");
+		printf("\n");
+		printf("Please select operation:\n\n");
 
-	memset(&pulseWidth, 0, sizeof(struct tPwq));
+		printf("N - File name				U - Run to replay\n");
+		printf("S - Samples per capture			P - Original rate / unthrottled\n");
+		printf("O - Output options			F - Filtering / lock-in\n");
+		printf("G - Software trigger / pre-trigger\n");
+		printf("\n");
+		printf("R - Replay\n");
+		printf("X - Back\n");
+		printf("Operation:");
 
-	setDefaults(unit);
+		ch = toupper(_getch());
 
-	/* Trigger disabled	*/
-	status = ps5000aSetSimpleTrigger(unit->handle, 0, PS5000A_EXTERNAL, 0, PS5000A_RISING, 0, 0);
+		printf("\n\n");
 
-	return unit->openStatus;
-}
+		switch (ch)
+		{
+			case 'N':
+				printf("File to replay:");
+#ifdef _WIN32
+				scanf_s("%255s", g_replayFile, (unsigned) sizeof(g_replayFile));
+#else
+				scanf_s("%255s", g_replayFile);
+#endif
+				break;
 
-/****************************************************************************
-* closeDevice 
-****************************************************************************/
-void closeDevice(UNIT *unit)
-{
-	ps5000aCloseUnit(unit->handle);
+			case 'U':
+				printf("Run to replay (-1 for the last):");
+				scanf_s("%u", &g_replayRun);
+				break;
+
+			case 'S':
+				do
+				{
+					printf("Samples per capture:");
+					scanf_s("%u", &g_replayCaptureSamples);
+
+					if (g_replayCaptureSamples == 0)
+					{
+						printf("Invalid value: at least one sample per capture. Please set a valid value\n");
+					}
+				} while (g_replayCaptureSamples == 0);
+				break;
+
+			case 'P':
+				g_replayPaced = !g_replayPaced;
+				break;
+
+			case 'O':
+				setOutputOptions();
+				break;
+
+			case 'F':
+				setDspOptions();
+				break;
+
+			case 'G':
+				setSoftTriggerOptions();
+				break;
+
+			case 'R':
+				replayRecording();
+				break;
+
+			case 'X':
+				break;
+
+			default:
+				printf("Invalid operation\n");
+				break;
+		}
+	}
 }
 
 /****************************************************************************
@@ -2224,8 +5365,13 @@ void mainMenu(UNIT *unit)
 		printf("						C - Coupling AC/DC (Default = AC)\n");
 		printf("W - Triggered streaming				V - Set voltages\n");
 		printf("R - Collect set of rapid captures		I - Set timebase\n");
-		printf("						A - ADC counts/mV\n");
+		printf("P - Replay a recording				A - ADC counts/mV\n");
 		printf("						D - Set resolution\n");
+		printf("						B - Fastest resolution and timebase for an interval\n");
+		printf("						O - Output options\n");
+		printf("						T - Real-time profile\n");
+		printf("						F - Filtering / lock-in\n");
+		printf("						G - Software trigger / pre-trigger\n");
 
 		printf("X - Exit\n");
 		printf("Operation:");
@@ -2244,6 +5390,10 @@ void mainMenu(UNIT *unit)
 				collectRapidBlock(unit);
 				break;
 
+			case 'P':
+				replayMenu();
+				break;
+
 			case 'V':
 				setVoltages(unit);
 				break;
@@ -2260,6 +5410,10 @@ void mainMenu(UNIT *unit)
 				setResolution(unit);
 				break;
 
+			case 'B':
+				setFastestResolution(unit);
+				break;
+
 			case 'X':
 				break;
 
@@ -2267,11 +5421,31 @@ void mainMenu(UNIT *unit)
 				setCoupling(unit);
 				break;
 
+			case 'O':
+				setOutputOptions();
+				break;
+
+			case 'T':
+				setRealtimeOptions();
+				break;
+
+			case 'F':
+				setDspOptions();
+				break;
+
+			case 'G':
+				setSoftTriggerOptions();
+				break;
+
 			default:
 				printf("Invalid operation\n");
 				break;
 		}
 	}
+
+	metricsStop();
+	clockSyncDestroy(g_clockSync);
+	g_clockSync = NULL;
 }
 
 
@@ -2307,6 +5481,9 @@ int32_t main(void)
 	if (devCount == 0)
 	{
 		printf("Picoscope devices not found\n");
+		// Recordings can still be run through the processing stages
+		replayMenu();
+		metricsStop();
 		return 1;
 	}
 
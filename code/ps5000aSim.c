@@ -0,0 +1,1834 @@
+/*******************************************************************************
+ *
+ * Filename: ps5000aSim.c
+ *
+ * Description:
+ *   Simulated libps5000a. Implements the subset of the ps5000aApi.h functions
+ *   used by ps5000aCon so that the program can be built and run without a
+ *   PicoScope attached (./configure --enable-simulator).
+ *
+ *   The simulated unit produces a periodic synthetic signal on every enabled
+ *   channel, honours the trigger set by the application (the EXT input is
+ *   modelled as the sync output of the generator), limits segment memory like
+ *   the real device and charges a per-call and a USB bandwidth latency on the
+ *   calls that move data, so the streaming and rapid block paths can be
+ *   timed on any machine.
+ *
+ *   The simulation is configured through environment variables:
+ *
+ *		PS5000A_SIM_MODEL			variant string (default 5444D)
+ *		PS5000A_SIM_UNITS			number of units found by ps5000aOpenUnit (default 1)
+ *		PS5000A_SIM_POWER			"dc" or "usb" power for 4 channel units (default dc)
+ *		PS5000A_SIM_SIGNAL			sine, square, triangle, pulse, noise, dc (default sine)
+ *		PS5000A_SIM_FREQUENCY		signal frequency in Hz (default 1000)
+ *		PS5000A_SIM_AMPLITUDE_MV	signal amplitude in mV (default 1000)
+ *		PS5000A_SIM_OFFSET_MV		signal offset in mV (default 0)
+ *		PS5000A_SIM_NOISE_MV		gaussian noise rms in mV (default 5)
+ *		PS5000A_SIM_MEMORY			capture memory in samples at 8 bits (default by model)
+ *		PS5000A_SIM_MAX_SEGMENTS	maximum number of memory segments (default 250000)
+ *		PS5000A_SIM_REARM_NS		rapid block re-arm time in ns (default 1000)
+ *		PS5000A_SIM_CALL_LATENCY_US	latency of every call that talks to the device (default 50)
+ *		PS5000A_SIM_USB_MBPS		USB bandwidth in MB/s, 0 for unlimited (default 350)
+ *		PS5000A_SIM_POWER_LOSS_MS	4 channel units: the +5 V supply drops this long after
+ *									each ps5000aRunStreaming, 0 for never (default 0)
+ *		PS5000A_SIM_POWER_OUTAGE_MS	time until the supply comes back (default 200)
+ *		PS5000A_SIM_CLOCK_PPM		error of the device clock in the trigger time stamps (default 0)
+ *
+ *   A supply change stops streaming and, like the real driver, every call
+ *   that talks to the device returns the new power state until it has been
+ *   acknowledged with ps5000aChangePowerSource.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <libps5000a/ps5000aApi.h>
+#ifndef PICO_STATUS
+#include <libps5000a/PicoStatus.h>
+#endif
+
+#define SIM_MAX_UNITS		8
+#define SIM_TABLE_BITS		12
+#define SIM_TABLE_SIZE		(1 << SIM_TABLE_BITS)
+#define SIM_NOISE_SIZE		65536
+#define SIM_HANDLE_BASE		16384
+#define SIM_SYNC_LEVEL		16384	/* EXT sync pulse height in ADC counts (2.5 V on the 5 V EXT input) */
+
+typedef enum
+{
+	SIM_SINE,
+	SIM_SQUARE,
+	SIM_TRIANGLE,
+	SIM_PULSE,
+	SIM_NOISE,
+	SIM_DC
+} SIM_SIGNAL;
+
+typedef struct
+{
+	char				model[8];
+	int16_t				units;
+	int16_t				usbPower;
+	SIM_SIGNAL			signal;
+	double				frequency;
+	double				amplitudeMv;
+	double				offsetMv;
+	double				noiseMv;
+	uint32_t			memorySamples;
+	uint32_t			maxSegments;
+	double				rearmSeconds;
+	double				callLatency;
+	double				usbBytesPerSecond;
+	double				powerLoss;
+	double				powerOutage;
+	double				clockError;
+} SIM_CONFIG;
+
+typedef struct
+{
+	int16_t				enabled;
+	PS5000A_COUPLING	coupling;
+	PS5000A_RANGE		range;
+	float				analogueOffset;
+	int16_t				clips;
+	int32_t				table[SIM_TABLE_SIZE];
+	int16_t				noise[SIM_NOISE_SIZE];
+} SIM_CHANNEL;
+
+typedef struct
+{
+	int16_t *			bufferMax;
+	int16_t *			bufferMin;
+	int32_t				length;
+} SIM_BUFFER;
+
+/* Generator state: position in the waveform table and in the noise sequence */
+typedef struct
+{
+	uint32_t			phase;
+	uint32_t			seed;
+} SIM_GENERATOR;
+
+typedef struct
+{
+	int16_t				handle;
+	int16_t				open;
+	int8_t				variant[8];
+	int8_t				serial[16];
+	int16_t				channelCount;
+	int16_t				hasAwg;
+	PICO_STATUS			powerState;
+	PICO_STATUS			powerPending;	/* supply change not yet acknowledged, PICO_OK if none */
+	double				powerRestore;	/* when the lost supply comes back, 0 if it is on */
+	PS5000A_DEVICE_RESOLUTION	resolution;
+	SIM_CHANNEL			channels[PS5000A_MAX_CHANNELS];
+
+	int16_t				triggerEnabled;
+	PS5000A_CHANNEL		triggerChannel;
+	int16_t				triggerThreshold;
+	PS5000A_THRESHOLD_DIRECTION	triggerDirection;
+	uint64_t			autoTriggerUs;
+
+	uint32_t			nSegments;
+	uint32_t			nCaptures;
+	SIM_BUFFER *		buffers;		/* [channel * nSegments + segment] */
+
+	pthread_mutex_t		lock;
+	pthread_t			blockThread;
+	int16_t				blockRunning;
+	volatile int16_t	stopRequested;
+	ps5000aBlockReady	blockReady;
+	void *				blockParameter;
+	double				runStart;
+	double				stopTime;
+	double				sampleInterval;
+	uint32_t			firstSegment;
+	uint32_t			preTrigger;
+	uint32_t			postTrigger;
+	int16_t				triggerFound;
+	double				firstTrigger;	/* seconds after arming */
+	double				captureSpacing;	/* seconds between triggers */
+	uint32_t			triggerPhase;
+
+	int16_t				streaming;
+	double				streamStart;
+	uint64_t			streamConsumed;
+	uint64_t			streamTarget;
+	uint64_t			streamLost;
+	uint32_t			streamWriteIndex;
+	uint32_t			streamPreTrigger;
+	uint32_t			streamPostTrigger;
+	int16_t				streamAutoStop;
+	int16_t				streamTriggered;
+	uint32_t			downSampleRatio;
+	PS5000A_RATIO_MODE	ratioMode;
+	uint32_t			overviewBufferSize;
+	SIM_GENERATOR		streamGenerators[PS5000A_MAX_CHANNELS];
+	int16_t *			scratch;
+	uint32_t			scratchLength;
+} SIM_UNIT;
+
+static const uint16_t simRanges[PS5000A_MAX_RANGES] = { 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000 };
+
+static pthread_once_t	simOnce = PTHREAD_ONCE_INIT;
+static SIM_CONFIG		simConfig;
+static SIM_UNIT			simUnits[SIM_MAX_UNITS];
+
+/****************************************************************************
+* Environment and timing helpers
+****************************************************************************/
+static double simEnvDouble(const char * name, double defaultValue)
+{
+	const char * value = getenv(name);
+	return (value != NULL && *value != '\0') ? atof(value) : defaultValue;
+}
+
+static void simLoadConfig(void)
+{
+	const char * value;
+
+	value = getenv("PS5000A_SIM_MODEL");
+	snprintf(simConfig.model, sizeof(simConfig.model), "%s", (value != NULL && strlen(value) >= 5) ? value : "5444D");
+
+	simConfig.units = (int16_t) simEnvDouble("PS5000A_SIM_UNITS", 1);
+	simConfig.units = simConfig.units > SIM_MAX_UNITS ? SIM_MAX_UNITS : simConfig.units;
+
+	value = getenv("PS5000A_SIM_POWER");
+	simConfig.usbPower = (value != NULL && strcmp(value, "usb") == 0);
+
+	value = getenv("PS5000A_SIM_SIGNAL");
+	simConfig.signal = SIM_SINE;
+
+	if (value != NULL)
+	{
+		if (strcmp(value, "square") == 0)		simConfig.signal = SIM_SQUARE;
+		if (strcmp(value, "triangle") == 0)		simConfig.signal = SIM_TRIANGLE;
+		if (strcmp(value, "pulse") == 0)		simConfig.signal = SIM_PULSE;
+		if (strcmp(value, "noise") == 0)		simConfig.signal = SIM_NOISE;
+		if (strcmp(value, "dc") == 0)			simConfig.signal = SIM_DC;
+	}
+
+	simConfig.frequency = simEnvDouble("PS5000A_SIM_FREQUENCY", 1000.0);
+	simConfig.amplitudeMv = simEnvDouble("PS5000A_SIM_AMPLITUDE_MV", 1000.0);
+	simConfig.offsetMv = simEnvDouble("PS5000A_SIM_OFFSET_MV", 0.0);
+	simConfig.noiseMv = simEnvDouble("PS5000A_SIM_NOISE_MV", 5.0);
+
+	// A, B and D models have 128, 256 and 512 MS of capture memory
+	switch (simConfig.model[4])
+	{
+		case 'A':
+			simConfig.memorySamples = 128u << 20;
+			break;
+		case 'B':
+			simConfig.memorySamples = 256u << 20;
+			break;
+		default:
+			simConfig.memorySamples = 512u << 20;
+			break;
+	}
+
+	simConfig.memorySamples = (uint32_t) simEnvDouble("PS5000A_SIM_MEMORY", simConfig.memorySamples);
+	simConfig.maxSegments = (uint32_t) simEnvDouble("PS5000A_SIM_MAX_SEGMENTS", 250000);
+	simConfig.rearmSeconds = simEnvDouble("PS5000A_SIM_REARM_NS", 1000.0) * 1e-9;
+	simConfig.callLatency = simEnvDouble("PS5000A_SIM_CALL_LATENCY_US", 50.0) * 1e-6;
+	simConfig.usbBytesPerSecond = simEnvDouble("PS5000A_SIM_USB_MBPS", 350.0) * 1e6;
+	simConfig.powerLoss = simEnvDouble("PS5000A_SIM_POWER_LOSS_MS", 0.0) * 1e-3;
+	simConfig.powerOutage = simEnvDouble("PS5000A_SIM_POWER_OUTAGE_MS", 200.0) * 1e-3;
+	simConfig.clockError = simEnvDouble("PS5000A_SIM_CLOCK_PPM", 0.0) * 1e-6;
+
+	if (simConfig.frequency <= 0.0)
+	{
+		simConfig.frequency = 1000.0;
+	}
+}
+
+static double simNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static void simSleep(double seconds)
+{
+	struct timespec ts;
+
+	if (seconds <= 0.0)
+	{
+		return;
+	}
+
+	ts.tv_sec = (time_t) seconds;
+	ts.tv_nsec = (long) ((seconds - (double) ts.tv_sec) * 1e9);
+	nanosleep(&ts, NULL);
+}
+
+/* Charge the round trip of one call plus the transfer of 'bytes' over USB */
+static void simTransfer(size_t bytes)
+{
+	double seconds = simConfig.callLatency;
+
+	if (simConfig.usbBytesPerSecond > 0.0)
+	{
+		seconds += (double) bytes / simConfig.usbBytesPerSecond;
+	}
+
+	simSleep(seconds);
+}
+
+static SIM_UNIT * simGetUnit(int16_t handle)
+{
+	int32_t index = handle - SIM_HANDLE_BASE;
+
+	if (index < 0 || index >= SIM_MAX_UNITS || !simUnits[index].open)
+	{
+		return NULL;
+	}
+
+	return &simUnits[index];
+}
+
+/****************************************************************************
+* Device characteristics
+****************************************************************************/
+static int16_t simMaxValue(PS5000A_DEVICE_RESOLUTION resolution)
+{
+	return resolution == PS5000A_DR_8BIT ? 32512 : 32767;
+}
+
+/* Samples are left justified: the low bits below the resolution are zero */
+static int32_t simQuantMask(PS5000A_DEVICE_RESOLUTION resolution)
+{
+	switch (resolution)
+	{
+		case PS5000A_DR_8BIT:	return ~0xFF;
+		case PS5000A_DR_12BIT:	return ~0x0F;
+		case PS5000A_DR_14BIT:	return ~0x03;
+		case PS5000A_DR_15BIT:	return ~0x01;
+		default:				return ~0x00;
+	}
+}
+
+static uint32_t simMemory(SIM_UNIT * unit)
+{
+	return unit->resolution == PS5000A_DR_8BIT ? simConfig.memorySamples : simConfig.memorySamples / 2;
+}
+
+static int16_t simEnabledChannels(SIM_UNIT * unit)
+{
+	int16_t ch, count = 0;
+
+	for (ch = 0; ch < unit->channelCount; ch++)
+	{
+		count += unit->channels[ch].enabled ? 1 : 0;
+	}
+
+	return count;
+}
+
+static int16_t simMaxChannels(PS5000A_DEVICE_RESOLUTION resolution)
+{
+	return resolution == PS5000A_DR_16BIT ? 1 : resolution == PS5000A_DR_15BIT ? 2 : 4;
+}
+
+static uint32_t simMinimumTimebase(PS5000A_DEVICE_RESOLUTION resolution, int16_t channels)
+{
+	switch (resolution)
+	{
+		case PS5000A_DR_8BIT:	return channels <= 1 ? 0 : channels == 2 ? 1 : 2;
+		case PS5000A_DR_12BIT:	return channels <= 1 ? 1 : channels == 2 ? 2 : 3;
+		case PS5000A_DR_14BIT:
+		case PS5000A_DR_15BIT:	return 3;
+		default:				return 4;
+	}
+}
+
+/* Sample interval in seconds of a timebase index, 0 if the index is not valid at this resolution */
+static double simTimebaseInterval(PS5000A_DEVICE_RESOLUTION resolution, uint32_t timebase)
+{
+	switch (resolution)
+	{
+		case PS5000A_DR_8BIT:
+			return timebase < 3 ? (double)(1u << timebase) * 1e-9 : (double)(timebase - 2) * 8e-9;
+
+		case PS5000A_DR_12BIT:
+			if (timebase == 0)
+			{
+				return 0.0;
+			}
+			return timebase < 4 ? (double)(1u << (timebase - 1)) * 2e-9 : (double)(timebase - 3) * 16e-9;
+
+		case PS5000A_DR_14BIT:
+		case PS5000A_DR_15BIT:
+			return timebase < 3 ? 0.0 : timebase == 3 ? 8e-9 : (double)(timebase - 2) * 8e-9;
+
+		default:
+			return timebase < 4 ? 0.0 : timebase == 4 ? 16e-9 : (double)(timebase - 3) * 16e-9;
+	}
+}
+
+/****************************************************************************
+* Signal generation
+****************************************************************************/
+static double simWaveform(double phase)
+{
+	switch (simConfig.signal)
+	{
+		case SIM_SQUARE:	return phase < 0.5 ? 1.0 : -1.0;
+		case SIM_TRIANGLE:	return phase < 0.5 ? 4.0 * phase - 1.0 : 3.0 - 4.0 * phase;
+		case SIM_PULSE:		return exp(-phase / 0.05);
+		case SIM_NOISE:		return 0.0;
+		case SIM_DC:		return 1.0;
+		default:			return sin(2.0 * M_PI * phase);
+	}
+}
+
+static uint32_t simRandom(uint32_t * state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/* Rebuild the waveform and noise tables of every channel from the current settings */
+static void simPrepareChannels(SIM_UNIT * unit)
+{
+	int16_t ch;
+	int32_t i;
+	int16_t maxValue = simMaxValue(unit->resolution);
+	uint32_t state = 0x9E3779B9u;
+
+	for (ch = 0; ch < unit->channelCount; ch++)
+	{
+		SIM_CHANNEL * channel = &unit->channels[ch];
+		double scale = (double) maxValue / (double) simRanges[channel->range];
+		double offset = simConfig.offsetMv + channel->analogueOffset * 1000.0;
+		double noise = simConfig.noiseMv * scale;
+		int32_t peak = 0;
+
+		for (i = 0; i < SIM_TABLE_SIZE; i++)
+		{
+			// Each channel is a quarter of a period behind the previous one
+			double phase = fmod((double) i / SIM_TABLE_SIZE + 0.25 * ch, 1.0);
+			channel->table[i] = (int32_t) lrint((simConfig.amplitudeMv * simWaveform(phase) + offset) * scale);
+			peak = abs(channel->table[i]) > peak ? abs(channel->table[i]) : peak;
+		}
+
+		for (i = 0; i < SIM_NOISE_SIZE; i += 2)
+		{
+			// Box-Muller pairs
+			double u1 = ((double) simRandom(&state) + 1.0) / 4294967297.0;
+			double u2 = (double) simRandom(&state) / 4294967296.0;
+			double r = sqrt(-2.0 * log(u1)) * noise;
+			double n0 = r * cos(2.0 * M_PI * u2);
+			double n1 = r * sin(2.0 * M_PI * u2);
+			channel->noise[i] = (int16_t)(n0 > 32767.0 ? 32767.0 : n0 < -32767.0 ? -32767.0 : n0);
+			channel->noise[i + 1] = (int16_t)(n1 > 32767.0 ? 32767.0 : n1 < -32767.0 ? -32767.0 : n1);
+		}
+
+		channel->clips = (peak + 4.0 * noise) > maxValue;
+	}
+}
+
+/* Generate 'count' raw samples of one channel, returns non zero if any sample was clipped */
+static int16_t simGenerate(SIM_UNIT * unit, int16_t ch, SIM_GENERATOR * generator, uint32_t increment, int16_t * out, uint32_t count)
+{
+	SIM_CHANNEL * channel = &unit->channels[ch];
+	int32_t mask = simQuantMask(unit->resolution);
+	int32_t maxValue = simMaxValue(unit->resolution);
+	uint32_t phase = generator->phase;
+	uint32_t seed = generator->seed;
+	int16_t clipped = 0;
+	uint32_t i;
+
+	if (!channel->clips)
+	{
+		for (i = 0; i < count; i++)
+		{
+			int32_t value = channel->table[phase >> (32 - SIM_TABLE_BITS)] + channel->noise[simRandom(&seed) >> 16];
+			out[i] = (int16_t)(value & mask);
+			phase += increment;
+		}
+	}
+	else
+	{
+		for (i = 0; i < count; i++)
+		{
+			int32_t value = channel->table[phase >> (32 - SIM_TABLE_BITS)] + channel->noise[simRandom(&seed) >> 16];
+
+			if (value > maxValue || value < -maxValue)
+			{
+				value = value > 0 ? maxValue : -maxValue;
+				clipped = 1;
+			}
+
+			out[i] = (int16_t)(value & mask);
+			phase += increment;
+		}
+	}
+
+	generator->phase = phase;
+	generator->seed = seed;
+	return clipped;
+}
+
+/* Phase (as a fraction of 2^32) at which the configured trigger fires, returns 0 if the signal never crosses the threshold */
+static int16_t simFindTriggerPhase(SIM_UNIT * unit, uint32_t * triggerPhase)
+{
+	SIM_CHANNEL * channel;
+	int32_t i;
+	int16_t rising = (unit->triggerDirection != PS5000A_FALLING && unit->triggerDirection != PS5000A_BELOW);
+
+	if (unit->triggerChannel == PS5000A_EXTERNAL || unit->triggerChannel >= PS5000A_MAX_CHANNELS)
+	{
+		// The EXT input sees the generator sync pulse at the start of each period
+		*triggerPhase = 0;
+		return rising ? (unit->triggerThreshold < SIM_SYNC_LEVEL) : (unit->triggerThreshold > 0);
+	}
+
+	channel = &unit->channels[unit->triggerChannel];
+
+	for (i = 0; i < SIM_TABLE_SIZE; i++)
+	{
+		int32_t previous = channel->table[(i + SIM_TABLE_SIZE - 1) % SIM_TABLE_SIZE];
+		int32_t current = channel->table[i];
+
+		if ((rising && previous < unit->triggerThreshold && current >= unit->triggerThreshold) ||
+			(!rising && previous > unit->triggerThreshold && current <= unit->triggerThreshold))
+		{
+			*triggerPhase = (uint32_t) i << (32 - SIM_TABLE_BITS);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static uint32_t simPhaseIncrement(double sampleInterval)
+{
+	return (uint32_t)(fmod(simConfig.frequency * sampleInterval, 1.0) * 4294967296.0);
+}
+
+/****************************************************************************
+* Rapid block capture model
+*
+* Triggers are evenly spaced: the first one is the first crossing after the
+* pre-trigger samples have been collected, the next ones are the first
+* crossings after the previous capture has completed and the device has
+* re-armed. Segment data are regenerated from the trigger time on readout,
+* so the host only holds the memory the application asked for.
+****************************************************************************/
+static double simCaptureCompleted(SIM_UNIT * unit, uint32_t capture)
+{
+	return unit->firstTrigger + (double) capture * unit->captureSpacing + unit->postTrigger * unit->sampleInterval;
+}
+
+static uint32_t simCapturesDone(SIM_UNIT * unit, double now)
+{
+	double elapsed = now - unit->runStart;
+	double done;
+
+	if (!unit->triggerFound)
+	{
+		return 0;
+	}
+
+	if (elapsed < simCaptureCompleted(unit, 0))
+	{
+		return 0;
+	}
+
+	done = floor((elapsed - simCaptureCompleted(unit, 0)) / unit->captureSpacing) + 1.0;
+	return done >= unit->nCaptures ? unit->nCaptures : (uint32_t) done;
+}
+
+/* Device time used to count completed captures: frozen once the run has been stopped */
+static double simCaptureClock(SIM_UNIT * unit)
+{
+	return unit->stopTime > 0.0 ? unit->stopTime : simNow();
+}
+
+static void * simBlockThread(void * parameter)
+{
+	SIM_UNIT * unit = (SIM_UNIT *) parameter;
+	double complete = unit->runStart + simCaptureCompleted(unit, unit->nCaptures - 1);
+
+	for (;;)
+	{
+		double remaining = complete - simNow();
+
+		if (unit->stopRequested)
+		{
+			return NULL;
+		}
+
+		if (unit->triggerFound && remaining <= 0.0)
+		{
+			break;
+		}
+
+		simSleep(remaining > 0.01 || !unit->triggerFound ? 0.01 : remaining);
+	}
+
+	unit->blockReady(unit->handle, PICO_OK, unit->blockParameter);
+	return NULL;
+}
+
+static void simStopBlock(SIM_UNIT * unit)
+{
+	if (unit->blockRunning)
+	{
+		unit->stopRequested = 1;
+		pthread_join(unit->blockThread, NULL);
+		unit->blockRunning = 0;
+	}
+}
+
+static void simFreeSegments(SIM_UNIT * unit)
+{
+	free(unit->buffers);
+	unit->buffers = NULL;
+}
+
+static PICO_STATUS simSetBuffers(int16_t handle, PS5000A_CHANNEL source, int16_t * bufferMax, int16_t * bufferMin, int32_t bufferLth, uint32_t segmentIndex)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+	SIM_BUFFER * buffer;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (source < PS5000A_CHANNEL_A || (int16_t) source >= unit->channelCount)
+	{
+		return PICO_INVALID_CHANNEL;
+	}
+
+	if (segmentIndex >= unit->nSegments)
+	{
+		return PICO_SEGMENT_OUT_OF_RANGE;
+	}
+
+	pthread_mutex_lock(&unit->lock);
+	buffer = &unit->buffers[source * unit->nSegments + segmentIndex];
+	buffer->bufferMax = bufferMax;
+	buffer->bufferMin = bufferMin;
+	buffer->length = bufferMax == NULL ? 0 : bufferLth;
+	pthread_mutex_unlock(&unit->lock);
+
+	return PICO_OK;
+}
+
+/****************************************************************************
+* Unit management
+****************************************************************************/
+PICO_STATUS ps5000aOpenUnit(int16_t * handle, int8_t * serial, PS5000A_DEVICE_RESOLUTION resolution)
+{
+	SIM_UNIT * unit;
+	int16_t index;
+	int16_t ch;
+
+	pthread_once(&simOnce, simLoadConfig);
+
+	if (handle == NULL)
+	{
+		return PICO_NULL_PARAMETER;
+	}
+
+	*handle = 0;
+
+	// The first unit not open, or the one with the serial; unit n is SIM/000n
+	for (index = 0; index < simConfig.units; index++)
+	{
+		char name[sizeof(unit->serial)];
+
+		snprintf(name, sizeof(name), "SIM/%04d", index);
+
+		if (!simUnits[index].open && (serial == NULL || strcmp((char *) serial, name) == 0))
+		{
+			break;
+		}
+	}
+
+	if (index >= simConfig.units)
+	{
+		return PICO_NOT_FOUND;
+	}
+
+	unit = &simUnits[index];
+	memset(unit, 0, sizeof(SIM_UNIT));
+
+	if ((unit->buffers = (SIM_BUFFER *) calloc(PS5000A_MAX_CHANNELS, sizeof(SIM_BUFFER))) == NULL)
+	{
+		return PICO_MEMORY_FAIL;
+	}
+
+	unit->handle = (int16_t)(SIM_HANDLE_BASE + index);
+	unit->open = 1;
+	snprintf((char *) unit->variant, sizeof(unit->variant), "%s", simConfig.model);
+	snprintf((char *) unit->serial, sizeof(unit->serial), "SIM/%04d", index);
+	unit->channelCount = (int16_t)(simConfig.model[1] - '0') == 4 ? 4 : 2;
+	unit->hasAwg = simConfig.model[4] != 'A';
+	unit->resolution = resolution;
+	unit->triggerChannel = PS5000A_EXTERNAL;
+	unit->nSegments = 1;
+	unit->nCaptures = 1;
+	pthread_mutex_init(&unit->lock, NULL);
+
+	for (ch = 0; ch < PS5000A_MAX_CHANNELS; ch++)
+	{
+		unit->channels[ch].enabled = ch < unit->channelCount;
+		unit->channels[ch].coupling = PS5000A_DC;
+		unit->channels[ch].range = PS5000A_5V;
+	}
+
+	*handle = unit->handle;
+	simTransfer(0);
+
+	if (unit->channelCount == 4 && simConfig.usbPower)
+	{
+		unit->powerState = PICO_POWER_SUPPLY_NOT_CONNECTED;
+		return PICO_POWER_SUPPLY_NOT_CONNECTED;
+	}
+
+	unit->powerState = PICO_POWER_SUPPLY_CONNECTED;
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aCloseUnit(int16_t handle)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	simStopBlock(unit);
+	simFreeSegments(unit);
+	free(unit->scratch);
+	pthread_mutex_destroy(&unit->lock);
+	unit->open = 0;
+
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aGetUnitInfo(int16_t handle, int8_t * string, int16_t stringLength, int16_t * requiredSize, PICO_INFO info)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+	const char * value;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	switch (info)
+	{
+		case PICO_DRIVER_VERSION:				value = "ps5000aSim 1.0.0"; break;
+		case PICO_USB_VERSION:					value = "3.0"; break;
+		case PICO_HARDWARE_VERSION:				value = "1"; break;
+		case PICO_VARIANT_INFO:					value = (char *) unit->variant; break;
+		case PICO_BATCH_AND_SERIAL:				value = (char *) unit->serial; break;
+		case PICO_CAL_DATE:						value = "01Jan18"; break;
+		case PICO_KERNEL_VERSION:				value = "simulated"; break;
+		case PICO_DIGITAL_HARDWARE_VERSION:		value = "1"; break;
+		case PICO_ANALOGUE_HARDWARE_VERSION:	value = "1"; break;
+		case PICO_FIRMWARE_VERSION_1:			value = "1.0.0.0"; break;
+		case PICO_FIRMWARE_VERSION_2:			value = "1.0.0.0"; break;
+		default:								return PICO_INVALID_INFO;
+	}
+
+	if (requiredSize != NULL)
+	{
+		*requiredSize = (int16_t)(strlen(value) + 1);
+	}
+
+	if (string != NULL && stringLength > 0)
+	{
+		snprintf((char *) string, stringLength, "%s", value);
+	}
+
+	return PICO_OK;
+}
+
+/* Brings the supply back once the outage is over; the change is then pending like the loss was */
+static PICO_STATUS simPowerPending(SIM_UNIT * unit)
+{
+	if (unit->powerRestore != 0.0 && simNow() >= unit->powerRestore)
+	{
+		unit->powerRestore = 0.0;
+		unit->powerPending = PICO_POWER_SUPPLY_CONNECTED;
+	}
+
+	return unit->powerPending;
+}
+
+PICO_STATUS ps5000aCurrentPowerSource(int16_t handle)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	simPowerPending(unit);
+	return unit->powerRestore != 0.0 ? PICO_POWER_SUPPLY_NOT_CONNECTED : unit->powerPending != PICO_OK ? unit->powerPending : unit->powerState;
+}
+
+PICO_STATUS ps5000aChangePowerSource(int16_t handle, PICO_STATUS powerState)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	simPowerPending(unit);
+
+	// The supply cannot be used while it is away
+	if (powerState == PICO_POWER_SUPPLY_CONNECTED && unit->powerRestore != 0.0)
+	{
+		return PICO_POWER_SUPPLY_REQUEST_INVALID;
+	}
+
+	unit->powerState = powerState == PICO_POWER_SUPPLY_CONNECTED ? PICO_POWER_SUPPLY_CONNECTED : PICO_POWER_SUPPLY_NOT_CONNECTED;
+	unit->powerPending = PICO_OK;
+	simTransfer(0);
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aSetDeviceResolution(int16_t handle, PS5000A_DEVICE_RESOLUTION resolution)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (resolution > PS5000A_DR_16BIT)
+	{
+		return PICO_INVALID_PARAMETER;
+	}
+
+	if (simEnabledChannels(unit) > simMaxChannels(resolution))
+	{
+		return PICO_INVALID_NUMBER_CHANNELS_FOR_RESOLUTION;
+	}
+
+	unit->resolution = resolution;
+	simTransfer(0);
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aGetDeviceResolution(int16_t handle, PS5000A_DEVICE_RESOLUTION * resolution)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	*resolution = unit->resolution;
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aMaximumValue(int16_t handle, int16_t * value)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	*value = simMaxValue(unit->resolution);
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aMinimumValue(int16_t handle, int16_t * value)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	*value = (int16_t) -simMaxValue(unit->resolution);
+	return PICO_OK;
+}
+
+/****************************************************************************
+* Channel, signal generator and trigger setup
+****************************************************************************/
+PICO_STATUS ps5000aSetChannel(int16_t handle, PS5000A_CHANNEL channel, int16_t enabled, PS5000A_COUPLING type, PS5000A_RANGE range, float analogOffset)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (channel == PS5000A_EXTERNAL)
+	{
+		return PICO_OK;
+	}
+
+	if (channel < PS5000A_CHANNEL_A || (int16_t) channel >= unit->channelCount)
+	{
+		return PICO_INVALID_CHANNEL;
+	}
+
+	if (range < PS5000A_10MV || range > PS5000A_20V)
+	{
+		return PICO_INVALID_VOLTAGE_RANGE;
+	}
+
+	unit->channels[channel].enabled = enabled ? 1 : 0;
+	unit->channels[channel].coupling = type;
+	unit->channels[channel].range = range;
+	unit->channels[channel].analogueOffset = analogOffset;
+	simTransfer(0);
+
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aSetDigitalPort(int16_t handle, PS5000A_CHANNEL port, int16_t enabled, int16_t logicLevel)
+{
+	(void) port;
+	(void) enabled;
+	(void) logicLevel;
+	return simGetUnit(handle) == NULL ? PICO_INVALID_HANDLE : PICO_OK;
+}
+
+PICO_STATUS ps5000aSetEts(int16_t handle, PS5000A_ETS_MODE mode, int16_t etsCycles, int16_t etsInterleave, int32_t * sampleTimePicoseconds)
+{
+	(void) etsCycles;
+	(void) etsInterleave;
+	(void) sampleTimePicoseconds;
+
+	if (simGetUnit(handle) == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	return mode == PS5000A_ETS_OFF ? PICO_OK : PICO_DRIVER_FUNCTION;
+}
+
+PICO_STATUS ps5000aSigGenArbitraryMinMaxValues(int16_t handle, int16_t * minArbitraryWaveformValue, int16_t * maxArbitraryWaveformValue,
+	uint32_t * minArbitraryWaveformSize, uint32_t * maxArbitraryWaveformSize)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (!unit->hasAwg)
+	{
+		return PICO_NOT_USED;
+	}
+
+	*minArbitraryWaveformValue = -32768;
+	*maxArbitraryWaveformValue = 32767;
+	*minArbitraryWaveformSize = MIN_SIG_GEN_BUFFER_SIZE;
+	*maxArbitraryWaveformSize = 32768;
+
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aSetSimpleTrigger(int16_t handle, int16_t enable, PS5000A_CHANNEL source, int16_t threshold,
+	PS5000A_THRESHOLD_DIRECTION direction, uint32_t delay, int16_t autoTrigger_ms)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	(void) delay;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	unit->triggerEnabled = enable;
+	unit->triggerChannel = source;
+	unit->triggerThreshold = threshold;
+	unit->triggerDirection = direction;
+	unit->autoTriggerUs = (uint64_t) autoTrigger_ms * 1000;
+	simTransfer(0);
+
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aSetTriggerChannelPropertiesV2(int16_t handle, PS5000A_TRIGGER_CHANNEL_PROPERTIES_V2 * channelProperties,
+	int16_t nChannelProperties, int16_t auxOutputEnable)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	(void) auxOutputEnable;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	// Only the first property set drives the simulated trigger
+	if (channelProperties != NULL && nChannelProperties > 0)
+	{
+		unit->triggerChannel = channelProperties[0].channel;
+		unit->triggerThreshold = channelProperties[0].thresholdUpper;
+	}
+
+	simTransfer(0);
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aSetTriggerChannelConditionsV2(int16_t handle, PS5000A_CONDITION * conditions, int16_t nConditions, PS5000A_CONDITIONS_INFO info)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	(void) info;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	unit->triggerEnabled = (conditions != NULL && nConditions > 0 && conditions[0].condition == PS5000A_CONDITION_TRUE);
+
+	if (unit->triggerEnabled)
+	{
+		unit->triggerChannel = conditions[0].source;
+	}
+
+	simTransfer(0);
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aSetTriggerChannelDirectionsV2(int16_t handle, PS5000A_DIRECTION * directions, uint16_t nDirections)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (directions != NULL && nDirections > 0)
+	{
+		unit->triggerDirection = directions[0].direction;
+	}
+
+	simTransfer(0);
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aSetAutoTriggerMicroSeconds(int16_t handle, uint64_t autoTriggerMicroseconds)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	unit->autoTriggerUs = autoTriggerMicroseconds;
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aSetTriggerDelay(int16_t handle, uint32_t delay)
+{
+	(void) delay;
+	return simGetUnit(handle) == NULL ? PICO_INVALID_HANDLE : PICO_OK;
+}
+
+PICO_STATUS ps5000aSetPulseWidthQualifierConditions(int16_t handle, PS5000A_CONDITION * conditions, int16_t nConditions, PS5000A_CONDITIONS_INFO info)
+{
+	(void) conditions;
+	(void) nConditions;
+	(void) info;
+	return simGetUnit(handle) == NULL ? PICO_INVALID_HANDLE : PICO_OK;
+}
+
+PICO_STATUS ps5000aSetPulseWidthQualifierDirections(int16_t handle, PS5000A_DIRECTION * directions, int16_t nDirections)
+{
+	(void) directions;
+	(void) nDirections;
+	return simGetUnit(handle) == NULL ? PICO_INVALID_HANDLE : PICO_OK;
+}
+
+PICO_STATUS ps5000aSetPulseWidthQualifierProperties(int16_t handle, uint32_t lower, uint32_t upper, PS5000A_PULSE_WIDTH_TYPE type)
+{
+	(void) lower;
+	(void) upper;
+	(void) type;
+	return simGetUnit(handle) == NULL ? PICO_INVALID_HANDLE : PICO_OK;
+}
+
+/****************************************************************************
+* Timebase and memory
+****************************************************************************/
+PICO_STATUS ps5000aGetMinimumTimebaseStateless(int16_t handle, PS5000A_CHANNEL_FLAGS enabledChannelOrPortFlags, uint32_t * timebase,
+	double * timeInterval, PS5000A_DEVICE_RESOLUTION resolution)
+{
+	int16_t ch, channels = 0;
+
+	if (simGetUnit(handle) == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	for (ch = 0; ch < PS5000A_MAX_CHANNELS; ch++)
+	{
+		channels += (enabledChannelOrPortFlags & (1 << ch)) ? 1 : 0;
+	}
+
+	if (channels > simMaxChannels(resolution))
+	{
+		return PICO_INVALID_NUMBER_CHANNELS_FOR_RESOLUTION;
+	}
+
+	*timebase = simMinimumTimebase(resolution, channels);
+	*timeInterval = simTimebaseInterval(resolution, *timebase);
+
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aGetTimebase(int16_t handle, uint32_t timebase, int32_t noSamples, int32_t * timeIntervalNanoseconds, int32_t * maxSamples, uint32_t segmentIndex)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+	int16_t channels;
+	double interval;
+	uint32_t available;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	channels = simEnabledChannels(unit);
+
+	if (channels > simMaxChannels(unit->resolution))
+	{
+		return PICO_INVALID_NUMBER_CHANNELS_FOR_RESOLUTION;
+	}
+
+	interval = simTimebaseInterval(unit->resolution, timebase);
+
+	if (interval == 0.0 || timebase < simMinimumTimebase(unit->resolution, channels))
+	{
+		return PICO_INVALID_TIMEBASE;
+	}
+
+	if (segmentIndex >= unit->nSegments)
+	{
+		return PICO_SEGMENT_OUT_OF_RANGE;
+	}
+
+	available = simMemory(unit) / unit->nSegments / (channels > 0 ? channels : 1);
+
+	if (noSamples > 0 && (uint32_t) noSamples > available)
+	{
+		return PICO_TOO_MANY_SAMPLES;
+	}
+
+	if (timeIntervalNanoseconds != NULL)
+	{
+		*timeIntervalNanoseconds = (int32_t) lrint(interval * 1e9);
+	}
+
+	if (maxSamples != NULL)
+	{
+		*maxSamples = (int32_t) available;
+	}
+
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aGetMaxSegments(int16_t handle, uint32_t * maxSegments)
+{
+	if (simGetUnit(handle) == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	*maxSegments = simConfig.maxSegments;
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aMemorySegments(int16_t handle, uint32_t nSegments, int32_t * nMaxSamples)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (nSegments == 0 || nSegments > simConfig.maxSegments)
+	{
+		return PICO_TOO_MANY_SEGMENTS;
+	}
+
+	simStopBlock(unit);
+	simFreeSegments(unit);
+
+	unit->nSegments = nSegments;
+	unit->nCaptures = unit->nCaptures > nSegments ? nSegments : unit->nCaptures;
+	unit->buffers = (SIM_BUFFER *) calloc((size_t) PS5000A_MAX_CHANNELS * nSegments, sizeof(SIM_BUFFER));
+
+	if (unit->buffers == NULL)
+	{
+		return PICO_MEMORY_FAIL;
+	}
+
+	if (nMaxSamples != NULL)
+	{
+		*nMaxSamples = (int32_t)(simMemory(unit) / nSegments);
+	}
+
+	simTransfer(0);
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aSetNoOfCaptures(int16_t handle, uint32_t nCaptures)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (nCaptures == 0 || nCaptures > unit->nSegments)
+	{
+		return PICO_TOO_MANY_SEGMENTS;
+	}
+
+	unit->nCaptures = nCaptures;
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aGetNoOfCaptures(int16_t handle, uint32_t * nCaptures)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	*nCaptures = simCapturesDone(unit, simCaptureClock(unit));
+	simTransfer(0);
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aSetDataBuffer(int16_t handle, PS5000A_CHANNEL source, int16_t * buffer, int32_t bufferLth, uint32_t segmentIndex, PS5000A_RATIO_MODE mode)
+{
+	(void) mode;
+	return simSetBuffers(handle, source, buffer, NULL, bufferLth, segmentIndex);
+}
+
+PICO_STATUS ps5000aSetDataBuffers(int16_t handle, PS5000A_CHANNEL source, int16_t * bufferMax, int16_t * bufferMin, int32_t bufferLth, uint32_t segmentIndex, PS5000A_RATIO_MODE mode)
+{
+	(void) mode;
+	return simSetBuffers(handle, source, bufferMax, bufferMin, bufferLth, segmentIndex);
+}
+
+/****************************************************************************
+* Block mode
+****************************************************************************/
+PICO_STATUS ps5000aRunBlock(int16_t handle, int32_t noOfPreTriggerSamples, int32_t noOfPostTriggerSamples, uint32_t timebase,
+	int32_t * timeIndisposedMs, uint32_t segmentIndex, ps5000aBlockReady lpReady, void * pParameter)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+	int32_t maxSamples;
+	PICO_STATUS status;
+	double period = 1.0 / simConfig.frequency;
+	double captureTime;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (unit->channelCount == 4 && unit->powerState == PICO_POWER_SUPPLY_NOT_CONNECTED &&
+		(unit->channels[PS5000A_CHANNEL_C].enabled || unit->channels[PS5000A_CHANNEL_D].enabled))
+	{
+		return PICO_POWER_SUPPLY_NOT_CONNECTED;
+	}
+
+	status = ps5000aGetTimebase(handle, timebase, noOfPreTriggerSamples + noOfPostTriggerSamples, NULL, &maxSamples, segmentIndex);
+
+	if (status != PICO_OK)
+	{
+		return status;
+	}
+
+	if (segmentIndex + unit->nCaptures > unit->nSegments)
+	{
+		return PICO_SEGMENT_OUT_OF_RANGE;
+	}
+
+	simStopBlock(unit);
+	simPrepareChannels(unit);
+
+	unit->sampleInterval = simTimebaseInterval(unit->resolution, timebase);
+	unit->preTrigger = noOfPreTriggerSamples;
+	unit->postTrigger = noOfPostTriggerSamples;
+	unit->firstSegment = segmentIndex;
+	unit->blockReady = lpReady;
+	unit->blockParameter = pParameter;
+	unit->stopRequested = 0;
+	unit->stopTime = 0.0;
+
+	captureTime = (double)(noOfPreTriggerSamples + noOfPostTriggerSamples) * unit->sampleInterval + simConfig.rearmSeconds;
+
+	if (!unit->triggerEnabled)
+	{
+		unit->triggerFound = 1;
+		unit->triggerPhase = 0;
+		unit->firstTrigger = noOfPreTriggerSamples * unit->sampleInterval;
+		unit->captureSpacing = captureTime;
+	}
+	else if (simFindTriggerPhase(unit, &unit->triggerPhase))
+	{
+		double phase = (double) unit->triggerPhase / 4294967296.0 * period;
+		double ready = noOfPreTriggerSamples * unit->sampleInterval;
+
+		unit->triggerFound = 1;
+		unit->firstTrigger = phase + ceil((ready - phase) / period) * period;
+		unit->captureSpacing = ceil(captureTime / period) * period;
+	}
+	else if (unit->autoTriggerUs > 0)
+	{
+		unit->triggerFound = 1;
+		unit->triggerPhase = 0;
+		unit->captureSpacing = unit->autoTriggerUs * 1e-6 > captureTime ? unit->autoTriggerUs * 1e-6 : captureTime;
+		unit->firstTrigger = unit->captureSpacing;
+	}
+	else
+	{
+		// Waits forever, like a real unit with no trigger in sight
+		unit->triggerFound = 0;
+	}
+
+	if (timeIndisposedMs != NULL)
+	{
+		*timeIndisposedMs = unit->triggerFound ? (int32_t)(simCaptureCompleted(unit, unit->nCaptures - 1) * 1000.0) : 0;
+	}
+
+	simTransfer(0);
+	unit->runStart = simNow();
+
+	if (lpReady == NULL)
+	{
+		return PICO_OK;
+	}
+
+	unit->blockRunning = 1;
+
+	if (pthread_create(&unit->blockThread, NULL, simBlockThread, unit) != 0)
+	{
+		unit->blockRunning = 0;
+		return PICO_DRIVER_FUNCTION;
+	}
+
+	return PICO_OK;
+}
+
+/* Downsample 'count' raw samples into max/min buffers, returns the number of samples written */
+static uint32_t simDownsample(const int16_t * raw, uint32_t count, uint32_t ratio, PS5000A_RATIO_MODE mode, int16_t * bufferMax, int16_t * bufferMin)
+{
+	uint32_t i, j, n = count / ratio;
+
+	if (ratio <= 1 || mode == PS5000A_RATIO_MODE_NONE)
+	{
+		memcpy(bufferMax, raw, count * sizeof(int16_t));
+		return count;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		const int16_t * block = raw + (size_t) i * ratio;
+		int16_t hi = block[0], lo = block[0];
+		int32_t sum = 0;
+
+		for (j = 0; j < ratio; j++)
+		{
+			hi = block[j] > hi ? block[j] : hi;
+			lo = block[j] < lo ? block[j] : lo;
+			sum += block[j];
+		}
+
+		switch (mode)
+		{
+			case PS5000A_RATIO_MODE_AGGREGATE:
+				bufferMax[i] = hi;
+				if (bufferMin != NULL)
+				{
+					bufferMin[i] = lo;
+				}
+				break;
+			case PS5000A_RATIO_MODE_AVERAGE:
+				bufferMax[i] = (int16_t)(sum / (int32_t) ratio);
+				break;
+			default:
+				bufferMax[i] = block[0];
+				break;
+		}
+	}
+
+	return n;
+}
+
+static int16_t * simScratch(SIM_UNIT * unit, uint32_t length)
+{
+	if (unit->scratchLength < length)
+	{
+		free(unit->scratch);
+		unit->scratch = (int16_t *) malloc(length * sizeof(int16_t));
+		unit->scratchLength = unit->scratch != NULL ? length : 0;
+	}
+
+	return unit->scratch;
+}
+
+PICO_STATUS ps5000aGetValuesBulk(int16_t handle, uint32_t * noOfSamples, uint32_t fromSegmentIndex, uint32_t toSegmentIndex,
+	uint32_t downSampleRatio, PS5000A_RATIO_MODE downSampleRatioMode, int16_t * overflow)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+	uint32_t segment, samples, written = 0, done;
+	uint32_t increment;
+	size_t bytes = 0;
+	int16_t ch;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (noOfSamples == NULL)
+	{
+		return PICO_NULL_PARAMETER;
+	}
+
+	if (toSegmentIndex < fromSegmentIndex || toSegmentIndex >= unit->nSegments)
+	{
+		return PICO_SEGMENT_OUT_OF_RANGE;
+	}
+
+	if (downSampleRatio == 0)
+	{
+		downSampleRatio = 1;
+	}
+
+	done = simCapturesDone(unit, simCaptureClock(unit));
+
+	if (toSegmentIndex >= unit->firstSegment + done)
+	{
+		return PICO_DATA_NOT_AVAILABLE;
+	}
+
+	samples = *noOfSamples < unit->preTrigger + unit->postTrigger ? *noOfSamples : unit->preTrigger + unit->postTrigger;
+	increment = simPhaseIncrement(unit->sampleInterval);
+
+	for (segment = fromSegmentIndex; segment <= toSegmentIndex; segment++)
+	{
+		uint32_t capture = segment - unit->firstSegment;
+		double start = unit->firstTrigger + (double) capture * unit->captureSpacing - unit->preTrigger * unit->sampleInterval;
+		int16_t flags = 0;
+
+		for (ch = 0; ch < unit->channelCount; ch++)
+		{
+			SIM_BUFFER * buffer = &unit->buffers[ch * unit->nSegments + segment];
+			SIM_GENERATOR generator;
+			uint32_t count = samples;
+			int16_t * raw;
+
+			if (!unit->channels[ch].enabled)
+			{
+				continue;
+			}
+
+			if (buffer->bufferMax == NULL)
+			{
+				return PICO_INVALID_BUFFER;
+			}
+
+			// The waveform is locked to the trigger: rewind from the trigger phase
+			generator.phase = unit->triggerPhase - unit->preTrigger * increment;
+			generator.seed = 0x2545F491u ^ (segment * 0x9E3779B1u) ^ (uint32_t)(ch + 1);
+			generator.seed = generator.seed ? generator.seed : 1;
+
+			if (!unit->triggerEnabled)
+			{
+				generator.phase = (uint32_t)(fmod(start * simConfig.frequency, 1.0) * 4294967296.0);
+			}
+
+			if (count / downSampleRatio > (uint32_t) buffer->length)
+			{
+				count = (uint32_t) buffer->length * downSampleRatio;
+			}
+
+			if (downSampleRatio == 1 || downSampleRatioMode == PS5000A_RATIO_MODE_NONE)
+			{
+				flags |= simGenerate(unit, ch, &generator, increment, buffer->bufferMax, count) ? (int16_t)(1 << ch) : 0;
+				written = count;
+			}
+			else
+			{
+				raw = simScratch(unit, count);
+
+				if (raw == NULL)
+				{
+					return PICO_MEMORY_FAIL;
+				}
+
+				flags |= simGenerate(unit, ch, &generator, increment, raw, count) ? (int16_t)(1 << ch) : 0;
+				written = simDownsample(raw, count, downSampleRatio, downSampleRatioMode, buffer->bufferMax, buffer->bufferMin);
+			}
+
+			bytes += (size_t) written * sizeof(int16_t) * (buffer->bufferMin != NULL && downSampleRatioMode == PS5000A_RATIO_MODE_AGGREGATE ? 2 : 1);
+		}
+
+		if (overflow != NULL)
+		{
+			overflow[segment - fromSegmentIndex] = flags;
+		}
+	}
+
+	*noOfSamples = written;
+	simTransfer(bytes);
+
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aGetTriggerInfoBulk(int16_t handle, PS5000A_TRIGGER_INFO * triggerInfo, uint32_t fromSegmentIndex, uint32_t toSegmentIndex)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+	uint32_t segment;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (triggerInfo == NULL)
+	{
+		return PICO_NULL_PARAMETER;
+	}
+
+	if (toSegmentIndex < fromSegmentIndex || toSegmentIndex >= unit->nSegments)
+	{
+		return PICO_SEGMENT_OUT_OF_RANGE;
+	}
+
+	for (segment = fromSegmentIndex; segment <= toSegmentIndex; segment++)
+	{
+		PS5000A_TRIGGER_INFO * info = &triggerInfo[segment - fromSegmentIndex];
+		uint32_t capture = segment - unit->firstSegment;
+		double trigger = unit->firstTrigger + (double) capture * unit->captureSpacing;
+
+		memset(info, 0, sizeof(PS5000A_TRIGGER_INFO));
+		info->status = capture == 0 ? PICO_DEVICE_TIME_STAMP_RESET : PICO_OK;
+		info->segmentIndex = segment;
+		info->triggerIndex = unit->preTrigger;
+		info->timeUnits = PS5000A_NS;
+		info->timeStampCounter = (uint64_t) llrint(trigger * (1.0 + simConfig.clockError) / unit->sampleInterval);
+	}
+
+	simTransfer((size_t)(toSegmentIndex - fromSegmentIndex + 1) * sizeof(PS5000A_TRIGGER_INFO));
+	return PICO_OK;
+}
+
+/****************************************************************************
+* Streaming mode
+****************************************************************************/
+PICO_STATUS ps5000aRunStreaming(int16_t handle, uint32_t * sampleInterval, PS5000A_TIME_UNITS sampleIntervalTimeUnits, uint32_t maxPreTriggerSamples,
+	uint32_t maxPostTriggerSamples, int16_t autoStop, uint32_t downSampleRatio, PS5000A_RATIO_MODE downSampleRatioMode, uint32_t overviewBufferSize)
+{
+	static const double unitSeconds[] = { 1e-15, 1e-12, 1e-9, 1e-6, 1e-3, 1.0 };
+	SIM_UNIT * unit = simGetUnit(handle);
+	double requested, grid, minimum;
+	int16_t ch;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (sampleInterval == NULL || sampleIntervalTimeUnits >= PS5000A_MAX_TIME_UNITS)
+	{
+		return PICO_INVALID_PARAMETER;
+	}
+
+	if (simPowerPending(unit) != PICO_OK)
+	{
+		return unit->powerPending;
+	}
+
+	if (unit->channelCount == 4 && unit->powerState == PICO_POWER_SUPPLY_NOT_CONNECTED &&
+		(unit->channels[PS5000A_CHANNEL_C].enabled || unit->channels[PS5000A_CHANNEL_D].enabled))
+	{
+		return PICO_POWER_SUPPLY_NOT_CONNECTED;
+	}
+
+	simStopBlock(unit);
+	simPrepareChannels(unit);
+
+	// Round the requested interval to the timebase grid of the current resolution
+	requested = *sampleInterval * unitSeconds[sampleIntervalTimeUnits];
+	minimum = simTimebaseInterval(unit->resolution, simMinimumTimebase(unit->resolution, simEnabledChannels(unit)));
+	grid = (unit->resolution == PS5000A_DR_12BIT || unit->resolution == PS5000A_DR_16BIT) ? 16e-9 : 8e-9;
+	unit->sampleInterval = requested <= minimum ? minimum : floor(requested / grid + 0.5) * grid;
+	*sampleInterval = (uint32_t) llrint(unit->sampleInterval / unitSeconds[sampleIntervalTimeUnits]);
+
+	unit->downSampleRatio = downSampleRatio == 0 ? 1 : downSampleRatio;
+	unit->ratioMode = downSampleRatioMode;
+	unit->overviewBufferSize = overviewBufferSize;
+	unit->streamPreTrigger = maxPreTriggerSamples;
+	unit->streamPostTrigger = maxPostTriggerSamples;
+	unit->streamAutoStop = autoStop;
+	unit->streamTriggered = 0;
+	unit->streamConsumed = 0;
+	unit->streamLost = 0;
+	unit->streamWriteIndex = 0;
+	unit->streamTarget = (uint64_t) maxPreTriggerSamples + maxPostTriggerSamples;
+
+	if (unit->triggerEnabled && simFindTriggerPhase(unit, &unit->triggerPhase))
+	{
+		// Autostop counts from the trigger point once it has been seen
+		unit->streamTarget = UINT64_MAX;
+	}
+	else
+	{
+		unit->triggerPhase = 0;
+	}
+
+	for (ch = 0; ch < PS5000A_MAX_CHANNELS; ch++)
+	{
+		unit->streamGenerators[ch].phase = 0;
+		unit->streamGenerators[ch].seed = 0x6C8E9CF5u ^ (uint32_t)(ch + 1);
+	}
+
+	simTransfer(0);
+	unit->streaming = 1;
+	unit->streamStart = simNow();
+
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aGetStreamingLatestValues(int16_t handle, ps5000aStreamingReady lpPs5000aReady, void * pParameter)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+	uint32_t ratio, increment, bufferLength = 0, count, written = 0, triggerAt = 0;
+	uint64_t captured, available, limit;
+	int16_t triggered = 0, autoStop, flags = 0, ch;
+	size_t bytes = 0;
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (simPowerPending(unit) != PICO_OK)
+	{
+		return unit->powerPending;
+	}
+
+	if (!unit->streaming)
+	{
+		return PICO_NOT_USED_IN_THIS_CAPTURE_MODE;
+	}
+
+	if (unit->channelCount == 4 && simConfig.powerLoss > 0.0 && unit->powerState == PICO_POWER_SUPPLY_CONNECTED &&
+		simNow() - unit->streamStart >= simConfig.powerLoss)
+	{
+		// The supply drops: the unit stops and the data not yet read are gone
+		unit->streaming = 0;
+		unit->powerPending = PICO_POWER_SUPPLY_NOT_CONNECTED;
+		unit->powerRestore = simNow() + simConfig.powerOutage;
+		simTransfer(0);
+		return PICO_POWER_SUPPLY_NOT_CONNECTED;
+	}
+
+	ratio = unit->downSampleRatio;
+	increment = simPhaseIncrement(unit->sampleInterval);
+
+	for (ch = 0; ch < unit->channelCount; ch++)
+	{
+		if (unit->channels[ch].enabled)
+		{
+			if (unit->buffers[ch * unit->nSegments].bufferMax == NULL)
+			{
+				return PICO_INVALID_BUFFER;
+			}
+
+			bufferLength = (uint32_t) unit->buffers[ch * unit->nSegments].length;
+		}
+	}
+
+	captured = (uint64_t)((simNow() - unit->streamStart) / unit->sampleInterval);
+	available = captured - unit->streamConsumed;
+
+	// Data older than the overview buffer have been overwritten by the driver
+	limit = (uint64_t) unit->overviewBufferSize * ratio;
+
+	if (available > limit)
+	{
+		uint64_t lost = available - limit;
+
+		for (ch = 0; ch < PS5000A_MAX_CHANNELS; ch++)
+		{
+			unit->streamGenerators[ch].phase += (uint32_t)(lost * increment);
+		}
+
+		unit->streamLost += lost;
+		unit->streamConsumed += lost;
+		available = limit;
+	}
+
+	if (unit->streamAutoStop && unit->streamConsumed + available > unit->streamTarget)
+	{
+		available = unit->streamTarget - unit->streamConsumed;
+	}
+
+	// Never wrap inside one callback
+	count = (uint32_t)(available / ratio);
+
+	if (count > bufferLength - unit->streamWriteIndex)
+	{
+		count = bufferLength - unit->streamWriteIndex;
+	}
+
+	count *= ratio;
+
+	if (count == 0)
+	{
+		simTransfer(0);
+		return PICO_OK;
+	}
+
+	if (unit->streamTarget == UINT64_MAX && !unit->streamTriggered)
+	{
+		// Look for the trigger phase inside this block of samples
+		uint32_t phase = unit->streamGenerators[PS5000A_CHANNEL_A].phase;
+		uint32_t i;
+
+		for (i = 0; i < count; i++, phase += increment)
+		{
+			if ((uint32_t)(unit->triggerPhase - phase) < increment)
+			{
+				unit->streamTriggered = 1;
+				triggered = 1;
+				triggerAt = i / ratio;
+				unit->streamTarget = unit->streamConsumed + i + unit->streamPostTrigger;
+				break;
+			}
+		}
+	}
+
+	for (ch = 0; ch < unit->channelCount; ch++)
+	{
+		SIM_BUFFER * buffer = &unit->buffers[ch * unit->nSegments];
+		int16_t * raw;
+
+		if (!unit->channels[ch].enabled)
+		{
+			continue;
+		}
+
+		if (ratio == 1 || unit->ratioMode == PS5000A_RATIO_MODE_NONE)
+		{
+			raw = buffer->bufferMax + unit->streamWriteIndex;
+			flags |= simGenerate(unit, ch, &unit->streamGenerators[ch], increment, raw, count) ? (int16_t)(1 << ch) : 0;
+			written = count;
+		}
+		else
+		{
+			raw = simScratch(unit, count);
+
+			if (raw == NULL)
+			{
+				return PICO_MEMORY_FAIL;
+			}
+
+			flags |= simGenerate(unit, ch, &unit->streamGenerators[ch], increment, raw, count) ? (int16_t)(1 << ch) : 0;
+			written = simDownsample(raw, count, ratio, unit->ratioMode, buffer->bufferMax + unit->streamWriteIndex,
+				buffer->bufferMin != NULL ? buffer->bufferMin + unit->streamWriteIndex : NULL);
+		}
+
+		bytes += (size_t) written * sizeof(int16_t);
+	}
+
+	// Keep the disabled channels in step so that enabling them later keeps the phase relation
+	for (ch = 0; ch < PS5000A_MAX_CHANNELS; ch++)
+	{
+		if (ch >= unit->channelCount || !unit->channels[ch].enabled)
+		{
+			unit->streamGenerators[ch].phase += count * increment;
+		}
+	}
+
+	unit->streamConsumed += count;
+	autoStop = unit->streamAutoStop && unit->streamConsumed >= unit->streamTarget;
+
+	simTransfer(bytes);
+
+	if (lpPs5000aReady != NULL)
+	{
+		lpPs5000aReady(handle, (int32_t) written, unit->streamWriteIndex, flags, triggerAt, triggered, autoStop, pParameter);
+	}
+
+	unit->streamWriteIndex = (unit->streamWriteIndex + written) % bufferLength;
+
+	if (autoStop)
+	{
+		unit->streaming = 0;
+	}
+
+	return PICO_OK;
+}
+
+PICO_STATUS ps5000aStop(int16_t handle)
+{
+	SIM_UNIT * unit = simGetUnit(handle);
+
+	if (unit == NULL)
+	{
+		return PICO_INVALID_HANDLE;
+	}
+
+	if (unit->blockRunning)
+	{
+		unit->stopTime = simNow();
+		simStopBlock(unit);
+	}
+
+	if (unit->streamLost > 0)
+	{
+		fprintf(stderr, "ps5000aSim: %llu samples were overwritten before being read\n", (unsigned long long) unit->streamLost);
+		unit->streamLost = 0;
+	}
+
+	unit->streaming = 0;
+	simTransfer(0);
+
+	return PICO_OK;
+}
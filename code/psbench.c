@@ -0,0 +1,614 @@
+/*******************************************************************************
+ *
+ * Filename: psbench.c
+ *
+ * Description:
+ *   Benchmark of the output formats of ps5000aCon over fixed synthetic
+ *   rapid block data, with a stored baseline to catch regressions.
+ *
+ *		psbench [-m quick|full] [-f FORMAT] [-p POINTS] [-i RUNS] [-b stdio|uring]
+ *			[-d DIR] [-s BASELINE] [-c BASELINE] [-t PERCENT]
+ *
+ *	Formats:
+ *
+ *		text		block.txt, ADC counts and mV of channels A and B
+ *		text-raw	block.txt, ADC counts of channels A and B under the run settings
+ *		binary		block_binary.txt, 20 byte records (BLOCK_BINARY_RECORD)
+ *		binary-raw	block_binary.txt, 8 byte records after the run header
+ *		wave		block_wave.bin, raw int16 chunks of every channel
+ *		wave-comp	block_wave.bin, compressed chunks
+ *
+ *	Datasets are every combination of a number of captures, of channels and
+ *	of a resolution: 1k and 10k captures, 1, 2 and 4 channels, 8 and 16 bits
+ *	in quick mode (the default), 1k to 100k captures and every resolution in
+ *	full mode. Each capture holds POINTS samples (256 by default) of a noisy
+ *	sine quantised to the resolution, from a pool of captures generated once
+ *	with a fixed seed, so every run writes the same bytes. Like ps5000aCon,
+ *	the text and block_binary formats only hold channels A and B.
+ *
+ *	Each format is written RUNS times (3 by default) through the output
+ *	writer to a file in DIR, which is then removed, and the fastest run is
+ *	kept. The table gives the size of the file, the MB/s written, the
+ *	records (sample times) per second and the CPU time.
+ *
+ *	-s saves the records per second of every case to BASELINE. -c compares
+ *	with BASELINE and exits with 1 if any case is more than PERCENT (15 by
+ *	default) slower; cases missing from the baseline are only reported. A
+ *	baseline only means something on the machine and disk it was saved on.
+ *
+ *	The block.txt and block_binary.txt formats go through blockFormat.c,
+ *	the same code as in ps5000aCon.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "outputWriter.h"
+#include "waveFile.h"
+#include "waveReader.h"
+#include "pipeline.h"
+#include "perfStats.h"
+#include "blockFormat.h"
+
+#define POOL_CAPTURES		64
+#define MAX_CASES			512
+#define KEY_SIZE			64
+
+typedef enum
+{
+	FORMAT_TEXT,
+	FORMAT_TEXT_RAW,
+	FORMAT_BINARY,
+	FORMAT_BINARY_RAW,
+	FORMAT_WAVE,
+	FORMAT_WAVE_COMPRESSED,
+	FORMATS
+} FORMAT;
+
+static const char * formatNames[FORMATS] = { "text", "text-raw", "binary", "binary-raw", "wave", "wave-comp" };
+
+/* Range index and its mV, as set by ps5000aCon: +/-5 V */
+#define RANGE_INDEX			8
+#define RANGE_MV			5000
+
+typedef struct
+{
+	uint32_t	captures;
+	uint16_t	channels;
+	uint16_t	bits;
+	uint32_t	points;
+	int16_t		maxADCValue;
+	int16_t *	pool[WAVE_MAX_CHANNELS];		// POOL_CAPTURES captures of 'points' samples
+} DATASET;
+
+typedef struct
+{
+	char		key[KEY_SIZE];
+	double		recordsPerSecond;
+} RESULT;
+
+typedef struct
+{
+	RESULT		results[MAX_CASES];
+	uint32_t	count;
+} RESULTS;
+
+static void usage(void)
+{
+	printf("Usage:\n");
+	printf("  psbench [-m quick|full] [-f FORMAT] [-p POINTS] [-i RUNS] [-b stdio|uring]\n");
+	printf("          [-d DIR] [-s BASELINE] [-c BASELINE] [-t PERCENT]\n");
+	printf("\nFormats: text text-raw binary binary-raw wave wave-comp\n");
+}
+
+/****************************************************************************
+* Synthetic data
+****************************************************************************/
+static uint32_t nextRandom(uint32_t * state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+static int32_t makeDataset(DATASET * data, uint32_t captures, uint16_t channels, uint16_t bits, uint32_t points)
+{
+	uint32_t state = 12345u + bits * 7u + channels;
+	int32_t lsb = 1 << (16 - bits);
+	uint32_t capture, i;
+	uint16_t ch;
+
+	memset(data, 0, sizeof(DATASET));
+	data->captures = captures;
+	data->channels = channels;
+	data->bits = bits;
+	data->points = points;
+	data->maxADCValue = bits == 8 ? 32512 : 32767;
+
+	for (ch = 0; ch < channels; ch++)
+	{
+		if ((data->pool[ch] = (int16_t *) malloc((size_t) POOL_CAPTURES * points * sizeof(int16_t))) == NULL)
+		{
+			printf("makeDataset: no memory for %u samples\n", POOL_CAPTURES * points);
+			return -1;
+		}
+
+		for (capture = 0; capture < POOL_CAPTURES; capture++)
+		{
+			double phase = (double) nextRandom(&state) / 16777216.0 * 2.0 * M_PI;
+
+			for (i = 0; i < points; i++)
+			{
+				double noise = ((double) nextRandom(&state) / 16777216.0 - 0.5) * 8.0 * lsb;
+				double value = 0.5 * data->maxADCValue * sin(phase + 2.0 * M_PI * i / 100.0 + ch) + noise;
+				int32_t count = (int32_t) lrint(value / lsb) * lsb;
+
+				count = count > data->maxADCValue ? data->maxADCValue : count < -data->maxADCValue ? -data->maxADCValue : count;
+				data->pool[ch][(size_t) capture * points + i] = (int16_t) count;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void freeDataset(DATASET * data)
+{
+	uint16_t ch;
+
+	for (ch = 0; ch < WAVE_MAX_CHANNELS; ch++)
+	{
+		free(data->pool[ch]);
+		data->pool[ch] = NULL;
+	}
+}
+
+static const int16_t * samplesOf(const DATASET * data, uint16_t channel, uint32_t capture)
+{
+	return channel < data->channels ? data->pool[channel] + (size_t)(capture % POOL_CAPTURES) * data->points : NULL;
+}
+
+static void fillRun(const DATASET * data, WAVE_RUN * run)
+{
+	uint16_t ch;
+
+	memset(run, 0, sizeof(WAVE_RUN));
+	run->resolution = data->bits == 8 ? 0 : data->bits == 12 ? 1 : data->bits == 14 ? 2 : data->bits == 15 ? 3 : 4;
+	run->maxADCValue = data->maxADCValue;
+	run->samplesPerRecord = data->points;
+	run->preTrigger = data->points / 4;
+	run->sampleIntervalNs = 8.0;
+
+	for (ch = 0; ch < WAVE_MAX_CHANNELS; ch++)
+	{
+		run->channelMask |= ch < data->channels ? 1 << ch : 0;
+		run->range[ch] = RANGE_INDEX;
+	}
+}
+
+/****************************************************************************
+* Writers
+****************************************************************************/
+/* One capture in 'format' through 'buffer', as ps5000aCon formats it */
+static int32_t writeCapture(OUTPUT_WRITER * fp, FORMAT format, const DATASET * data, PIPE_BUFFER * buffer, uint32_t capture)
+{
+	int16_t text = format == FORMAT_TEXT || format == FORMAT_TEXT_RAW;
+	BLOCK_CAPTURE samples;
+	int32_t result;
+	int j;
+
+	for (j = 0; j < 2; j++)
+	{
+		samples.channel[j] = samplesOf(data, (uint16_t) j, capture);
+		samples.rangeMv[j] = RANGE_MV;
+	}
+
+	samples.maxADCValue = data->maxADCValue;
+	samples.nSamples = data->points;
+	samples.firstTime = 0;
+	samples.intervalNs = 8;
+
+	buffer->length = 0;
+
+	if (format == FORMAT_TEXT_RAW || format == FORMAT_BINARY_RAW)
+	{
+		result = blockFormatRaw(&samples, text ? buffer : NULL, text ? NULL : buffer);
+	}
+	else
+	{
+		result = blockFormatCapture(&samples, text ? buffer : NULL, text ? NULL : buffer);
+	}
+
+	return result != 0 ? result : writerWrite(fp, buffer->data, buffer->length);
+}
+
+static int32_t writeWave(WAVE_FILE * wave, const DATASET * data, uint32_t capture)
+{
+	WAVE_CHUNK chunk;
+	uint16_t ch;
+
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.type = WAVE_CHUNK_CAPTURE;
+	chunk.segment = capture;
+	chunk.nSamples = data->points;
+	chunk.firstSample = (uint64_t) capture * data->points * 4;
+	chunk.triggerIndex = data->points / 4;
+	chunk.flags = WAVE_CHUNK_TRIGGERED;
+
+	for (ch = 0; ch < data->channels; ch++)
+	{
+		chunk.channel = ch;
+
+		if (waveFileWrite(wave, &chunk, samplesOf(data, ch, capture)) != 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/****************************************************************************
+* One case
+****************************************************************************/
+static double cpuSeconds(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+/* Writes the dataset once in 'format', returns the wall and CPU seconds and the file size; -1 on error */
+static int32_t runOnce(const DATASET * data, FORMAT format, const WRITER_OPTIONS * options, const char * path,
+						double * wall, double * cpu, uint64_t * bytes)
+{
+	PIPE_BUFFER buffer;
+	OUTPUT_WRITER * fp = NULL;
+	WAVE_FILE * wave = NULL;
+	WAVE_RUN run;
+	struct stat st;
+	uint64_t startNs;
+	double startCpu;
+	uint32_t capture;
+	int32_t result = 0;
+
+	memset(&buffer, 0, sizeof(buffer));
+	fillRun(data, &run);
+
+	startNs = perfNow();
+	startCpu = cpuSeconds();
+
+	if (format == FORMAT_WAVE || format == FORMAT_WAVE_COMPRESSED)
+	{
+		wave = waveFileOpen(path, options, &run, format == FORMAT_WAVE ? WAVE_OUTPUT_RAW : WAVE_OUTPUT_COMPRESSED, 0);
+		result = wave != NULL ? 0 : -1;
+	}
+	else
+	{
+		fp = writerOpen(path, options);
+		result = fp != NULL ? 0 : -1;
+
+		if (fp != NULL && (format == FORMAT_TEXT_RAW || format == FORMAT_BINARY_RAW))
+		{
+			uint32_t rangeMv[WAVE_MAX_CHANNELS];
+			uint16_t ch;
+
+			for (ch = 0; ch < WAVE_MAX_CHANNELS; ch++)
+			{
+				rangeMv[ch] = RANGE_MV;
+			}
+
+			result = blockWriteRawHeaders(format == FORMAT_TEXT_RAW ? fp : NULL, format == FORMAT_BINARY_RAW ? fp : NULL, &run, rangeMv);
+		}
+	}
+
+	for (capture = 0; capture < data->captures && result == 0; capture++)
+	{
+		result = wave != NULL ? writeWave(wave, data, capture) : writeCapture(fp, format, data, &buffer, capture);
+	}
+
+	if (fp != NULL && writerClose(fp) != 0)
+	{
+		result = -1;
+	}
+
+	if (wave != NULL && waveFileClose(wave, NULL) != 0)
+	{
+		result = -1;
+	}
+
+	*wall = (double)(perfNow() - startNs) * 1e-9;
+	*cpu = cpuSeconds() - startCpu;
+	*bytes = stat(path, &st) == 0 ? (uint64_t) st.st_size : 0;
+
+	unlink(path);
+	free(buffer.data);
+
+	if (result != 0)
+	{
+		printf("runOnce: %s could not be written to %s\n", formatNames[format], path);
+	}
+
+	return result;
+}
+
+static void caseKey(char * key, FORMAT format, const DATASET * data)
+{
+	snprintf(key, KEY_SIZE, "%s/%u/%u/%u/%u", formatNames[format], data->captures, data->channels, data->bits, data->points);
+}
+
+static int32_t runCase(const DATASET * data, FORMAT format, const WRITER_OPTIONS * options, const char * dir,
+						uint32_t runs, RESULTS * results)
+{
+	char path[512];
+	double wall, cpu, bestWall = 0.0, bestCpu = 0.0;
+	uint64_t bytes = 0;
+	uint64_t records = (uint64_t) data->captures * data->points;
+	uint32_t i;
+
+	snprintf(path, sizeof(path), "%s/psbench.%s.out", dir, formatNames[format]);
+
+	for (i = 0; i < runs; i++)
+	{
+		if (runOnce(data, format, options, path, &wall, &cpu, &bytes) != 0)
+		{
+			return -1;
+		}
+
+		if (i == 0 || wall < bestWall)
+		{
+			bestWall = wall;
+			bestCpu = cpu;
+		}
+	}
+
+	bestWall = bestWall > 1e-9 ? bestWall : 1e-9;
+
+	printf("%-11s %7u %3u %3u %10.1f %9.1f %9.2f %8.3f %8.3f\n", formatNames[format], data->captures, data->channels, data->bits,
+			(double) bytes / 1e6, (double) bytes / 1e6 / bestWall, (double) records / 1e6 / bestWall, bestCpu, bestWall);
+
+	if (results->count < MAX_CASES)
+	{
+		caseKey(results->results[results->count].key, format, data);
+		results->results[results->count].recordsPerSecond = (double) records / bestWall;
+		results->count++;
+	}
+
+	return 0;
+}
+
+/****************************************************************************
+* Baseline
+****************************************************************************/
+static int32_t saveBaseline(const char * path, const RESULTS * results)
+{
+	FILE * fp = fopen(path, "w");
+	uint32_t i;
+
+	if (fp == NULL)
+	{
+		printf("Cannot open the file %s for writing.\n", path);
+		return -1;
+	}
+
+	fprintf(fp, "# psbench baseline: format/captures/channels/bits/points records_per_second\n");
+
+	for (i = 0; i < results->count; i++)
+	{
+		fprintf(fp, "%s %.0f\n", results->results[i].key, results->results[i].recordsPerSecond);
+	}
+
+	fclose(fp);
+	printf("\nBaseline of %u cases saved to %s\n", results->count, path);
+	return 0;
+}
+
+/* Returns the number of regressions, -1 if the baseline cannot be read */
+static int32_t compareBaseline(const char * path, const RESULTS * results, double tolerance)
+{
+	FILE * fp = fopen(path, "r");
+	char line[256];
+	char key[KEY_SIZE];
+	double baseline;
+	int32_t regressions = 0;
+	uint32_t compared = 0;
+	uint32_t i;
+
+	if (fp == NULL)
+	{
+		printf("Cannot open the baseline %s\n", path);
+		return -1;
+	}
+
+	printf("\nAgainst %s (%.0f %% tolerance):\n", path, tolerance * 100.0);
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (line[0] == '#' || sscanf(line, "%63s %lf", key, &baseline) != 2)
+		{
+			continue;
+		}
+
+		for (i = 0; i < results->count; i++)
+		{
+			double change;
+
+			if (strcmp(results->results[i].key, key) != 0)
+			{
+				continue;
+			}
+
+			change = results->results[i].recordsPerSecond / baseline - 1.0;
+			compared++;
+
+			if (change < -tolerance)
+			{
+				printf("  REGRESSION %-28s %+.1f %% (%.0f against %.0f records/s)\n", key, change * 100.0,
+						results->results[i].recordsPerSecond, baseline);
+				regressions++;
+			}
+		}
+	}
+
+	fclose(fp);
+	printf("  %u cases compared, %d regressions, %u not in the baseline\n", compared, regressions, results->count - compared);
+	return regressions;
+}
+
+int main(int argc, char ** argv)
+{
+	static const uint32_t quickCaptures[] = { 1000, 10000 };
+	static const uint32_t fullCaptures[] = { 1000, 10000, 100000 };
+	static const uint16_t quickBits[] = { 8, 16 };
+	static const uint16_t fullBits[] = { 8, 12, 14, 15, 16 };
+	static const uint16_t channelCounts[] = { 1, 2, 4 };
+	WRITER_OPTIONS options = { WRITER_STDIO, 8, 1 << 20, 0, 0, 0 };
+	RESULTS results;
+	DATASET data;
+	const uint32_t * captures = quickCaptures;
+	const uint16_t * bits = quickBits;
+	uint32_t nCaptures = 2, nBits = 2;
+	uint32_t points = 256, runs = 3;
+	const char * dir = ".";
+	const char * save = NULL;
+	const char * compare = NULL;
+	double tolerance = 0.15;
+	int32_t only = -1;
+	int32_t failed = 0;
+	uint32_t c, b, n;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (value == NULL)
+		{
+			usage();
+			return 2;
+		}
+
+		if (strcmp(argv[i], "-m") == 0)
+		{
+			int16_t full = strcmp(value, "full") == 0;
+
+			captures = full ? fullCaptures : quickCaptures;
+			nCaptures = full ? 3 : 2;
+			bits = full ? fullBits : quickBits;
+			nBits = full ? 5 : 2;
+		}
+		else if (strcmp(argv[i], "-f") == 0)
+		{
+			for (only = 0; only < FORMATS && strcmp(formatNames[only], value) != 0; only++)
+			{
+			}
+
+			if (only == FORMATS)
+			{
+				usage();
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "-p") == 0)
+		{
+			points = (uint32_t) strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "-i") == 0)
+		{
+			runs = (uint32_t) strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "-b") == 0)
+		{
+			options.backend = strcmp(value, "uring") == 0 ? WRITER_URING : WRITER_STDIO;
+		}
+		else if (strcmp(argv[i], "-d") == 0)
+		{
+			dir = value;
+		}
+		else if (strcmp(argv[i], "-s") == 0)
+		{
+			save = value;
+		}
+		else if (strcmp(argv[i], "-c") == 0)
+		{
+			compare = value;
+		}
+		else if (strcmp(argv[i], "-t") == 0)
+		{
+			tolerance = strtod(value, NULL) / 100.0;
+		}
+		else
+		{
+			usage();
+			return 2;
+		}
+
+		i++;
+	}
+
+	if (points == 0 || runs == 0)
+	{
+		usage();
+		return 2;
+	}
+
+	memset(&results, 0, sizeof(results));
+	printf("%u points per capture, best of %u runs, %s backend, files in %s\n\n", points, runs, writerBackendName(options.backend), dir);
+	printf("%-11s %7s %3s %3s %10s %9s %9s %8s %8s\n", "format", "capt", "ch", "bit", "MB", "MB/s", "Mrec/s", "CPU s", "wall s");
+
+	for (c = 0; c < nCaptures && !failed; c++)
+	{
+		for (n = 0; n < sizeof(channelCounts) / sizeof(channelCounts[0]) && !failed; n++)
+		{
+			for (b = 0; b < nBits && !failed; b++)
+			{
+				FORMAT format;
+
+				if (makeDataset(&data, captures[c], channelCounts[n], bits[b], points) != 0)
+				{
+					failed = 1;
+				}
+
+				for (format = FORMAT_TEXT; format < FORMATS && !failed; format++)
+				{
+					if (only < 0 || only == (int32_t) format)
+					{
+						failed = runCase(&data, format, &options, dir, runs, &results) != 0;
+					}
+				}
+
+				freeDataset(&data);
+			}
+		}
+	}
+
+	if (failed)
+	{
+		return 2;
+	}
+
+	if (save != NULL && saveBaseline(save, &results) != 0)
+	{
+		return 2;
+	}
+
+	if (compare != NULL)
+	{
+		int32_t regressions = compareBaseline(compare, &results, tolerance);
+
+		return regressions < 0 ? 2 : regressions > 0 ? 1 : 0;
+	}
+
+	return 0;
+}
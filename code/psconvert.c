@@ -0,0 +1,1300 @@
+/*******************************************************************************
+ *
+ * Filename: psconvert.c
+ *
+ * Description:
+ *   Parallel batch converter for the block.txt and block_binary.txt files
+ *   of past runs.
+ *
+ *		psconvert [-f csv|col|features] [-j THREADS] [-o DIR] [-p POINTS]
+ *			[-b stdio|uring] FILE...
+ *
+ *	Each FILE (block.txt with or without mV columns, block_binary.txt in
+ *	either layout) becomes DIR/FILE.csv, DIR/FILE.col or
+ *	DIR/FILE.features.txt (DIR defaults to the directory of FILE):
+ *
+ *		csv			capture,sample,time_ns and the ADC counts and mV of each channel
+ *		col			the same columns, stored column by column (below)
+ *		features	one line per capture: samples, first time, and min, max,
+ *					mean and RMS in counts, mean and RMS in mV of each channel
+ *
+ *	The input is mapped and cut into chunks of whole captures, about
+ *	CHUNK_BYTES each: on the "Time (ns)" lines of block.txt, on multiples of
+ *	the capture size for block_binary.txt (from its header, or -p POINTS for
+ *	files with an mV column, 2000 by default). THREADS workers (one per core
+ *	by default) parse and format the chunks. Chunk k is first offered to
+ *	worker k % THREADS; a worker whose own next chunk is not ready to start
+ *	steals the oldest chunk nobody has taken. The output goes to disk in
+ *	chunk order, written by whichever worker completes the next one due, and
+ *	no chunk more than WINDOW_PER_THREAD * THREADS ahead of the last one
+ *	written is started, so memory stays bounded on files of any size.
+ *
+ *	Captures are numbered from 0 over the whole file. A worker that has
+ *	parsed a chunk of block.txt waits for the number of captures before it,
+ *	known as soon as the previous chunk is parsed.
+ *
+ *	The mV of block.txt and block_binary.txt with mV columns are the stored
+ *	integers; those of the files in ADC counts are worked out from their
+ *	header. Rows of block.txt with one channel are taken as channel A unless
+ *	the header says only B was recorded. Averaged block.txt files are not
+ *	converted.
+ *
+ *	Columnar layout (native little endian):
+ *
+ *		header		16 bytes: COLUMNS_MAGIC, version u16, channel mask u16
+ *		group		24 bytes: "RGRP", rows u32, first capture u64, captures u32,
+ *					then time_ns int32[rows], capture u32[rows] and, for each
+ *					channel in the mask, ADC int16[rows] (padded to 4 bytes)
+ *					and mV float[rows]
+ *		...
+ *		footer		offset u64 of each group, number of groups u64, COLUMNS_END
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "outputWriter.h"
+#include "waveReader.h"
+#include "pipeline.h"
+#include "perfStats.h"
+
+#define CHUNK_BYTES				(8u << 20)
+#define WINDOW_PER_THREAD		4
+#define MAX_THREADS				256
+#define COLUMNS_MAGIC			"PSCOL\r\n"
+#define COLUMNS_VERSION			1
+#define COLUMNS_GROUP_MAGIC		0x50524752u		/* "RGRP" */
+#define COLUMNS_END				"PSCOLEND"
+
+typedef enum
+{
+	OUTPUT_CSV,
+	OUTPUT_COLUMNS,
+	OUTPUT_FEATURES
+} OUTPUT_KIND;
+
+typedef enum
+{
+	SOURCE_TEXT,
+	SOURCE_BINARY,					// block_binary.txt with mV columns
+	SOURCE_BLOCK_RAW				// block_binary.txt in ADC counts
+} SOURCE_KIND;
+
+typedef struct
+{
+	SOURCE_KIND		kind;
+	const char *	path;
+	WAVE_READER *	reader;			// block_binary.txt
+	const uint8_t *	text;			// block.txt mapping
+	uint64_t		size;			// bytes of the file
+	int16_t			textMv;			// block.txt with mV columns
+	uint16_t		channels;		// A and B bits
+	double			mvPerCount[2];	// files in ADC counts
+	uint64_t		records;		// block_binary.txt
+	const BLOCK_BINARY_RECORD * binary;
+	const BLOCK_RAW_RECORD * raw;
+	uint32_t		points;			// samples per capture of block_binary.txt
+	uint64_t *		bounds;			// chunk k: bounds[k] to bounds[k + 1], bytes or captures
+	uint32_t		chunks;
+} SOURCE;
+
+/* Rows of one chunk */
+typedef struct
+{
+	uint32_t		rows;
+	uint32_t		capacity;
+	int32_t *		time;
+	int16_t *		adc[2];
+	float *			mv[2];
+	uint32_t *		starts;			// first row of each capture
+	uint32_t		captures;
+	uint32_t		startCapacity;
+	int16_t			error;
+} ROWS;
+
+typedef struct
+{
+	PIPE_BUFFER		out;
+	int16_t			done;
+} SLOT;
+
+typedef struct tConverter CONVERTER;
+
+typedef struct
+{
+	CONVERTER *		converter;
+	uint32_t		index;
+	uint32_t		own;			// next of its own chunks, index + k * threads
+	ROWS			rows;
+	pthread_t		thread;
+} WORKER;
+
+struct tConverter
+{
+	SOURCE *		source;
+	OUTPUT_KIND		output;
+	OUTPUT_WRITER *	writer;
+	uint32_t		threads;
+	uint32_t		window;
+	uint8_t *		claimed;		// one flag per chunk
+	uint32_t		oldest;			// no unclaimed chunk below this
+	int64_t *		captureBase;	// captures before each chunk, -1 until known
+	SLOT *			slots;			// chunk k in slots[k % window] until written
+	uint32_t		nextWrite;
+	int16_t			writing;
+	uint64_t		bytesOut;
+	uint64_t *		groupOffsets;	// columnar output
+	int16_t			failed;
+	pthread_mutex_t	lock;
+	pthread_cond_t	progress;
+	WORKER			workers[MAX_THREADS];
+};
+
+static void usage(void)
+{
+	printf("Usage:\n");
+	printf("  psconvert [-f csv|col|features] [-j THREADS] [-o DIR] [-p POINTS] [-b stdio|uring] FILE...\n");
+}
+
+/****************************************************************************
+* Sources
+****************************************************************************/
+static const uint8_t * lineEnd(const uint8_t * p, const uint8_t * end)
+{
+	const uint8_t * eol = (const uint8_t *) memchr(p, '\n', (size_t)(end - p));
+
+	return eol != NULL ? eol : end;
+}
+
+static int16_t startsWith(const uint8_t * p, const uint8_t * end, const char * prefix)
+{
+	size_t length = strlen(prefix);
+
+	return (size_t)(end - p) >= length && memcmp(p, prefix, length) == 0;
+}
+
+/* Offset of the first "Time (ns)" line at or after 'from', or the end */
+static uint64_t nextCapture(const SOURCE * source, uint64_t from)
+{
+	const uint8_t * end = source->text + source->size;
+	const uint8_t * p = source->text + from;
+
+	if (from > 0 && p[-1] != '\n')
+	{
+		p = lineEnd(p, end);
+		p += p < end ? 1 : 0;
+	}
+
+	while (p < end && !startsWith(p, end, "Time (ns)"))
+	{
+		p = lineEnd(p, end);
+		p += p < end ? 1 : 0;
+	}
+
+	return (uint64_t)(p - source->text);
+}
+
+static int32_t mapText(SOURCE * source)
+{
+	struct stat info;
+	void * base;
+	int fd = open(source->path, O_RDONLY);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	base = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	source->text = (const uint8_t *) base;
+	source->size = (uint64_t) info.st_size;
+	madvise(base, (size_t) info.st_size, MADV_SEQUENTIAL);
+	return 0;
+}
+
+/* Calibration lines of block.txt in ADC counts, before the first capture */
+static void readTextHeader(SOURCE * source, uint64_t dataStart)
+{
+	const uint8_t * p = source->text;
+	const uint8_t * end = source->text + dataStart;
+	int32_t maxADCValue = 0;
+	uint32_t rangeMv[2] = { 0, 0 };
+	uint16_t mask = 0;
+	char line[256];
+
+	while (p < end)
+	{
+		const uint8_t * eol = lineEnd(p, end);
+		size_t length = (size_t)(eol - p) < sizeof(line) - 1 ? (size_t)(eol - p) : sizeof(line) - 1;
+		const char * field;
+		char channel;
+		uint32_t range;
+
+		memcpy(line, p, length);
+		line[length] = '\0';
+
+		if ((field = strstr(line, "maxADCValue ")) != NULL)
+		{
+			maxADCValue = atoi(field + 12);
+		}
+
+		if (sscanf(line, "# channel %c range_mV %u", &channel, &range) == 2 && (channel == 'A' || channel == 'B'))
+		{
+			rangeMv[channel - 'A'] = range;
+			mask |= 1 << (channel - 'A');
+		}
+
+		p = eol + (eol < end ? 1 : 0);
+	}
+
+	source->channels = mask ? mask : 3;
+	source->mvPerCount[0] = maxADCValue ? (double) rangeMv[0] / maxADCValue : 0.0;
+	source->mvPerCount[1] = maxADCValue ? (double) rangeMv[1] / maxADCValue : 0.0;
+}
+
+static int32_t openText(SOURCE * source)
+{
+	uint64_t dataStart;
+	uint64_t next;
+	uint32_t capacity = 16;
+	const uint8_t * end;
+	const uint8_t * previous;
+	char line[256];
+	size_t length;
+
+	if (mapText(source) != 0)
+	{
+		printf("%s: cannot be read\n", source->path);
+		return -1;
+	}
+
+	end = source->text + source->size;
+	dataStart = nextCapture(source, 0);
+
+	if (dataStart == source->size)
+	{
+		printf("%s: no capture found\n", source->path);
+		return -1;
+	}
+
+	// Legacy files have an mV column next to each ADC column
+	length = (size_t)(lineEnd(source->text + dataStart, end) - (source->text + dataStart));
+	length = length < sizeof(line) - 1 ? length : sizeof(line) - 1;
+	memcpy(line, source->text + dataStart, length);
+	line[length] = '\0';
+	source->textMv = strstr(line, "mV_ch") != NULL;
+
+	if (source->textMv)
+	{
+		source->channels = 3;
+	}
+	else
+	{
+		readTextHeader(source, dataStart);
+	}
+
+	// Averaged files have a "Captures" line before each "Time (ns)" line
+	previous = source->text + dataStart - (dataStart > 0 ? 1 : 0);
+
+	while (previous > source->text && previous[-1] != '\n')
+	{
+		previous--;
+	}
+
+	if (dataStart > 0 && startsWith(previous, end, "Captures "))
+	{
+		printf("%s: averaged block.txt files are not converted\n", source->path);
+		return -1;
+	}
+
+	if ((source->bounds = (uint64_t *) malloc(capacity * sizeof(uint64_t))) == NULL)
+	{
+		return -1;
+	}
+
+	source->bounds[0] = dataStart;
+	source->chunks = 0;
+
+	// Chunks end on the next capture after every CHUNK_BYTES
+	while (source->bounds[source->chunks] < source->size)
+	{
+		next = nextCapture(source, source->bounds[source->chunks] + CHUNK_BYTES < source->size ?
+								source->bounds[source->chunks] + CHUNK_BYTES : source->size);
+
+		if (source->chunks + 2 > capacity)
+		{
+			uint64_t * larger = (uint64_t *) realloc(source->bounds, 2 * capacity * sizeof(uint64_t));
+
+			if (larger == NULL)
+			{
+				return -1;
+			}
+
+			source->bounds = larger;
+			capacity *= 2;
+		}
+
+		source->bounds[++source->chunks] = next;
+	}
+
+	return 0;
+}
+
+static int32_t openBinary(SOURCE * source, uint32_t points)
+{
+	uint64_t captures;
+	uint64_t perChunk;
+	uint32_t k;
+	WAVE_RUN run;
+	struct stat info;
+
+	if ((source->reader = waveReaderOpen(source->path)) == NULL ||
+		(waveReaderKind(source->reader) != WAVE_KIND_BLOCK_BINARY && waveReaderKind(source->reader) != WAVE_KIND_BLOCK_RAW))
+	{
+		printf("%s: not a block.txt or block_binary.txt file\n", source->path);
+		return -1;
+	}
+
+	source->size = stat(source->path, &info) == 0 ? (uint64_t) info.st_size : 0;
+
+	if (waveReaderKind(source->reader) == WAVE_KIND_BLOCK_RAW)
+	{
+		source->kind = SOURCE_BLOCK_RAW;
+		source->raw = waveReaderBlockRaw(source->reader, &source->records);
+		waveReaderRun(source->reader, 0, &run);
+		source->points = run.samplesPerRecord ? run.samplesPerRecord : points;
+		source->channels = run.channelMask & 3;
+		source->mvPerCount[0] = waveAdcToMv(&run, 0, 1);
+		source->mvPerCount[1] = waveAdcToMv(&run, 1, 1);
+
+		if (waveReaderTruncated(source->reader) > 0)
+		{
+			printf("%s: truncated, the partial record at its end is ignored\n", source->path);
+		}
+	}
+	else
+	{
+		source->kind = SOURCE_BINARY;
+		source->binary = waveReaderBinary(source->reader, &source->records);
+		source->points = points;
+		source->channels = 3;
+	}
+
+	captures = (source->records + source->points - 1) / source->points;
+	perChunk = CHUNK_BYTES / ((uint64_t) source->points * (source->kind == SOURCE_BLOCK_RAW ? sizeof(BLOCK_RAW_RECORD) : sizeof(BLOCK_BINARY_RECORD)));
+	perChunk = perChunk ? perChunk : 1;
+	source->chunks = (uint32_t)((captures + perChunk - 1) / perChunk);
+
+	if ((source->bounds = (uint64_t *) malloc((source->chunks + 1) * sizeof(uint64_t))) == NULL)
+	{
+		return -1;
+	}
+
+	for (k = 0; k <= source->chunks; k++)
+	{
+		source->bounds[k] = (uint64_t) k * perChunk < captures ? (uint64_t) k * perChunk : captures;
+	}
+
+	return 0;
+}
+
+static int32_t openSource(SOURCE * source, const char * path, uint32_t points)
+{
+	char start[16] = { 0 };
+	FILE * fp = fopen(path, "rb");
+
+	memset(source, 0, sizeof(SOURCE));
+	source->path = path;
+
+	if (fp == NULL)
+	{
+		printf("%s: cannot be read\n", path);
+		return -1;
+	}
+
+	if (fread(start, 1, sizeof(start) - 1, fp) == 0)
+	{
+		start[0] = '\0';
+	}
+
+	fclose(fp);
+
+	// block.txt starts with a capture or with the settings of the counts
+	if (strncmp(start, "Time (ns)", 9) == 0 || strncmp(start, "# ", 2) == 0 || strncmp(start, "Captures ", 9) == 0)
+	{
+		source->kind = SOURCE_TEXT;
+		return openText(source);
+	}
+
+	return openBinary(source, points);
+}
+
+static void closeSource(SOURCE * source)
+{
+	if (source->text != NULL)
+	{
+		munmap((void *) source->text, (size_t) source->size);
+	}
+
+	waveReaderClose(source->reader);
+	free(source->bounds);
+}
+
+/****************************************************************************
+* Parsing
+****************************************************************************/
+static int32_t growRows(ROWS * rows, uint32_t needed)
+{
+	uint32_t capacity = rows->capacity ? rows->capacity : 4096;
+	int16_t ch;
+
+	if (needed <= rows->capacity)
+	{
+		return 0;
+	}
+
+	while (capacity < needed)
+	{
+		capacity *= 2;
+	}
+
+	if ((rows->time = (int32_t *) realloc(rows->time, capacity * sizeof(int32_t))) == NULL)
+	{
+		return -1;
+	}
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		if ((rows->adc[ch] = (int16_t *) realloc(rows->adc[ch], capacity * sizeof(int16_t))) == NULL ||
+			(rows->mv[ch] = (float *) realloc(rows->mv[ch], capacity * sizeof(float))) == NULL)
+		{
+			return -1;
+		}
+	}
+
+	rows->capacity = capacity;
+	return 0;
+}
+
+static int32_t addCapture(ROWS * rows, uint32_t row)
+{
+	if (rows->captures == rows->startCapacity)
+	{
+		uint32_t capacity = rows->startCapacity ? rows->startCapacity * 2 : 256;
+		uint32_t * larger = (uint32_t *) realloc(rows->starts, capacity * sizeof(uint32_t));
+
+		if (larger == NULL)
+		{
+			return -1;
+		}
+
+		rows->starts = larger;
+		rows->startCapacity = capacity;
+	}
+
+	rows->starts[rows->captures++] = row;
+	return 0;
+}
+
+/* Signed decimal after any blanks, NULL if there is none before the end of the line */
+static const uint8_t * parseInt(const uint8_t * p, const uint8_t * end, int32_t * value)
+{
+	int32_t sign = 1;
+	int32_t v = 0;
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+	{
+		p++;
+	}
+
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		sign = *p == '-' ? -1 : 1;
+		p++;
+	}
+
+	if (p == end || *p < '0' || *p > '9')
+	{
+		return NULL;
+	}
+
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		v = v * 10 + (*p++ - '0');
+	}
+
+	*value = sign * v;
+	return p;
+}
+
+static int32_t parseText(const SOURCE * source, uint32_t chunk, ROWS * rows)
+{
+	const uint8_t * p = source->text + source->bounds[chunk];
+	const uint8_t * end = source->text + source->bounds[chunk + 1];
+	int16_t single = (source->channels & 1) ? 0 : 1;
+
+	while (p < end)
+	{
+		const uint8_t * eol = lineEnd(p, end);
+		const uint8_t * q;
+		int32_t values[4];
+		int32_t time;
+		int n = 0;
+
+		if (*p == 'T')
+		{
+			if (addCapture(rows, rows->rows) != 0)
+			{
+				return -1;
+			}
+		}
+		else if (*p != '#' && (q = parseInt(p, eol, &time)) != NULL)
+		{
+			while (n < 4 && (q = parseInt(q, eol, &values[n])) != NULL)
+			{
+				n++;
+			}
+
+			if (rows->rows == rows->capacity && growRows(rows, rows->rows + 1) != 0)
+			{
+				return -1;
+			}
+
+			rows->time[rows->rows] = time;
+			rows->adc[0][rows->rows] = rows->adc[1][rows->rows] = 0;
+			rows->mv[0][rows->rows] = rows->mv[1][rows->rows] = 0.0f;
+
+			if (source->textMv)
+			{
+				int16_t ch;
+
+				// ADC and mV pairs: A then B, or the only channel
+				for (ch = 0; ch < n / 2; ch++)
+				{
+					rows->adc[ch][rows->rows] = (int16_t) values[ch * 2];
+					rows->mv[ch][rows->rows] = (float) values[ch * 2 + 1];
+				}
+			}
+			else
+			{
+				int16_t ch;
+
+				for (ch = 0; ch < n && ch < 2; ch++)
+				{
+					int16_t channel = n == 1 ? single : ch;
+
+					rows->adc[channel][rows->rows] = (int16_t) values[ch];
+					rows->mv[channel][rows->rows] = (float)(values[ch] * source->mvPerCount[channel]);
+				}
+			}
+
+			rows->rows++;
+		}
+
+		p = eol + (eol < end ? 1 : 0);
+	}
+
+	return 0;
+}
+
+static int32_t parseBinary(const SOURCE * source, uint32_t chunk, ROWS * rows)
+{
+	uint64_t first = source->bounds[chunk] * source->points;
+	uint64_t last = source->bounds[chunk + 1] * source->points;
+	uint64_t i;
+
+	last = last < source->records ? last : source->records;
+
+	if (growRows(rows, (uint32_t)(last - first)) != 0)
+	{
+		return -1;
+	}
+
+	for (i = first; i < last; i++)
+	{
+		uint32_t row = (uint32_t)(i - first);
+
+		if ((i - first) % source->points == 0 && addCapture(rows, row) != 0)
+		{
+			return -1;
+		}
+
+		if (source->kind == SOURCE_BLOCK_RAW)
+		{
+			rows->time[row] = source->raw[i].time;
+			rows->adc[0][row] = source->raw[i].adcA;
+			rows->adc[1][row] = source->raw[i].adcB;
+			rows->mv[0][row] = (float)(source->raw[i].adcA * source->mvPerCount[0]);
+			rows->mv[1][row] = (float)(source->raw[i].adcB * source->mvPerCount[1]);
+		}
+		else
+		{
+			rows->time[row] = source->binary[i].time;
+			rows->adc[0][row] = (int16_t) source->binary[i].adcA;
+			rows->adc[1][row] = (int16_t) source->binary[i].adcB;
+			rows->mv[0][row] = (float) source->binary[i].mvA;
+			rows->mv[1][row] = (float) source->binary[i].mvB;
+		}
+	}
+
+	rows->rows = (uint32_t)(last - first);
+	return 0;
+}
+
+/****************************************************************************
+* Formatting
+****************************************************************************/
+static char * putInt(char * p, int64_t value)
+{
+	char digits[24];
+	int n = 0;
+	uint64_t v = value < 0 ? (uint64_t)(-value) : (uint64_t) value;
+
+	if (value < 0)
+	{
+		*p++ = '-';
+	}
+
+	do
+	{
+		digits[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v != 0);
+
+	while (n > 0)
+	{
+		*p++ = digits[--n];
+	}
+
+	return p;
+}
+
+/* mV to three decimals */
+static char * putMv(char * p, float mv)
+{
+	int64_t milli = llrint((double) mv * 1000.0);
+	int64_t whole = (milli < 0 ? -milli : milli) / 1000;
+	int64_t fraction = (milli < 0 ? -milli : milli) % 1000;
+
+	if (milli < 0)
+	{
+		*p++ = '-';
+	}
+
+	p = putInt(p, whole);
+	*p++ = '.';
+	*p++ = (char)('0' + fraction / 100);
+	*p++ = (char)('0' + fraction / 10 % 10);
+	*p++ = (char)('0' + fraction % 10);
+	return p;
+}
+
+static int32_t formatCsv(const SOURCE * source, const ROWS * rows, int64_t base, PIPE_BUFFER * out)
+{
+	uint32_t capture, row;
+	int16_t ch;
+
+	for (capture = 0; capture < rows->captures; capture++)
+	{
+		uint32_t last = capture + 1 < rows->captures ? rows->starts[capture + 1] : rows->rows;
+
+		// At most 10 + 10 + 11 + 2 * (6 + 16) + separators per line
+		char * p = (char *) pipeReserve(out, (size_t)(last - rows->starts[capture]) * 96);
+
+		if (p == NULL)
+		{
+			return -1;
+		}
+
+		for (row = rows->starts[capture]; row < last; row++)
+		{
+			p = putInt(p, base + capture);
+			*p++ = ',';
+			p = putInt(p, row - rows->starts[capture]);
+			*p++ = ',';
+			p = putInt(p, rows->time[row]);
+
+			for (ch = 0; ch < 2; ch++)
+			{
+				if (source->channels & (1 << ch))
+				{
+					*p++ = ',';
+					p = putInt(p, rows->adc[ch][row]);
+					*p++ = ',';
+					p = putMv(p, rows->mv[ch][row]);
+				}
+			}
+
+			*p++ = '\n';
+		}
+
+		out->length = (size_t)((uint8_t *) p - out->data);
+	}
+
+	return 0;
+}
+
+static int32_t formatFeatures(const SOURCE * source, const ROWS * rows, int64_t base, PIPE_BUFFER * out)
+{
+	uint32_t capture, row;
+	int16_t ch;
+
+	for (capture = 0; capture < rows->captures; capture++)
+	{
+		uint32_t first = rows->starts[capture];
+		uint32_t last = capture + 1 < rows->captures ? rows->starts[capture + 1] : rows->rows;
+		uint32_t n = last - first;
+		double divisor = n ? n : 1;
+
+		pipePrintf(out, "%lld\t%u\t%d", (long long)(base + capture), n, n ? rows->time[first] : 0);
+
+		for (ch = 0; ch < 2; ch++)
+		{
+			int32_t minimum = 32767, maximum = -32768;
+			double sum = 0.0, squares = 0.0, sumMv = 0.0, squaresMv = 0.0;
+
+			if (!(source->channels & (1 << ch)))
+			{
+				continue;
+			}
+
+			for (row = first; row < last; row++)
+			{
+				int32_t adc = rows->adc[ch][row];
+				double mv = rows->mv[ch][row];
+
+				minimum = adc < minimum ? adc : minimum;
+				maximum = adc > maximum ? adc : maximum;
+				sum += adc;
+				squares += (double) adc * adc;
+				sumMv += mv;
+				squaresMv += mv * mv;
+			}
+
+			if (n == 0)
+			{
+				minimum = maximum = 0;
+			}
+
+			pipePrintf(out, "\t%d\t%d\t%.3f\t%.3f\t%.3f\t%.3f", minimum, maximum, sum / divisor, sqrt(squares / divisor),
+						sumMv / divisor, sqrt(squaresMv / divisor));
+		}
+
+		pipePrintf(out, "\n");
+	}
+
+	return 0;
+}
+
+static int32_t formatColumns(const SOURCE * source, const ROWS * rows, int64_t base, PIPE_BUFFER * out)
+{
+	uint32_t n = rows->rows;
+	size_t adcBytes = ((size_t) n * sizeof(int16_t) + 3) & ~(size_t) 3;
+	size_t bytes = 24 + (size_t) n * 8;
+	uint8_t * p;
+	uint32_t * captures;
+	uint32_t capture, row;
+	int16_t ch;
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		bytes += source->channels & (1 << ch) ? adcBytes + (size_t) n * sizeof(float) : 0;
+	}
+
+	if ((p = pipeReserve(out, bytes)) == NULL)
+	{
+		return -1;
+	}
+
+	memset(p, 0, bytes);
+	wavePut32(p, COLUMNS_GROUP_MAGIC);
+	wavePut32(p + 4, n);
+	wavePut64(p + 8, (uint64_t) base);
+	wavePut32(p + 16, rows->captures);
+	p += 24;
+
+	memcpy(p, rows->time, (size_t) n * sizeof(int32_t));
+	p += (size_t) n * sizeof(int32_t);
+	captures = (uint32_t *)(void *) p;
+
+	for (capture = 0; capture < rows->captures; capture++)
+	{
+		uint32_t last = capture + 1 < rows->captures ? rows->starts[capture + 1] : n;
+
+		for (row = rows->starts[capture]; row < last; row++)
+		{
+			captures[row] = (uint32_t)(base + capture);
+		}
+	}
+
+	p += (size_t) n * sizeof(uint32_t);
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		if (source->channels & (1 << ch))
+		{
+			memcpy(p, rows->adc[ch], (size_t) n * sizeof(int16_t));
+			p += adcBytes;
+			memcpy(p, rows->mv[ch], (size_t) n * sizeof(float));
+			p += (size_t) n * sizeof(float);
+		}
+	}
+
+	out->length += bytes;
+	return 0;
+}
+
+/****************************************************************************
+* Workers
+****************************************************************************/
+/* Writes the chunks due, in order, unless another worker already does */
+static void depositChunk(CONVERTER * converter, uint32_t chunk)
+{
+	pthread_mutex_lock(&converter->lock);
+	converter->slots[chunk % converter->window].done = 1;
+
+	if (converter->writing)
+	{
+		pthread_mutex_unlock(&converter->lock);
+		return;
+	}
+
+	converter->writing = 1;
+
+	while (converter->nextWrite < converter->source->chunks && converter->slots[converter->nextWrite % converter->window].done)
+	{
+		SLOT * slot = &converter->slots[converter->nextWrite % converter->window];
+		uint64_t offset = converter->bytesOut;
+
+		pthread_mutex_unlock(&converter->lock);
+
+		if (slot->out.length > 0 && writerWrite(converter->writer, slot->out.data, slot->out.length) != 0)
+		{
+			converter->failed = 1;
+		}
+
+		pthread_mutex_lock(&converter->lock);
+
+		if (converter->groupOffsets != NULL)
+		{
+			converter->groupOffsets[converter->nextWrite] = slot->out.length > 0 ? offset : UINT64_MAX;
+		}
+
+		converter->bytesOut += slot->out.length;
+		slot->out.length = 0;
+		slot->done = 0;
+		converter->nextWrite++;
+		pthread_cond_broadcast(&converter->progress);
+	}
+
+	converter->writing = 0;
+	pthread_mutex_unlock(&converter->lock);
+}
+
+static int16_t claim(CONVERTER * converter, uint32_t chunk)
+{
+	return __atomic_exchange_n(&converter->claimed[chunk], 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+/* Next chunk for 'worker': its own if it may start, else the oldest nobody has taken. UINT32_MAX when all are taken. */
+static uint32_t takeChunk(WORKER * worker)
+{
+	CONVERTER * converter = worker->converter;
+	uint32_t chunks = converter->source->chunks;
+	uint32_t chunk;
+
+	pthread_mutex_lock(&converter->lock);
+
+	for (;;)
+	{
+		uint32_t limit = converter->nextWrite + converter->window;
+
+		while (worker->own < chunks && __atomic_load_n(&converter->claimed[worker->own], __ATOMIC_ACQUIRE))
+		{
+			worker->own += converter->threads;
+		}
+
+		if (worker->own < chunks && worker->own < limit && claim(converter, worker->own))
+		{
+			chunk = worker->own;
+			break;
+		}
+
+		// Steal
+		while (converter->oldest < chunks && __atomic_load_n(&converter->claimed[converter->oldest], __ATOMIC_ACQUIRE))
+		{
+			converter->oldest++;
+		}
+
+		if (converter->oldest >= chunks || converter->failed)
+		{
+			chunk = UINT32_MAX;
+			break;
+		}
+
+		if (converter->oldest < limit && claim(converter, converter->oldest))
+		{
+			chunk = converter->oldest;
+			break;
+		}
+
+		pthread_cond_wait(&converter->progress, &converter->lock);
+	}
+
+	pthread_mutex_unlock(&converter->lock);
+	return chunk;
+}
+
+/* Captures before 'chunk', once the chunks before it are parsed; also publishes the base of the next one */
+static int64_t captureBase(CONVERTER * converter, uint32_t chunk, uint32_t captures)
+{
+	int64_t base;
+
+	pthread_mutex_lock(&converter->lock);
+
+	while (converter->captureBase[chunk] < 0 && !converter->failed)
+	{
+		pthread_cond_wait(&converter->progress, &converter->lock);
+	}
+
+	base = converter->captureBase[chunk];
+	converter->captureBase[chunk + 1] = base + captures;
+	pthread_cond_broadcast(&converter->progress);
+	pthread_mutex_unlock(&converter->lock);
+	return base;
+}
+
+static void * workerThread(void * parameter)
+{
+	WORKER * worker = (WORKER *) parameter;
+	CONVERTER * converter = worker->converter;
+	SOURCE * source = converter->source;
+	uint32_t chunk;
+
+	while ((chunk = takeChunk(worker)) != UINT32_MAX)
+	{
+		PIPE_BUFFER * out = &converter->slots[chunk % converter->window].out;
+		int64_t base;
+		int32_t result;
+
+		worker->rows.rows = 0;
+		worker->rows.captures = 0;
+		result = source->kind == SOURCE_TEXT ? parseText(source, chunk, &worker->rows) : parseBinary(source, chunk, &worker->rows);
+		base = captureBase(converter, chunk, worker->rows.captures);
+
+		if (result == 0 && converter->output == OUTPUT_CSV)
+		{
+			result = formatCsv(source, &worker->rows, base, out);
+		}
+		else if (result == 0 && converter->output == OUTPUT_FEATURES)
+		{
+			result = formatFeatures(source, &worker->rows, base, out);
+		}
+		else if (result == 0 && worker->rows.rows > 0)
+		{
+			result = formatColumns(source, &worker->rows, base, out);
+		}
+
+		if (result != 0)
+		{
+			printf("%s: no memory for chunk %u\n", source->path, chunk);
+			pthread_mutex_lock(&converter->lock);
+			converter->failed = 1;
+			pthread_cond_broadcast(&converter->progress);
+			pthread_mutex_unlock(&converter->lock);
+		}
+
+		depositChunk(converter, chunk);
+	}
+
+	return NULL;
+}
+
+static void freeRows(ROWS * rows)
+{
+	free(rows->time);
+	free(rows->adc[0]);
+	free(rows->adc[1]);
+	free(rows->mv[0]);
+	free(rows->mv[1]);
+	free(rows->starts);
+}
+
+/****************************************************************************
+* One file
+****************************************************************************/
+static void writeHeader(CONVERTER * converter)
+{
+	SOURCE * source = converter->source;
+	uint8_t header[16];
+	int16_t ch;
+
+	if (converter->output == OUTPUT_COLUMNS)
+	{
+		memset(header, 0, sizeof(header));
+		memcpy(header, COLUMNS_MAGIC, 8);
+		wavePut16(header + 8, COLUMNS_VERSION);
+		wavePut16(header + 10, source->channels);
+		writerWrite(converter->writer, header, sizeof(header));
+		converter->bytesOut = sizeof(header);
+		return;
+	}
+
+	writerPrintf(converter->writer, converter->output == OUTPUT_CSV ? "capture,sample,time_ns" : "capture\tsamples\ttime_ns");
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		if (source->channels & (1 << ch))
+		{
+			writerPrintf(converter->writer, converter->output == OUTPUT_CSV ? ",adc%c,mv%c" :
+							"\tmin%c\tmax%c\tmean%c\trms%c\tmean_mv%c\trms_mv%c", 'A' + ch, 'A' + ch, 'A' + ch, 'A' + ch, 'A' + ch, 'A' + ch);
+		}
+	}
+
+	writerPrintf(converter->writer, "\n");
+}
+
+static void writeFooter(CONVERTER * converter)
+{
+	uint8_t entry[8];
+	uint64_t groups = 0;
+	uint32_t k;
+
+	for (k = 0; k < converter->source->chunks; k++)
+	{
+		if (converter->groupOffsets[k] != UINT64_MAX)
+		{
+			wavePut64(entry, converter->groupOffsets[k]);
+			writerWrite(converter->writer, entry, sizeof(entry));
+			groups++;
+		}
+	}
+
+	wavePut64(entry, groups);
+	writerWrite(converter->writer, entry, sizeof(entry));
+	writerWrite(converter->writer, COLUMNS_END, 8);
+}
+
+static int32_t convertFile(const char * path, const char * dir, OUTPUT_KIND output, uint32_t threads, uint32_t points,
+							const WRITER_OPTIONS * options, uint64_t * bytesIn, uint64_t * bytesOut)
+{
+	static const char * suffixes[] = { ".csv", ".col", ".features.txt" };
+	CONVERTER * converter;
+	SOURCE source;
+	char target[1024];
+	const char * name = strrchr(path, '/');
+	uint32_t i;
+	int32_t result;
+
+	if (openSource(&source, path, points) != 0)
+	{
+		closeSource(&source);
+		return -1;
+	}
+
+	name = name != NULL ? name + 1 : path;
+
+	if (dir != NULL)
+	{
+		snprintf(target, sizeof(target), "%s/%s%s", dir, name, suffixes[output]);
+	}
+	else
+	{
+		snprintf(target, sizeof(target), "%s%s", path, suffixes[output]);
+	}
+
+	converter = (CONVERTER *) calloc(1, sizeof(CONVERTER));
+
+	if (converter == NULL)
+	{
+		closeSource(&source);
+		return -1;
+	}
+
+	converter->source = &source;
+	converter->output = output;
+	converter->threads = threads;
+	converter->window = threads * WINDOW_PER_THREAD;
+	converter->claimed = (uint8_t *) calloc(source.chunks + 1, 1);
+	converter->captureBase = (int64_t *) malloc((source.chunks + 1) * sizeof(int64_t));
+	converter->slots = (SLOT *) calloc(converter->window, sizeof(SLOT));
+	converter->groupOffsets = output == OUTPUT_COLUMNS ? (uint64_t *) malloc((source.chunks + 1) * sizeof(uint64_t)) : NULL;
+	converter->writer = writerOpen(target, options);
+	pthread_mutex_init(&converter->lock, NULL);
+	pthread_cond_init(&converter->progress, NULL);
+
+	result = converter->claimed != NULL && converter->captureBase != NULL && converter->slots != NULL &&
+				(output != OUTPUT_COLUMNS || converter->groupOffsets != NULL) && converter->writer != NULL ? 0 : -1;
+
+	if (result == 0)
+	{
+		converter->captureBase[0] = 0;
+
+		for (i = 1; i <= source.chunks; i++)
+		{
+			converter->captureBase[i] = -1;
+		}
+
+		writeHeader(converter);
+
+		for (i = 0; i < threads; i++)
+		{
+			converter->workers[i].converter = converter;
+			converter->workers[i].index = i;
+			converter->workers[i].own = i;
+
+			if (pthread_create(&converter->workers[i].thread, NULL, workerThread, &converter->workers[i]) != 0)
+			{
+				printf("convertFile:pthread_create failed\n");
+				converter->threads = i;
+				break;
+			}
+		}
+
+		for (i = 0; i < converter->threads; i++)
+		{
+			pthread_join(converter->workers[i].thread, NULL);
+		}
+
+		result = converter->failed || converter->nextWrite < source.chunks || converter->threads == 0 ? -1 : 0;
+
+		if (result == 0 && output == OUTPUT_COLUMNS)
+		{
+			writeFooter(converter);
+		}
+	}
+
+	if (converter->writer != NULL && writerClose(converter->writer) != 0)
+	{
+		result = -1;
+	}
+
+	if (result == 0)
+	{
+		printf("%s -> %s: %u chunks, %lld captures\n", path, target, source.chunks, (long long) converter->captureBase[source.chunks]);
+		*bytesIn += source.size;
+		*bytesOut += converter->bytesOut;
+	}
+	else
+	{
+		printf("%s: conversion failed\n", path);
+	}
+
+	for (i = 0; i < threads; i++)
+	{
+		freeRows(&converter->workers[i].rows);
+	}
+
+	for (i = 0; i < converter->window && converter->slots != NULL; i++)
+	{
+		free(converter->slots[i].out.data);
+	}
+
+	pthread_mutex_destroy(&converter->lock);
+	pthread_cond_destroy(&converter->progress);
+	free(converter->claimed);
+	free(converter->captureBase);
+	free(converter->slots);
+	free(converter->groupOffsets);
+	free(converter);
+	closeSource(&source);
+	return result;
+}
+
+int main(int argc, char ** argv)
+{
+	WRITER_OPTIONS options = { WRITER_STDIO, 8, 1 << 20, 0, 0, 0 };
+	OUTPUT_KIND output = OUTPUT_CSV;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t threads = cores > 0 ? (uint32_t) cores : 1;
+	uint32_t points = 2000;
+	const char * dir = NULL;
+	uint64_t bytesIn = 0, bytesOut = 0, start;
+	double seconds;
+	int failures = 0, files = 0;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i += 2)
+	{
+		const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (value == NULL)
+		{
+			usage();
+			return 2;
+		}
+
+		if (strcmp(argv[i], "-f") == 0)
+		{
+			output = strcmp(value, "col") == 0 ? OUTPUT_COLUMNS : strcmp(value, "features") == 0 ? OUTPUT_FEATURES : OUTPUT_CSV;
+		}
+		else if (strcmp(argv[i], "-j") == 0)
+		{
+			threads = (uint32_t) strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "-o") == 0)
+		{
+			dir = value;
+		}
+		else if (strcmp(argv[i], "-p") == 0)
+		{
+			points = (uint32_t) strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "-b") == 0)
+		{
+			options.backend = strcmp(value, "uring") == 0 ? WRITER_URING : WRITER_STDIO;
+		}
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+
+	if (i == argc || threads == 0 || points == 0)
+	{
+		usage();
+		return 2;
+	}
+
+	threads = threads > MAX_THREADS ? MAX_THREADS : threads;
+	start = perfNow();
+
+	for (; i < argc; i++, files++)
+	{
+		failures += convertFile(argv[i], dir, output, threads, points, &options, &bytesIn, &bytesOut) != 0;
+	}
+
+	seconds = (double)(perfNow() - start) * 1e-9;
+	seconds = seconds > 1e-9 ? seconds : 1e-9;
+	printf("%d files (%d failed), %.1f MB read, %.1f MB written in %.2f s with %u threads: %.1f MB/s in, %.1f MB/s out\n",
+			files, failures, (double) bytesIn / 1e6, (double) bytesOut / 1e6, seconds, threads,
+			(double) bytesIn / 1e6 / seconds, (double) bytesOut / 1e6 / seconds);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,1063 @@
+/*******************************************************************************
+ *
+ * Filename: pswave.c
+ *
+ * Description:
+ *   Command line tool for the files written by ps5000aCon, built on the
+ *   waveReader library.
+ *
+ *		pswave info FILE				runs, settings and size of a file
+ *		pswave list FILE [selection]			trigger table of the selected chunks
+ *		pswave dump FILE [selection]			samples as text
+ *		pswave convert FILE OUT [selection] [-f csv|raw]	samples to CSV or raw int16
+ *		pswave slice FILE OUT [selection]		selected chunks to a new container
+ *		pswave verify FILE				check every checksum
+ *		pswave overview FILE.pyr [selection] [-w COLUMNS]	min/max/mean columns from a pyramid
+ *		pswave journal FILE [OUT]			check a journaled output, its data to OUT
+ *
+ *	Selection:
+ *
+ *		-r RUN			only this run (default all runs)
+ *		-s FIRST[:LAST]		segments (captures or streaming callbacks)
+ *		-c CHANNELS		channel letters, e.g. AC (default all)
+ *		-i START -n COUNT	samples of each segment (overview: of the stream)
+ *		-m			values in mV instead of ADC counts
+ *		-p POINTS		block_binary.txt with mV only: points per capture
+ *
+ *	overview reads the coarsest level of the stream_wave.pyr pyramid that
+ *	still has a record per column (100 columns by default), so it costs the
+ *	same for a minute or a day of streaming.
+ *
+ *	journal reads a journaled block.txt, block_binary.txt or stream.txt
+ *	(or the .recovered copy kept after a crash) up to its last good record,
+ *	and writes the data it holds as the plain file would have been.
+ *
+ *	block_binary.txt holds ADC counts and a header with the run settings,
+ *	which give the capture size and the mV; older files with an mV column
+ *	are read as they are, cut into captures with -p.
+ *
+ *	Raw output holds the int16 samples of each selected chunk one after the
+ *	other, in index order (run, segment, channel).
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "waveReader.h"
+#include "wavePyramid.h"
+#include "waveJournal.h"
+
+typedef struct
+{
+	int64_t		run;
+	uint32_t	firstSegment;
+	uint32_t	lastSegment;
+	uint16_t	channels;
+	uint64_t	start;
+	uint64_t	count;
+	int16_t		mv;
+	int16_t		raw;
+	uint32_t	points;
+	uint32_t	columns;
+} SELECTION;
+
+static void usage(void)
+{
+	printf("Usage:\n");
+	printf("  pswave info FILE\n");
+	printf("  pswave list FILE [selection]\n");
+	printf("  pswave dump FILE [selection]\n");
+	printf("  pswave convert FILE OUT [selection] [-f csv|raw]\n");
+	printf("  pswave slice FILE OUT [selection]\n");
+	printf("  pswave verify FILE\n");
+	printf("  pswave overview FILE.pyr [selection] [-w COLUMNS]\n");
+	printf("  pswave journal FILE [OUT]\n");
+	printf("\nSelection:\n");
+	printf("  -r RUN  -s FIRST[:LAST]  -c CHANNELS  -i START  -n COUNT  -m (mV)  -p POINTS (block_binary.txt)\n");
+}
+
+static int32_t parseSelection(int argc, char ** argv, int first, SELECTION * sel)
+{
+	int i;
+
+	memset(sel, 0, sizeof(SELECTION));
+	sel->run = -1;
+	sel->lastSegment = 0xFFFFFFFFu;
+	sel->channels = 0xFFFF;
+
+	for (i = first; i < argc; i++)
+	{
+		const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+		const char * p;
+
+		if (strcmp(argv[i], "-m") == 0)
+		{
+			sel->mv = 1;
+			continue;
+		}
+
+		if (value == NULL)
+		{
+			printf("Missing value after %s\n", argv[i]);
+			return -1;
+		}
+
+		if (strcmp(argv[i], "-r") == 0)
+		{
+			sel->run = strtoll(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "-s") == 0)
+		{
+			sel->firstSegment = (uint32_t) strtoul(value, NULL, 10);
+			p = strchr(value, ':');
+			sel->lastSegment = p != NULL ? (uint32_t) strtoul(p + 1, NULL, 10) : sel->firstSegment;
+		}
+		else if (strcmp(argv[i], "-c") == 0)
+		{
+			sel->channels = 0;
+
+			for (p = value; *p; p++)
+			{
+				if (toupper(*p) >= 'A' && toupper(*p) < 'A' + WAVE_MAX_CHANNELS)
+				{
+					sel->channels |= 1 << (toupper(*p) - 'A');
+				}
+			}
+		}
+		else if (strcmp(argv[i], "-i") == 0)
+		{
+			sel->start = strtoull(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "-n") == 0)
+		{
+			sel->count = strtoull(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "-w") == 0)
+		{
+			sel->columns = (uint32_t) strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "-p") == 0)
+		{
+			sel->points = (uint32_t) strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "-f") == 0)
+		{
+			sel->raw = strcmp(value, "raw") == 0;
+		}
+		else
+		{
+			printf("Unknown option %s\n", argv[i]);
+			return -1;
+		}
+
+		i++;
+	}
+
+	return 0;
+}
+
+static int16_t selected(const SELECTION * sel, const WAVE_INDEX_ENTRY * entry)
+{
+	return entry->type != WAVE_CHUNK_RUN &&
+			(sel->run < 0 || entry->run == (uint64_t) sel->run) &&
+			entry->segment >= sel->firstSegment && entry->segment <= sel->lastSegment &&
+			entry->channel < 16 && (sel->channels >> entry->channel) & 1;
+}
+
+/* Clips the sample range of the selection to a chunk of n samples, returns the count */
+static uint32_t sampleRange(const SELECTION * sel, uint32_t n, uint32_t * start)
+{
+	*start = sel->start < n ? (uint32_t) sel->start : n;
+	n -= *start;
+	return sel->count && sel->count < n ? (uint32_t) sel->count : n;
+}
+
+static const char * typeName(uint16_t type)
+{
+	return type == WAVE_CHUNK_CAPTURE ? "capture" : type == WAVE_CHUNK_STREAM ? "stream" : type == WAVE_CHUNK_PYRAMID ? "pyramid" : "run";
+}
+
+/****************************************************************************
+* Containers
+****************************************************************************/
+static int32_t info(WAVE_READER * reader, const char * path)
+{
+	const WAVE_INDEX_ENTRY * index;
+	uint64_t entries, i, chunks = 0, samples = 0, bytes = 0;
+	WAVE_RUN run;
+	int16_t ch;
+
+	index = waveReaderIndex(reader, &entries);
+	printf("%s: waveform container, %llu chunks, index %s\n", path, (unsigned long long) entries,
+			waveReaderIndexValid(reader) ? "present" : "missing (rebuilt from the chunks)");
+
+	for (i = 0; i < entries; i++)
+	{
+		if (index[i].type != WAVE_CHUNK_RUN)
+		{
+			chunks++;
+			samples += index[i].nSamples;
+			bytes += index[i].payloadBytes;
+		}
+
+		// Print each run after its last chunk
+		if (i + 1 < entries && index[i + 1].run == index[i].run)
+		{
+			continue;
+		}
+
+		printf("\nRun %u: %llu chunks, %llu samples, %llu payload bytes", index[i].run,
+				(unsigned long long) chunks, (unsigned long long) samples, (unsigned long long) bytes);
+
+		if (bytes > 0)
+		{
+			printf(" (%.2f bytes/sample)", (double) bytes / (double) samples);
+		}
+
+		printf("\n");
+
+		if (waveReaderRun(reader, index[i].run, &run) == 0)
+		{
+			printf("  Start %llu ns (Unix), resolution %u, max ADC %d, interval %.3f ns, %u samples per record, %u pre-trigger\n",
+					(unsigned long long) run.startUnixNs, run.resolution, run.maxADCValue, run.sampleIntervalNs,
+					run.samplesPerRecord, run.preTrigger);
+
+			for (ch = 0; ch < WAVE_MAX_CHANNELS; ch++)
+			{
+				if ((run.channelMask >> ch) & 1)
+				{
+					printf("  Channel %c: range %d, analogue offset %g V\n", 'A' + ch, run.range[ch], run.analogueOffset[ch]);
+				}
+			}
+		}
+
+		chunks = samples = bytes = 0;
+	}
+
+	return 0;
+}
+
+static int32_t list(WAVE_READER * reader, const SELECTION * sel)
+{
+	const WAVE_INDEX_ENTRY * index;
+	uint64_t entries, i;
+	WAVE_CHUNK chunk;
+
+	index = waveReaderIndex(reader, &entries);
+	printf("run\ttype\tsegment\tchannel\tsamples\tfirstSample\ttrigger\tflags\thostTimeNs\n");
+
+	for (i = 0; i < entries; i++)
+	{
+		if (!selected(sel, &index[i]) || waveReaderChunk(reader, i, &chunk) != 0)
+		{
+			continue;
+		}
+
+		printf("%u\t%s\t%u\t%c\t%u\t%llu\t", chunk.run, typeName(chunk.type), chunk.segment, 'A' + chunk.channel,
+				chunk.nSamples, (unsigned long long) chunk.firstSample);
+
+		if (chunk.flags & WAVE_CHUNK_TRIGGERED)
+		{
+			printf("%u", chunk.triggerIndex);
+		}
+		else
+		{
+			printf("-");
+		}
+
+		printf("\t%s%s%s%s\t%llu\n", chunk.flags & WAVE_CHUNK_OVERFLOW ? "O" : "", chunk.flags & WAVE_CHUNK_TIME_RESET ? "R" : "",
+				chunk.flags & WAVE_CHUNK_GAP ? "G" : "", chunk.flags & WAVE_CHUNK_COMPRESSED ? "C" : "", (unsigned long long) chunk.hostTimeNs);
+	}
+
+	return 0;
+}
+
+/* Time of sample i of a chunk, relative to the trigger for captures */
+static double sampleTimeNs(const WAVE_RUN * run, const WAVE_INDEX_ENTRY * entry, uint32_t i)
+{
+	if (entry->type == WAVE_CHUNK_STREAM)
+	{
+		return (double)(entry->firstSample + i) * run->sampleIntervalNs;
+	}
+
+	return ((double) i - run->preTrigger) * run->sampleIntervalNs;
+}
+
+/****************************************************************************
+* writeSamples
+*
+* Text (dump, CSV) or raw output of the selected chunks. Text rows hold one
+* column per selected channel, so the chunks of one segment are gathered
+* before printing.
+****************************************************************************/
+static int32_t writeSamples(WAVE_READER * reader, const SELECTION * sel, FILE * out, int16_t csv)
+{
+	const WAVE_INDEX_ENTRY * index;
+	uint64_t entries, i, j, group[WAVE_MAX_CHANNELS];
+	WAVE_SPAN spans[WAVE_MAX_CHANNELS];
+	int16_t * scratch[WAVE_MAX_CHANNELS];
+	uint32_t capacity[WAVE_MAX_CHANNELS];
+	uint32_t nChannels, start, count, k, c;
+	WAVE_RUN run;
+	int32_t result = 0;
+	int64_t currentRun = -1;
+	char separator = csv ? ',' : '\t';
+
+	memset(scratch, 0, sizeof(scratch));
+	memset(capacity, 0, sizeof(capacity));
+	memset(&run, 0, sizeof(run));
+	index = waveReaderIndex(reader, &entries);
+
+	for (i = 0; i < entries && result == 0; i = j)
+	{
+		// Chunks of the same run, type and segment are next to each other
+		nChannels = 0;
+
+		for (j = i; j < entries && index[j].run == index[i].run && index[j].type == index[i].type && index[j].segment == index[i].segment; j++)
+		{
+			// Pyramid records are not samples, see overview
+			if (selected(sel, &index[j]) && index[j].type != WAVE_CHUNK_PYRAMID && nChannels < WAVE_MAX_CHANNELS)
+			{
+				group[nChannels++] = j;
+			}
+		}
+
+		if (nChannels == 0)
+		{
+			continue;
+		}
+
+		if ((int64_t) index[i].run != currentRun)
+		{
+			currentRun = index[i].run;
+
+			if (waveReaderRun(reader, index[i].run, &run) != 0)
+			{
+				memset(&run, 0, sizeof(run));
+			}
+
+			if (!sel->raw)
+			{
+				fprintf(out, csv ? "run,segment,sample,time_ns" : "# run %u\nrun\tsegment\tsample\ttime_ns", index[i].run);
+
+				for (c = 0; c < nChannels; c++)
+				{
+					fprintf(out, "%c%c%s", separator, 'A' + index[group[c]].channel, sel->mv ? "_mV" : "");
+				}
+
+				fprintf(out, "\n");
+			}
+		}
+
+		for (c = 0; c < nChannels; c++)
+		{
+			if (index[group[c]].nSamples > capacity[c])
+			{
+				free(scratch[c]);
+				capacity[c] = index[group[c]].nSamples;
+				scratch[c] = (int16_t *) malloc(capacity[c] * sizeof(int16_t));
+			}
+
+			if (scratch[c] == NULL || waveReaderSamples(reader, group[c], scratch[c], &spans[c]) != 0)
+			{
+				printf("Chunk run %u segment %u channel %c is damaged\n", index[group[c]].run, index[group[c]].segment, 'A' + index[group[c]].channel);
+				result = -1;
+				break;
+			}
+		}
+
+		if (result != 0)
+		{
+			break;
+		}
+
+		if (sel->raw)
+		{
+			for (c = 0; c < nChannels; c++)
+			{
+				count = sampleRange(sel, spans[c].nSamples, &start);
+
+				if (fwrite(spans[c].samples + start, sizeof(int16_t), count, out) != count)
+				{
+					result = -1;
+				}
+			}
+
+			continue;
+		}
+
+		count = sampleRange(sel, spans[0].nSamples, &start);
+
+		for (k = start; k < start + count; k++)
+		{
+			fprintf(out, "%u%c%u%c%u%c%.3f", index[i].run, separator, index[i].segment, separator, k, separator, sampleTimeNs(&run, &index[i], k));
+
+			for (c = 0; c < nChannels; c++)
+			{
+				if (k >= spans[c].nSamples)
+				{
+					fprintf(out, "%c", separator);
+				}
+				else if (sel->mv)
+				{
+					fprintf(out, "%c%.3f", separator, waveAdcToMv(&run, index[group[c]].channel, spans[c].samples[k]));
+				}
+				else
+				{
+					fprintf(out, "%c%d", separator, spans[c].samples[k]);
+				}
+			}
+
+			fprintf(out, "\n");
+		}
+	}
+
+	for (c = 0; c < WAVE_MAX_CHANNELS; c++)
+	{
+		free(scratch[c]);
+	}
+
+	return result;
+}
+
+/****************************************************************************
+* slice
+*
+* Copies the selected chunks, and the run chunks they belong to, to a new
+* container. Chunks are copied as stored, without decoding.
+****************************************************************************/
+static int32_t slice(WAVE_READER * reader, const SELECTION * sel, FILE * out)
+{
+	const WAVE_INDEX_ENTRY * index;
+	WAVE_INDEX_ENTRY * copied;
+	uint8_t encoded[WAVE_HEADER_SIZE];
+	WAVE_HEADER header;
+	WAVE_TRAILER trailer;
+	uint64_t entries, i, n = 0, offset = WAVE_HEADER_SIZE;
+	int32_t result = 0;
+	int64_t runEntry;
+
+	index = waveReaderIndex(reader, &entries);
+	copied = (WAVE_INDEX_ENTRY *) malloc((entries ? entries : 1) * sizeof(WAVE_INDEX_ENTRY));
+
+	if (copied == NULL)
+	{
+		return -1;
+	}
+
+	header.version = WAVE_VERSION;
+	header.createdUnixNs = 0;
+	waveEncodeHeader(&header, encoded);
+	fwrite(encoded, 1, WAVE_HEADER_SIZE, out);
+
+	for (i = 0; i < entries && result == 0; i++)
+	{
+		uint64_t source = i;
+
+		if (!selected(sel, &index[i]))
+		{
+			continue;
+		}
+
+		// The run chunk goes in front of the first chunk taken from its run
+		if (n == 0 || copied[n - 1].run != index[i].run)
+		{
+			runEntry = waveReaderFind(reader, index[i].run, WAVE_CHUNK_RUN, 0, WAVE_NO_CHANNEL);
+
+			if (runEntry >= 0)
+			{
+				source = (uint64_t) runEntry;
+				i--;
+			}
+		}
+
+		copied[n] = index[source];
+		copied[n].offset = offset;
+
+		if (fwrite(waveReaderPayload(reader, source) - WAVE_CHUNK_SIZE, 1, (size_t) waveChunkSpan(index[source].payloadBytes), out) != waveChunkSpan(index[source].payloadBytes))
+		{
+			result = -1;
+		}
+
+		offset += waveChunkSpan(index[source].payloadBytes);
+		n++;
+	}
+
+	trailer.indexOffset = offset;
+	trailer.entries = n;
+	trailer.indexCrc = 0;
+
+	for (i = 0; i < n && result == 0; i++)
+	{
+		uint8_t entry[WAVE_INDEX_ENTRY_SIZE];
+
+		waveEncodeIndexEntry(&copied[i], entry);
+		trailer.indexCrc = waveCrc32c(trailer.indexCrc, entry, WAVE_INDEX_ENTRY_SIZE);
+
+		if (fwrite(entry, 1, WAVE_INDEX_ENTRY_SIZE, out) != WAVE_INDEX_ENTRY_SIZE)
+		{
+			result = -1;
+		}
+	}
+
+	waveEncodeTrailer(&trailer, encoded);
+
+	if (result == 0 && fwrite(encoded, 1, WAVE_TRAILER_SIZE, out) != WAVE_TRAILER_SIZE)
+	{
+		result = -1;
+	}
+
+	printf("%llu chunks copied\n", (unsigned long long) n);
+	free(copied);
+	return result;
+}
+
+static int32_t verify(WAVE_READER * reader, const char * path)
+{
+	const WAVE_INDEX_ENTRY * index;
+	uint64_t entries, i, damaged = 0;
+
+	index = waveReaderIndex(reader, &entries);
+
+	for (i = 0; i < entries; i++)
+	{
+		if (waveReaderVerify(reader, i) != 0)
+		{
+			printf("Damaged: run %u %s segment %u channel %c at offset %llu\n", index[i].run, typeName(index[i].type),
+					index[i].segment, index[i].channel == WAVE_NO_CHANNEL ? '-' : 'A' + index[i].channel,
+					(unsigned long long) index[i].offset);
+			damaged++;
+		}
+	}
+
+	printf("%s: %llu chunks, %llu damaged, index %s\n", path, (unsigned long long) entries, (unsigned long long) damaged,
+			waveReaderIndexValid(reader) ? "present" : "missing");
+
+	return damaged == 0 && waveReaderIndexValid(reader) ? 0 : -1;
+}
+
+/****************************************************************************
+* overview
+*
+* Minimum, maximum and mean of each column of a streamed run, from the
+* pyramid in a stream_wave.pyr sidecar
+****************************************************************************/
+static int32_t overview(WAVE_READER * reader, const SELECTION * sel)
+{
+	uint32_t run = sel->run < 0 ? 0 : (uint32_t) sel->run;
+	uint32_t columns = sel->columns ? sel->columns : 100;
+	uint32_t factor, levels, nChannels = 0, c, k;
+	uint16_t channels[WAVE_MAX_CHANNELS];
+	WAVE_EXTENT * extents[WAVE_MAX_CHANNELS];
+	uint64_t samples = 0, channelSamples, start, count, size = 1;
+	int32_t level = -1, result = 0;
+	uint16_t ch;
+	WAVE_RUN settings;
+
+	for (ch = 0; ch < WAVE_MAX_CHANNELS; ch++)
+	{
+		if ((sel->channels >> ch) & 1 && pyramidInfo(reader, run, ch, &factor, &levels, &channelSamples) == 0)
+		{
+			channels[nChannels++] = ch;
+			samples = channelSamples > samples ? channelSamples : samples;
+		}
+	}
+
+	if (nChannels == 0 || waveReaderRun(reader, run, &settings) != 0)
+	{
+		printf("No pyramid for the selected channels in run %u\n", run);
+		return -1;
+	}
+
+	start = sel->start < samples ? sel->start : samples;
+	count = sel->count && sel->count < samples - start ? sel->count : samples - start;
+	memset(extents, 0, sizeof(extents));
+
+	for (c = 0; c < nChannels && result == 0; c++)
+	{
+		if ((extents[c] = (WAVE_EXTENT *) malloc(columns * sizeof(WAVE_EXTENT))) == NULL ||
+			(level = pyramidQuery(reader, run, channels[c], start, count, columns, extents[c])) <= 0)
+		{
+			result = -1;
+		}
+	}
+
+	if (level == 0)
+	{
+		printf("Fewer than %u samples per column, dump the samples of this range instead\n", factor);
+	}
+	else if (result == 0)
+	{
+		for (k = 0; k < (uint32_t) level; k++)
+		{
+			size *= factor;
+		}
+
+		printf("# run %u, level %d, %llu samples per record\ncolumn\tsample\ttime_ns", run, level, (unsigned long long) size);
+
+		for (c = 0; c < nChannels; c++)
+		{
+			printf(sel->mv ? "\t%c_min_mV\t%c_max_mV\t%c_mean_mV" : "\t%c_min\t%c_max\t%c_mean", 'A' + channels[c], 'A' + channels[c], 'A' + channels[c]);
+		}
+
+		printf("\n");
+
+		for (k = 0; k < columns; k++)
+		{
+			uint64_t first = start + count / columns * k + (count % columns) * k / columns;
+
+			printf("%u\t%llu\t%.3f", k, (unsigned long long) first, (double) first * settings.sampleIntervalNs);
+
+			for (c = 0; c < nChannels; c++)
+			{
+				const WAVE_EXTENT * e = &extents[c][k];
+
+				if (e->min > e->max)
+				{
+					printf("\t-\t-\t-");
+				}
+				else if (sel->mv)
+				{
+					printf("\t%.3f\t%.3f\t%.3f", waveAdcToMv(&settings, channels[c], e->min), waveAdcToMv(&settings, channels[c], e->max),
+							waveAdcToMv(&settings, channels[c], e->mean));
+				}
+				else
+				{
+					printf("\t%d\t%d\t%d", e->min, e->max, e->mean);
+				}
+			}
+
+			printf("\n");
+		}
+	}
+
+	for (c = 0; c < nChannels; c++)
+	{
+		free(extents[c]);
+	}
+
+	return result;
+}
+
+/****************************************************************************
+* journal
+****************************************************************************/
+static int32_t writeRecord(void * context, const uint8_t * data, uint32_t length)
+{
+	return fwrite(data, 1, length, (FILE *) context) == length ? 0 : -1;
+}
+
+static int32_t journal(const char * path, const char * outPath)
+{
+	JOURNAL_SCAN scan;
+	FILE * fp = fopen(path, "rb");
+	FILE * out = NULL;
+	int32_t result;
+
+	if (fp == NULL)
+	{
+		printf("Cannot read %s\n", path);
+		return -1;
+	}
+
+	if (outPath != NULL && (out = fopen(outPath, "wb")) == NULL)
+	{
+		printf("Cannot open the file %s for writing.\n", outPath);
+		fclose(fp);
+		return -1;
+	}
+
+	result = journalScan(fp, &scan, out != NULL ? writeRecord : NULL, out);
+	fclose(fp);
+
+	if (out != NULL && fclose(out) != 0)
+	{
+		result = -1;
+	}
+
+	if (result != 0 && scan.goodBytes == 0)
+	{
+		printf("%s is not a journaled file\n", path);
+		return -1;
+	}
+
+	printf("%s: %llu records, %llu bytes of data, %s\n", path, (unsigned long long) scan.records,
+			(unsigned long long) scan.dataBytes, scan.closed ? "closed" : "not closed");
+
+	if (scan.goodBytes < scan.fileBytes)
+	{
+		printf("  %llu bytes after the last good record at %llu\n", (unsigned long long)(scan.fileBytes - scan.goodBytes),
+				(unsigned long long) scan.goodBytes);
+	}
+
+	return result == 0 && scan.closed && scan.goodBytes == scan.fileBytes ? 0 : -1;
+}
+
+/****************************************************************************
+* block_binary.txt
+*
+* The records are cut into captures of 'points' samples; -s picks captures
+* and -i/-n the samples of each, as for the chunks of a container. Both
+* channels share a record, so -c picks the text columns but raw output and
+* slice, which keep the records whole, take both or fail.
+****************************************************************************/
+static int32_t blockChannels(const SELECTION * sel, int16_t wholeRecords)
+{
+	if ((sel->channels & 3) == 0)
+	{
+		printf("block_binary files hold channels A and B only\n");
+		return -1;
+	}
+
+	if (wholeRecords && (sel->channels & 3) != 3)
+	{
+		printf("-c does not apply to raw output or slice of block_binary files, each record holds both channels\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int16_t blockSampleSelected(const SELECTION * sel, uint64_t record, uint32_t points)
+{
+	uint32_t start;
+	uint32_t n = sampleRange(sel, points, &start);
+
+	return record % points >= start && record % points < (uint64_t) start + n;
+}
+
+static int32_t writeBlockRecords(const void * records, size_t size, uint64_t first, uint64_t last, uint32_t points, const SELECTION * sel, FILE * out)
+{
+	uint64_t capture, from, to;
+	uint32_t start, n;
+
+	for (capture = points ? first / points : 0; points && capture * points < last; capture++)
+	{
+		n = sampleRange(sel, points, &start);
+		from = capture * points + start;
+		to = from + n < last ? from + n : last;
+
+		if (from < to && fwrite((const uint8_t *) records + from * size, size, (size_t)(to - from), out) != to - from)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int32_t binaryCommand(WAVE_READER * reader, const char * command, const char * path, const SELECTION * sel, FILE * out)
+{
+	const BLOCK_BINARY_RECORD * records;
+	uint64_t count, first = 0, last, i;
+	uint32_t points, c;
+	char separator = strcmp(command, "convert") == 0 ? ',' : '\t';
+
+	records = waveReaderBinary(reader, &count);
+	points = sel->points ? sel->points : (uint32_t) count;
+
+	if (strcmp(command, "info") == 0)
+	{
+		printf("%s: block_binary records, %llu samples", path, (unsigned long long) count);
+
+		if (sel->points)
+		{
+			printf(", %llu captures of %u points", (unsigned long long)(count / points), points);
+		}
+
+		printf("\n");
+		return 0;
+	}
+
+	if (strcmp(command, "dump") != 0 && strcmp(command, "convert") != 0 && strcmp(command, "slice") != 0)
+	{
+		printf("%s is not available for block_binary files\n", command);
+		return -1;
+	}
+
+	if (sel->firstSegment > 0 || sel->lastSegment != 0xFFFFFFFFu)
+	{
+		first = (uint64_t) sel->firstSegment * points;
+		last = sel->lastSegment == 0xFFFFFFFFu ? count : ((uint64_t) sel->lastSegment + 1) * points;
+	}
+	else
+	{
+		last = count;
+	}
+
+	last = last < count ? last : count;
+	first = first < last ? first : last;
+
+	if (blockChannels(sel, strcmp(command, "slice") == 0 || sel->raw) != 0)
+	{
+		return -1;
+	}
+
+	// slice keeps the record layout
+	if (strcmp(command, "slice") == 0 || sel->raw)
+	{
+		return writeBlockRecords(records, sizeof(BLOCK_BINARY_RECORD), first, last, points, sel, out);
+	}
+
+	fprintf(out, "capture%csample%ctime", separator, separator);
+
+	for (c = 0; c < 2; c++)
+	{
+		if ((sel->channels >> c) & 1)
+		{
+			fprintf(out, "%cadc%c%cmv%c", separator, 'A' + c, separator, 'A' + c);
+		}
+	}
+
+	fprintf(out, "\n");
+
+	for (i = first; i < last; i++)
+	{
+		if (!blockSampleSelected(sel, i, points))
+		{
+			continue;
+		}
+
+		fprintf(out, "%llu%c%llu%c%d", (unsigned long long)(i / points), separator, (unsigned long long)(i % points), separator, records[i].time);
+
+		if (sel->channels & 1)
+		{
+			fprintf(out, "%c%d%c%d", separator, records[i].adcA, separator, records[i].mvA);
+		}
+
+		if (sel->channels & 2)
+		{
+			fprintf(out, "%c%d%c%d", separator, records[i].adcB, separator, records[i].mvB);
+		}
+
+		fprintf(out, "\n");
+	}
+
+	return 0;
+}
+
+/****************************************************************************
+* block_binary.txt with raw counts
+****************************************************************************/
+static int32_t blockRawCommand(WAVE_READER * reader, const char * command, const char * path, const SELECTION * sel, FILE * out)
+{
+	const BLOCK_RAW_RECORD * records;
+	uint8_t header[BLOCK_RAW_HEADER_SIZE];
+	uint64_t count, first = 0, last, i;
+	uint32_t points, c;
+	WAVE_RUN run;
+	int16_t csv = strcmp(command, "convert") == 0;
+	char separator = csv ? ',' : '\t';
+
+	records = waveReaderBlockRaw(reader, &count);
+	waveReaderRun(reader, 0, &run);
+	points = run.samplesPerRecord ? run.samplesPerRecord : (uint32_t) count;
+
+	if (strcmp(command, "info") == 0)
+	{
+		printf("%s: block_binary ADC counts, %llu samples, %llu captures of %u points\n", path, (unsigned long long) count,
+				(unsigned long long)(count / points), points);
+		printf("  Resolution %u, max ADC %d, interval %.3f ns, %u pre-trigger\n", run.resolution, run.maxADCValue, run.sampleIntervalNs,
+				run.preTrigger);
+
+		if (waveReaderTruncated(reader) > 0)
+		{
+			printf("  Truncated: the last %llu bytes are part of a record and are ignored\n", (unsigned long long) waveReaderTruncated(reader));
+		}
+
+		for (i = 0; i < 2; i++)
+		{
+			if (run.channelMask & (1 << i))
+			{
+				printf("  Channel %c: range %u, analogue offset %g V\n", (int)('A' + i), run.range[i], run.analogueOffset[i]);
+			}
+		}
+
+		return 0;
+	}
+
+	if (strcmp(command, "dump") != 0 && !csv && strcmp(command, "slice") != 0)
+	{
+		printf("%s is not available for block_binary files\n", command);
+		return -1;
+	}
+
+	first = (uint64_t) sel->firstSegment * points;
+	last = sel->lastSegment == 0xFFFFFFFFu ? count : ((uint64_t) sel->lastSegment + 1) * points;
+	last = last < count ? last : count;
+	first = first < last ? first : last;
+
+	if (blockChannels(sel, strcmp(command, "slice") == 0 || sel->raw) != 0)
+	{
+		return -1;
+	}
+
+	// slice keeps the layout, and the header that scales it
+	if (strcmp(command, "slice") == 0)
+	{
+		waveEncodeBlockRaw(&run, header);
+
+		if (fwrite(header, 1, sizeof(header), out) != sizeof(header))
+		{
+			return -1;
+		}
+	}
+
+	if (strcmp(command, "slice") == 0 || sel->raw)
+	{
+		return writeBlockRecords(records, sizeof(BLOCK_RAW_RECORD), first, last, points, sel, out);
+	}
+
+	fprintf(out, "capture%csample%ctime", separator, separator);
+
+	for (c = 0; c < 2; c++)
+	{
+		if ((sel->channels >> c) & 1)
+		{
+			fprintf(out, "%c%s%c", separator, sel->mv ? "mv" : "adc", 'A' + c);
+		}
+	}
+
+	fprintf(out, "\n");
+
+	for (i = first; i < last; i++)
+	{
+		if (!blockSampleSelected(sel, i, points))
+		{
+			continue;
+		}
+
+		fprintf(out, "%llu%c%llu%c%d", (unsigned long long)(i / points), separator, (unsigned long long)(i % points), separator, records[i].time);
+
+		for (c = 0; c < 2; c++)
+		{
+			int16_t adc = c == 0 ? records[i].adcA : records[i].adcB;
+
+			if (!((sel->channels >> c) & 1))
+			{
+				continue;
+			}
+
+			if (sel->mv)
+			{
+				fprintf(out, "%c%.3f", separator, waveAdcToMv(&run, (uint16_t) c, adc));
+			}
+			else
+			{
+				fprintf(out, "%c%d", separator, adc);
+			}
+		}
+
+		fprintf(out, "\n");
+	}
+
+	return 0;
+}
+
+int main(int argc, char ** argv)
+{
+	WAVE_READER * reader;
+	SELECTION sel;
+	FILE * out = stdout;
+	const char * command;
+	int16_t hasOutput;
+	int32_t result;
+
+	if (argc < 3)
+	{
+		usage();
+		return 2;
+	}
+
+	command = argv[1];
+
+	if (strcmp(command, "journal") == 0)
+	{
+		return journal(argv[2], argc > 3 ? argv[3] : NULL) == 0 ? 0 : 1;
+	}
+
+	hasOutput = strcmp(command, "convert") == 0 || strcmp(command, "slice") == 0;
+
+	if ((hasOutput && argc < 4) || parseSelection(argc, argv, hasOutput ? 4 : 3, &sel) != 0)
+	{
+		usage();
+		return 2;
+	}
+
+	reader = waveReaderOpen(argv[2]);
+
+	if (reader == NULL)
+	{
+		printf("Cannot read %s: not a waveform container or block_binary file\n", argv[2]);
+		return 1;
+	}
+
+	if (hasOutput)
+	{
+		out = fopen(argv[3], "wb");
+
+		if (out == NULL)
+		{
+			printf("Cannot open the file %s for writing.\n", argv[3]);
+			waveReaderClose(reader);
+			return 1;
+		}
+	}
+
+	if (waveReaderKind(reader) == WAVE_KIND_BLOCK_BINARY)
+	{
+		result = binaryCommand(reader, command, argv[2], &sel, out);
+	}
+	else if (waveReaderKind(reader) == WAVE_KIND_BLOCK_RAW)
+	{
+		result = blockRawCommand(reader, command, argv[2], &sel, out);
+	}
+	else if (strcmp(command, "info") == 0)
+	{
+		result = info(reader, argv[2]);
+	}
+	else if (strcmp(command, "list") == 0)
+	{
+		result = list(reader, &sel);
+	}
+	else if (strcmp(command, "dump") == 0)
+	{
+		result = writeSamples(reader, &sel, out, 0);
+	}
+	else if (strcmp(command, "convert") == 0)
+	{
+		result = writeSamples(reader, &sel, out, 1);
+	}
+	else if (strcmp(command, "slice") == 0)
+	{
+		result = slice(reader, &sel, out);
+	}
+	else if (strcmp(command, "verify") == 0)
+	{
+		result = verify(reader, argv[2]);
+	}
+	else if (strcmp(command, "overview") == 0)
+	{
+		result = overview(reader, &sel);
+	}
+	else
+	{
+		usage();
+		result = -1;
+	}
+
+	if (out != stdout && fclose(out) != 0)
+	{
+		result = -1;
+	}
+
+	waveReaderClose(reader);
+	return result == 0 ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+/*******************************************************************************
+ *
+ * Filename: realtime.c
+ *
+ * Description:
+ *   Real-time profile, see realtime.h. Linux only; on other systems every
+ *   step reports that it is not supported.
+ *
+ ******************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "realtime.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+typedef struct
+{
+	int16_t		active;
+	int16_t		affinitySet;
+	int16_t		policySet;
+	int16_t		memoryLocked;
+	cpu_set_t	affinity;
+	int			policy;
+	struct sched_param param;
+	uint64_t	prefaulted;
+	size_t		pageSize;
+} RT_STATE;
+
+static RT_STATE state;
+
+int32_t rtEnter(const RT_OPTIONS * options)
+{
+	pthread_t self = pthread_self();
+	int32_t failed = 0;
+	char label[32];
+	int error;
+
+	memset(&state, 0, sizeof(state));
+	state.pageSize = (size_t) sysconf(_SC_PAGESIZE);
+
+	if (options == NULL || !options->enabled)
+	{
+		return 0;
+	}
+
+	state.active = 1;
+	printf("Real-time profile:\n");
+
+	if (options->cpu >= 0)
+	{
+		cpu_set_t set;
+
+		snprintf(label, sizeof(label), "pin to CPU %d", options->cpu);
+		pthread_getaffinity_np(self, sizeof(cpu_set_t), &state.affinity);
+		CPU_ZERO(&set);
+		CPU_SET(options->cpu, &set);
+
+		if ((error = pthread_setaffinity_np(self, sizeof(cpu_set_t), &set)) == 0)
+		{
+			state.affinitySet = 1;
+			printf("  %-24s OK\n", label);
+		}
+		else
+		{
+			printf("  %-24s failed: %s\n", label, strerror(error));
+			failed++;
+		}
+	}
+
+	if (options->priority > 0)
+	{
+		struct sched_param param;
+
+		snprintf(label, sizeof(label), "SCHED_FIFO priority %d", options->priority);
+		pthread_getschedparam(self, &state.policy, &state.param);
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = options->priority;
+
+		if ((error = pthread_setschedparam(self, SCHED_FIFO, &param)) == 0)
+		{
+			state.policySet = 1;
+			printf("  %-24s OK\n", label);
+		}
+		else
+		{
+			printf("  %-24s failed: %s%s\n", label, strerror(error),
+					error == EPERM ? " (needs CAP_SYS_NICE or an rtprio limit)" : "");
+			failed++;
+		}
+	}
+
+	if (options->lockMemory)
+	{
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+		{
+			state.memoryLocked = 1;
+			printf("  %-24s OK\n", "mlockall");
+		}
+		else
+		{
+			struct rlimit limit;
+
+			error = errno;
+			getrlimit(RLIMIT_MEMLOCK, &limit);
+			printf("  %-24s failed: %s (memlock limit %llu kB)\n", "mlockall", strerror(error),
+					limit.rlim_cur == RLIM_INFINITY ? 0ULL : (unsigned long long) limit.rlim_cur / 1024);
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+void rtLeave(void)
+{
+	pthread_t self = pthread_self();
+
+	if (!state.active)
+	{
+		return;
+	}
+
+	if (state.policySet)
+	{
+		pthread_setschedparam(self, state.policy, &state.param);
+	}
+
+	if (state.affinitySet)
+	{
+		pthread_setaffinity_np(self, sizeof(cpu_set_t), &state.affinity);
+	}
+
+	if (state.memoryLocked)
+	{
+		munlockall();
+	}
+
+	if (state.prefaulted > 0)
+	{
+		printf("Real-time profile: %llu kB of buffers prefaulted\n", (unsigned long long) state.prefaulted / 1024);
+	}
+
+	state.active = 0;
+}
+
+void rtPrefault(void * buffer, size_t bytes)
+{
+	volatile uint8_t * p = (volatile uint8_t *) buffer;
+	size_t offset;
+
+	if (!state.active || buffer == NULL)
+	{
+		return;
+	}
+
+	// Write back what is there, so that a zeroed page is really allocated
+	for (offset = 0; offset < bytes; offset += state.pageSize)
+	{
+		p[offset] = p[offset];
+	}
+
+	if (bytes > 0)
+	{
+		p[bytes - 1] = p[bytes - 1];
+	}
+
+	state.prefaulted += bytes;
+}
+
+void rtRelax(void)
+{
+	struct timespec pause = { 0, 50000 };
+
+	if (state.policySet)
+	{
+		nanosleep(&pause, NULL);
+	}
+}
+
+#else
+
+int32_t rtEnter(const RT_OPTIONS * options)
+{
+	if (options != NULL && options->enabled)
+	{
+		printf("Real-time profile: not supported on this system\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+void rtLeave(void)
+{
+}
+
+void rtPrefault(void * buffer, size_t bytes)
+{
+}
+
+void rtRelax(void)
+{
+}
+
+#endif
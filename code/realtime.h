@@ -0,0 +1,41 @@
+/*******************************************************************************
+ *
+ * Filename: realtime.h
+ *
+ * Description:
+ *   Opt-in real-time profile for the thread that polls the driver.
+ *
+ *   rtEnter() pins the calling thread to one CPU, switches it to SCHED_FIFO
+ *   and locks the process memory, printing the outcome of every step; the
+ *   steps that fail are skipped and the others stay in effect. rtLeave()
+ *   restores the previous affinity and policy. rtPrefault() touches every
+ *   page of a buffer so that the first access during acquisition does not
+ *   take a page fault.
+ *
+ *   A SCHED_FIFO thread that spins starves the driver's own threads, so the
+ *   wait loops call rtRelax(), which sleeps briefly while the profile is on.
+ *
+ ******************************************************************************/
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct
+{
+	int16_t		enabled;
+	int32_t		cpu;			// CPU to pin to, -1 to leave the affinity alone
+	int32_t		priority;		// SCHED_FIFO priority 1..99, 0 to leave the policy alone
+	int16_t		lockMemory;		// mlockall(MCL_CURRENT | MCL_FUTURE)
+} RT_OPTIONS;
+
+/* Applies the profile to the calling thread. Returns the number of steps that failed. */
+int32_t rtEnter(const RT_OPTIONS * options);
+void rtLeave(void);
+
+void rtPrefault(void * buffer, size_t bytes);
+void rtRelax(void);
+
+#endif
@@ -0,0 +1,561 @@
+/*******************************************************************************
+ *
+ * Filename: replay.c
+ *
+ * Description:
+ *   Playback of recorded acquisitions, see replay.h.
+ *
+ *   The sample chunks of a run follow each other in the index, sorted by
+ *   segment and then channel, so a record is the chunks of one segment taken
+ *   in a single pass; nothing is read ahead or copied unless the chunk is
+ *   compressed.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "waveReader.h"
+#include "perfStats.h"
+#include "replay.h"
+
+struct tReplay
+{
+	WAVE_READER *		reader;
+	REPLAY_KIND			kind;
+	WAVE_RUN			run;
+	uint32_t			runNumber;
+	const WAVE_INDEX_ENTRY * index;
+	uint64_t			position;				// next index entry, or next capture of block_binary.txt
+	uint64_t			end;
+	const BLOCK_BINARY_RECORD * binary;
+	const BLOCK_RAW_RECORD * raw;
+	uint32_t			records;
+	uint32_t			maxSamples;
+	int16_t				inPlace;
+	int16_t *			scratch[WAVE_MAX_CHANNELS];
+	REPLAY_RECORD		record;
+	uint64_t			startNs;				// host clock of the first record
+	uint64_t			elapsed;				// samples from the first record to the start of this one
+	uint64_t			lastSample;
+	uint32_t			lastSamples;
+	struct stat			source;
+	char				path[260];
+};
+
+/* Input ranges in mV, in the order of PS5000A_RANGE */
+static const int32_t rangeMv[] = { 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000 };
+
+/* Full scale at 8 bit, and at 12 bit and above */
+static const int16_t fullScale[] = { 32512, 32767 };
+
+/****************************************************************************
+* binaryRange
+*
+* Finds the range and full scale that turn the ADC column of a channel into
+* its mV column, from the sample furthest from zero. Returns 0 if the
+* channel holds only zeros.
+****************************************************************************/
+static int16_t binaryRange(const BLOCK_BINARY_RECORD * records, uint64_t count, uint16_t channel, WAVE_RUN * run)
+{
+	int32_t adc = 0;
+	int32_t mv = 0;
+	uint64_t i;
+	uint32_t r;
+	uint32_t f;
+
+	for (i = 0; i < count; i++)
+	{
+		int32_t a = channel == 0 ? records[i].adcA : records[i].adcB;
+
+		if (abs(a) > abs(adc))
+		{
+			adc = a;
+			mv = channel == 0 ? records[i].mvA : records[i].mvB;
+		}
+	}
+
+	if (adc == 0)
+	{
+		return 0;
+	}
+
+	for (f = 0; f < sizeof(fullScale) / sizeof(fullScale[0]); f++)
+	{
+		for (r = 0; r < sizeof(rangeMv) / sizeof(rangeMv[0]); r++)
+		{
+			if (adc * rangeMv[r] / fullScale[f] == mv)
+			{
+				run->range[channel] = (uint8_t) r;
+				run->maxADCValue = fullScale[f];
+				// The full scale only tells 8 bit from the others
+				run->resolution = f == 0 ? 0 : 1;
+				return 1;
+			}
+		}
+	}
+
+	printf("replayOpen: no input range gives the mV of channel %c, taking +/-%d mV\n", 'A' + channel, (int) rangeMv[run->range[channel]]);
+	return 1;
+}
+
+/****************************************************************************
+* allocateCaptures
+*
+* Scratch buffers that a capture of block_binary.txt is split into.
+****************************************************************************/
+static int16_t allocateCaptures(REPLAY * replay)
+{
+	uint16_t ch;
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		if ((replay->scratch[ch] = (int16_t *) malloc(replay->maxSamples * sizeof(int16_t))) == NULL)
+		{
+			printf("replayOpen: no memory for the captures\n");
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/****************************************************************************
+* openBinary
+*
+* Cuts the records of block_binary.txt into captures of 'captureSamples'.
+****************************************************************************/
+static int16_t openBinary(REPLAY * replay, uint32_t captureSamples)
+{
+	uint64_t count;
+	uint16_t ch;
+
+	replay->binary = waveReaderBinary(replay->reader, &count);
+
+	if (captureSamples == 0 || count < captureSamples)
+	{
+		printf("replayOpen: %s holds %llu samples, not one capture of %u\n", replay->path, (unsigned long long) count, captureSamples);
+		return 0;
+	}
+
+	if (count % captureSamples != 0)
+	{
+		printf("replayOpen: the last %llu samples do not make a whole capture and are left out\n",
+					(unsigned long long)(count % captureSamples));
+	}
+
+	replay->kind = REPLAY_CAPTURES;
+	replay->records = (uint32_t)(count / captureSamples);
+	replay->end = replay->records;
+	replay->maxSamples = captureSamples;
+	replay->inPlace = 0;
+
+	replay->run.maxADCValue = fullScale[0];
+	replay->run.samplesPerRecord = captureSamples;
+	replay->run.range[0] = replay->run.range[1] = 6;	// 1 V, if nothing better is found
+	replay->run.sampleIntervalNs = count > 1 && replay->binary[1].time > replay->binary[0].time ?
+										(double)(replay->binary[1].time - replay->binary[0].time) : 1.0;
+
+	for (ch = 0; ch < 2; ch++)
+	{
+		if (binaryRange(replay->binary, (uint64_t) replay->records * captureSamples, ch, &replay->run))
+		{
+			replay->run.channelMask |= 1 << ch;
+		}
+	}
+
+	if (replay->run.channelMask == 0)
+	{
+		replay->run.channelMask = 1;
+	}
+
+	return allocateCaptures(replay);
+}
+
+/****************************************************************************
+* openBlockRaw
+*
+* Cuts the records of a raw block_binary.txt into the captures its run
+* describes; the settings come from its header.
+****************************************************************************/
+static int16_t openBlockRaw(REPLAY * replay)
+{
+	uint64_t count;
+
+	replay->raw = waveReaderBlockRaw(replay->reader, &count);
+	waveReaderRun(replay->reader, 0, &replay->run);
+
+	if (replay->run.samplesPerRecord == 0 || count < replay->run.samplesPerRecord)
+	{
+		printf("replayOpen: %s holds %llu samples, not one capture of %u\n", replay->path, (unsigned long long) count,
+					replay->run.samplesPerRecord);
+		return 0;
+	}
+
+	if (waveReaderTruncated(replay->reader) > 0)
+	{
+		printf("replayOpen: %s is truncated, the partial record at its end is ignored\n", replay->path);
+	}
+
+	replay->kind = REPLAY_CAPTURES;
+	replay->records = (uint32_t)(count / replay->run.samplesPerRecord);
+	replay->end = replay->records;
+	replay->maxSamples = replay->run.samplesPerRecord;
+	replay->inPlace = 0;
+	// Only channels A and B are kept in block_binary.txt
+	replay->run.channelMask &= 3;
+
+	return allocateCaptures(replay);
+}
+
+/****************************************************************************
+* openContainer
+*
+* Picks the run and the span of the index holding its sample chunks.
+****************************************************************************/
+static int16_t openContainer(REPLAY * replay, uint32_t run)
+{
+	uint64_t entries;
+	uint64_t i;
+	uint32_t segment = 0;
+	uint16_t type;
+	uint16_t ch;
+
+	replay->index = waveReaderIndex(replay->reader, &entries);
+
+	if (run == REPLAY_LAST_RUN)
+	{
+		for (i = 0, run = 0; i < entries; i++)
+		{
+			if (replay->index[i].type == WAVE_CHUNK_RUN && replay->index[i].run >= run)
+			{
+				run = replay->index[i].run;
+			}
+		}
+	}
+
+	if (waveReaderRun(replay->reader, run, &replay->run) < 0)
+	{
+		printf("replayOpen: %s has no run %u\n", replay->path, run);
+		return 0;
+	}
+
+	replay->runNumber = run;
+
+	// The index is sorted by run then type, so the chunks of the run are together
+	for (i = 0; i < entries && (replay->index[i].run != run ||
+			(replay->index[i].type != WAVE_CHUNK_STREAM && replay->index[i].type != WAVE_CHUNK_CAPTURE)); i++)
+	{
+	}
+
+	if (i == entries)
+	{
+		printf("replayOpen: run %u of %s holds no samples\n", run, replay->path);
+		return 0;
+	}
+
+	type = replay->index[i].type;
+	replay->kind = type == WAVE_CHUNK_STREAM ? REPLAY_STREAM : REPLAY_CAPTURES;
+	replay->position = i;
+	replay->inPlace = 1;
+
+	for (; i < entries && replay->index[i].run == run && replay->index[i].type == type; i++)
+	{
+		if (replay->records == 0 || replay->index[i].segment != segment)
+		{
+			segment = replay->index[i].segment;
+			replay->records++;
+		}
+
+		if (replay->index[i].nSamples > replay->maxSamples)
+		{
+			replay->maxSamples = replay->index[i].nSamples;
+		}
+
+		if (replay->index[i].flags & WAVE_CHUNK_COMPRESSED)
+		{
+			replay->inPlace = 0;
+		}
+	}
+
+	replay->end = i;
+
+	for (ch = 0; ch < WAVE_MAX_CHANNELS && !replay->inPlace; ch++)
+	{
+		if ((replay->run.channelMask >> ch) & 1 &&
+			(replay->scratch[ch] = (int16_t *) malloc(replay->maxSamples * sizeof(int16_t))) == NULL)
+		{
+			printf("replayOpen: no memory to decode the chunks\n");
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+REPLAY * replayOpen(const char * path, uint32_t run, uint32_t captureSamples)
+{
+	REPLAY * replay = (REPLAY *) calloc(1, sizeof(REPLAY));
+	int16_t opened;
+
+	if (replay == NULL)
+	{
+		return NULL;
+	}
+
+	strncpy(replay->path, path, sizeof(replay->path) - 1);
+
+	if ((replay->reader = waveReaderOpen(path)) == NULL || stat(path, &replay->source) != 0)
+	{
+		printf("replayOpen: cannot read %s as a waveform or block_binary.txt file\n", path);
+		replayClose(replay);
+		return NULL;
+	}
+
+	switch (waveReaderKind(replay->reader))
+	{
+		case WAVE_KIND_BLOCK_BINARY:
+			opened = openBinary(replay, captureSamples);
+			break;
+		case WAVE_KIND_BLOCK_RAW:
+			opened = openBlockRaw(replay);
+			break;
+		default:
+			opened = openContainer(replay, run);
+			break;
+	}
+
+	if (!opened)
+	{
+		replayClose(replay);
+		return NULL;
+	}
+
+	return replay;
+}
+
+void replayClose(REPLAY * replay)
+{
+	uint16_t ch;
+
+	if (replay == NULL)
+	{
+		return;
+	}
+
+	for (ch = 0; ch < WAVE_MAX_CHANNELS; ch++)
+	{
+		free(replay->scratch[ch]);
+	}
+
+	waveReaderClose(replay->reader);
+	free(replay);
+}
+
+REPLAY_KIND replayKind(const REPLAY * replay)
+{
+	return replay->kind;
+}
+
+const WAVE_RUN * replayRun(const REPLAY * replay)
+{
+	return &replay->run;
+}
+
+uint32_t replayRunNumber(const REPLAY * replay)
+{
+	return replay->runNumber;
+}
+
+uint32_t replayRecords(const REPLAY * replay)
+{
+	return replay->records;
+}
+
+uint32_t replayMaxSamples(const REPLAY * replay)
+{
+	return replay->maxSamples;
+}
+
+int16_t replayInPlace(const REPLAY * replay)
+{
+	return replay->inPlace;
+}
+
+int16_t replaySource(const REPLAY * replay, const char * path)
+{
+	struct stat other;
+
+	if (stat(path, &other) != 0)
+	{
+		return 0;
+	}
+
+#ifdef _WIN32
+	// No inode numbers, compare the names
+	return _stricmp(path, replay->path) == 0;
+#else
+	return other.st_dev == replay->source.st_dev && other.st_ino == replay->source.st_ino;
+#endif
+}
+
+/****************************************************************************
+* nextChunks
+*
+* Gathers the chunks of the next segment of a waveform run.
+****************************************************************************/
+static int16_t nextChunks(REPLAY * replay)
+{
+	REPLAY_RECORD * record = &replay->record;
+	WAVE_CHUNK chunk;
+	WAVE_SPAN span;
+	uint64_t i = replay->position;
+
+	record->segment = replay->index[i].segment;
+	record->nSamples = 0;
+
+	for (; i < replay->end && replay->index[i].segment == record->segment; i++)
+	{
+		uint16_t ch = replay->index[i].channel;
+
+		if (ch >= WAVE_MAX_CHANNELS || !((replay->run.channelMask >> ch) & 1))
+		{
+			continue;
+		}
+
+		if (waveReaderChunk(replay->reader, i, &chunk) < 0 || waveReaderSamples(replay->reader, i, replay->scratch[ch], &span) < 0)
+		{
+			printf("replayNext: chunk %llu of %s is damaged, the replay stops there\n", (unsigned long long) i, replay->path);
+			return 0;
+		}
+
+		// The channels of a segment were written together, they share their timing
+		record->firstSample = chunk.firstSample;
+		record->triggerIndex = chunk.triggerIndex;
+		record->flags |= chunk.flags & (WAVE_CHUNK_TRIGGERED | WAVE_CHUNK_TIME_RESET);
+		record->overflow |= chunk.flags & WAVE_CHUNK_OVERFLOW ? 1 << ch : 0;
+		record->samples[ch] = span.samples;
+		record->nSamples = record->nSamples == 0 || span.nSamples < record->nSamples ? span.nSamples : record->nSamples;
+	}
+
+	replay->position = i;
+	return record->nSamples > 0;
+}
+
+/****************************************************************************
+* nextCapture
+*
+* Splits the next capture of block_binary.txt into its channels.
+****************************************************************************/
+static int16_t nextCapture(REPLAY * replay)
+{
+	REPLAY_RECORD * record = &replay->record;
+	uint64_t first = replay->position * replay->run.samplesPerRecord;
+	uint32_t i;
+
+	for (i = 0; i < replay->run.samplesPerRecord && replay->raw != NULL; i++)
+	{
+		replay->scratch[0][i] = replay->raw[first + i].adcA;
+		replay->scratch[1][i] = replay->raw[first + i].adcB;
+	}
+
+	for (i = 0; i < replay->run.samplesPerRecord && replay->binary != NULL; i++)
+	{
+		replay->scratch[0][i] = (int16_t) replay->binary[first + i].adcA;
+		replay->scratch[1][i] = (int16_t) replay->binary[first + i].adcB;
+	}
+
+	// No time stamps were kept, the captures are taken to be back to back
+	record->segment = (uint32_t) replay->position;
+	record->firstSample = replay->position * replay->run.samplesPerRecord;
+	record->nSamples = replay->run.samplesPerRecord;
+	record->triggerIndex = WAVE_NO_TRIGGER;
+	record->samples[0] = replay->run.channelMask & 1 ? replay->scratch[0] : NULL;
+	record->samples[1] = replay->run.channelMask & 2 ? replay->scratch[1] : NULL;
+
+	replay->position++;
+	return 1;
+}
+
+/****************************************************************************
+* pace
+*
+* Waits until the end of the record is due at the original sample rate. A
+* time stamp that goes back (a counter reset) counts as back to back.
+****************************************************************************/
+static void pace(REPLAY * replay)
+{
+	REPLAY_RECORD * record = &replay->record;
+	uint64_t dueNs;
+	uint64_t now;
+
+	if (replay->startNs == 0)
+	{
+		replay->startNs = perfNow();
+	}
+	else if ((record->flags & WAVE_CHUNK_TIME_RESET) || record->firstSample < replay->lastSample)
+	{
+		replay->elapsed += replay->lastSamples;
+	}
+	else
+	{
+		replay->elapsed += record->firstSample - replay->lastSample;
+	}
+
+	replay->lastSample = record->firstSample;
+	replay->lastSamples = record->nSamples;
+
+	dueNs = replay->startNs + (uint64_t)((double)(replay->elapsed + record->nSamples) * replay->run.sampleIntervalNs);
+
+	while ((now = perfNow()) < dueNs)
+	{
+#ifdef _WIN32
+		Sleep((DWORD)((dueNs - now) / 1000000));
+#else
+		struct timespec pause;
+
+		pause.tv_sec = (time_t)((dueNs - now) / 1000000000ULL);
+		pause.tv_nsec = (long)((dueNs - now) % 1000000000ULL);
+		nanosleep(&pause, NULL);
+#endif
+	}
+}
+
+const REPLAY_RECORD * replayNext(REPLAY * replay, int16_t paced)
+{
+	int16_t ok;
+
+	if (replay->position >= replay->end)
+	{
+		return NULL;
+	}
+
+	memset(&replay->record, 0, sizeof(REPLAY_RECORD));
+
+	ok = replay->binary != NULL || replay->raw != NULL ? nextCapture(replay) : nextChunks(replay);
+
+	if (!ok)
+	{
+		replay->position = replay->end;
+		return NULL;
+	}
+
+	if (paced)
+	{
+		pace(replay);
+	}
+
+	return &replay->record;
+}
@@ -0,0 +1,86 @@
+/*******************************************************************************
+ *
+ * Filename: replay.h
+ *
+ * Description:
+ *   Recorded acquisitions played back as a data source, so that the
+ *   processing stages can be run and timed without a scope attached.
+ *
+ *   The source is one run of a waveform file (stream_wave.bin or
+ *   block_wave.bin, read through waveReader.h so the samples come straight
+ *   from the mapping) or the records of block_binary.txt cut into captures.
+ *   It is handed out one record at a time: a streaming callback or a capture,
+ *   with the samples of every channel recorded.
+ *
+ *   Paced, each record is held back until it would have arrived at the
+ *   original sample rate, counted from the first; otherwise the records come
+ *   as fast as they are asked for.
+ *
+ ******************************************************************************/
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+
+#include "waveFormat.h"
+
+#define REPLAY_LAST_RUN		0xFFFFFFFFu
+
+typedef enum
+{
+	REPLAY_STREAM,
+	REPLAY_CAPTURES
+} REPLAY_KIND;
+
+typedef struct
+{
+	uint32_t		segment;					// streaming callback or capture number
+	uint64_t		firstSample;				// absolute index (streaming) or trigger time stamp counter
+	uint32_t		nSamples;
+	uint32_t		triggerIndex;				// WAVE_NO_TRIGGER if none
+	uint32_t		flags;						// WAVE_CHUNK_TRIGGERED and WAVE_CHUNK_TIME_RESET
+	uint16_t		overflow;					// one bit per channel
+	const int16_t *	samples[WAVE_MAX_CHANNELS];	// NULL for the channels not recorded
+} REPLAY_RECORD;
+
+typedef struct tReplay REPLAY;
+
+/*
+ * Opens 'run' of a waveform file (REPLAY_LAST_RUN for the last one), or a
+ * block_binary.txt file cut into captures of 'captureSamples'. The range of
+ * each channel of block_binary.txt is worked out from its mV column, unless
+ * it holds raw counts: then its header gives the settings and the capture
+ * size, and 'captureSamples' is not used. Prints why and returns NULL if
+ * there is nothing to replay.
+ */
+REPLAY * replayOpen(const char * path, uint32_t run, uint32_t captureSamples);
+void replayClose(REPLAY * replay);
+
+REPLAY_KIND replayKind(const REPLAY * replay);
+
+/* Settings of the run; for block_binary.txt with mV, as far as they can be told from the file */
+const WAVE_RUN * replayRun(const REPLAY * replay);
+
+/* Run number actually opened (0 for block_binary.txt) */
+uint32_t replayRunNumber(const REPLAY * replay);
+
+uint32_t replayRecords(const REPLAY * replay);
+
+/* Longest record, in samples */
+uint32_t replayMaxSamples(const REPLAY * replay);
+
+/* 1 if the samples handed out point into the mapping and stay valid until replayClose() */
+int16_t replayInPlace(const REPLAY * replay);
+
+/* 1 if 'path' names the file being replayed */
+int16_t replaySource(const REPLAY * replay, const char * path);
+
+/*
+ * Next record, NULL at the end or if the file is damaged. Unless in place,
+ * the samples are valid until the next call. Paced, waits until the record
+ * is due.
+ */
+const REPLAY_RECORD * replayNext(REPLAY * replay, int16_t paced);
+
+#endif
@@ -0,0 +1,458 @@
+/*******************************************************************************
+ *
+ * Filename: softTrigger.c
+ *
+ * Description:
+ *   Software trigger engine, see softTrigger.h.
+ *
+ *   Every condition is reduced to two ranges of the per-sample value (the
+ *   sample itself, or x[n] - x[n - span] for slopes): a range that sets the
+ *   channel state and one that clears it, each possibly inverted (outside
+ *   the range). Samples in neither keep the state, which is the hysteresis.
+ *   A group of samples can only change a channel's state if it holds a
+ *   sample of the opposite range, which is what the vector pass looks for.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "softTrigger.h"
+#include "lanes.h"
+
+typedef struct
+{
+	int32_t		low;
+	int32_t		high;
+	int32_t		invert;				// true outside [low, high]
+} RANGE;
+
+typedef struct
+{
+	int32_t		used;
+	int32_t		slope;
+	uint32_t	span;
+	RANGE		set;
+	RANGE		clear;
+	int32_t		state;
+	int16_t *	work;				// span previous samples, then the current block (slopes)
+	uint32_t	workSize;
+	int32_t *	values;				// per-sample value of the current block
+	uint32_t	valuesSize;
+} CHANNEL;
+
+struct tTriggerEngine
+{
+	TRIG_SETUP	setup;
+	CHANNEL		channels[TRIG_CHANNELS];
+	int32_t		primed;				// states taken from a first sample since the reset
+	int32_t		active;				// in a pulse of the combined condition
+	int32_t		fired;				// the current pulse has triggered
+	uint64_t	pulseStart;
+	uint64_t	holdoffEnd;			// first sample that can trigger again
+	uint64_t	next;				// index of the next sample
+	uint64_t *	triggers;
+	uint32_t	triggerSize;
+	uint32_t	triggerCount;
+};
+
+#define INT16_LOW		(-32768)
+#define INT16_HIGH		32767
+#define SLOPE_LOW		(-65536)
+#define SLOPE_HIGH		65536
+
+static RANGE range(int32_t low, int32_t high, int32_t invert)
+{
+	RANGE r;
+
+	r.low = low;
+	r.high = high;
+	r.invert = invert;
+	return r;
+}
+
+static int32_t inRange(const RANGE * r, int32_t value)
+{
+	return (value >= r->low && value <= r->high) != r->invert;
+}
+
+/****************************************************************************
+* Setup
+****************************************************************************/
+static void setupChannel(CHANNEL * channel, const TRIG_CONDITION * condition)
+{
+	int32_t h = condition->hysteresis < 0 ? 0 : condition->hysteresis;
+	int32_t upper = condition->upper;
+	int32_t lower = condition->lower;
+
+	memset(channel, 0, sizeof(CHANNEL));
+	channel->used = condition->type != TRIG_NONE;
+
+	switch (condition->type)
+	{
+		case TRIG_ABOVE:
+			channel->set = range(upper + 1, INT16_HIGH, 0);
+			channel->clear = range(INT16_LOW, upper - h - 1, 0);
+			break;
+
+		case TRIG_BELOW:
+			channel->set = range(INT16_LOW, lower - 1, 0);
+			channel->clear = range(lower + h + 1, INT16_HIGH, 0);
+			break;
+
+		case TRIG_INSIDE:
+			channel->set = range(lower, upper, 0);
+			channel->clear = range(lower - h, upper + h, 1);
+			break;
+
+		case TRIG_OUTSIDE:
+			channel->set = range(lower, upper, 1);
+			channel->clear = range(lower + h, upper - h, 0);
+			break;
+
+		case TRIG_SLOPE_RISING:
+			channel->slope = 1;
+			channel->set = range(condition->rate, SLOPE_HIGH, 0);
+			channel->clear = range(SLOPE_LOW, condition->rate - 1, 0);
+			break;
+
+		case TRIG_SLOPE_FALLING:
+			channel->slope = 1;
+			channel->set = range(SLOPE_LOW, -condition->rate, 0);
+			channel->clear = range(-condition->rate + 1, SLOPE_HIGH, 0);
+			break;
+
+		default:
+			break;
+	}
+
+	if (channel->slope)
+	{
+		channel->span = condition->span < 1 ? 1 : condition->span > TRIG_MAX_SPAN ? TRIG_MAX_SPAN : condition->span;
+	}
+}
+
+TRIGGER_ENGINE * triggerCreate(const TRIG_SETUP * setup)
+{
+	TRIGGER_ENGINE * engine;
+	int32_t ch, used = 0;
+
+	for (ch = 0; ch < TRIG_CHANNELS; ch++)
+	{
+		used += setup->channels[ch].type != TRIG_NONE;
+	}
+
+	if (used == 0 || (engine = (TRIGGER_ENGINE *) calloc(1, sizeof(TRIGGER_ENGINE))) == NULL)
+	{
+		return NULL;
+	}
+
+	engine->setup = *setup;
+
+	for (ch = 0; ch < TRIG_CHANNELS; ch++)
+	{
+		setupChannel(&engine->channels[ch], &setup->channels[ch]);
+	}
+
+	triggerReset(engine, 0);
+	return engine;
+}
+
+void triggerDestroy(TRIGGER_ENGINE * engine)
+{
+	int32_t ch;
+
+	if (engine == NULL)
+	{
+		return;
+	}
+
+	for (ch = 0; ch < TRIG_CHANNELS; ch++)
+	{
+		free(engine->channels[ch].work);
+		free(engine->channels[ch].values);
+	}
+
+	free(engine->triggers);
+	free(engine);
+}
+
+void triggerReset(TRIGGER_ENGINE * engine, uint64_t firstSample)
+{
+	int32_t ch;
+
+	for (ch = 0; ch < TRIG_CHANNELS; ch++)
+	{
+		engine->channels[ch].state = 0;
+	}
+
+	engine->primed = 0;
+	engine->active = 0;
+	engine->fired = 0;
+	engine->holdoffEnd = 0;
+	engine->next = firstSample;
+}
+
+/****************************************************************************
+* Scan
+****************************************************************************/
+static int32_t grow(void ** buffer, uint32_t * size, uint32_t needed, size_t element)
+{
+	void * bigger;
+
+	if (needed <= *size)
+	{
+		return 0;
+	}
+
+	if ((bigger = realloc(*buffer, needed * element)) == NULL)
+	{
+		return -1;
+	}
+
+	*buffer = bigger;
+	*size = needed;
+	return 0;
+}
+
+/* The per-sample values of a block: the samples, or the slope over 'span' samples */
+static int32_t prepare(CHANNEL * channel, const int16_t * samples, uint32_t count, int32_t primed)
+{
+	uint32_t whole = WHOLE_LANES(count, TRIG_LANES);
+	uint32_t span = channel->span;
+	int32_t * values;
+	int16_t * work;
+	uint32_t n, j;
+
+	if (grow((void **) &channel->values, &channel->valuesSize, count + TRIG_LANES, sizeof(int32_t)) != 0 ||
+		(channel->slope && grow((void **) &channel->work, &channel->workSize, span + count, sizeof(int16_t)) != 0))
+	{
+		return -1;
+	}
+
+	values = channel->values;
+	work = channel->work;
+
+	if (!channel->slope)
+	{
+		for (n = 0; n < whole; n += TRIG_LANES)
+		{
+			for (j = 0; j < TRIG_LANES; j++)
+			{
+				values[n + j] = samples[n + j];
+			}
+		}
+
+		for (n = whole; n < count; n++)
+		{
+			values[n] = samples[n];
+		}
+
+		return 0;
+	}
+
+	// After a reset the first sample stands in for the ones before it, so there is no false slope
+	if (!primed)
+	{
+		for (n = 0; n < span; n++)
+		{
+			work[n] = samples[0];
+		}
+	}
+
+	memcpy(work + span, samples, count * sizeof(int16_t));
+
+	for (n = 0; n < whole; n += TRIG_LANES)
+	{
+		const int16_t * now = work + span + n;
+		const int16_t * before = work + n;
+
+		for (j = 0; j < TRIG_LANES; j++)
+		{
+			values[n + j] = (int32_t) now[j] - before[j];
+		}
+	}
+
+	for (n = whole; n < count; n++)
+	{
+		values[n] = (int32_t) work[span + n] - work[n];
+	}
+
+	// Keep the last span samples in front for the next block
+	memmove(work, work + count, span * sizeof(int16_t));
+	return 0;
+}
+
+/* Whether any of the TRIG_LANES values can take the channel out of its state */
+static int32_t canChange(const CHANNEL * channel, const int32_t * values)
+{
+	const RANGE * r = channel->state ? &channel->clear : &channel->set;
+	int32_t hits = 0;
+	uint32_t j;
+
+	for (j = 0; j < TRIG_LANES; j++)
+	{
+		hits |= ((values[j] >= r->low) & (values[j] <= r->high)) ^ r->invert;
+	}
+
+	return hits;
+}
+
+static void fire(TRIGGER_ENGINE * engine, uint64_t index)
+{
+	engine->fired = 1;
+
+	if (index < engine->holdoffEnd)
+	{
+		return;
+	}
+
+	if (engine->triggerCount == engine->triggerSize &&
+		grow((void **) &engine->triggers, &engine->triggerSize, engine->triggerSize ? engine->triggerSize * 2 : 64, sizeof(uint64_t)) != 0)
+	{
+		return;
+	}
+
+	engine->triggers[engine->triggerCount++] = index;
+	engine->holdoffEnd = index + engine->setup.holdoff + 1;
+}
+
+/* One sample: channel states, combined condition, pulse qualification */
+static void step(TRIGGER_ENGINE * engine, uint32_t n)
+{
+	const TRIG_SETUP * setup = &engine->setup;
+	uint64_t index = engine->next + n;
+	int32_t combined = setup->logic == TRIG_AND;
+	int32_t ch;
+
+	for (ch = 0; ch < TRIG_CHANNELS; ch++)
+	{
+		CHANNEL * channel = &engine->channels[ch];
+
+		if (!channel->used)
+		{
+			continue;
+		}
+
+		if (channel->state ? inRange(&channel->clear, channel->values[n]) : inRange(&channel->set, channel->values[n]))
+		{
+			channel->state = !channel->state;
+		}
+
+		combined = setup->logic == TRIG_AND ? combined && channel->state : combined || channel->state;
+	}
+
+	// A pulse already there at the first sample has no start edge, it does not trigger
+	if (!engine->primed)
+	{
+		engine->primed = 1;
+		engine->active = combined;
+		engine->fired = 1;
+		return;
+	}
+
+	if (combined && !engine->active)
+	{
+		engine->active = 1;
+		engine->fired = 0;
+		engine->pulseStart = index;
+
+		if (setup->minWidth == 0 && setup->maxWidth == 0)
+		{
+			fire(engine, index);
+		}
+	}
+
+	if (engine->active && combined && !engine->fired && setup->minWidth > 0 && setup->maxWidth == 0 &&
+		index - engine->pulseStart + 1 >= setup->minWidth)
+	{
+		fire(engine, index);
+	}
+
+	if (engine->active && !combined)
+	{
+		uint64_t width = index - engine->pulseStart;
+
+		engine->active = 0;
+
+		if (!engine->fired && setup->maxWidth > 0 && width >= setup->minWidth && width <= setup->maxWidth)
+		{
+			fire(engine, index);
+		}
+	}
+}
+
+uint32_t triggerScan(TRIGGER_ENGINE * engine, const int16_t * const * samples, uint32_t count, const uint64_t ** triggers)
+{
+	const TRIG_SETUP * setup = &engine->setup;
+	uint32_t whole = WHOLE_LANES(count, TRIG_LANES);
+	uint32_t n, j;
+	int32_t ch;
+
+	engine->triggerCount = 0;
+	*triggers = engine->triggers;
+
+	for (ch = 0; ch < TRIG_CHANNELS; ch++)
+	{
+		if (engine->channels[ch].used && (samples[ch] == NULL || prepare(&engine->channels[ch], samples[ch], count, engine->primed) != 0))
+		{
+			engine->next += count;
+			return 0;
+		}
+	}
+
+	for (n = 0; n < count; n += TRIG_LANES)
+	{
+		int32_t quiet = n < whole && engine->primed;
+
+		for (ch = 0; ch < TRIG_CHANNELS && quiet; ch++)
+		{
+			quiet = !engine->channels[ch].used || !canChange(&engine->channels[ch], engine->channels[ch].values + n);
+		}
+
+		// A pulse reaching its minimum width inside the group also needs the sample by sample pass
+		if (quiet && engine->active && !engine->fired && setup->minWidth > 0 && setup->maxWidth == 0 &&
+			engine->pulseStart + setup->minWidth <= engine->next + n + TRIG_LANES)
+		{
+			quiet = 0;
+		}
+
+		if (!quiet)
+		{
+			for (j = n; j < n + TRIG_LANES && j < count; j++)
+			{
+				step(engine, j);
+			}
+		}
+	}
+
+	engine->next += count;
+	*triggers = engine->triggers;
+	return engine->triggerCount;
+}
+
+const char * triggerTypeName(TRIG_TYPE type)
+{
+	switch (type)
+	{
+		case TRIG_ABOVE:
+			return "above";
+		case TRIG_BELOW:
+			return "below";
+		case TRIG_INSIDE:
+			return "inside window";
+		case TRIG_OUTSIDE:
+			return "outside window";
+		case TRIG_SLOPE_RISING:
+			return "slope rising";
+		case TRIG_SLOPE_FALLING:
+			return "slope falling";
+		default:
+			return "none";
+	}
+}
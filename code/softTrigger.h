@@ -0,0 +1,91 @@
+/*******************************************************************************
+ *
+ * Filename: softTrigger.h
+ *
+ * Description:
+ *   Host-side trigger engine run on the streamed samples, block after block.
+ *
+ *   Each channel has a condition on its ADC counts:
+ *
+ *	 TRIG_ABOVE / TRIG_BELOW	level with hysteresis
+ *	 TRIG_INSIDE / TRIG_OUTSIDE	window between 'lower' and 'upper', with hysteresis
+ *	 TRIG_SLOPE_RISING / _FALLING	x[n] - x[n - span] at least 'rate' counts up / down
+ *
+ *   The conditions of the channels in use are combined with AND or OR. A
+ *   trigger is the start of a pulse of the combined condition; with a pulse
+ *   width qualifier it is the sample where the pulse has lasted minWidth
+ *   samples, or, when maxWidth is set, the end of a pulse of minWidth to
+ *   maxWidth samples. After a trigger, none is taken for 'holdoff' samples.
+ *
+ *   The scan goes through groups of TRIG_LANES samples (see lanes.h); a group
+ *   where no condition can change state is skipped in one step, and only
+ *   groups with an edge are followed sample by sample. State is kept between
+ *   calls, so triggers spanning two blocks are found.
+ *
+ ******************************************************************************/
+
+#ifndef SOFT_TRIGGER_H
+#define SOFT_TRIGGER_H
+
+#include <stdint.h>
+
+#define TRIG_CHANNELS		4
+#define TRIG_LANES			16
+#define TRIG_MAX_SPAN		1024
+
+typedef enum
+{
+	TRIG_NONE,
+	TRIG_ABOVE,
+	TRIG_BELOW,
+	TRIG_INSIDE,
+	TRIG_OUTSIDE,
+	TRIG_SLOPE_RISING,
+	TRIG_SLOPE_FALLING
+} TRIG_TYPE;
+
+typedef enum
+{
+	TRIG_AND,
+	TRIG_OR
+} TRIG_LOGIC;
+
+/* Thresholds in ADC counts */
+typedef struct
+{
+	TRIG_TYPE	type;
+	int32_t		upper;
+	int32_t		lower;
+	int32_t		hysteresis;
+	int32_t		rate;				// slope conditions
+	uint32_t	span;				// slope conditions, samples (1..TRIG_MAX_SPAN)
+} TRIG_CONDITION;
+
+typedef struct
+{
+	TRIG_CONDITION	channels[TRIG_CHANNELS];
+	TRIG_LOGIC		logic;
+	uint32_t		minWidth;		// samples, 0 for no qualifier
+	uint32_t		maxWidth;		// samples, 0 for no upper bound
+	uint32_t		holdoff;		// samples
+} TRIG_SETUP;
+
+typedef struct tTriggerEngine TRIGGER_ENGINE;
+
+/* NULL when no channel has a condition */
+TRIGGER_ENGINE * triggerCreate(const TRIG_SETUP * setup);
+void triggerDestroy(TRIGGER_ENGINE * engine);
+
+/* Clears the state, the next sample scanned has index 'firstSample' */
+void triggerReset(TRIGGER_ENGINE * engine, uint64_t firstSample);
+
+/*
+ * Scans 'count' samples of every channel (samples[ch] may be NULL for the
+ * channels without a condition). Returns the number of triggers and points
+ * 'triggers' at their sample indices, valid until the next call.
+ */
+uint32_t triggerScan(TRIGGER_ENGINE * engine, const int16_t * const * samples, uint32_t count, const uint64_t ** triggers);
+
+const char * triggerTypeName(TRIG_TYPE type);
+
+#endif
@@ -0,0 +1,398 @@
+/*******************************************************************************
+ *
+ * Filename: waveCodec.c
+ *
+ * Description:
+ *   Block predictive coder with bit-packed residuals, see waveCodec.h.
+ *
+ *   Block layout (little endian):
+ *
+ *		uint16	number of samples
+ *		uint8	predictor (bits 0-1: 0 verbatim, 1 delta, 2 linear), shift (bits 4-7)
+ *		uint8	reserved
+ *		verbatim:	int16 samples[n]
+ *		otherwise:	int16 warm-up samples[order], uint8 widths[groups], packed residuals
+ *
+ ******************************************************************************/
+
+#include <string.h>
+
+#include "waveCodec.h"
+
+#define CODEC_VERBATIM		0
+#define CODEC_DELTA			1
+#define CODEC_LINEAR		2
+#define CODEC_BLOCK_HEADER	4
+#define CODEC_MAX_WIDTH		18
+
+static inline uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t) v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u)
+{
+	return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+static inline uint32_t bitWidth(uint32_t v)
+{
+	return v == 0 ? 0 : 32 - (uint32_t) __builtin_clz(v);
+}
+
+/* Fills one width per group, returns the total number of packed bits */
+static uint64_t groupWidths(const uint32_t * residuals, uint32_t count, uint8_t * widths)
+{
+	uint64_t total = 0;
+	uint32_t g, i, start;
+
+	for (g = 0, start = 0; start < count; g++, start += WAVE_CODEC_GROUP)
+	{
+		uint32_t end = start + WAVE_CODEC_GROUP < count ? start + WAVE_CODEC_GROUP : count;
+		uint32_t bits = 0;
+
+		for (i = start; i < end; i++)
+		{
+			bits |= residuals[i];
+		}
+
+		widths[g] = (uint8_t) bitWidth(bits);
+		total += (uint64_t) widths[g] * (end - start);
+	}
+
+	return total;
+}
+
+static uint8_t * packBits(const uint32_t * residuals, uint32_t count, const uint8_t * widths, uint8_t * out)
+{
+	uint64_t accumulator = 0;
+	uint32_t bits = 0;
+	uint32_t g, i, start;
+
+	for (g = 0, start = 0; start < count; g++, start += WAVE_CODEC_GROUP)
+	{
+		uint32_t end = start + WAVE_CODEC_GROUP < count ? start + WAVE_CODEC_GROUP : count;
+		uint32_t width = widths[g];
+
+		if (width == 0)
+		{
+			continue;
+		}
+
+		for (i = start; i < end; i++)
+		{
+			accumulator |= (uint64_t) residuals[i] << bits;
+			bits += width;
+
+			if (bits >= 32)
+			{
+				out[0] = (uint8_t) accumulator;
+				out[1] = (uint8_t)(accumulator >> 8);
+				out[2] = (uint8_t)(accumulator >> 16);
+				out[3] = (uint8_t)(accumulator >> 24);
+				out += 4;
+				accumulator >>= 32;
+				bits -= 32;
+			}
+		}
+	}
+
+	while (bits > 0)
+	{
+		*out++ = (uint8_t) accumulator;
+		accumulator >>= 8;
+		bits = bits > 8 ? bits - 8 : 0;
+	}
+
+	return out;
+}
+
+static size_t encodeBlock(const int16_t * samples, uint32_t n, uint8_t * out)
+{
+	int32_t values[WAVE_CODEC_BLOCK];
+	uint32_t delta[WAVE_CODEC_BLOCK];
+	uint32_t linear[WAVE_CODEC_BLOCK];
+	uint8_t deltaWidths[WAVE_CODEC_BLOCK / WAVE_CODEC_GROUP + 1];
+	uint8_t linearWidths[WAVE_CODEC_BLOCK / WAVE_CODEC_GROUP + 1];
+	size_t verbatimSize = CODEC_BLOCK_HEADER + 2 * (size_t) n;
+	size_t deltaSize, linearSize = (size_t) -1;
+	uint16_t used = 0;
+	uint32_t shift = 0, order, groups, i;
+	const uint32_t * residuals;
+	const uint8_t * widths;
+	uint8_t * p;
+
+	for (i = 0; i < n; i++)
+	{
+		used |= (uint16_t) samples[i];
+	}
+
+	// Low bits that are zero in every sample carry no information
+	if (used != 0)
+	{
+		shift = (uint32_t) __builtin_ctz(used);
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		values[i] = samples[i] >> shift;
+	}
+
+	for (i = 1; i < n; i++)
+	{
+		delta[i] = zigzag(values[i] - values[i - 1]);
+	}
+
+	for (i = 2; i < n; i++)
+	{
+		linear[i] = zigzag(values[i] - 2 * values[i - 1] + values[i - 2]);
+	}
+
+	groups = (n - 1 + WAVE_CODEC_GROUP - 1) / WAVE_CODEC_GROUP;
+	deltaSize = CODEC_BLOCK_HEADER + 2 + groups + (size_t)((groupWidths(delta + 1, n - 1, deltaWidths) + 7) / 8);
+
+	if (n > 2)
+	{
+		groups = (n - 2 + WAVE_CODEC_GROUP - 1) / WAVE_CODEC_GROUP;
+		linearSize = CODEC_BLOCK_HEADER + 4 + groups + (size_t)((groupWidths(linear + 2, n - 2, linearWidths) + 7) / 8);
+	}
+
+	out[0] = (uint8_t) n;
+	out[1] = (uint8_t)(n >> 8);
+	out[3] = 0;
+
+	if (verbatimSize <= deltaSize && verbatimSize <= linearSize)
+	{
+		out[2] = CODEC_VERBATIM;
+
+		for (i = 0; i < n; i++)
+		{
+			out[CODEC_BLOCK_HEADER + 2 * i] = (uint8_t) samples[i];
+			out[CODEC_BLOCK_HEADER + 2 * i + 1] = (uint8_t)((uint16_t) samples[i] >> 8);
+		}
+
+		return verbatimSize;
+	}
+
+	if (linearSize < deltaSize)
+	{
+		out[2] = (uint8_t)(CODEC_LINEAR | (shift << 4));
+		order = 2;
+		residuals = linear;
+		widths = linearWidths;
+	}
+	else
+	{
+		out[2] = (uint8_t)(CODEC_DELTA | (shift << 4));
+		order = 1;
+		residuals = delta;
+		widths = deltaWidths;
+	}
+
+	p = out + CODEC_BLOCK_HEADER;
+
+	for (i = 0; i < order; i++)
+	{
+		p[0] = (uint8_t) values[i];
+		p[1] = (uint8_t)((uint32_t) values[i] >> 8);
+		p += 2;
+	}
+
+	groups = (n - order + WAVE_CODEC_GROUP - 1) / WAVE_CODEC_GROUP;
+	memcpy(p, widths, groups);
+	p += groups;
+	p = packBits(residuals + order, n - order, widths, p);
+
+	return (size_t)(p - out);
+}
+
+size_t waveEncodeBound(uint32_t n)
+{
+	return ((size_t) n + WAVE_CODEC_BLOCK - 1) / WAVE_CODEC_BLOCK * CODEC_BLOCK_HEADER + 2 * (size_t) n;
+}
+
+size_t waveEncode(const int16_t * samples, uint32_t n, uint8_t * out)
+{
+	size_t length = 0;
+	uint32_t done, count;
+
+	for (done = 0; done < n; done += count)
+	{
+		count = n - done < WAVE_CODEC_BLOCK ? n - done : WAVE_CODEC_BLOCK;
+		length += encodeBlock(samples + done, count, out + length);
+	}
+
+	return length;
+}
+
+/****************************************************************************
+* Decoder
+****************************************************************************/
+static int64_t decodeBlock(const uint8_t * in, size_t length, int16_t * samples, uint32_t maxSamples, size_t * used)
+{
+	uint32_t residuals[WAVE_CODEC_BLOCK];
+	uint32_t n, predictor, shift, order, groups, g, i, start;
+	uint64_t totalBits = 0, accumulator = 0;
+	uint32_t bits = 0;
+	const uint8_t * widths;
+	const uint8_t * p;
+	const uint8_t * end;
+	int32_t previous, beforePrevious;
+
+	if (length < CODEC_BLOCK_HEADER)
+	{
+		return -1;
+	}
+
+	n = (uint32_t) in[0] | ((uint32_t) in[1] << 8);
+	predictor = in[2] & 0x03;
+	shift = in[2] >> 4;
+
+	if (n == 0 || n > WAVE_CODEC_BLOCK || n > maxSamples || predictor > CODEC_LINEAR)
+	{
+		return -1;
+	}
+
+	p = in + CODEC_BLOCK_HEADER;
+
+	if (predictor == CODEC_VERBATIM)
+	{
+		if (length < CODEC_BLOCK_HEADER + 2 * (size_t) n)
+		{
+			return -1;
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			samples[i] = (int16_t)(p[2 * i] | (p[2 * i + 1] << 8));
+		}
+
+		*used = CODEC_BLOCK_HEADER + 2 * (size_t) n;
+		return n;
+	}
+
+	order = predictor;
+
+	if (n < order)
+	{
+		return -1;
+	}
+
+	groups = (n - order + WAVE_CODEC_GROUP - 1) / WAVE_CODEC_GROUP;
+
+	if (length < CODEC_BLOCK_HEADER + 2 * (size_t) order + groups)
+	{
+		return -1;
+	}
+
+	previous = (int16_t)(p[0] | (p[1] << 8));
+	beforePrevious = previous;
+
+	if (order == 2)
+	{
+		previous = (int16_t)(p[2] | (p[3] << 8));
+	}
+
+	p += 2 * order;
+	widths = p;
+	p += groups;
+
+	for (g = 0, start = 0; g < groups; g++, start += WAVE_CODEC_GROUP)
+	{
+		uint32_t count = n - order - start < WAVE_CODEC_GROUP ? n - order - start : WAVE_CODEC_GROUP;
+
+		if (widths[g] > CODEC_MAX_WIDTH)
+		{
+			return -1;
+		}
+
+		totalBits += (uint64_t) widths[g] * count;
+	}
+
+	end = p + (totalBits + 7) / 8;
+
+	if ((size_t)(end - in) > length)
+	{
+		return -1;
+	}
+
+	for (g = 0, start = 0; g < groups; g++, start += WAVE_CODEC_GROUP)
+	{
+		uint32_t count = n - order - start < WAVE_CODEC_GROUP ? n - order - start : WAVE_CODEC_GROUP;
+		uint32_t width = widths[g];
+		uint64_t mask = ((uint64_t) 1 << width) - 1;
+
+		for (i = start; i < start + count; i++)
+		{
+			if (bits < width)
+			{
+				if (end - p >= 4)
+				{
+					accumulator |= ((uint64_t) p[0] | ((uint64_t) p[1] << 8) | ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24)) << bits;
+					p += 4;
+					bits += 32;
+				}
+				else
+				{
+					while (bits < width && p < end)
+					{
+						accumulator |= (uint64_t) *p++ << bits;
+						bits += 8;
+					}
+				}
+			}
+
+			residuals[i] = (uint32_t)(accumulator & mask);
+			accumulator >>= width;
+			bits -= width;
+		}
+	}
+
+	samples[0] = (int16_t)((uint32_t) beforePrevious << shift);
+
+	if (order == 1)
+	{
+		for (i = 1; i < n; i++)
+		{
+			previous += unzigzag(residuals[i - 1]);
+			samples[i] = (int16_t)((uint32_t) previous << shift);
+		}
+	}
+	else
+	{
+		samples[1] = (int16_t)((uint32_t) previous << shift);
+
+		for (i = 2; i < n; i++)
+		{
+			int32_t value = 2 * previous - beforePrevious + unzigzag(residuals[i - 2]);
+			beforePrevious = previous;
+			previous = value;
+			samples[i] = (int16_t)((uint32_t) value << shift);
+		}
+	}
+
+	*used = (size_t)(end - in);
+	return n;
+}
+
+int64_t waveDecode(const uint8_t * in, size_t length, int16_t * samples, uint32_t maxSamples)
+{
+	size_t offset = 0;
+	int64_t total = 0;
+
+	while (offset < length)
+	{
+		size_t used = 0;
+		int64_t n = decodeBlock(in + offset, length - offset, samples + total, maxSamples - (uint32_t) total, &used);
+
+		if (n < 0)
+		{
+			return -1;
+		}
+
+		offset += used;
+		total += n;
+	}
+
+	return total;
+}
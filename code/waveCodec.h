@@ -0,0 +1,39 @@
+/*******************************************************************************
+ *
+ * Filename: waveCodec.h
+ *
+ * Description:
+ *   Lossless codec for int16 waveform samples.
+ *
+ *   Samples are cut in blocks of up to WAVE_CODEC_BLOCK samples. In each block
+ *   the low bits that are zero in every sample (8 bit data are left justified
+ *   in the 16 bit counts) are shifted out, the samples are predicted from the
+ *   previous one (delta) or the previous two (linear), and the zig-zag coded
+ *   residuals are bit-packed in groups of WAVE_CODEC_GROUP with one width per
+ *   group. A block that would not shrink is stored verbatim.
+ *
+ *   Every block is self contained, so a payload can be decoded from any block
+ *   boundary.
+ *
+ ******************************************************************************/
+
+#ifndef WAVE_CODEC_H
+#define WAVE_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WAVE_CODEC_BLOCK	4096
+#define WAVE_CODEC_GROUP	32
+
+/* Upper bound of the encoded size of n samples */
+size_t waveEncodeBound(uint32_t n);
+
+/* Encodes n samples into 'out' (at least waveEncodeBound(n) bytes), returns the encoded size */
+size_t waveEncode(const int16_t * samples, uint32_t n, uint8_t * out);
+
+/* Decodes 'length' bytes into at most maxSamples samples.
+ * Returns the number of samples decoded, or -1 if the data are corrupt or do not fit. */
+int64_t waveDecode(const uint8_t * in, size_t length, int16_t * samples, uint32_t maxSamples);
+
+#endif
@@ -0,0 +1,113 @@
+/*******************************************************************************
+ *
+ * Filename: waveCrc.c
+ *
+ * Description:
+ *   CRC-32C, slice-by-8 tables with a hardware path on x86-64, see waveCrc.h.
+ *
+ ******************************************************************************/
+
+#include <string.h>
+
+#include "waveCrc.h"
+
+#define CRC32C_POLY	0x82F63B78u
+
+static uint32_t crcTable[8][256];
+static int32_t crcReady = 0;
+
+static void crcInit(void)
+{
+	uint32_t i, j, crc;
+
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+
+		for (j = 0; j < 8; j++)
+		{
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+		}
+
+		crcTable[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++)
+	{
+		for (j = 1; j < 8; j++)
+		{
+			crcTable[j][i] = (crcTable[j - 1][i] >> 8) ^ crcTable[0][crcTable[j - 1][i] & 0xFF];
+		}
+	}
+
+	crcReady = 1;
+}
+
+static uint32_t crcSoftware(uint32_t crc, const uint8_t * p, size_t length)
+{
+	if (!crcReady)
+	{
+		crcInit();
+	}
+
+	while (length >= 8)
+	{
+		uint32_t low = crc ^ ((uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24));
+		uint32_t high = (uint32_t) p[4] | ((uint32_t) p[5] << 8) | ((uint32_t) p[6] << 16) | ((uint32_t) p[7] << 24);
+
+		crc = crcTable[7][low & 0xFF] ^ crcTable[6][(low >> 8) & 0xFF] ^
+				crcTable[5][(low >> 16) & 0xFF] ^ crcTable[4][low >> 24] ^
+				crcTable[3][high & 0xFF] ^ crcTable[2][(high >> 8) & 0xFF] ^
+				crcTable[1][(high >> 16) & 0xFF] ^ crcTable[0][high >> 24];
+		p += 8;
+		length -= 8;
+	}
+
+	while (length-- > 0)
+	{
+		crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xFF];
+	}
+
+	return crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crcHardware(uint32_t crc, const uint8_t * p, size_t length)
+{
+	uint64_t crc64 = crc;
+
+	while (length >= 8)
+	{
+		uint64_t word;
+
+		memcpy(&word, p, sizeof(word));
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+		p += 8;
+		length -= 8;
+	}
+
+	crc = (uint32_t) crc64;
+
+	while (length-- > 0)
+	{
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+	}
+
+	return crc;
+}
+#endif
+
+uint32_t waveCrc32c(uint32_t crc, const void * data, size_t length)
+{
+	crc = ~crc;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2"))
+	{
+		return ~crcHardware(crc, (const uint8_t *) data, length);
+	}
+#endif
+
+	return ~crcSoftware(crc, (const uint8_t *) data, length);
+}
@@ -0,0 +1,20 @@
+/*******************************************************************************
+ *
+ * Filename: waveCrc.h
+ *
+ * Description:
+ *   CRC-32C (Castagnoli) used to protect the chunks and the index of the
+ *   waveform files. The SSE4.2 crc32 instruction is used when the CPU has it.
+ *
+ ******************************************************************************/
+
+#ifndef WAVE_CRC_H
+#define WAVE_CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Continues 'crc' (0 for a new checksum) over 'length' bytes */
+uint32_t waveCrc32c(uint32_t crc, const void * data, size_t length);
+
+#endif
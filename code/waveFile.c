@@ -0,0 +1,493 @@
+/*******************************************************************************
+ *
+ * Filename: waveFile.c
+ *
+ * Description:
+ *   Binary waveform file writer, see waveFile.h.
+ *
+ *   Closing a run is ordered so that the file is always readable: the
+ *   chunks are flushed and synced before the index and trailer are written,
+ *   and then synced again. A file without a valid trailer is recovered by
+ *   the reader, which walks the chunks from the header and keeps those whose
+ *   checksums match.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define fseeko	_fseeki64
+#define ftello	_ftelli64
+#else
+#include <unistd.h>
+#endif
+
+#include "waveFile.h"
+#include "waveCodec.h"
+#include "waveReader.h"
+
+#define INDEX_BATCH		4096
+
+struct tWaveFile
+{
+	OUTPUT_WRITER *		writer;
+	char				path[256];
+	int16_t				compressed;
+	uint32_t			run;
+	uint32_t			nextRun;
+	uint64_t			offset;
+	uint8_t *			scratch;
+	size_t				scratchSize;
+
+	WAVE_INDEX_ENTRY *	index;
+	uint64_t			entries;
+	uint64_t			capacity;
+	int16_t				sorted;
+
+	uint64_t			samples;
+	uint64_t			payloadBytes;
+};
+
+static uint64_t waveNowNs(void)
+{
+#ifdef _WIN32
+	return (uint64_t) time(NULL) * 1000000000ULL;
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+#endif
+}
+
+static void syncFile(FILE * fp)
+{
+	fflush(fp);
+#ifdef _WIN32
+	_commit(_fileno(fp));
+#else
+	fsync(fileno(fp));
+#endif
+}
+
+static int32_t reserveScratch(WAVE_FILE * file, size_t size)
+{
+	uint8_t * scratch;
+
+	if (size <= file->scratchSize)
+	{
+		return 0;
+	}
+
+	scratch = (uint8_t *) realloc(file->scratch, size);
+
+	if (scratch == NULL)
+	{
+		return -1;
+	}
+
+	file->scratch = scratch;
+	file->scratchSize = size;
+	return 0;
+}
+
+static int32_t addIndexEntry(WAVE_FILE * file, const WAVE_INDEX_ENTRY * entry)
+{
+	if (file->entries == file->capacity)
+	{
+		uint64_t capacity = file->capacity ? file->capacity * 2 : 1024;
+		WAVE_INDEX_ENTRY * index = (WAVE_INDEX_ENTRY *) realloc(file->index, capacity * sizeof(WAVE_INDEX_ENTRY));
+
+		if (index == NULL)
+		{
+			return -1;
+		}
+
+		file->index = index;
+		file->capacity = capacity;
+	}
+
+	if (file->entries > 0 && waveCompareIndex(&file->index[file->entries - 1], entry) > 0)
+	{
+		file->sorted = 0;
+	}
+
+	if (entry->run >= file->nextRun)
+	{
+		file->nextRun = entry->run + 1;
+	}
+
+	file->index[file->entries++] = *entry;
+	return 0;
+}
+
+static int compareEntries(const void * a, const void * b)
+{
+	return waveCompareIndex((const WAVE_INDEX_ENTRY *) a, (const WAVE_INDEX_ENTRY *) b);
+}
+
+/* Returns the offset where the new run starts, or -1 if the file must not be appended to */
+static int64_t prepareAppend(WAVE_FILE * file, const char * path)
+{
+	const WAVE_INDEX_ENTRY * index;
+	WAVE_READER * reader;
+	uint64_t entries, i;
+	int64_t end;
+	FILE * fp = fopen(path, "rb");
+
+	if (fp == NULL)
+	{
+		return 0;
+	}
+
+	// A missing or empty file is simply created
+	if (fseeko(fp, 0, SEEK_END) != 0 || ftello(fp) == 0)
+	{
+		fclose(fp);
+		return 0;
+	}
+
+	fclose(fp);
+	reader = waveReaderOpen(path);
+
+	if (reader == NULL || waveReaderKind(reader) != WAVE_KIND_CONTAINER)
+	{
+		printf("%s is not a version %d waveform file, not appending to it.\n", path, WAVE_VERSION);
+		waveReaderClose(reader);
+		return -1;
+	}
+
+	index = waveReaderIndex(reader, &entries);
+
+	for (i = 0; i < entries; i++)
+	{
+		if (addIndexEntry(file, &index[i]) != 0)
+		{
+			waveReaderClose(reader);
+			return -1;
+		}
+	}
+
+	end = (int64_t) waveReaderDataEnd(reader);
+
+	if (!waveReaderIndexValid(reader))
+	{
+		printf("%s: no valid index, recovered %llu chunks, file cut at %lld bytes\n", path,
+				(unsigned long long) entries, (long long) end);
+	}
+
+	waveReaderClose(reader);
+	return end;
+}
+
+/****************************************************************************
+* writeChunk
+*
+* Writes a chunk header and its payload, which is already encoded
+****************************************************************************/
+static int32_t writeChunk(WAVE_FILE * file, WAVE_CHUNK * chunk, const void * payload)
+{
+	static const uint8_t padding[WAVE_CHUNK_ALIGN] = { 0 };
+	uint8_t encoded[WAVE_CHUNK_SIZE];
+	WAVE_INDEX_ENTRY entry;
+	uint64_t span = waveChunkSpan(chunk->payloadBytes);
+
+	chunk->run = file->run;
+	chunk->payloadCrc = waveCrc32c(0, payload, chunk->payloadBytes);
+	chunk->hostTimeNs = waveNowNs();
+
+	waveEncodeChunk(chunk, encoded);
+
+	entry.run = chunk->run;
+	entry.segment = chunk->segment;
+	entry.channel = chunk->channel;
+	entry.type = chunk->type;
+	entry.flags = chunk->flags;
+	entry.offset = file->offset;
+	entry.payloadBytes = chunk->payloadBytes;
+	entry.nSamples = chunk->nSamples;
+	entry.firstSample = chunk->firstSample;
+
+	if (addIndexEntry(file, &entry) != 0)
+	{
+		return -1;
+	}
+
+	file->offset += span;
+
+	if (writerWrite(file->writer, encoded, WAVE_CHUNK_SIZE) < 0 ||
+		writerWrite(file->writer, payload, chunk->payloadBytes) < 0)
+	{
+		return -1;
+	}
+
+	return writerWrite(file->writer, padding, (size_t)(span - WAVE_CHUNK_SIZE - chunk->payloadBytes));
+}
+
+WAVE_FILE * waveFileOpen(const char * path, const WRITER_OPTIONS * options, WAVE_RUN * run, WAVE_OUTPUT output, int16_t append)
+{
+	uint8_t encoded[WAVE_HEADER_SIZE];
+	WAVE_HEADER header;
+	WAVE_CHUNK chunk;
+	WAVE_FILE * file;
+	int64_t start = 0;
+
+	if (output == WAVE_OUTPUT_OFF)
+	{
+		return NULL;
+	}
+
+	file = (WAVE_FILE *) calloc(1, sizeof(WAVE_FILE));
+
+	if (file == NULL)
+	{
+		return NULL;
+	}
+
+	snprintf(file->path, sizeof(file->path), "%s", path);
+	file->compressed = output == WAVE_OUTPUT_COMPRESSED;
+	file->sorted = 1;
+
+	if (append)
+	{
+		start = prepareAppend(file, path);
+	}
+
+	if (start >= 0)
+	{
+		// Chunks carry their own CRC, so only the periodic sync applies
+		WRITER_OPTIONS waveOptions = { WRITER_STDIO, 0, 0, 0, 0, 0 };
+
+		if (options != NULL)
+		{
+			waveOptions = *options;
+			waveOptions.journal = 0;
+		}
+
+		file->writer = writerOpenAt(path, &waveOptions, (uint64_t) start);
+	}
+
+	if (file->writer == NULL)
+	{
+		if (start >= 0)
+		{
+			printf("Cannot open the file %s for writing.\n", path);
+		}
+
+		free(file->scratch);
+		free(file->index);
+		free(file);
+		return NULL;
+	}
+
+	file->offset = (uint64_t) start;
+
+	if (start == 0)
+	{
+		header.version = WAVE_VERSION;
+		header.createdUnixNs = waveNowNs();
+		waveEncodeHeader(&header, encoded);
+		writerWrite(file->writer, encoded, WAVE_HEADER_SIZE);
+		file->offset = WAVE_HEADER_SIZE;
+	}
+
+	file->run = file->nextRun;
+	run->startUnixNs = waveNowNs();
+	waveEncodeRun(run, encoded);
+
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.type = WAVE_CHUNK_RUN;
+	chunk.channel = WAVE_NO_CHANNEL;
+	chunk.payloadBytes = WAVE_RUN_SIZE;
+	chunk.triggerIndex = WAVE_NO_TRIGGER;
+	writeChunk(file, &chunk, encoded);
+
+	return file;
+}
+
+int32_t waveFileWrite(WAVE_FILE * file, WAVE_CHUNK * chunk, const int16_t * samples)
+{
+	const void * payload = samples;
+	uint32_t i;
+
+	if (file == NULL || chunk->nSamples == 0)
+	{
+		return -1;
+	}
+
+	chunk->flags &= ~WAVE_CHUNK_COMPRESSED;
+	chunk->payloadBytes = chunk->nSamples * sizeof(int16_t);
+
+	if (file->compressed)
+	{
+		if (reserveScratch(file, waveEncodeBound(chunk->nSamples)) < 0)
+		{
+			return -1;
+		}
+
+		chunk->payloadBytes = (uint32_t) waveEncode(samples, chunk->nSamples, file->scratch);
+		chunk->flags |= WAVE_CHUNK_COMPRESSED;
+		payload = file->scratch;
+	}
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	else
+	{
+		if (reserveScratch(file, chunk->payloadBytes) < 0)
+		{
+			return -1;
+		}
+
+		for (i = 0; i < chunk->nSamples; i++)
+		{
+			wavePut16(file->scratch + 2 * i, (uint16_t) samples[i]);
+		}
+
+		payload = file->scratch;
+	}
+#endif
+	(void) i;
+
+	file->samples += chunk->nSamples;
+	file->payloadBytes += chunk->payloadBytes;
+
+	return writeChunk(file, chunk, payload);
+}
+
+/****************************************************************************
+* writeIndex
+*
+* Appends the sorted index and the trailer after the last chunk
+****************************************************************************/
+static int32_t writeIndex(WAVE_FILE * file)
+{
+	uint8_t encoded[WAVE_TRAILER_SIZE];
+	WAVE_TRAILER trailer;
+	uint8_t * batch;
+	uint64_t i, j, n;
+	int32_t result = 0;
+	FILE * fp = fopen(file->path, "r+b");
+
+	if (fp == NULL || fseeko(fp, (off_t) file->offset, SEEK_SET) != 0)
+	{
+		if (fp != NULL)
+		{
+			fclose(fp);
+		}
+
+		return -1;
+	}
+
+	// The chunks must be on disk before an index that points to them
+	syncFile(fp);
+
+	if (!file->sorted)
+	{
+		qsort(file->index, (size_t) file->entries, sizeof(WAVE_INDEX_ENTRY), compareEntries);
+	}
+
+	batch = (uint8_t *) malloc(INDEX_BATCH * WAVE_INDEX_ENTRY_SIZE);
+	trailer.indexOffset = file->offset;
+	trailer.entries = file->entries;
+	trailer.indexCrc = 0;
+
+	for (i = 0; batch != NULL && i < file->entries; i += n)
+	{
+		n = file->entries - i < INDEX_BATCH ? file->entries - i : INDEX_BATCH;
+
+		for (j = 0; j < n; j++)
+		{
+			waveEncodeIndexEntry(&file->index[i + j], batch + j * WAVE_INDEX_ENTRY_SIZE);
+		}
+
+		trailer.indexCrc = waveCrc32c(trailer.indexCrc, batch, (size_t)(n * WAVE_INDEX_ENTRY_SIZE));
+
+		if (fwrite(batch, WAVE_INDEX_ENTRY_SIZE, (size_t) n, fp) != n)
+		{
+			result = -1;
+			break;
+		}
+	}
+
+	if (batch == NULL)
+	{
+		result = -1;
+	}
+
+	if (result == 0)
+	{
+		waveEncodeTrailer(&trailer, encoded);
+
+		if (fwrite(encoded, 1, WAVE_TRAILER_SIZE, fp) != WAVE_TRAILER_SIZE)
+		{
+			result = -1;
+		}
+	}
+
+	syncFile(fp);
+
+	if (fclose(fp) != 0)
+	{
+		result = -1;
+	}
+
+	free(batch);
+	return result;
+}
+
+int32_t waveFileClose(WAVE_FILE * file, WAVE_FILE_STATS * stats)
+{
+	int32_t result;
+
+	if (file == NULL)
+	{
+		return -1;
+	}
+
+	result = writerClose(file->writer);
+
+	if (result == 0)
+	{
+		result = writeIndex(file);
+	}
+
+	if (result != 0)
+	{
+		printf("%s: the index could not be written, it will be rebuilt on the next append\n", file->path);
+	}
+
+	if (stats != NULL)
+	{
+		stats->run = file->run;
+		stats->chunks = file->entries;
+		stats->compressed = file->compressed;
+		stats->samples = file->samples;
+		stats->payloadBytes = file->payloadBytes;
+	}
+
+	free(file->scratch);
+	free(file->index);
+	free(file);
+
+	return result;
+}
+
+const char * waveOutputName(WAVE_OUTPUT output)
+{
+	switch (output)
+	{
+		case WAVE_OUTPUT_RAW:
+			return "raw int16";
+		case WAVE_OUTPUT_COMPRESSED:
+			return "compressed";
+		default:
+			return "Off";
+	}
+}
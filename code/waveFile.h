@@ -0,0 +1,60 @@
+/*******************************************************************************
+ *
+ * Filename: waveFile.h
+ *
+ * Description:
+ *   Writer for the binary waveform files described in waveFormat.h.
+ *
+ *   Chunks are encoded on the acquisition thread just before they are handed
+ *   to the output writer, so with compression enabled less data goes through
+ *   the writer and to the disk. The index is kept in memory and written when
+ *   the file is closed.
+ *
+ ******************************************************************************/
+
+#ifndef WAVE_FILE_H
+#define WAVE_FILE_H
+
+#include <stdint.h>
+
+#include "outputWriter.h"
+#include "waveFormat.h"
+
+typedef enum
+{
+	WAVE_OUTPUT_OFF,
+	WAVE_OUTPUT_RAW,
+	WAVE_OUTPUT_COMPRESSED
+} WAVE_OUTPUT;
+
+typedef struct tWaveFile WAVE_FILE;
+
+/* What a run put in the file, given back by waveFileClose */
+typedef struct
+{
+	uint32_t	run;
+	uint64_t	chunks;			// chunks in the file, of this run and the ones before it
+	int16_t		compressed;
+	uint64_t	samples;
+	uint64_t	payloadBytes;	// of the sample chunks, as stored
+} WAVE_FILE_STATS;
+
+/* Starts a new run in 'path'. With 'append' set, the runs already in the
+ * file are kept (after recovering the file if its index is missing),
+ * otherwise the file is created from scratch. The start time of the run is
+ * filled in here. */
+WAVE_FILE * waveFileOpen(const char * path, const WRITER_OPTIONS * options, WAVE_RUN * run, WAVE_OUTPUT output, int16_t append);
+
+/* Writes one chunk of samples. The caller fills type, channel, segment,
+ * nSamples, firstSample, triggerIndex and the overflow, trigger and time
+ * reset flags; the run, payload and host time fields are filled in here. */
+int32_t waveFileWrite(WAVE_FILE * file, WAVE_CHUNK * chunk, const int16_t * samples);
+
+/* Closes the run: flushes the chunks, writes the index and trailer and
+ * releases the file. 'stats', if not NULL, is filled in before the file is
+ * released. Returns -1 if anything could not be written. */
+int32_t waveFileClose(WAVE_FILE * file, WAVE_FILE_STATS * stats);
+
+const char * waveOutputName(WAVE_OUTPUT output);
+
+#endif
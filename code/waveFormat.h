@@ -0,0 +1,418 @@
+/*******************************************************************************
+ *
+ * Filename: waveFormat.h
+ *
+ * Description:
+ *   On-disk layout of the binary waveform files (block_wave.bin and
+ *   stream_wave.bin), shared by the writer and the readers.
+ *
+ *   A file is a container of chunks. Every acquisition appended to the file
+ *   is a run: it starts with a run chunk describing the channel settings,
+ *   followed by one chunk per channel for each rapid block capture or each
+ *   streaming callback. Sample payloads are little endian int16 or compressed
+ *   with waveCodec. Each chunk header carries a CRC-32C of itself and of its
+ *   payload. Payloads are padded to WAVE_CHUNK_ALIGN bytes so that samples
+ *   can be used in place from a memory mapping.
+ *
+ *   block_binary.txt in its raw layout (the default) is not a container: a
+ *   BLOCK_RAW_HEADER_SIZE header holding the run description of the
+ *   acquisition, then BLOCK_RAW_RECORD_SIZE bytes per sample (int32 time in
+ *   ns, int16 ADC counts of channels A and B) for every capture in turn.
+ *   Volts are worked out from the run when the file is read.
+ *
+ *   A pyramid sidecar (stream_wave.pyr) is a container of the same kind
+ *   holding min/max/mean records of the stream at successive decimation
+ *   levels, see wavePyramid.h.
+ *
+ *   When the file is closed an index of every chunk, sorted by run, type,
+ *   segment, channel and first sample, and a fixed size trailer pointing to
+ *   it are written at the end, so a reader can find any capture without
+ *   scanning the file. A run appended later replaces the index; if the
+ *   program stops before the index is written, the chunks are scanned and
+ *   checked again on the next append (or by the reader) and the file is cut
+ *   after the last good one.
+ *
+ *		header		WAVE_HEADER_SIZE bytes
+ *		chunk		WAVE_CHUNK_SIZE bytes of chunk header, payloadBytes of data, padding
+ *		chunk		...
+ *		index		entries * WAVE_INDEX_ENTRY_SIZE bytes
+ *		trailer		WAVE_TRAILER_SIZE bytes
+ *
+ *   All fields are little endian.
+ *
+ ******************************************************************************/
+
+#ifndef WAVE_FORMAT_H
+#define WAVE_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "waveCrc.h"
+
+#define WAVE_MAGIC				"PSWAVE\r\n"
+#define WAVE_TRAILER_MAGIC		"PSWIDX\r\n"
+#define WAVE_VERSION			2
+#define WAVE_HEADER_SIZE		64
+#define WAVE_RUN_SIZE			64
+#define WAVE_CHUNK_MAGIC		0x43575350u		/* "PSWC" */
+#define WAVE_CHUNK_SIZE			64
+#define WAVE_CHUNK_ALIGN		8
+#define WAVE_INDEX_ENTRY_SIZE	40
+#define WAVE_TRAILER_SIZE		32
+#define WAVE_MAX_CHANNELS		4
+
+#define BLOCK_RAW_MAGIC			"PSBRAW\r\n"
+#define BLOCK_RAW_VERSION		1
+#define BLOCK_RAW_RUN_OFFSET	16
+#define BLOCK_RAW_HEADER_SIZE	(BLOCK_RAW_RUN_OFFSET + WAVE_RUN_SIZE)
+#define BLOCK_RAW_RECORD_SIZE	8
+
+/* Chunk types, in index order */
+#define WAVE_CHUNK_RUN			0
+#define WAVE_CHUNK_CAPTURE		1
+#define WAVE_CHUNK_STREAM		2
+#define WAVE_CHUNK_PYRAMID		3		// segment is the level, firstSample the first record
+
+/* Chunk flags */
+#define WAVE_CHUNK_COMPRESSED	0x0001
+#define WAVE_CHUNK_OVERFLOW		0x0002		// the channel went over range
+#define WAVE_CHUNK_TRIGGERED	0x0004		// triggerIndex is valid
+#define WAVE_CHUNK_TIME_RESET	0x0008		// firstSample starts a new time stamp count
+#define WAVE_CHUNK_GAP			0x0010		// samples before firstSample were lost (streaming stopped)
+
+#define WAVE_NO_CHANNEL			0xFFFF
+#define WAVE_NO_TRIGGER			0xFFFFFFFFu
+
+typedef struct
+{
+	uint16_t	version;
+	uint64_t	createdUnixNs;
+} WAVE_HEADER;
+
+/* Settings of one run, the payload of its run chunk */
+typedef struct
+{
+	uint16_t	channelMask;
+	uint16_t	resolution;
+	int16_t		maxADCValue;
+	uint32_t	samplesPerRecord;		// 0 when chunks vary in length (streaming)
+	uint32_t	preTrigger;				// samples before the trigger in each capture
+	double		sampleIntervalNs;
+	uint8_t		range[WAVE_MAX_CHANNELS];
+	float		analogueOffset[WAVE_MAX_CHANNELS];
+	uint64_t	startUnixNs;
+} WAVE_RUN;
+
+typedef struct
+{
+	uint16_t	type;
+	uint16_t	channel;
+	uint32_t	run;
+	uint32_t	segment;				// capture number or streaming callback number
+	uint32_t	nSamples;
+	uint32_t	payloadBytes;
+	uint32_t	flags;
+	uint32_t	payloadCrc;
+	uint64_t	firstSample;			// trigger time stamp counter or absolute sample index
+	uint64_t	hostTimeNs;				// host clock when the data reached the program
+	uint32_t	triggerIndex;			// trigger position in the chunk, WAVE_NO_TRIGGER if none
+} WAVE_CHUNK;
+
+typedef struct
+{
+	uint32_t	run;
+	uint32_t	segment;
+	uint16_t	channel;
+	uint16_t	type;
+	uint32_t	flags;
+	uint64_t	offset;					// file offset of the chunk header
+	uint32_t	payloadBytes;
+	uint32_t	nSamples;
+	uint64_t	firstSample;
+} WAVE_INDEX_ENTRY;
+
+typedef struct
+{
+	uint64_t	indexOffset;
+	uint64_t	entries;
+	uint32_t	indexCrc;
+} WAVE_TRAILER;
+
+/****************************************************************************
+* Little endian field access
+****************************************************************************/
+static inline void wavePut16(uint8_t * p, uint16_t v)
+{
+	p[0] = (uint8_t) v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void wavePut32(uint8_t * p, uint32_t v)
+{
+	p[0] = (uint8_t) v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static inline void wavePut64(uint8_t * p, uint64_t v)
+{
+	wavePut32(p, (uint32_t) v);
+	wavePut32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint16_t waveGet16(const uint8_t * p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t waveGet32(const uint8_t * p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t waveGet64(const uint8_t * p)
+{
+	return (uint64_t) waveGet32(p) | ((uint64_t) waveGet32(p + 4) << 32);
+}
+
+/* Bytes taken in the file by a chunk with 'payloadBytes' of payload */
+static inline uint64_t waveChunkSpan(uint32_t payloadBytes)
+{
+	return WAVE_CHUNK_SIZE + (((uint64_t) payloadBytes + WAVE_CHUNK_ALIGN - 1) & ~(uint64_t)(WAVE_CHUNK_ALIGN - 1));
+}
+
+/****************************************************************************
+* File header
+****************************************************************************/
+static inline void waveEncodeHeader(const WAVE_HEADER * header, uint8_t * p)
+{
+	memset(p, 0, WAVE_HEADER_SIZE);
+	memcpy(p, WAVE_MAGIC, 8);
+	wavePut16(p + 8, header->version);
+	wavePut64(p + 16, header->createdUnixNs);
+	wavePut32(p + 60, waveCrc32c(0, p, 60));
+}
+
+/* Returns 0 on success, -1 if the magic, version or checksum does not match */
+static inline int32_t waveDecodeHeader(const uint8_t * p, WAVE_HEADER * header)
+{
+	if (memcmp(p, WAVE_MAGIC, 8) != 0 || waveGet32(p + 60) != waveCrc32c(0, p, 60))
+	{
+		return -1;
+	}
+
+	header->version = waveGet16(p + 8);
+	header->createdUnixNs = waveGet64(p + 16);
+
+	return header->version == WAVE_VERSION ? 0 : -1;
+}
+
+/****************************************************************************
+* Run description
+****************************************************************************/
+static inline void waveEncodeRun(const WAVE_RUN * run, uint8_t * p)
+{
+	uint64_t interval;
+	uint32_t offset;
+	int32_t ch;
+
+	memset(p, 0, WAVE_RUN_SIZE);
+	memcpy(&interval, &run->sampleIntervalNs, sizeof(interval));
+
+	wavePut16(p, run->channelMask);
+	wavePut16(p + 2, run->resolution);
+	wavePut16(p + 4, (uint16_t) run->maxADCValue);
+	wavePut32(p + 8, run->samplesPerRecord);
+	wavePut32(p + 12, run->preTrigger);
+	wavePut64(p + 16, interval);
+
+	for (ch = 0; ch < WAVE_MAX_CHANNELS; ch++)
+	{
+		memcpy(&offset, &run->analogueOffset[ch], sizeof(offset));
+		p[24 + ch] = run->range[ch];
+		wavePut32(p + 28 + 4 * ch, offset);
+	}
+
+	wavePut64(p + 44, run->startUnixNs);
+}
+
+static inline void waveDecodeRun(const uint8_t * p, WAVE_RUN * run)
+{
+	uint64_t interval;
+	uint32_t offset;
+	int32_t ch;
+
+	run->channelMask = waveGet16(p);
+	run->resolution = waveGet16(p + 2);
+	run->maxADCValue = (int16_t) waveGet16(p + 4);
+	run->samplesPerRecord = waveGet32(p + 8);
+	run->preTrigger = waveGet32(p + 12);
+	interval = waveGet64(p + 16);
+	memcpy(&run->sampleIntervalNs, &interval, sizeof(interval));
+
+	for (ch = 0; ch < WAVE_MAX_CHANNELS; ch++)
+	{
+		run->range[ch] = p[24 + ch];
+		offset = waveGet32(p + 28 + 4 * ch);
+		memcpy(&run->analogueOffset[ch], &offset, sizeof(offset));
+	}
+
+	run->startUnixNs = waveGet64(p + 44);
+}
+
+/****************************************************************************
+* Chunk header
+****************************************************************************/
+static inline void waveEncodeChunk(const WAVE_CHUNK * chunk, uint8_t * p)
+{
+	memset(p, 0, WAVE_CHUNK_SIZE);
+	wavePut32(p, WAVE_CHUNK_MAGIC);
+	wavePut16(p + 4, chunk->type);
+	wavePut16(p + 6, chunk->channel);
+	wavePut32(p + 8, chunk->run);
+	wavePut32(p + 12, chunk->segment);
+	wavePut32(p + 16, chunk->nSamples);
+	wavePut32(p + 20, chunk->payloadBytes);
+	wavePut32(p + 24, chunk->flags);
+	wavePut32(p + 28, chunk->payloadCrc);
+	wavePut64(p + 32, chunk->firstSample);
+	wavePut64(p + 40, chunk->hostTimeNs);
+	wavePut32(p + 48, chunk->triggerIndex);
+	wavePut32(p + 60, waveCrc32c(0, p, 60));
+}
+
+/* Returns 0 on success, -1 if the magic or header checksum does not match */
+static inline int32_t waveDecodeChunk(const uint8_t * p, WAVE_CHUNK * chunk)
+{
+	if (waveGet32(p) != WAVE_CHUNK_MAGIC || waveGet32(p + 60) != waveCrc32c(0, p, 60))
+	{
+		return -1;
+	}
+
+	chunk->type = waveGet16(p + 4);
+	chunk->channel = waveGet16(p + 6);
+	chunk->run = waveGet32(p + 8);
+	chunk->segment = waveGet32(p + 12);
+	chunk->nSamples = waveGet32(p + 16);
+	chunk->payloadBytes = waveGet32(p + 20);
+	chunk->flags = waveGet32(p + 24);
+	chunk->payloadCrc = waveGet32(p + 28);
+	chunk->firstSample = waveGet64(p + 32);
+	chunk->hostTimeNs = waveGet64(p + 40);
+	chunk->triggerIndex = waveGet32(p + 48);
+
+	return 0;
+}
+
+/****************************************************************************
+* Index and trailer
+****************************************************************************/
+static inline void waveEncodeIndexEntry(const WAVE_INDEX_ENTRY * entry, uint8_t * p)
+{
+	wavePut32(p, entry->run);
+	wavePut32(p + 4, entry->segment);
+	wavePut16(p + 8, entry->channel);
+	wavePut16(p + 10, entry->type);
+	wavePut32(p + 12, entry->flags);
+	wavePut64(p + 16, entry->offset);
+	wavePut32(p + 24, entry->payloadBytes);
+	wavePut32(p + 28, entry->nSamples);
+	wavePut64(p + 32, entry->firstSample);
+}
+
+static inline void waveDecodeIndexEntry(const uint8_t * p, WAVE_INDEX_ENTRY * entry)
+{
+	entry->run = waveGet32(p);
+	entry->segment = waveGet32(p + 4);
+	entry->channel = waveGet16(p + 8);
+	entry->type = waveGet16(p + 10);
+	entry->flags = waveGet32(p + 12);
+	entry->offset = waveGet64(p + 16);
+	entry->payloadBytes = waveGet32(p + 24);
+	entry->nSamples = waveGet32(p + 28);
+	entry->firstSample = waveGet64(p + 32);
+}
+
+/* Index order: run, type, segment, channel, first sample */
+static inline int32_t waveCompareIndex(const WAVE_INDEX_ENTRY * a, const WAVE_INDEX_ENTRY * b)
+{
+	if (a->run != b->run)
+	{
+		return a->run < b->run ? -1 : 1;
+	}
+
+	if (a->type != b->type)
+	{
+		return a->type < b->type ? -1 : 1;
+	}
+
+	if (a->segment != b->segment)
+	{
+		return a->segment < b->segment ? -1 : 1;
+	}
+
+	if (a->channel != b->channel)
+	{
+		return a->channel < b->channel ? -1 : 1;
+	}
+
+	if (a->firstSample != b->firstSample)
+	{
+		return a->firstSample < b->firstSample ? -1 : 1;
+	}
+
+	return 0;
+}
+
+static inline void waveEncodeTrailer(const WAVE_TRAILER * trailer, uint8_t * p)
+{
+	memcpy(p, WAVE_TRAILER_MAGIC, 8);
+	wavePut64(p + 8, trailer->indexOffset);
+	wavePut64(p + 16, trailer->entries);
+	wavePut32(p + 24, trailer->indexCrc);
+	wavePut32(p + 28, waveCrc32c(0, p, 28));
+}
+
+/* Returns 0 on success, -1 if the magic or trailer checksum does not match */
+static inline int32_t waveDecodeTrailer(const uint8_t * p, WAVE_TRAILER * trailer)
+{
+	if (memcmp(p, WAVE_TRAILER_MAGIC, 8) != 0 || waveGet32(p + 28) != waveCrc32c(0, p, 28))
+	{
+		return -1;
+	}
+
+	trailer->indexOffset = waveGet64(p + 8);
+	trailer->entries = waveGet64(p + 16);
+	trailer->indexCrc = waveGet32(p + 24);
+
+	return 0;
+}
+
+/****************************************************************************
+* Raw block_binary.txt header
+****************************************************************************/
+static inline void waveEncodeBlockRaw(const WAVE_RUN * run, uint8_t * p)
+{
+	memset(p, 0, BLOCK_RAW_HEADER_SIZE);
+	memcpy(p, BLOCK_RAW_MAGIC, 8);
+	wavePut16(p + 8, BLOCK_RAW_VERSION);
+	waveEncodeRun(run, p + BLOCK_RAW_RUN_OFFSET);
+	wavePut32(p + 12, waveCrc32c(waveCrc32c(0, p, 12), p + BLOCK_RAW_RUN_OFFSET, WAVE_RUN_SIZE));
+}
+
+/* Returns 0 on success, -1 if the magic, version or checksum does not match */
+static inline int32_t waveDecodeBlockRaw(const uint8_t * p, WAVE_RUN * run)
+{
+	if (memcmp(p, BLOCK_RAW_MAGIC, 8) != 0 || waveGet16(p + 8) != BLOCK_RAW_VERSION ||
+		waveGet32(p + 12) != waveCrc32c(waveCrc32c(0, p, 12), p + BLOCK_RAW_RUN_OFFSET, WAVE_RUN_SIZE))
+	{
+		return -1;
+	}
+
+	waveDecodeRun(p + BLOCK_RAW_RUN_OFFSET, run);
+	return 0;
+}
+
+#endif
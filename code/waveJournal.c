@@ -0,0 +1,112 @@
+/*******************************************************************************
+ *
+ * Filename: waveJournal.c
+ *
+ * Description:
+ *   Encoding and recovery scan of journaled output files, see waveJournal.h.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "waveFormat.h"
+#include "waveJournal.h"
+
+void journalEncodeHeader(uint8_t * encoded)
+{
+	memset(encoded, 0, JOURNAL_HEADER_SIZE);
+	memcpy(encoded, JOURNAL_MAGIC, 8);
+	wavePut16(encoded + 8, JOURNAL_VERSION);
+}
+
+void journalEncodeRecord(uint8_t * encoded, uint32_t flags, uint64_t sequence, const void * data, uint32_t length)
+{
+	wavePut32(encoded, JOURNAL_RECORD_MAGIC);
+	wavePut32(encoded + 4, flags);
+	wavePut64(encoded + 8, sequence);
+	wavePut32(encoded + 16, length);
+	wavePut32(encoded + 20, waveCrc32c(waveCrc32c(0, encoded, 20), data, length));
+}
+
+int32_t journalScan(FILE * fp, JOURNAL_SCAN * scan, JOURNAL_VISIT visit, void * context)
+{
+	uint8_t header[JOURNAL_RECORD_SIZE];
+	uint8_t * data = NULL;
+	uint32_t capacity = 0;
+	uint64_t sequence = 0;
+	int32_t result = 0;
+
+	memset(scan, 0, sizeof(JOURNAL_SCAN));
+
+	if (fread(header, 1, JOURNAL_HEADER_SIZE, fp) != JOURNAL_HEADER_SIZE || memcmp(header, JOURNAL_MAGIC, 8) != 0 ||
+		waveGet16(header + 8) != JOURNAL_VERSION)
+	{
+		return -1;
+	}
+
+	scan->goodBytes = JOURNAL_HEADER_SIZE;
+
+	while (!scan->closed && fread(header, 1, JOURNAL_RECORD_SIZE, fp) == JOURNAL_RECORD_SIZE)
+	{
+		uint32_t flags = waveGet32(header + 4);
+		uint32_t length = waveGet32(header + 16);
+		uint32_t span = length + journalPadding(length);
+
+		if (waveGet32(header) != JOURNAL_RECORD_MAGIC || waveGet64(header + 8) != sequence || length > JOURNAL_MAX_RECORD)
+		{
+			break;
+		}
+
+		if (span > capacity)
+		{
+			uint8_t * larger = (uint8_t *) realloc(data, span);
+
+			if (larger == NULL)
+			{
+				break;
+			}
+
+			data = larger;
+			capacity = span;
+		}
+
+		if (fread(data, 1, span, fp) != span || waveCrc32c(waveCrc32c(0, header, 20), data, length) != waveGet32(header + 20))
+		{
+			break;
+		}
+
+		if (flags & JOURNAL_RECORD_END)
+		{
+			scan->closed = 1;
+		}
+		else
+		{
+			if (visit != NULL && visit(context, data, length) != 0)
+			{
+				result = -1;
+				break;
+			}
+
+			scan->records++;
+			scan->dataBytes += length;
+		}
+
+		scan->goodBytes += JOURNAL_RECORD_SIZE + span;
+		sequence++;
+	}
+
+#ifdef _WIN32
+	_fseeki64(fp, 0, SEEK_END);
+	scan->fileBytes = (uint64_t) _ftelli64(fp);
+#else
+	fseeko(fp, 0, SEEK_END);
+	scan->fileBytes = (uint64_t) ftello(fp);
+#endif
+	free(data);
+	return result;
+}
@@ -0,0 +1,72 @@
+/*******************************************************************************
+ *
+ * Filename: waveJournal.h
+ *
+ * Description:
+ *   Journaled layout of the block.txt, block_binary.txt and stream.txt
+ *   outputs, for runs that must survive a crash or a power cut.
+ *
+ *   The writes of the program are gathered into records of up to the
+ *   writer's buffer size: a header carrying the length, a sequence number
+ *   and a CRC-32C of the header and the data, then the data padded to
+ *   JOURNAL_ALIGN bytes. The file is synced to disk
+ *   every so often rather than after each record, so a crash can lose the
+ *   last records written, but never leaves a damaged one unnoticed: the
+ *   scan stops at the first record that is cut short, fails its checksum or
+ *   is out of sequence, and everything before it is good. A clean close
+ *   ends the file with an empty JOURNAL_RECORD_END record.
+ *
+ *		header		JOURNAL_HEADER_SIZE bytes (magic, version)
+ *		record		JOURNAL_RECORD_SIZE bytes of record header, length bytes of data, padding
+ *		record		...
+ *		end record	JOURNAL_RECORD_SIZE bytes, no data
+ *
+ *   All fields are little endian.
+ *
+ ******************************************************************************/
+
+#ifndef WAVE_JOURNAL_H
+#define WAVE_JOURNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define JOURNAL_MAGIC			"PSJRNL\r\n"
+#define JOURNAL_VERSION			1
+#define JOURNAL_HEADER_SIZE		16
+#define JOURNAL_RECORD_MAGIC	0x524A5350u		/* "PSJR" */
+#define JOURNAL_RECORD_SIZE		24
+#define JOURNAL_ALIGN			8
+#define JOURNAL_MAX_RECORD		(1u << 30)
+
+/* Record flags */
+#define JOURNAL_RECORD_END		0x0001
+
+typedef struct
+{
+	uint64_t	records;			// good data records
+	uint64_t	dataBytes;			// bytes of data in them
+	uint64_t	goodBytes;			// file offset just after the last good record
+	uint64_t	fileBytes;
+	int16_t		closed;				// the end record was found
+} JOURNAL_SCAN;
+
+/* Called with the data of each good record; a non-zero return stops the scan */
+typedef int32_t (* JOURNAL_VISIT)(void * context, const uint8_t * data, uint32_t length);
+
+void journalEncodeHeader(uint8_t * encoded);
+
+/* Encodes the header of a record over 'length' bytes of 'data' */
+void journalEncodeRecord(uint8_t * encoded, uint32_t flags, uint64_t sequence, const void * data, uint32_t length);
+
+/* Padding after 'length' bytes of data */
+static inline uint32_t journalPadding(uint32_t length)
+{
+	return (JOURNAL_ALIGN - length % JOURNAL_ALIGN) % JOURNAL_ALIGN;
+}
+
+/* Reads a journal from the start of 'fp'. Returns -1 if it is not a
+ * journal (or 'visit' stopped the scan), 0 otherwise. */
+int32_t journalScan(FILE * fp, JOURNAL_SCAN * scan, JOURNAL_VISIT visit, void * context);
+
+#endif
@@ -0,0 +1,406 @@
+/*******************************************************************************
+ *
+ * Filename: wavePyramid.c
+ *
+ * Description:
+ *   Min/max/mean pyramid builder and query, see wavePyramid.h.
+ *
+ *   The builder keeps one open record per level. Samples are reduced a
+ *   record of the first level at a time; a record is closed when a sample of
+ *   a later record arrives (or at the end), goes into the pending chunk of
+ *   its level and is folded into the open record of the level above, so
+ *   every level is built from exact sums rather than from rounded means.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wavePyramid.h"
+
+typedef struct
+{
+	uint64_t	record;				// index of the open record
+	int32_t		min;
+	int32_t		max;
+	int64_t		sum;
+	uint64_t	samples;			// samples in the open record, 0 if there is none
+	uint64_t	firstRecord;		// first record of the pending chunk
+	uint32_t	pending;			// records in the pending chunk
+	int16_t		planes[3 * WAVE_PYRAMID_RECORDS];
+} PYRAMID_LEVEL;
+
+struct tPyramidBuilder
+{
+	uint32_t		factor;
+	uint16_t		channel;
+	PYRAMID_EMIT	emit;
+	void *			context;
+	uint32_t		levels;
+	PYRAMID_LEVEL	level[WAVE_PYRAMID_LEVELS];		// level[0] is level 1
+};
+
+/****************************************************************************
+* pyramidCreate
+****************************************************************************/
+PYRAMID_BUILDER * pyramidCreate(uint32_t factor, uint16_t channel, PYRAMID_EMIT emit, void * context)
+{
+	PYRAMID_BUILDER * builder;
+	uint64_t span = factor;
+
+	if (factor < 2 || factor > 1024 || emit == NULL || (builder = (PYRAMID_BUILDER *) calloc(1, sizeof(PYRAMID_BUILDER))) == NULL)
+	{
+		return NULL;
+	}
+
+	builder->factor = factor;
+	builder->channel = channel;
+	builder->emit = emit;
+	builder->context = context;
+
+	// Up to records of about 2^48 samples, far beyond any recording
+	for (builder->levels = 1; builder->levels < WAVE_PYRAMID_LEVELS && span <= (1ull << 48) / factor; builder->levels++)
+	{
+		span *= factor;
+	}
+
+	return builder;
+}
+
+/****************************************************************************
+* pyramidDestroy
+****************************************************************************/
+void pyramidDestroy(PYRAMID_BUILDER * builder)
+{
+	free(builder);
+}
+
+/* Hands over the pending chunk of a level, the planes moved together first if it is not full */
+static void flushChunk(PYRAMID_BUILDER * builder, uint32_t l)
+{
+	PYRAMID_LEVEL * level = &builder->level[l];
+	uint32_t n = level->pending;
+
+	if (n == 0)
+	{
+		return;
+	}
+
+	if (n < WAVE_PYRAMID_RECORDS)
+	{
+		memmove(&level->planes[n], &level->planes[WAVE_PYRAMID_RECORDS], n * sizeof(int16_t));
+		memmove(&level->planes[2 * n], &level->planes[2 * WAVE_PYRAMID_RECORDS], n * sizeof(int16_t));
+	}
+
+	builder->emit(builder->context, builder->channel, l + 1, level->firstRecord, n, level->planes);
+	level->pending = 0;
+}
+
+static void addRecord(PYRAMID_BUILDER * builder, uint32_t l, uint64_t record, int32_t min, int32_t max, int64_t sum, uint64_t samples);
+
+/* Moves the open record of a level to its chunk and into the level above */
+static void closeRecord(PYRAMID_BUILDER * builder, uint32_t l)
+{
+	PYRAMID_LEVEL * level = &builder->level[l];
+	uint64_t samples = level->samples;
+	int64_t half = (int64_t)(samples / 2);
+	int64_t mean;
+
+	if (samples == 0)
+	{
+		return;
+	}
+
+	// A chunk only holds consecutive records
+	if (level->pending > 0 && level->record != level->firstRecord + level->pending)
+	{
+		flushChunk(builder, l);
+	}
+
+	if (level->pending == 0)
+	{
+		level->firstRecord = level->record;
+	}
+
+	mean = level->sum >= 0 ? (level->sum + half) / (int64_t) samples : -((-level->sum + half) / (int64_t) samples);
+	level->planes[level->pending] = (int16_t) level->min;
+	level->planes[WAVE_PYRAMID_RECORDS + level->pending] = (int16_t) level->max;
+	level->planes[2 * WAVE_PYRAMID_RECORDS + level->pending] = (int16_t) mean;
+
+	if (++level->pending == WAVE_PYRAMID_RECORDS)
+	{
+		flushChunk(builder, l);
+	}
+
+	level->samples = 0;
+
+	if (l + 1 < builder->levels)
+	{
+		addRecord(builder, l + 1, level->record / builder->factor, level->min, level->max, level->sum, samples);
+	}
+}
+
+static void addRecord(PYRAMID_BUILDER * builder, uint32_t l, uint64_t record, int32_t min, int32_t max, int64_t sum, uint64_t samples)
+{
+	PYRAMID_LEVEL * level = &builder->level[l];
+
+	if (level->samples > 0 && level->record != record)
+	{
+		closeRecord(builder, l);
+	}
+
+	if (level->samples == 0)
+	{
+		level->record = record;
+		level->min = min;
+		level->max = max;
+		level->sum = sum;
+		level->samples = samples;
+		return;
+	}
+
+	level->min = min < level->min ? min : level->min;
+	level->max = max > level->max ? max : level->max;
+	level->sum += sum;
+	level->samples += samples;
+}
+
+/* Minimum, maximum and sum of n samples; whole groups of WAVE_PYRAMID_LANES first, the fixed inner loop is what gets vectorised */
+static void reduce(const int16_t * samples, uint32_t n, int32_t * min, int32_t * max, int64_t * sum)
+{
+	int32_t lo[WAVE_PYRAMID_LANES], hi[WAVE_PYRAMID_LANES], total[WAVE_PYRAMID_LANES];
+	uint32_t whole = n / WAVE_PYRAMID_LANES * WAVE_PYRAMID_LANES;
+	uint32_t i, j;
+
+	for (j = 0; j < WAVE_PYRAMID_LANES; j++)
+	{
+		lo[j] = INT16_MAX;
+		hi[j] = INT16_MIN;
+		total[j] = 0;
+	}
+
+	for (i = 0; i < whole; i += WAVE_PYRAMID_LANES)
+	{
+		const int16_t * in = samples + i;
+
+		for (j = 0; j < WAVE_PYRAMID_LANES; j++)
+		{
+			lo[j] = in[j] < lo[j] ? in[j] : lo[j];
+			hi[j] = in[j] > hi[j] ? in[j] : hi[j];
+			total[j] += in[j];
+		}
+	}
+
+	for (i = whole; i < n; i++)
+	{
+		lo[0] = samples[i] < lo[0] ? samples[i] : lo[0];
+		hi[0] = samples[i] > hi[0] ? samples[i] : hi[0];
+		total[0] += samples[i];
+	}
+
+	*min = lo[0];
+	*max = hi[0];
+	*sum = 0;
+
+	for (j = 0; j < WAVE_PYRAMID_LANES; j++)
+	{
+		*min = lo[j] < *min ? lo[j] : *min;
+		*max = hi[j] > *max ? hi[j] : *max;
+		*sum += total[j];
+	}
+}
+
+/****************************************************************************
+* pyramidAdd
+****************************************************************************/
+void pyramidAdd(PYRAMID_BUILDER * builder, uint64_t firstSample, const int16_t * samples, uint32_t count)
+{
+	uint32_t factor = builder->factor;
+	uint32_t offset, n;
+	int32_t min, max;
+	int64_t sum;
+
+	// Up to the end of a first level record at a time
+	while (count > 0)
+	{
+		offset = (uint32_t)(firstSample % factor);
+		n = factor - offset < count ? factor - offset : count;
+
+		reduce(samples, n, &min, &max, &sum);
+		addRecord(builder, 0, firstSample / factor, min, max, sum, n);
+
+		if (offset + n == factor)
+		{
+			closeRecord(builder, 0);
+		}
+
+		firstSample += n;
+		samples += n;
+		count -= n;
+	}
+}
+
+/****************************************************************************
+* pyramidFinish
+****************************************************************************/
+void pyramidFinish(PYRAMID_BUILDER * builder)
+{
+	uint32_t l;
+
+	// Bottom up, so that each level gets the last record of the one below
+	for (l = 0; l < builder->levels; l++)
+	{
+		closeRecord(builder, l);
+		flushChunk(builder, l);
+	}
+}
+
+/* Index entries of the chunks of one level and channel: the first one and how many */
+static uint64_t findChunks(const WAVE_READER * reader, uint32_t run, uint32_t level, uint16_t channel, uint64_t * first)
+{
+	uint64_t entries, n = 0;
+	const WAVE_INDEX_ENTRY * index = waveReaderIndex(reader, &entries);
+	int64_t entry = waveReaderFind(reader, run, WAVE_CHUNK_PYRAMID, level, channel);
+
+	if (entry < 0)
+	{
+		return 0;
+	}
+
+	*first = (uint64_t) entry;
+
+	while (*first + n < entries && index[*first + n].run == run && index[*first + n].type == WAVE_CHUNK_PYRAMID &&
+			index[*first + n].segment == level && index[*first + n].channel == channel)
+	{
+		n++;
+	}
+
+	return n;
+}
+
+/****************************************************************************
+* pyramidInfo
+****************************************************************************/
+int32_t pyramidInfo(const WAVE_READER * reader, uint32_t run, uint16_t channel, uint32_t * factor, uint32_t * levels, uint64_t * samples)
+{
+	const WAVE_INDEX_ENTRY * index;
+	WAVE_RUN settings;
+	uint64_t entries, first, n;
+
+	if (waveReaderKind(reader) != WAVE_KIND_CONTAINER || waveReaderRun(reader, run, &settings) != 0 || settings.samplesPerRecord < 2 ||
+		(n = findChunks(reader, run, 1, channel, &first)) == 0)
+	{
+		return -1;
+	}
+
+	index = waveReaderIndex(reader, &entries);
+	*factor = settings.samplesPerRecord;
+	*samples = (index[first + n - 1].firstSample + index[first + n - 1].nSamples / 3) * settings.samplesPerRecord;
+
+	for (*levels = 1; *levels < WAVE_PYRAMID_LEVELS && findChunks(reader, run, *levels + 1, channel, &first) > 0; (*levels)++)
+	{
+	}
+
+	return 0;
+}
+
+/****************************************************************************
+* pyramidQuery
+****************************************************************************/
+int32_t pyramidQuery(const WAVE_READER * reader, uint32_t run, uint16_t channel, uint64_t first, uint64_t count,
+						uint32_t columns, WAVE_EXTENT * extents)
+{
+	const WAVE_INDEX_ENTRY * index;
+	int16_t * scratch;
+	WAVE_SPAN span;
+	uint64_t entries, chunk, chunks, loaded = UINT64_MAX, start, end, r, last, records = 0;
+	uint64_t perColumn = columns ? count / columns : 0, size = 1, samples;
+	uint32_t factor, levels, level = 0, c;
+	int64_t sum;
+	int32_t min, max, n;
+
+	if (pyramidInfo(reader, run, channel, &factor, &levels, &samples) != 0 || columns == 0)
+	{
+		return -1;
+	}
+
+	// Coarsest level with records no wider than a column
+	while (level < levels && size * factor <= perColumn)
+	{
+		size *= factor;
+		level++;
+	}
+
+	if (level == 0)
+	{
+		return 0;
+	}
+
+	if ((scratch = (int16_t *) malloc(3 * WAVE_PYRAMID_RECORDS * sizeof(int16_t))) == NULL)
+	{
+		return -1;
+	}
+
+	index = waveReaderIndex(reader, &entries);
+	chunks = findChunks(reader, run, level, channel, &chunk);
+	chunks += chunk;
+	memset(&span, 0, sizeof(span));
+
+	for (c = 0; c < columns; c++)
+	{
+		start = first + perColumn * c + (count % columns) * c / columns;
+		end = first + perColumn * (c + 1) + (count % columns) * (c + 1) / columns;
+		min = INT16_MAX;
+		max = INT16_MIN;
+		sum = 0;
+		n = 0;
+
+		for (r = start / size, last = end > start ? (end - 1) / size : 0; end > start && r <= last; r++)
+		{
+			// The chunks are in record order, and so are the columns
+			while (chunk < chunks && index[chunk].firstSample + index[chunk].nSamples / 3 <= r)
+			{
+				chunk++;
+			}
+
+			if (chunk == chunks)
+			{
+				break;
+			}
+
+			if (r < index[chunk].firstSample)
+			{
+				r = index[chunk].firstSample - 1;
+				continue;
+			}
+
+			if (chunk != loaded)
+			{
+				if (index[chunk].nSamples > 3 * WAVE_PYRAMID_RECORDS || waveReaderSamples(reader, chunk, scratch, &span) != 0)
+				{
+					free(scratch);
+					return -1;
+				}
+
+				loaded = chunk;
+				records = span.nSamples / 3;
+			}
+
+			min = span.samples[r - index[chunk].firstSample] < min ? span.samples[r - index[chunk].firstSample] : min;
+			max = span.samples[records + r - index[chunk].firstSample] > max ? span.samples[records + r - index[chunk].firstSample] : max;
+			sum += span.samples[2 * records + r - index[chunk].firstSample];
+			n++;
+		}
+
+		extents[c].min = (int16_t) min;
+		extents[c].max = (int16_t) max;
+		extents[c].mean = n > 0 ? (int16_t)(sum / n) : 0;
+	}
+
+	free(scratch);
+	return (int32_t) level;
+}
@@ -0,0 +1,76 @@
+/*******************************************************************************
+ *
+ * Filename: wavePyramid.h
+ *
+ * Description:
+ *   Min/max/mean pyramid of a streamed channel, for drawing any stretch of a
+ *   long recording at any zoom without reading its samples.
+ *
+ *   A record of level L covers the 'factor'^L samples from index
+ *   r * factor^L on, and holds their minimum, maximum and mean in ADC
+ *   counts. The records are kept in WAVE_CHUNK_PYRAMID chunks of a waveform
+ *   container (the stream_wave.pyr sidecar): segment is the level,
+ *   firstSample the index of the first record and the payload three planes
+ *   of nSamples / 3 values, the minima, the maxima and the means. A chunk
+ *   holds consecutive records; samples dropped by the acquisition leave a
+ *   gap between chunks. The run chunk of the sidecar is the one of the
+ *   stream, with samplesPerRecord set to the factor.
+ *
+ *   The builder takes the samples as they are written and hands over each
+ *   chunk when it is full; the query picks the coarsest level that still
+ *   has a record per column, so drawing W columns reads at most about
+ *   W * factor records whatever the length of the recording.
+ *
+ ******************************************************************************/
+
+#ifndef WAVE_PYRAMID_H
+#define WAVE_PYRAMID_H
+
+#include <stdint.h>
+
+#include "waveReader.h"
+
+#define WAVE_PYRAMID_RECORDS	4096		// records per chunk
+#define WAVE_PYRAMID_LEVELS		16
+#define WAVE_PYRAMID_LANES		16
+
+/* Minimum, maximum and mean of a record or a column; min > max when there is no data */
+typedef struct
+{
+	int16_t		min;
+	int16_t		max;
+	int16_t		mean;
+} WAVE_EXTENT;
+
+/* Receives a full (or, at the end, the last) chunk of records: min, max and mean planes */
+typedef void (*PYRAMID_EMIT)(void * context, uint16_t channel, uint32_t level, uint64_t firstRecord,
+								uint32_t records, const int16_t * planes);
+
+typedef struct tPyramidBuilder PYRAMID_BUILDER;
+
+/* 'factor' from 2 to 1024 */
+PYRAMID_BUILDER * pyramidCreate(uint32_t factor, uint16_t channel, PYRAMID_EMIT emit, void * context);
+void pyramidDestroy(PYRAMID_BUILDER * builder);
+
+/* Adds 'count' samples from index 'firstSample' on; indices must go up, a jump is a gap */
+void pyramidAdd(PYRAMID_BUILDER * builder, uint64_t firstSample, const int16_t * samples, uint32_t count);
+
+/* Closes the open records of every level and hands over what is left */
+void pyramidFinish(PYRAMID_BUILDER * builder);
+
+/*
+ * Factor, number of levels and samples covered by a pyramid in a run of a
+ * sidecar. Returns -1 if the run has no pyramid for the channel.
+ */
+int32_t pyramidInfo(const WAVE_READER * reader, uint32_t run, uint16_t channel, uint32_t * factor, uint32_t * levels, uint64_t * samples);
+
+/*
+ * Splits the samples from 'first' to 'first' + 'count' into 'columns' equal
+ * columns and fills the extent of each. Returns the level read, 0 when the
+ * columns are narrower than a record of the first level (read the samples
+ * instead), -1 if there is no pyramid.
+ */
+int32_t pyramidQuery(const WAVE_READER * reader, uint32_t run, uint16_t channel, uint64_t first, uint64_t count,
+						uint32_t columns, WAVE_EXTENT * extents);
+
+#endif
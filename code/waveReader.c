@@ -0,0 +1,485 @@
+/*******************************************************************************
+ *
+ * Filename: waveReader.c
+ *
+ * Description:
+ *   Memory mapped reader of the acquisition files, see waveReader.h.
+ *
+ ******************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define fseeko	_fseeki64
+#define ftello	_ftelli64
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "waveReader.h"
+#include "waveCodec.h"
+#include "waveJournal.h"
+
+struct tWaveReader
+{
+	const uint8_t *		base;
+	uint64_t			size;
+	int16_t				mapped;
+	WAVE_KIND			kind;
+
+	WAVE_INDEX_ENTRY *	index;
+	uint64_t			entries;
+	uint64_t			capacity;
+	uint64_t			dataEnd;
+	int16_t				indexValid;
+	uint64_t			truncated;
+};
+
+/* Range of each PS5000A_RANGE in mV, as inputRanges in ps5000aCon.c */
+static const uint16_t rangeMv[] = { 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000 };
+
+/****************************************************************************
+* File mapping
+****************************************************************************/
+static int32_t mapFile(WAVE_READER * reader, const char * path)
+{
+#ifdef _WIN32
+	FILE * fp = fopen(path, "rb");
+	uint8_t * copy;
+
+	// No mmap: read the whole file instead
+	if (fp == NULL || fseeko(fp, 0, SEEK_END) != 0)
+	{
+		if (fp != NULL)
+		{
+			fclose(fp);
+		}
+
+		return -1;
+	}
+
+	reader->size = (uint64_t) ftello(fp);
+	copy = (uint8_t *) malloc(reader->size ? (size_t) reader->size : 1);
+
+	if (copy == NULL || fseeko(fp, 0, SEEK_SET) != 0 || fread(copy, 1, (size_t) reader->size, fp) != reader->size)
+	{
+		free(copy);
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+	reader->base = copy;
+	return 0;
+#else
+	struct stat info;
+	void * base;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	base = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	reader->base = (const uint8_t *) base;
+	reader->size = (uint64_t) info.st_size;
+	reader->mapped = 1;
+	return 0;
+#endif
+}
+
+static void unmapFile(WAVE_READER * reader)
+{
+#ifdef _WIN32
+	free((void *) reader->base);
+#else
+	if (reader->mapped)
+	{
+		munmap((void *) reader->base, (size_t) reader->size);
+	}
+#endif
+}
+
+/****************************************************************************
+* Index
+****************************************************************************/
+static int32_t addEntry(WAVE_READER * reader, const WAVE_INDEX_ENTRY * entry)
+{
+	if (reader->entries == reader->capacity)
+	{
+		uint64_t capacity = reader->capacity ? reader->capacity * 2 : 1024;
+		WAVE_INDEX_ENTRY * index = (WAVE_INDEX_ENTRY *) realloc(reader->index, capacity * sizeof(WAVE_INDEX_ENTRY));
+
+		if (index == NULL)
+		{
+			return -1;
+		}
+
+		reader->index = index;
+		reader->capacity = capacity;
+	}
+
+	reader->index[reader->entries++] = *entry;
+	return 0;
+}
+
+static int compareEntries(const void * a, const void * b)
+{
+	return waveCompareIndex((const WAVE_INDEX_ENTRY *) a, (const WAVE_INDEX_ENTRY *) b);
+}
+
+/* Reads the index written when the file was closed */
+static int32_t loadIndex(WAVE_READER * reader)
+{
+	WAVE_TRAILER trailer;
+	WAVE_INDEX_ENTRY entry;
+	uint64_t i;
+
+	if (reader->size < WAVE_HEADER_SIZE + WAVE_TRAILER_SIZE ||
+		waveDecodeTrailer(reader->base + reader->size - WAVE_TRAILER_SIZE, &trailer) != 0 ||
+		trailer.indexOffset < WAVE_HEADER_SIZE ||
+		trailer.entries > (reader->size - WAVE_HEADER_SIZE) / WAVE_INDEX_ENTRY_SIZE ||
+		trailer.indexOffset + trailer.entries * WAVE_INDEX_ENTRY_SIZE + WAVE_TRAILER_SIZE != reader->size ||
+		waveCrc32c(0, reader->base + trailer.indexOffset, (size_t)(trailer.entries * WAVE_INDEX_ENTRY_SIZE)) != trailer.indexCrc)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < trailer.entries; i++)
+	{
+		waveDecodeIndexEntry(reader->base + trailer.indexOffset + i * WAVE_INDEX_ENTRY_SIZE, &entry);
+
+		// Every chunk must lie before the index
+		if (entry.offset < WAVE_HEADER_SIZE || entry.offset > trailer.indexOffset ||
+			waveChunkSpan(entry.payloadBytes) > trailer.indexOffset - entry.offset ||
+			addEntry(reader, &entry) != 0)
+		{
+			reader->entries = 0;
+			return -1;
+		}
+	}
+
+	reader->dataEnd = trailer.indexOffset;
+	return 0;
+}
+
+/* Indexes the chunks one after the other, up to the first damaged one */
+static void scanChunks(WAVE_READER * reader)
+{
+	uint64_t offset = WAVE_HEADER_SIZE;
+	WAVE_INDEX_ENTRY entry;
+	WAVE_CHUNK chunk;
+
+	while (offset + WAVE_CHUNK_SIZE <= reader->size &&
+			waveDecodeChunk(reader->base + offset, &chunk) == 0 &&
+			waveChunkSpan(chunk.payloadBytes) <= reader->size - offset &&
+			waveCrc32c(0, reader->base + offset + WAVE_CHUNK_SIZE, chunk.payloadBytes) == chunk.payloadCrc)
+	{
+		entry.run = chunk.run;
+		entry.segment = chunk.segment;
+		entry.channel = chunk.channel;
+		entry.type = chunk.type;
+		entry.flags = chunk.flags;
+		entry.offset = offset;
+		entry.payloadBytes = chunk.payloadBytes;
+		entry.nSamples = chunk.nSamples;
+		entry.firstSample = chunk.firstSample;
+
+		if (addEntry(reader, &entry) != 0)
+		{
+			break;
+		}
+
+		offset += waveChunkSpan(chunk.payloadBytes);
+	}
+
+	reader->dataEnd = offset;
+	qsort(reader->index, (size_t) reader->entries, sizeof(WAVE_INDEX_ENTRY), compareEntries);
+}
+
+/****************************************************************************
+* waveReaderOpen
+****************************************************************************/
+WAVE_READER * waveReaderOpen(const char * path)
+{
+	WAVE_READER * reader = (WAVE_READER *) calloc(1, sizeof(WAVE_READER));
+	WAVE_HEADER header;
+	WAVE_RUN run;
+
+	if (reader == NULL)
+	{
+		return NULL;
+	}
+
+	if (mapFile(reader, path) != 0)
+	{
+		free(reader);
+		return NULL;
+	}
+
+	if (reader->size >= WAVE_HEADER_SIZE && waveDecodeHeader(reader->base, &header) == 0)
+	{
+		reader->kind = WAVE_KIND_CONTAINER;
+		reader->indexValid = loadIndex(reader) == 0;
+
+		if (!reader->indexValid)
+		{
+			scanChunks(reader);
+		}
+
+		return reader;
+	}
+
+	// A run cut short by a crash or a full disk can end part way through a record
+	if (reader->size >= BLOCK_RAW_HEADER_SIZE && waveDecodeBlockRaw(reader->base, &run) == 0)
+	{
+		reader->kind = WAVE_KIND_BLOCK_RAW;
+		reader->truncated = (reader->size - BLOCK_RAW_HEADER_SIZE) % BLOCK_RAW_RECORD_SIZE;
+		return reader;
+	}
+
+	if (reader->size >= 8 && memcmp(reader->base, WAVE_MAGIC, 6) != 0 && memcmp(reader->base, BLOCK_RAW_MAGIC, 6) != 0 &&
+		memcmp(reader->base, JOURNAL_MAGIC, 8) != 0 && reader->size % sizeof(BLOCK_BINARY_RECORD) == 0)
+	{
+		reader->kind = WAVE_KIND_BLOCK_BINARY;
+		return reader;
+	}
+
+	waveReaderClose(reader);
+	return NULL;
+}
+
+void waveReaderClose(WAVE_READER * reader)
+{
+	if (reader == NULL)
+	{
+		return;
+	}
+
+	unmapFile(reader);
+	free(reader->index);
+	free(reader);
+}
+
+WAVE_KIND waveReaderKind(const WAVE_READER * reader)
+{
+	return reader->kind;
+}
+
+const WAVE_INDEX_ENTRY * waveReaderIndex(const WAVE_READER * reader, uint64_t * entries)
+{
+	*entries = reader->entries;
+	return reader->index;
+}
+
+int16_t waveReaderIndexValid(const WAVE_READER * reader)
+{
+	return reader->indexValid;
+}
+
+uint64_t waveReaderDataEnd(const WAVE_READER * reader)
+{
+	return reader->dataEnd;
+}
+
+int64_t waveReaderFind(const WAVE_READER * reader, uint32_t run, uint16_t type, uint32_t segment, uint16_t channel)
+{
+	WAVE_INDEX_ENTRY key;
+	uint64_t low = 0, high = reader->entries;
+
+	memset(&key, 0, sizeof(key));
+	key.run = run;
+	key.type = type;
+	key.segment = segment;
+	key.channel = channel;
+
+	// First entry not before the key, the one with the lowest first sample if there are several
+	while (low < high)
+	{
+		uint64_t middle = low + (high - low) / 2;
+
+		if (waveCompareIndex(&reader->index[middle], &key) < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	if (low == reader->entries || reader->index[low].run != run || reader->index[low].type != type ||
+		reader->index[low].segment != segment || reader->index[low].channel != channel)
+	{
+		return -1;
+	}
+
+	return (int64_t) low;
+}
+
+int32_t waveReaderChunk(const WAVE_READER * reader, uint64_t entry, WAVE_CHUNK * chunk)
+{
+	if (entry >= reader->entries)
+	{
+		return -1;
+	}
+
+	return waveDecodeChunk(reader->base + reader->index[entry].offset, chunk);
+}
+
+int32_t waveReaderRun(const WAVE_READER * reader, uint32_t run, WAVE_RUN * settings)
+{
+	int64_t entry;
+
+	if (reader->kind == WAVE_KIND_BLOCK_RAW)
+	{
+		return run == 0 ? waveDecodeBlockRaw(reader->base, settings) : -1;
+	}
+
+	entry = waveReaderFind(reader, run, WAVE_CHUNK_RUN, 0, WAVE_NO_CHANNEL);
+
+	if (entry < 0 || reader->index[entry].payloadBytes < WAVE_RUN_SIZE)
+	{
+		return -1;
+	}
+
+	waveDecodeRun(waveReaderPayload(reader, (uint64_t) entry), settings);
+	return 0;
+}
+
+const uint8_t * waveReaderPayload(const WAVE_READER * reader, uint64_t entry)
+{
+	if (entry >= reader->entries)
+	{
+		return NULL;
+	}
+
+	return reader->base + reader->index[entry].offset + WAVE_CHUNK_SIZE;
+}
+
+int32_t waveReaderVerify(const WAVE_READER * reader, uint64_t entry)
+{
+	WAVE_CHUNK chunk;
+
+	if (waveReaderChunk(reader, entry, &chunk) != 0 || chunk.payloadBytes != reader->index[entry].payloadBytes)
+	{
+		return -1;
+	}
+
+	return waveCrc32c(0, waveReaderPayload(reader, entry), chunk.payloadBytes) == chunk.payloadCrc ? 0 : -1;
+}
+
+int32_t waveReaderSamples(const WAVE_READER * reader, uint64_t entry, int16_t * scratch, WAVE_SPAN * span)
+{
+	const WAVE_INDEX_ENTRY * e;
+	const uint8_t * payload;
+
+	if (entry >= reader->entries || reader->index[entry].type == WAVE_CHUNK_RUN)
+	{
+		return -1;
+	}
+
+	e = &reader->index[entry];
+	payload = waveReaderPayload(reader, entry);
+	span->nSamples = e->nSamples;
+
+	if (e->flags & WAVE_CHUNK_COMPRESSED)
+	{
+		if (scratch == NULL || waveDecode(payload, e->payloadBytes, scratch, e->nSamples) != (int64_t) e->nSamples)
+		{
+			return -1;
+		}
+
+		span->samples = scratch;
+		return 0;
+	}
+
+	if (e->payloadBytes != e->nSamples * sizeof(int16_t))
+	{
+		return -1;
+	}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	{
+		uint32_t i;
+
+		if (scratch == NULL)
+		{
+			return -1;
+		}
+
+		for (i = 0; i < e->nSamples; i++)
+		{
+			scratch[i] = (int16_t) waveGet16(payload + 2 * i);
+		}
+
+		span->samples = scratch;
+		return 0;
+	}
+#else
+	span->samples = (const int16_t *)(const void *) payload;
+	return 0;
+#endif
+}
+
+const BLOCK_BINARY_RECORD * waveReaderBinary(const WAVE_READER * reader, uint64_t * count)
+{
+	if (reader->kind != WAVE_KIND_BLOCK_BINARY)
+	{
+		*count = 0;
+		return NULL;
+	}
+
+	*count = reader->size / sizeof(BLOCK_BINARY_RECORD);
+	return (const BLOCK_BINARY_RECORD *)(const void *) reader->base;
+}
+
+const BLOCK_RAW_RECORD * waveReaderBlockRaw(const WAVE_READER * reader, uint64_t * count)
+{
+	if (reader->kind != WAVE_KIND_BLOCK_RAW)
+	{
+		*count = 0;
+		return NULL;
+	}
+
+	*count = (reader->size - BLOCK_RAW_HEADER_SIZE) / BLOCK_RAW_RECORD_SIZE;
+	return (const BLOCK_RAW_RECORD *)(const void *)(reader->base + BLOCK_RAW_HEADER_SIZE);
+}
+
+uint64_t waveReaderTruncated(const WAVE_READER * reader)
+{
+	return reader->truncated;
+}
+
+double waveAdcToMv(const WAVE_RUN * run, uint16_t channel, int32_t adc)
+{
+	if (channel >= WAVE_MAX_CHANNELS || run->range[channel] >= sizeof(rangeMv) / sizeof(rangeMv[0]) || run->maxADCValue == 0)
+	{
+		return 0.0;
+	}
+
+	return (double) adc * rangeMv[run->range[channel]] / run->maxADCValue;
+}
@@ -0,0 +1,110 @@
+/*******************************************************************************
+ *
+ * Filename: waveReader.h
+ *
+ * Description:
+ *   Read-only access to the acquisition files, for analysis programs and for
+ *   the pswave command line tool.
+ *
+ *   The file is memory mapped and never copied: the index, chunk headers and
+ *   uncompressed sample payloads are read in place, so walking a large file
+ *   costs no more than the pages actually touched. Compressed payloads are
+ *   decoded into a buffer supplied by the caller.
+ *
+ *   Two kinds of file are understood: the waveform containers described in
+ *   waveFormat.h and the block_binary.txt records written by rapid block.
+ *
+ ******************************************************************************/
+
+#ifndef WAVE_READER_H
+#define WAVE_READER_H
+
+#include <stdint.h>
+
+#include "waveFormat.h"
+
+typedef enum
+{
+	WAVE_KIND_CONTAINER,
+	WAVE_KIND_BLOCK_BINARY,				// block_binary.txt with ADC counts and mV
+	WAVE_KIND_BLOCK_RAW					// block_binary.txt with ADC counts and the run
+} WAVE_KIND;
+
+/* One sample of block_binary.txt, as blockFormat.c writes it */
+typedef struct
+{
+	int32_t	time;
+	int32_t	adcA;
+	int32_t	mvA;
+	int32_t	adcB;
+	int32_t	mvB;
+} BLOCK_BINARY_RECORD;
+
+/* One sample of a raw block_binary.txt, after its header */
+typedef struct
+{
+	int32_t	time;
+	int16_t	adcA;
+	int16_t	adcB;
+} BLOCK_RAW_RECORD;
+
+/* Samples of one chunk, pointing into the mapping or into the caller's buffer */
+typedef struct
+{
+	const int16_t *	samples;
+	uint32_t		nSamples;
+} WAVE_SPAN;
+
+typedef struct tWaveReader WAVE_READER;
+
+/* Maps 'path'. A container without a valid index (still being written, or
+ * left by a crash) is indexed by checking its chunks. Returns NULL if the
+ * file cannot be mapped or is of neither kind. */
+WAVE_READER * waveReaderOpen(const char * path);
+void waveReaderClose(WAVE_READER * reader);
+
+WAVE_KIND waveReaderKind(const WAVE_READER * reader);
+
+/* Containers: the index, sorted by run, type, segment and channel */
+const WAVE_INDEX_ENTRY * waveReaderIndex(const WAVE_READER * reader, uint64_t * entries);
+
+/* Containers: 1 if the index was read from the file, 0 if it was rebuilt */
+int16_t waveReaderIndexValid(const WAVE_READER * reader);
+
+/* Containers: end of the last good chunk, where the next run would start */
+uint64_t waveReaderDataEnd(const WAVE_READER * reader);
+
+/* Returns the position in the index of the chunk (the first one of a pyramid level), or -1 if there is none */
+int64_t waveReaderFind(const WAVE_READER * reader, uint32_t run, uint16_t type, uint32_t segment, uint16_t channel);
+
+/* Decodes the header of the chunk at position 'entry' of the index */
+int32_t waveReaderChunk(const WAVE_READER * reader, uint64_t entry, WAVE_CHUNK * chunk);
+
+/* Decodes the settings of a run, returns -1 if the run does not exist */
+int32_t waveReaderRun(const WAVE_READER * reader, uint32_t run, WAVE_RUN * settings);
+
+/* Payload of a chunk as stored (compressed or not) */
+const uint8_t * waveReaderPayload(const WAVE_READER * reader, uint64_t entry);
+
+/* Returns 0 if the payload of a chunk matches its checksum */
+int32_t waveReaderVerify(const WAVE_READER * reader, uint64_t entry);
+
+/* Samples of a chunk. Uncompressed chunks are returned in place; compressed
+ * chunks are decoded into 'scratch', which must hold nSamples values (if it
+ * is NULL, compressed chunks fail). Returns -1 if the chunk is not a sample
+ * chunk or is damaged. */
+int32_t waveReaderSamples(const WAVE_READER * reader, uint64_t entry, int16_t * scratch, WAVE_SPAN * span);
+
+/* block_binary.txt files: all the records, in place */
+const BLOCK_BINARY_RECORD * waveReaderBinary(const WAVE_READER * reader, uint64_t * count);
+
+/* Raw block_binary.txt files: all the records, in place; waveReaderRun() gives their run as run 0 */
+const BLOCK_RAW_RECORD * waveReaderBlockRaw(const WAVE_READER * reader, uint64_t * count);
+
+/* Bytes of a partial record at the end of a raw block_binary.txt file, left out of the records */
+uint64_t waveReaderTruncated(const WAVE_READER * reader);
+
+/* Converts ADC counts of 'channel' to mV with the range of the run */
+double waveAdcToMv(const WAVE_RUN * run, uint16_t channel, int32_t adc);
+
+#endif